@@ -0,0 +1,195 @@
+/** \file codec_bench.cxx
+ *	Micro-benchmarks of the routines used to encode requests and decode
+ *	responses: hashing, base64, AES, RSA, JSON serialization and parsing,
+ *	and merging of paged data arrays.
+ *	Use --benchmark_out=<file> --benchmark_out_format=json to save results.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tplink_m7350.h"
+#include "tp_m7350_codec.h"
+#include <benchmark/benchmark.h>
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#include <openssl/core_names.h>
+#include <vector>
+
+namespace {
+	using namespace tplink;
+
+	/** \brief Typical status reply */
+	const std::string kStatusReply = "{\"result\":0,\"deviceInfo\":{\"productID\":\"73500005\",\"model\":\"M7350\",\"hardwareVer\":\"5.0\",\"firmwareVer\":\"1.0.10\"},"
+		"\"wan\":{\"connectStatus\":4,\"networkType\":3,\"signalStrength\":3,\"rssi\":-71,\"operatorName\":\"Operator\","
+		"\"ipv4\":\"10.0.0.2\",\"dailyStatistics\":12345678,\"totalStatistics\":987654321,\"txSpeed\":1200,\"rxSpeed\":34000},"
+		"\"battery\":{\"voltage\":4012,\"capacity\":87,\"charging\":false},"
+		"\"connectedDevices\":{\"number\":2,\"list\":[{\"mac\":\"00-11-22-33-44-55\",\"ip\":\"192.168.0.100\",\"name\":\"laptop\"},"
+		"{\"mac\":\"66-77-88-99-AA-BB\",\"ip\":\"192.168.0.101\",\"name\":\"phone\"}]},"
+		"\"wlan\":{\"ssid\":\"M7350\",\"status\":1},\"sim\":{\"status\":2},\"message\":{\"unreadMessages\":1}}";
+
+	/** \brief Typical request, as sent to web_cgi */
+	const std::string kRequest = "{\"token\":\"5a2f0e9c7b\",\"module\":\"message\",\"action\":2,\"pageNumber\":1,\"amountPerPage\":8,\"box\":0}";
+
+	const unsigned char kKey[16] = {'0','1','2','3','4','5','6','7','8','9','a','b','c','d','e','f'};
+	const unsigned char kIV[16] = {'f','e','d','c','b','a','9','8','7','6','5','4','3','2','1','0'};
+
+	/** \brief Build a message list entry.
+	 *	\param i: entry number.
+	 *	\returns JSON object, as string.
+	 */
+	std::string message(const size_t i) {
+		return "{\"index\":" + std::to_string(i + 1) + ",\"from\":\"+4179000" + std::to_string(1000 + i % 9000)
+			+ "\",\"content\":\"Message number " + std::to_string(i) + ", padded to a typical length of a text message.\""
+			+ ",\"receivedTime\":\"2021-01-01 12:00:00\",\"unread\":" + (i % 2 ? "true" : "false") + "}";
+	}
+
+	/** \brief Build one page of a message list.
+	 *	\param total: number of messages in list.
+	 *	\param page: page number, from 1.
+	 *	\returns JSON object, as string.
+	 */
+	std::string message_page(const size_t total, const size_t page) {
+		std::string s = "{\"totalNumber\":" + std::to_string(total) + ",\"messageList\":[";
+		for (size_t i=(page-1)*8; i<std::min(total, page*8); i++) {
+			if (i > (page-1)*8) s += ",";
+			s += message(i);
+		}
+		return s + "],\"result\":0}";
+	}
+
+	/** \brief Generate an RSA public key modulus.
+	 *	\param bits: key size.
+	 *	\returns modulus, in hexadecimal.
+	 */
+	std::string rsa_modulus(const unsigned int bits) {
+		auto pkey = UniquePointer<EVP_PKEY, EVP_PKEY_free>(EVP_PKEY_Q_keygen(nullptr, nullptr, "RSA", static_cast<size_t>(bits)));
+		BIGNUM * n = nullptr;
+		verify(EVP_PKEY_get_bn_param(pkey.get(), OSSL_PKEY_PARAM_RSA_N, &n) == 1);
+		auto hex = BN_bn2hex(n);
+		std::string result(hex);
+		OPENSSL_free(hex);
+		BN_free(n);
+		return result;
+	}
+}
+
+
+static void BM_md5(benchmark::State & state) {
+	const std::string password = "adminpassword";
+	for (auto _: state)
+		benchmark::DoNotOptimize(compute_md5_hash(password));
+}
+BENCHMARK(BM_md5);
+
+
+static void BM_b64_encode(benchmark::State & state) {
+	std::string data(state.range(0), 'x');
+	for (auto _: state)
+		benchmark::DoNotOptimize(b64_encode(data));
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_b64_encode)->Arg(64)->Arg(1024)->Arg(16384);
+
+
+static void BM_b64_decode(benchmark::State & state) {
+	auto data = b64_encode(std::string(state.range(0), 'x'));
+	for (auto _: state)
+		benchmark::DoNotOptimize(b64_decode(data));
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_b64_decode)->Arg(64)->Arg(1024)->Arg(16384);
+
+
+static void BM_aes_encrypt(benchmark::State & state) {
+	std::string data(state.range(0), 'x');
+	for (auto _: state)
+		benchmark::DoNotOptimize(aes_encrypt(data, kKey, kIV));
+	state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(BM_aes_encrypt)->Arg(64)->Arg(1024)->Arg(16384);
+
+
+static void BM_aes_decrypt(benchmark::State & state) {
+	auto data = aes_encrypt(std::string(state.range(0), 'x'), kKey, kIV);
+	for (auto _: state)
+		benchmark::DoNotOptimize(aes_decrypt(data, kKey, kIV));
+	state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_aes_decrypt)->Arg(64)->Arg(1024)->Arg(16384);
+
+
+/* signature of a request, as built by TPLink_M7350::rsa_sign */
+static void BM_rsa_encrypt(benchmark::State & state) {
+	auto modulus = rsa_modulus(state.range(0));
+	const std::string signature = "&h=" + compute_md5_hash("adminpassword") + "&s=123456789";
+	for (auto _: state)
+		benchmark::DoNotOptimize(rsa_encrypt(signature, modulus, "010001"));
+}
+BENCHMARK(BM_rsa_encrypt)->Arg(512)->Arg(1024);
+
+
+static void BM_stringify(benchmark::State & state) {
+	rj::Document d;
+	d.Parse(kStatusReply.c_str());
+	for (auto _: state)
+		benchmark::DoNotOptimize(stringify(d));
+}
+BENCHMARK(BM_stringify);
+
+
+/* what TPLink_M7350::parse_response does with plain replies */
+static void BM_parse_response(benchmark::State & state) {
+	for (auto _: state) {
+		rj::Document d;
+		d.Parse(kStatusReply.c_str());
+		benchmark::DoNotOptimize(d.IsObject());
+	}
+	state.SetBytesProcessed(state.iterations() * kStatusReply.size());
+}
+BENCHMARK(BM_parse_response);
+
+
+/* what TPLink_M7350::parse_response does with encrypted replies */
+static void BM_parse_response_encrypted(benchmark::State & state) {
+	auto reply = aes_encrypt(kStatusReply, kKey, kIV);
+	for (auto _: state) {
+		rj::Document d;
+		d.Parse(aes_decrypt(reply, kKey, kIV).c_str());
+		benchmark::DoNotOptimize(d.IsObject());
+	}
+	state.SetBytesProcessed(state.iterations() * kStatusReply.size());
+}
+BENCHMARK(BM_parse_response_encrypted);
+
+
+/* full request encoding path: stringify, then encrypt */
+static void BM_encode_request(benchmark::State & state) {
+	rj::Document d;
+	d.Parse(kRequest.c_str());
+	for (auto _: state)
+		benchmark::DoNotOptimize(aes_encrypt(stringify(d), kKey, kIV));
+}
+BENCHMARK(BM_encode_request);
+
+
+/* merge of parsed pages by TPLink_M7350::get_data_array; argument is list size */
+static void BM_get_data_array_merge(benchmark::State & state) {
+	const size_t total = state.range(0);
+	std::vector<rj::Document> pages((total + 7) / 8);
+	for (size_t p=0; p<pages.size(); p++)
+		pages[p].Parse(message_page(total, p+1).c_str());
+	for (auto _: state) {
+		rj::Document response;
+		response.SetObject();
+		rj::Value a(rj::kArrayType);
+		response.AddMember("messageList", a, response.GetAllocator());
+		for (auto & page: pages)
+			append_page(response, "messageList", page);
+		benchmark::DoNotOptimize(response["messageList"].Size());
+	}
+	state.SetItemsProcessed(state.iterations() * total);
+}
+BENCHMARK(BM_get_data_array_merge)->Arg(8)->Arg(64)->Arg(512)->Arg(4096);
+
+
+BENCHMARK_MAIN();
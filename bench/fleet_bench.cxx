@@ -0,0 +1,84 @@
+/** \file fleet_bench.cxx
+ *	Scaling benchmark of the fleet manager against local stand-in gateways.
+ *	For each fleet size, logs in to every gateway, then times fleet-wide
+ *	get_status calls at several concurrency levels.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_fleet.h"
+#include "stub_gateway.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <unistd.h>
+
+/* main function - returns 0 if execution went fine, 1 otherwise */
+int main( int argc, char** argv ) {
+	using namespace tplink;
+	using clock = std::chrono::steady_clock;
+
+	size_t gateways = 1000, threads = 8, rounds = 5;
+	long latency_us = 0;
+
+	int opt;
+	while ( ( opt = getopt ( argc, argv, "hn:t:r:l:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'n': gateways = std::stoul(optarg); break;
+			case 't': threads = std::stoul(optarg); break;
+			case 'r': rounds = std::stoul(optarg); break;
+			case 'l': latency_us = std::stol(optarg); break;
+			default:
+				std::cout << "Usage:" << std::endl;
+				std::cout << argv[0] << " [-n gateways] [-t worker_threads] [-r rounds] [-l gateway_latency_us]" << std::endl;
+				return 1;
+		}
+	}
+
+	auto fd_limit = bench::raise_fd_limit();
+	if (fd_limit < 3*gateways + 64) {
+		std::cerr << "Open file limit (" << fd_limit << ") too low for " << gateways << " gateways." << std::endl;
+		return 1;
+	}
+
+	bench::StubOptions options;
+	options.latency = std::chrono::microseconds(latency_us);
+	options.threads = 2;
+	bench::StubGateway stub(options);
+	if (!stub.listen(gateways) || !stub.start()) {
+		std::cerr << "Couldn't start stand-in gateways." << std::endl;
+		return 1;
+	}
+
+	std::cout << std::setw(8) << "modems" << std::setw(13) << "concurrency" << std::setw(12) << "login [ms]"
+		<< std::setw(16) << "status round" << std::setw(14) << "calls/s" << std::endl;
+	for (size_t n = 10; n <= gateways; n *= 10) {
+		for (size_t concurrency = 1; concurrency <= threads; concurrency *= 2) {
+			Fleet fleet(threads);
+			for (size_t i=0; i<n; i++)
+				fleet.add(stub.addresses()[i], "admin");
+
+			auto t0 = clock::now();
+			auto logins = fleet.login_all(concurrency);
+			std::chrono::duration<double, std::milli> login_time = clock::now() - t0;
+			for (size_t i=0; i<n; i++) {
+				if (!logins[i]) {
+					std::cerr << "Login failed for " << fleet.address(i) << std::endl;
+					return 1;
+				}
+			}
+
+			t0 = clock::now();
+			for (size_t r=0; r<rounds; r++)
+				fleet.get_status_all(concurrency);
+			std::chrono::duration<double> status_time = clock::now() - t0;
+
+			std::cout << std::setw(8) << n << std::setw(13) << concurrency
+				<< std::setw(12) << std::fixed << std::setprecision(1) << login_time.count()
+				<< std::setw(13) << std::setprecision(2) << 1000*status_time.count()/rounds << " ms"
+				<< std::setw(14) << std::setprecision(0) << n*rounds/status_time.count() << std::endl;
+		}
+		if (n < gateways && n*10 > gateways) n = gateways/10;
+	}
+	std::cout << stub.requests() << " requests served." << std::endl;
+	return 0;
+}
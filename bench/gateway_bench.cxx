@@ -0,0 +1,89 @@
+/** \file gateway_bench.cxx
+ *	Failover run of the SMS gateway against local stand-in gateways.
+ *	Sends a first round of messages over all modems, takes one gateway down,
+ *	then sends a second round. Every message must be delivered, and the
+ *	modem whose gateway went down must have been taken out of rotation.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_gateway.h"
+#include "stub_gateway.h"
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <unistd.h>
+
+/* main function - returns 0 if execution went fine, 1 otherwise */
+int main( int argc, char** argv ) {
+	using namespace tplink;
+	using clock = std::chrono::steady_clock;
+
+	size_t gateways = 4, messages = 200;
+	long latency_us = 1000;
+
+	int opt;
+	while ( ( opt = getopt ( argc, argv, "hn:m:l:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'n': gateways = std::stoul(optarg); break;
+			case 'm': messages = std::stoul(optarg); break;
+			case 'l': latency_us = std::stol(optarg); break;
+			default:
+				std::cout << "Usage:" << std::endl;
+				std::cout << argv[0] << " [-n gateways] [-m messages_per_round] [-l gateway_latency_us]" << std::endl;
+				return 1;
+		}
+	}
+	if (gateways < 2) {
+		std::cerr << "Failover needs at least 2 gateways." << std::endl;
+		return 1;
+	}
+
+	bench::StubOptions options;
+	options.latency = std::chrono::microseconds(latency_us);
+	options.threads = 2;
+	bench::StubGateway stub(options);
+	if (!stub.listen(gateways) || !stub.start()) {
+		std::cerr << "Couldn't start stand-in gateways." << std::endl;
+		return 1;
+	}
+
+	SMSGateway gateway;
+	for (auto & address: stub.addresses())
+		gateway.add_modem(address, "admin");
+	// keep the failed modem out of rotation for the whole run
+	gateway.set_failure_policy(3, std::chrono::minutes(1));
+	if (!gateway.start()) {
+		std::cerr << "Couldn't log in to stand-in gateways." << std::endl;
+		return 1;
+	}
+
+	size_t delivered = 0;
+	auto send_round = [&]() {
+		std::vector<std::future<bool> > results;
+		for (size_t i=0; i<messages; i++)
+			results.push_back(gateway.send_sms("+4179000" + std::to_string(1000 + i), "Message " + std::to_string(i)));
+		for (auto & r: results)
+			delivered += r.get();
+	};
+
+	auto t0 = clock::now();
+	send_round();
+	// messages already queued on the modem going down must move to the others
+	stub.set_down(0, true);
+	send_round();
+	std::chrono::duration<double, std::milli> elapsed = clock::now() - t0;
+	auto stats = gateway.stats();
+	gateway.stop();
+
+	std::cout << std::setw(24) << "modem" << std::setw(9) << "healthy" << std::setw(8) << "sent" << std::setw(8) << "failed" << std::endl;
+	for (auto & m: stats.modems)
+		std::cout << std::setw(24) << m.address << std::setw(9) << (m.healthy ? "yes" : "no")
+			<< std::setw(8) << m.sent << std::setw(8) << m.failed << std::endl;
+	std::cout << delivered << "/" << 2*messages << " messages delivered in " << std::fixed << std::setprecision(1)
+		<< elapsed.count() << " ms, " << stats.retried << " retried." << std::endl;
+
+	bool ok = delivered == 2*messages && stats.failed == 0 && !stats.modems[0].healthy && stats.modems[0].failed > 0;
+	if (!ok)
+		std::cerr << "Failover didn't behave as expected." << std::endl;
+	return ok ? 0 : 1;
+}
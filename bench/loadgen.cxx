@@ -0,0 +1,292 @@
+/** \file loadgen.cxx
+ *	Load generator: drives a mix of calls against a local stand-in gateway,
+ *	either as fast as a number of concurrent clients allow, or at a target
+ *	rate, and reports latency percentiles, throughput, error rate and
+ *	allocations per call. Calls are drawn from a seeded generator, so that
+ *	runs with a fixed number of calls are reproducible.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tplink_m7350.h"
+#include "tp_m7350_metrics.h"
+#include "tp_m7350_http.h"
+#include "stub_gateway.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+#include <array>
+#include <memory>
+#include <cstdlib>
+#include <unistd.h>
+
+/* Count allocations of each thread. With glibc, malloc is interposed, so that
+ * allocations of CURL, OpenSSL and RapidJSON are counted along with C++ ones. */
+static thread_local uint64_t thread_allocations = 0;
+
+#ifdef __GLIBC__
+extern "C" {
+	void * __libc_malloc(size_t size);
+	void * __libc_calloc(size_t n, size_t size);
+	void * __libc_realloc(void * ptr, size_t size);
+
+	void * malloc(size_t size) {
+		thread_allocations++;
+		return __libc_malloc(size);
+	}
+
+	void * calloc(size_t n, size_t size) {
+		thread_allocations++;
+		return __libc_calloc(n, size);
+	}
+
+	void * realloc(void * ptr, size_t size) {
+		thread_allocations++;
+		return __libc_realloc(ptr, size);
+	}
+}
+#else
+void * operator new(size_t size) {
+	thread_allocations++;
+	if (auto p = std::malloc(size)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void * ptr) noexcept {
+	std::free(ptr);
+}
+
+void operator delete(void * ptr, size_t) noexcept {
+	std::free(ptr);
+}
+#endif
+
+namespace {
+	using namespace tplink;
+	using clock = std::chrono::steady_clock;
+
+	/** \brief Kinds of calls. */
+	enum Call : size_t { GetStatus, ReadSMS, GetLog, SendSMS, Set, kCallCount };
+
+	const char * const kCallNames[kCallCount] = {"get_status", "read_sms", "get_log", "send_sms", "set"};
+
+	/** \brief Results of a worker, or of the whole run. */
+	struct Results {
+		std::array<metrics::HistogramSnapshot, kCallCount> latency;
+		std::array<uint64_t, kCallCount> errors{};
+		std::array<uint64_t, kCallCount> allocations{};
+
+		Results() {
+			for (auto & h: this->latency)
+				h.counts.resize(metrics::LatencyHistogram::kBuckets);
+		}
+
+		void record(const Call call, const uint64_t ns, const bool ok, const uint64_t allocations) {
+			auto & h = this->latency[call];
+			h.counts[metrics::LatencyHistogram::bucket(ns)]++;
+			h.count++;
+			h.sum += ns;
+			h.max = std::max(h.max, ns);
+			this->errors[call] += !ok;
+			this->allocations[call] += allocations;
+		}
+
+		void merge(const Results & other) {
+			for (size_t c=0; c<kCallCount; c++) {
+				this->latency[c].merge(other.latency[c]);
+				this->errors[c] += other.errors[c];
+				this->allocations[c] += other.allocations[c];
+			}
+		}
+	};
+
+	/** \brief Parse a call mix, as "get_status=60,read_sms=10,...".
+	 *	\param spec: mix specification.
+	 *	\param weights: where to store call weights; calls not listed get 0.
+	 *	\returns true if specification is valid, false otherwise.
+	 */
+	bool parse_mix(const std::string & spec, std::array<double, kCallCount> & weights) {
+		weights.fill(0);
+		std::istringstream in(spec);
+		std::string item;
+		double total = 0;
+		while (std::getline(in, item, ',')) {
+			auto eq = item.find('=');
+			if (eq == std::string::npos) return false;
+			auto name = item.substr(0, eq);
+			size_t c = 0;
+			while (c < kCallCount && name != kCallNames[c]) c++;
+			if (c == kCallCount) return false;
+			weights[c] = std::stod(item.substr(eq + 1));
+			if (weights[c] < 0) return false;
+			total += weights[c];
+		}
+		return total > 0;
+	}
+
+	/** \brief Issue one call.
+	 *	\param modem: client.
+	 *	\param call: kind of call.
+	 *	\param settings: data sent by set calls.
+	 *	\returns true if call succeeded, false otherwise.
+	 */
+	bool issue(const TPLink_M7350 & modem, const Call call, const rj::Document & settings) {
+		switch (call) {
+			case GetStatus: return modem.get_status().IsObject();
+			case ReadSMS: return modem.read_sms(MailboxCode::Inbox).IsObject();
+			case GetLog: return modem.get_log().IsObject();
+			case SendSMS: return modem.send_sms("+41790000000", "Load generator message");
+			case Set: return modem.set_flow_stat_settings(settings);
+			default: return false;
+		}
+	}
+
+	/** \brief Format a duration.
+	 *	\param ns: duration, in nanoseconds.
+	 *	\returns duration in microseconds, as string.
+	 */
+	std::string us(const uint64_t ns) {
+		std::ostringstream s;
+		s << std::fixed << std::setprecision(1) << ns/1e3;
+		return s.str();
+	}
+}
+
+/* main function - returns 0 if execution went fine, 1 otherwise */
+int main( int argc, char** argv ) {
+	double duration = 10, rate = 0;
+	size_t concurrency = 8, calls = 0, stub_threads = 2;
+	uint64_t seed = 1;
+	bool builtin_http = false;
+	long latency_us = 0;
+	std::string mix = "get_status=60,read_sms=10,get_log=10,send_sms=10,set=10";
+	bench::StubOptions options;
+
+	int opt;
+	while ( ( opt = getopt ( argc, argv, "hHd:n:c:r:m:s:l:p:i:g:T:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'd': duration = std::stod(optarg); break;
+			case 'n': calls = std::stoul(optarg); break;
+			case 'c': concurrency = std::max<size_t>(std::stoul(optarg), 1); break;
+			case 'r': rate = std::stod(optarg); break;
+			case 'm': mix = optarg; break;
+			case 's': seed = std::stoull(optarg); break;
+			case 'l': latency_us = std::stol(optarg); break;
+			case 'p': options.sending_polls = std::stoul(optarg); break;
+			case 'i': options.inbox_size = std::stoul(optarg); break;
+			case 'g': options.log_size = std::stoul(optarg); break;
+			case 'T': stub_threads = std::stoul(optarg); break;
+			case 'H': builtin_http = true; break;
+			default:
+				std::cout << "Usage:" << std::endl;
+				std::cout << argv[0] << " [-d seconds] [-n calls] [-c concurrency] [-r calls_per_second] [-m mix] [-s seed]" << std::endl;
+				std::cout << "    [-l gateway_latency_us] [-p send_status_polls] [-i inbox_size] [-g log_size] [-T gateway_threads] [-H]" << std::endl;
+				std::cout << "Mix is a list of call=weight, with calls among get_status, read_sms, get_log, send_sms, set." << std::endl;
+				std::cout << "With -n, the run stops after that many calls instead of after -d seconds." << std::endl;
+				std::cout << "With -H, clients use the built-in HTTP client instead of CURL." << std::endl;
+				std::cout << "With -r, calls start on a Poisson schedule and latency counts from scheduled start." << std::endl;
+				return 1;
+		}
+	}
+
+	std::array<double, kCallCount> weights;
+	if (!parse_mix(mix, weights)) {
+		std::cerr << "Invalid call mix: " << mix << std::endl;
+		return 1;
+	}
+
+	Logger::set_level(LogLevel::Error);
+	options.latency = std::chrono::microseconds(latency_us);
+	options.threads = stub_threads;
+	bench::StubGateway stub(options);
+	if (!stub.listen(1) || !stub.start()) {
+		std::cerr << "Couldn't start stand-in gateway." << std::endl;
+		return 1;
+	}
+
+	// log every client in before starting the clock
+	std::vector<std::unique_ptr<TPLink_M7350> > clients;
+	for (size_t w=0; w<concurrency; w++) {
+		clients.emplace_back(std::make_unique<TPLink_M7350>(stub.addresses()[0], "admin"));
+		// the stand-in gateway answers at once: poll send status back to back, to time the client only
+		clients.back()->set_send_status_polling(std::chrono::seconds(60), std::chrono::milliseconds(0));
+		if (builtin_http)
+			clients.back()->set_transport(std::make_shared<HttpTransport>());
+		if (!clients.back()->login()) {
+			std::cerr << "Login failed." << std::endl;
+			return 1;
+		}
+	}
+
+	std::vector<Results> results(concurrency);
+	std::vector<std::thread> workers;
+	auto start = clock::now();
+	auto deadline = start + std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(duration));
+	for (size_t w=0; w<concurrency; w++) {
+		workers.emplace_back([&, w] {
+			std::mt19937_64 rng(seed + w);
+			std::discrete_distribution<size_t> pick(weights.begin(), weights.end());
+			std::exponential_distribution<double> gap(rate > 0 ? rate/concurrency : 1);
+			rj::Document settings;
+			settings.Parse("{\"enable\":true,\"totalTrafficLimit\":0}");
+			auto & modem = *clients[w];
+			auto & res = results[w];
+			// share calls evenly; first workers take the remainder
+			size_t n = calls/concurrency + (w < calls % concurrency);
+			auto scheduled = start;
+			for (size_t i=0; calls == 0 || i < n; i++) {
+				auto call = static_cast<Call>(pick(rng));
+				if (rate > 0) {
+					scheduled += std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(gap(rng)));
+					if (calls == 0 && scheduled >= deadline) break;
+					std::this_thread::sleep_until(scheduled);
+				} else {
+					scheduled = clock::now();
+					if (calls == 0 && scheduled >= deadline) break;
+				}
+				auto allocations = thread_allocations;
+				auto ok = issue(modem, call, settings);
+				auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - scheduled).count();
+				res.record(call, elapsed, ok, thread_allocations - allocations);
+			}
+		});
+	}
+	for (auto & t: workers) t.join();
+	std::chrono::duration<double> elapsed = clock::now() - start;
+	stub.stop();
+
+	Results total;
+	for (auto & r: results) total.merge(r);
+
+	std::cout << (builtin_http ? "built-in HTTP client" : "CURL") << ", seed " << seed << ", concurrency " << concurrency;
+	if (rate > 0) std::cout << ", target rate " << rate << " calls/s";
+	std::cout << ", mix " << mix << std::endl;
+	std::cout << std::setw(12) << "call" << std::setw(10) << "calls" << std::setw(9) << "errors"
+		<< std::setw(11) << "p50 [us]" << std::setw(11) << "p90 [us]" << std::setw(11) << "p99 [us]"
+		<< std::setw(12) << "p999 [us]" << std::setw(11) << "max [us]" << std::setw(13) << "allocs/call" << std::endl;
+	metrics::HistogramSnapshot all;
+	uint64_t errors = 0, allocations = 0;
+	auto row = [](const char * name, const metrics::HistogramSnapshot & h, const uint64_t errors, const uint64_t allocations) {
+		std::cout << std::setw(12) << name << std::setw(10) << h.count << std::setw(9) << errors
+			<< std::setw(11) << us(h.percentile(0.5)) << std::setw(11) << us(h.percentile(0.9))
+			<< std::setw(11) << us(h.percentile(0.99)) << std::setw(12) << us(h.percentile(0.999))
+			<< std::setw(11) << us(h.max) << std::setw(13) << std::fixed << std::setprecision(1)
+			<< (h.count > 0 ? static_cast<double>(allocations)/h.count : 0.0) << std::endl;
+	};
+	for (size_t c=0; c<kCallCount; c++) {
+		if (total.latency[c].count == 0) continue;
+		row(kCallNames[c], total.latency[c], total.errors[c], total.allocations[c]);
+		all.merge(total.latency[c]);
+		errors += total.errors[c];
+		allocations += total.allocations[c];
+	}
+	row("all", all, errors, allocations);
+	std::cout << std::fixed << std::setprecision(1) << all.count/elapsed.count() << " calls/s over "
+		<< std::setprecision(2) << elapsed.count() << " s, error rate "
+		<< std::setprecision(3) << (all.count > 0 ? 100.0*errors/all.count : 0.0) << " %, "
+		<< stub.requests() << " requests served." << std::endl;
+	return errors > 0;
+}
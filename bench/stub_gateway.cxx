@@ -0,0 +1,376 @@
+/** \file stub_gateway.cxx
+ *	Local stand-in for TP-Link M7350 web gateways, used by benchmarks.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "stub_gateway.h"
+#include <algorithm>
+#include <unordered_map>
+#include <queue>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace tplink {
+	namespace bench {
+
+		/** \brief Find a string value in a flat JSON request.
+		 *	Requests sent by TPLink_M7350 are compact and well-formed, so a substring search is enough.
+		 *	\param body: JSON request.
+		 *	\param key: member name.
+		 *	\returns member value, or an empty string if not found.
+		 */
+		static std::string find_string(const std::string & body, const char * key) {
+			auto pattern = std::string("\"") + key + "\":\"";
+			auto pos = body.find(pattern);
+			if (pos == std::string::npos) return "";
+			pos += pattern.size();
+			return body.substr(pos, body.find('"', pos) - pos);
+		}
+
+		/** \brief Find an integer value in a flat JSON request.
+		 *	\param body: JSON request.
+		 *	\param key: member name.
+		 *	\param fallback: value returned if not found.
+		 *	\returns member value.
+		 */
+		static long find_int(const std::string & body, const char * key, const long fallback) {
+			auto pattern = std::string("\"") + key + "\":";
+			auto pos = body.find(pattern);
+			if (pos == std::string::npos) return fallback;
+			return std::strtol(body.c_str() + pos + pattern.size(), nullptr, 10);
+		}
+
+		/** \brief Build a paged list reply.
+		 *	\param field: list name.
+		 *	\param total: total number of items.
+		 *	\param page: page number, starting at 1.
+		 *	\param item: function producing item number i.
+		 *	\returns JSON reply.
+		 */
+		template <typename Item>
+		static std::string paged_list(const char * field, const size_t total, const long page, Item item) {
+			std::string s = "{\"totalNumber\":" + std::to_string(total) + ",\"" + field + "\":[";
+			size_t first = (page > 0 ? page - 1 : 0)*8;
+			for (size_t i=first; i<std::min(total, first + 8); i++) {
+				if (i > first) s += ",";
+				s += item(i);
+			}
+			return s + "],\"result\":0}";
+		}
+
+
+		/** \brief State of a client connection. */
+		struct Connection {
+			std::string in;
+			std::string out;
+			size_t out_offset = 0;
+			uint64_t id = 0;
+			size_t gateway = 0;
+			unsigned int send_polls = 0;
+		};
+
+		/** \brief A reply waiting for its delay to expire. */
+		struct DelayedReply {
+			std::chrono::steady_clock::time_point due;
+			int fd;
+			uint64_t id;
+			std::string data;
+			bool operator<(const DelayedReply & other) const { return due > other.due; }
+		};
+
+
+		StubGateway::StubGateway(const StubOptions & options) : options(options) {
+			if (this->options.threads == 0) this->options.threads = 1;
+		}
+
+
+		StubGateway::~StubGateway() {
+			this->stop();
+		}
+
+
+		bool StubGateway::listen(const size_t count, const uint16_t first_port) {
+			for (size_t i=0; i<count; i++) {
+				int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+				if (fd < 0) return false;
+				int one = 1;
+				setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+				sockaddr_in addr{};
+				addr.sin_family = AF_INET;
+				addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+				addr.sin_port = htons(first_port > 0 ? first_port + i : 0);
+				socklen_t len = sizeof(addr);
+				if (bind(fd, reinterpret_cast<sockaddr*>(&addr), len) != 0 || ::listen(fd, 1024) != 0
+						|| getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+					::close(fd);
+					return false;
+				}
+				this->listeners.push_back(fd);
+				this->down.emplace_back(false);
+				this->gateway_addresses.push_back("127.0.0.1:" + std::to_string(ntohs(addr.sin_port)));
+			}
+			return true;
+		}
+
+
+		const std::vector<std::string> & StubGateway::addresses() const {
+			return this->gateway_addresses;
+		}
+
+
+		bool StubGateway::start() {
+			if (this->running.exchange(true)) return false;
+			if (pipe2(this->stop_pipe, O_CLOEXEC | O_NONBLOCK) != 0) return false;
+			for (size_t i=0; i<this->options.threads; i++)
+				this->threads.emplace_back(&StubGateway::run, this, i);
+			return true;
+		}
+
+
+		void StubGateway::stop() {
+			if (this->running.exchange(false)) {
+				char c = 0;
+				while (write(this->stop_pipe[1], &c, 1) < 0 && errno == EINTR) {}
+				for (auto & t: this->threads)
+					t.join();
+				this->threads.clear();
+				::close(this->stop_pipe[0]);
+				::close(this->stop_pipe[1]);
+			}
+			for (auto fd: this->listeners)
+				::close(fd);
+			this->listeners.clear();
+			this->down.clear();
+			this->gateway_addresses.clear();
+		}
+
+
+		void StubGateway::set_down(const size_t index, const bool is_down) {
+			if (index < this->down.size())
+				this->down[index] = is_down;
+		}
+
+
+		uint64_t StubGateway::requests() const {
+			return this->served;
+		}
+
+
+		std::string StubGateway::reply(const std::string & path, const std::string & body) const {
+			auto module = find_string(body, "module");
+			auto action = find_int(body, "action", -1);
+
+			if (path.find("auth_cgi") != std::string::npos) {
+				switch (action) {
+					case 0: return "{\"authedIP\":\"0.0.0.0\",\"nonce\":\"3d1b8c4f\",\"result\":1}";
+					case 1: return "{\"token\":\"5a2f0e9c7b\",\"authedIP\":\"127.0.0.1\",\"factoryDefault\":\"0\",\"result\":0}";
+					case 2: return "{\"attempt\":0,\"result\":0}";
+					default: return "{\"result\":0}";
+				}
+			}
+
+			auto page = find_int(body, "pageNumber", 1);
+			if (module == "message" && action == 2) {
+				return paged_list("messageList", this->options.inbox_size, page, [](size_t i) {
+					return "{\"index\":" + std::to_string(i + 1) + ",\"from\":\"+4179000" + std::to_string(1000 + i % 9000)
+						+ "\",\"content\":\"Message number " + std::to_string(i) + ", padded to a typical length of a text message.\""
+						+ ",\"receivedTime\":\"2021-01-01 12:00:00\",\"unread\":" + (i % 2 ? "true" : "false") + "}";
+				});
+			}
+			if (module == "log" && action == 0) {
+				return paged_list("logList", this->options.log_size, page, [](size_t i) {
+					return "{\"time\":\"2021-01-01 12:00:" + std::to_string(10 + i % 50) + "\",\"type\":" + std::to_string(i % 4)
+						+ ",\"level\":" + std::to_string(i % 3) + ",\"content\":\"Entry " + std::to_string(i) + ": WAN state changed\"}";
+				});
+			}
+			if (module == "status") {
+				return "{\"result\":0,\"deviceInfo\":{\"productID\":\"73500005\",\"model\":\"M7350\",\"hardwareVer\":\"5.0\",\"firmwareVer\":\"1.0.10\"},"
+					"\"wan\":{\"connectStatus\":4,\"networkType\":3,\"signalStrength\":3,\"rssi\":-71,\"operatorName\":\"Stub\","
+					"\"ipv4\":\"10.0.0.2\",\"dailyStatistics\":12345678,\"totalStatistics\":987654321,\"txSpeed\":1200,\"rxSpeed\":34000},"
+					"\"battery\":{\"voltage\":4012,\"capacity\":87,\"charging\":false},"
+					"\"connectedDevices\":{\"number\":2,\"list\":[{\"mac\":\"00-11-22-33-44-55\",\"ip\":\"192.168.0.100\",\"name\":\"laptop\"},"
+					"{\"mac\":\"66-77-88-99-AA-BB\",\"ip\":\"192.168.0.101\",\"name\":\"phone\"}]},"
+					"\"wlan\":{\"ssid\":\"M7350\",\"status\":1},\"sim\":{\"status\":2},\"message\":{\"unreadMessages\":1}}";
+			}
+			if (action == 0) {
+				return "{\"result\":0,\"enable\":true,\"mode\":1,\"name\":\"" + module + "\",\"list\":[]}";
+			}
+			return "{\"result\":0}";
+		}
+
+
+		void StubGateway::run(const size_t thread_index) {
+			int epfd = epoll_create1(EPOLL_CLOEXEC);
+			std::unordered_map<int, Connection> connections;
+			std::priority_queue<DelayedReply> delayed;
+			uint64_t next_id = 1;
+
+			epoll_event ev{};
+			ev.events = EPOLLIN;
+			ev.data.fd = this->stop_pipe[0];
+			epoll_ctl(epfd, EPOLL_CTL_ADD, this->stop_pipe[0], &ev);
+			// gateway index of each listening socket, or -1
+			std::vector<long> listener_index;
+			for (size_t i=thread_index; i<this->listeners.size(); i+=this->options.threads) {
+				ev.data.fd = this->listeners[i];
+				epoll_ctl(epfd, EPOLL_CTL_ADD, this->listeners[i], &ev);
+				if (listener_index.size() <= static_cast<size_t>(this->listeners[i]))
+					listener_index.resize(this->listeners[i] + 1, -1);
+				listener_index[this->listeners[i]] = i;
+			}
+
+			auto close_connection = [&](int fd) {
+				epoll_ctl(epfd, EPOLL_CTL_DEL, fd, nullptr);
+				::close(fd);
+				connections.erase(fd);
+			};
+			// send as much as possible; wait for writability if needed
+			auto flush = [&](int fd, Connection & c) {
+				while (c.out_offset < c.out.size()) {
+					auto n = ::send(fd, c.out.data() + c.out_offset, c.out.size() - c.out_offset, MSG_NOSIGNAL);
+					if (n < 0) {
+						if (errno == EAGAIN) break;
+						close_connection(fd);
+						return;
+					}
+					c.out_offset += n;
+				}
+				epoll_event e{};
+				e.data.fd = fd;
+				e.events = EPOLLIN | (c.out_offset < c.out.size() ? uint32_t(EPOLLOUT) : 0u);
+				if (c.out_offset == c.out.size()) {
+					c.out.clear();
+					c.out_offset = 0;
+				}
+				epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &e);
+			};
+			auto respond = [&](int fd, Connection & c, std::string && data) {
+				if (this->options.latency.count() > 0) {
+					delayed.push(DelayedReply{std::chrono::steady_clock::now() + this->options.latency, fd, c.id, std::move(data)});
+				} else {
+					c.out += data;
+					flush(fd, c);
+				}
+			};
+
+			std::vector<epoll_event> events(256);
+			while (this->running) {
+				int timeout = -1;
+				if (!delayed.empty()) {
+					auto wait = std::chrono::duration_cast<std::chrono::milliseconds>(delayed.top().due - std::chrono::steady_clock::now()).count();
+					timeout = wait > 0 ? static_cast<int>(wait) : 0;
+				}
+				int n = epoll_wait(epfd, events.data(), events.size(), timeout);
+				for (int i=0; i<n; i++) {
+					int fd = events[i].data.fd;
+					if (fd == this->stop_pipe[0]) continue;
+					if (static_cast<size_t>(fd) < listener_index.size() && listener_index[fd] >= 0) {
+						size_t gateway = listener_index[fd];
+						int client;
+						while ((client = accept4(fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+							if (this->down[gateway]) {
+								::close(client);
+								continue;
+							}
+							int one = 1;
+							setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+							epoll_event e{};
+							e.events = EPOLLIN;
+							e.data.fd = client;
+							epoll_ctl(epfd, EPOLL_CTL_ADD, client, &e);
+							connections[client] = Connection();
+							connections[client].id = next_id++;
+							connections[client].gateway = gateway;
+						}
+						continue;
+					}
+					auto itr = connections.find(fd);
+					if (itr == connections.end()) continue;
+					auto & c = itr->second;
+					if (events[i].events & EPOLLOUT) {
+						flush(fd, c);
+						if (connections.find(fd) == connections.end()) continue;
+					}
+					if (!(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))) continue;
+					if (this->down[c.gateway]) {
+						close_connection(fd);
+						continue;
+					}
+
+					char buffer[16384];
+					bool closed = false;
+					for (;;) {
+						auto r = ::recv(fd, buffer, sizeof(buffer), 0);
+						if (r > 0) { c.in.append(buffer, r); continue; }
+						if (r == 0 || errno != EAGAIN) closed = true;
+						break;
+					}
+					// handle every complete request
+					for (;;) {
+						auto header_end = c.in.find("\r\n\r\n");
+						if (header_end == std::string::npos) break;
+						size_t length = 0;
+						auto cl = c.in.find("Content-Length:");
+						if (cl == std::string::npos) cl = c.in.find("content-length:");
+						if (cl != std::string::npos && cl < header_end)
+							length = std::strtoul(c.in.c_str() + cl + 15, nullptr, 10);
+						if (c.in.size() < header_end + 4 + length) break;
+						auto path = c.in.substr(c.in.find(' ') + 1);
+						path = path.substr(0, path.find(' '));
+						auto body = c.in.substr(header_end + 4, length);
+						c.in.erase(0, header_end + 4 + length);
+
+						std::string data;
+						if (find_string(body, "module") == "message" && find_int(body, "action", -1) == 7
+								&& c.send_polls < this->options.sending_polls) {
+							c.send_polls++;
+							data = "{\"result\":4}";
+						} else {
+							if (find_int(body, "action", -1) == 7) c.send_polls = 0;
+							data = this->reply(path, body);
+						}
+						this->served++;
+						respond(fd, c, "HTTP/1.1 200 OK\r\nContent-Type: application/json\r\nContent-Length: "
+							+ std::to_string(data.size()) + "\r\nConnection: keep-alive\r\n\r\n" + data);
+						if (connections.find(fd) == connections.end()) break;
+					}
+					if (closed && connections.find(fd) != connections.end())
+						close_connection(fd);
+				}
+				// send replies whose delay expired
+				auto now = std::chrono::steady_clock::now();
+				while (!delayed.empty() && delayed.top().due <= now) {
+					auto itr = connections.find(delayed.top().fd);
+					if (itr != connections.end() && itr->second.id == delayed.top().id) {
+						itr->second.out += delayed.top().data;
+						flush(itr->first, itr->second);
+					}
+					delayed.pop();
+				}
+			}
+
+			for (auto & c: connections)
+				::close(c.first);
+			::close(epfd);
+		}
+
+
+		size_t raise_fd_limit() {
+			rlimit rl;
+			if (getrlimit(RLIMIT_NOFILE, &rl) != 0) return 0;
+			rl.rlim_cur = rl.rlim_max;
+			setrlimit(RLIMIT_NOFILE, &rl);
+			getrlimit(RLIMIT_NOFILE, &rl);
+			return rl.rlim_cur;
+		}
+	}
+}
@@ -0,0 +1,124 @@
+/** \file stub_gateway.h
+ *  Local stand-in for TP-Link M7350 web gateways, used by benchmarks.
+ *  It serves the cgi-bin/auth_cgi and cgi-bin/web_cgi endpoints on any number of
+ *  local ports with canned replies. Replies are in plain JSON, as with firmwares
+ *  preceding M7350(EU)_V5_201019, so clients must be built with NEW_FIRMWARE=OFF.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace tplink {
+	namespace bench {
+
+		/** \brief Behaviour of a stand-in gateway. */
+		struct StubOptions {
+			/** \brief Number of messages in each mailbox */
+			size_t inbox_size = 8;
+			/** \brief Number of log entries */
+			size_t log_size = 8;
+			/** \brief Delay before each reply */
+			std::chrono::microseconds latency{0};
+			/** \brief Number of GetSendStatus polls answered with 'sending' */
+			unsigned int sending_polls = 0;
+			/** \brief Number of server threads */
+			size_t threads = 1;
+		};
+
+		/** \brief Serve stand-in modem web gateways on local ports. */
+		class StubGateway {
+		private:
+      /** \brief Gateway behaviour */
+      StubOptions options;
+
+      /** \brief Listening sockets */
+      std::vector<int> listeners;
+
+      /** \brief Gateway addresses */
+      std::vector<std::string> gateway_addresses;
+
+      /** \brief True for gateways that stopped responding */
+      std::deque<std::atomic<bool> > down;
+
+      /** \brief Server threads */
+      std::vector<std::thread> threads;
+
+      /** \brief Pipe used to wake threads up when stopping */
+      int stop_pipe[2] = {-1, -1};
+
+      /** \brief True while serving */
+      std::atomic<bool> running{false};
+
+      /** \brief Number of requests served */
+      std::atomic<uint64_t> served{0};
+
+      /** \brief Server thread main loop.
+       *  \param thread_index: index of thread; serves listeners with matching index modulo thread count.
+       */
+      void run(const size_t thread_index);
+
+      /** \brief Build reply to a request.
+       *  \param path: request path.
+       *  \param body: request body.
+       *  \returns reply body.
+       */
+      std::string reply(const std::string & path, const std::string & body) const;
+
+		public:
+      /** \brief Constructor.
+       *  \param options: gateway behaviour.
+       */
+      explicit StubGateway(const StubOptions & options = StubOptions());
+
+      StubGateway(const StubGateway &) = delete;
+      StubGateway & operator=(const StubGateway &) = delete;
+
+      /** \brief Destructor; stops serving. */
+      ~StubGateway();
+
+      /** \brief Listen on local ports, one per stand-in gateway.
+       *  \param count: number of gateways.
+       *  \param first_port: first port number; ports are consecutive. 0 lets the system choose.
+       *  \returns true if successful, false otherwise.
+       */
+      bool listen(const size_t count, const uint16_t first_port = 0);
+
+      /** \brief Get gateway addresses, as accepted by TPLink_M7350::set_address.
+       *  \returns list of host:port strings.
+       */
+      const std::vector<std::string> & addresses() const;
+
+      /** \brief Start serving.
+       *  \returns true if successful, false otherwise.
+       */
+      bool start();
+
+      /** \brief Stop serving and close sockets. */
+      void stop();
+
+      /** \brief Make a gateway stop responding, or bring it back.
+       *  A gateway that is down closes connections as soon as they are accepted or send a request.
+       *  \param index: gateway index.
+       *  \param is_down: true to stop responding, false to respond again.
+       */
+      void set_down(const size_t index, const bool is_down);
+
+      /** \brief Get number of requests served.
+       *  \returns number of requests.
+       */
+      uint64_t requests() const;
+		};
+
+		/** \brief Raise the limit of open file descriptors to its maximum.
+		 *  \returns new limit.
+		 */
+		size_t raise_fd_limit();
+	}
+}
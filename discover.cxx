@@ -0,0 +1,94 @@
+/** \file discover.cxx
+ *	This is a short example code that uses the TP-Link M7350 discovery interface
+ *	to find modems on network ranges using the command line. Each modem found is
+ *	printed on a line with its address, firmware generation (old/new) and reply time.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_discovery.h"
+#include <iostream>
+#include <csignal>
+#include <unistd.h>
+#include <sys/resource.h>
+
+/* scan being run, cancelled on interruption */
+static tplink::Discovery * current_scan = nullptr;
+static volatile std::sig_atomic_t interrupted = 0;
+
+static void interrupt(int) {
+	interrupted = 1;
+	if (current_scan != nullptr)
+		current_scan->cancel();
+}
+
+/* main function - returns 0 if at least one modem was found, 1 otherwise */
+int main( int argc, char** argv ) {
+	using namespace tplink;
+
+	Discovery discovery;
+	size_t concurrency = 1024;
+
+	// parse command line for arguments
+	int opt;
+	while ( ( opt = getopt ( argc, argv, "hp:t:c:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'h':
+				std::cout << "Usage:" << std::endl;
+				std::cout << argv[0] << " [-p port] [-t timeout_ms] [-c concurrency] range [range...]" << std::endl;
+				std::cout << argv[0] << " -h" << std::endl;
+				std::cout << "Ranges are in CIDR notation, e.g. 10.1.0.0/16." << std::endl;
+				return 1;
+				break;
+
+			case 'p':
+				discovery.set_port(std::stoi(optarg));
+				break;
+
+			case 't':
+				discovery.set_timeout(std::chrono::milliseconds(std::stoi(optarg)));
+				break;
+
+			case 'c':
+				concurrency = std::stoul(optarg);
+				break;
+		}
+	}
+	if (optind >= argc) {
+		std::cout << "No network range given." << std::endl;
+		std::cout << "Type " << argv[0] << " -h for help" << std::endl;
+		return 1;
+	}
+
+	// each probe needs a socket; stay within the open file limit
+	rlimit lim;
+	if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+		lim.rlim_cur = lim.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &lim);
+		getrlimit(RLIMIT_NOFILE, &lim);
+		if (lim.rlim_cur != RLIM_INFINITY && concurrency + 64 > lim.rlim_cur)
+			concurrency = lim.rlim_cur > 128 ? lim.rlim_cur - 64 : 64;
+	}
+	discovery.set_concurrency(concurrency);
+
+	current_scan = &discovery;
+	std::signal(SIGINT, interrupt);
+	std::signal(SIGTERM, interrupt);
+
+	size_t probed = 0, found = 0, timed_out = 0;
+	for (int i=optind; i<argc && !interrupted; i++) {
+		bool valid = discovery.scan(argv[i], [](const DiscoveredGateway & gateway) {
+			std::cout << gateway.address << "\t" << (gateway.new_firmware ? "new" : "old")
+				<< "\t" << gateway.latency.count()/1000.0 << " ms" << std::endl;
+		});
+		if (!valid) {
+			std::cerr << "Invalid network range: " << argv[i] << std::endl;
+			continue;
+		}
+		probed += discovery.stats().probed;
+		found += discovery.stats().found;
+		timed_out += discovery.stats().timed_out;
+	}
+	std::cerr << probed << " hosts probed, " << found << " modems found, " << timed_out << " timed out." << std::endl;
+
+	return found > 0 ? 0 : 1;
+}
@@ -16,15 +16,15 @@ int main( int argc, char** argv ) {
 	// flags indicating whether arguments have been set
 	bool address_set = false, pw_set = false, number_set = false, message_set = false;
 	// argument values
-	std::string address, passwd, phone_number, message;
+	std::string address, passwd, phone_number, message, cache;
 
 	// parse command line for arguments
 	int opt;
-	while ( ( opt = getopt ( argc, argv, "ha:p:n:m:" ) ) != -1 ) {
+	while ( ( opt = getopt ( argc, argv, "ha:p:n:m:c:" ) ) != -1 ) {
 		switch ( opt ) {
 			case 'h':
 				std::cout << "Usage:" << std::endl;
-				std::cout << argv[0] << " -a modem_address -p password -n phone_number -m message" << std::endl;
+				std::cout << argv[0] << " -a modem_address -p password -n phone_number -m message [-c session_cache]" << std::endl;
 				std::cout << argv[0] << " -h" << std::endl;
 				return 1;
 				break;
@@ -48,6 +48,10 @@ int main( int argc, char** argv ) {
 				message = optarg;
 				message_set = true;
 				break;
+
+			case 'c':
+				cache = optarg;
+				break;
 		}
 	}
 	if (!address_set || !pw_set || !number_set || !message_set) {
@@ -57,6 +61,8 @@ int main( int argc, char** argv ) {
 	}
 
 	TPLink_M7350 tpl(address, passwd);
+	if (!cache.empty())
+		tpl.set_session_cache(cache);
 	if (!tpl.login())
 		return 1;
 	
@@ -0,0 +1,723 @@
+/** \file tp_m7350_archive.cxx
+ *	Local archive of TP-Link M7350 SMS and log entries, stored in a memory-mapped file.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_archive.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if TPLINK_ARCHIVE_COMPRESSION
+#include <zlib.h>
+#endif
+
+namespace tplink {
+
+	/* Archive layout:
+		[ArchiveHeader, padded to kDataOffset][block][block]...
+	Each block is a BlockHeader followed by its contents, zlib-compressed or not,
+	padded to 8 bytes. Uncompressed contents are entries one after the other, each
+	a RecordHeader followed by sender and text. A block is written whole, then the
+	end offset in the archive header is moved past it, so that a crash never
+	leaves a partial block within the archive. */
+
+	/** \brief Archive file identifier */
+	static const char kArchiveMagic[8] = {'T','P','A','R','C','H','I','V'};
+
+	/** \brief Archive format version */
+	static const uint32_t kArchiveVersion = 1;
+
+	/** \brief Offset of first block */
+	static const uint64_t kDataOffset = 64;
+
+	/** \brief Initial archive file size */
+	static const size_t kInitialSize = 1024*1024;
+
+	/** \brief Size above which the block being filled is written */
+	static const size_t kBlockLimit = 16*1024;
+
+	/** \brief Number of uncompressed blocks kept in cache */
+	static const size_t kCacheSize = 8;
+
+	/** \brief Block flag for zlib-compressed contents */
+	static const uint32_t kCompressed = 1;
+
+	/** \brief Archive header, stored at offset 0. */
+	struct ArchiveHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t end; ///< end of last block
+	};
+
+	/** \brief Block header. */
+	struct BlockHeader {
+		uint32_t stored_size; ///< size of contents in file
+		uint32_t raw_size; ///< size of uncompressed contents
+		uint32_t count; ///< number of entries
+		uint32_t flags;
+		uint64_t checksum; ///< hash of contents in file
+	};
+	static_assert(sizeof(BlockHeader) == 24, "unexpected block header size");
+
+	/** \brief Entry header. */
+	struct RecordHeader {
+		int64_t time;
+		uint32_t text_size;
+		uint16_t sender_size;
+		uint8_t kind;
+		int8_t level;
+		int8_t type;
+		uint8_t reserved[7];
+	};
+	static_assert(sizeof(RecordHeader) == 24, "unexpected record header size");
+
+	/** \brief Compute the FNV-1a hash of a byte sequence.
+	 *	\param data: bytes.
+	 *	\param size: number of bytes.
+	 *	\returns 64-bit hash.
+	 */
+	static uint64_t fnv1a(const char * data, const size_t size) {
+		uint64_t hash = 14695981039346656037u;
+		for (size_t i=0; i<size; i++) {
+			hash ^= uint8_t(data[i]);
+			hash *= 1099511628211u;
+		}
+		return hash;
+	}
+
+	/** \brief Round a size up to a multiple of 8.
+	 *	\param size: size.
+	 *	\returns rounded size.
+	 */
+	static uint64_t align8(const uint64_t size) {
+		return (size + 7) & ~uint64_t(7);
+	}
+
+	/** \brief Split a text into lowercase words, for the inverted index.
+	 *	Words are runs of ASCII letters and digits, and of non-ASCII UTF-8 bytes.
+	 *	\param text: text.
+	 *	\param words: receives words.
+	 */
+	static void split_words(const std::string & text, std::vector<std::string> & words) {
+		std::string word;
+		for (auto c: text) {
+			auto u = uint8_t(c);
+			if (u >= 0x80 || (u >= '0' && u <= '9') || (u >= 'a' && u <= 'z'))
+				word += c;
+			else if (u >= 'A' && u <= 'Z')
+				word += char(u - 'A' + 'a');
+			else if (!word.empty()) {
+				words.push_back(std::move(word));
+				word.clear();
+			}
+		}
+		if (!word.empty())
+			words.push_back(std::move(word));
+	}
+
+	/** \brief Append an encoded entry to a block.
+	 *	\param e: entry.
+	 *	\param block: uncompressed block contents.
+	 */
+	static void encode(const ArchiveEntry & e, std::string & block) {
+		RecordHeader h;
+		std::memset(&h, 0, sizeof(h));
+		h.time = e.time;
+		h.text_size = uint32_t(e.text.size());
+		h.sender_size = uint16_t(std::min<size_t>(e.sender.size(), UINT16_MAX));
+		h.kind = uint8_t(e.kind);
+		h.level = int8_t(e.level);
+		h.type = int8_t(e.type);
+		block.append(reinterpret_cast<const char*>(&h), sizeof(h));
+		block.append(e.sender, 0, h.sender_size);
+		block.append(e.text);
+	}
+
+	/** \brief Decode an entry of a block.
+	 *	\param data: uncompressed block contents.
+	 *	\param size: contents size.
+	 *	\param pos: entry offset.
+	 *	\param e: receives entry.
+	 *	\returns encoded entry size, or 0 if entry doesn't fit in block.
+	 */
+	static size_t decode_record(const char * data, const size_t size, const size_t pos, ArchiveEntry & e) {
+		RecordHeader h;
+		if (pos + sizeof(h) > size) return 0;
+		std::memcpy(&h, data + pos, sizeof(h));
+		auto record_size = sizeof(h) + h.sender_size + size_t(h.text_size);
+		if (record_size > size - pos || h.kind > uint8_t(ArchiveKind::Log)) return 0;
+		e.time = h.time;
+		e.kind = ArchiveKind(h.kind);
+		e.level = h.level;
+		e.type = h.type;
+		e.sender.assign(data + pos + sizeof(h), h.sender_size);
+		e.text.assign(data + pos + sizeof(h) + h.sender_size, h.text_size);
+		return record_size;
+	}
+
+	/** \brief Get a string member of a JSON object.
+	 *	\param v: JSON object.
+	 *	\param name: member name.
+	 *	\returns member value, or an empty string if it doesn't exist.
+	 */
+	static std::string string_member(const rj::Value & v, const char * name) {
+		auto itr = v.FindMember(name);
+		if (itr == v.MemberEnd() || !itr->value.IsString()) return "";
+		return std::string(itr->value.GetString(), itr->value.GetStringLength());
+	}
+
+	/** \brief Get an integer member of a JSON object.
+	 *	\param v: JSON object.
+	 *	\param name: member name.
+	 *	\returns member value, or -1 if it doesn't exist.
+	 */
+	static int int_member(const rj::Value & v, const char * name) {
+		auto itr = v.FindMember(name);
+		return itr != v.MemberEnd() && itr->value.IsInt() ? itr->value.GetInt() : -1;
+	}
+
+	/** \brief Convert a modem time stamp to seconds since the Unix epoch.
+	 *	\param stamp: time stamp, as "YYYY-MM-DD hh:mm:ss".
+	 *	\returns time, taking modem clock as UTC, or 0 if stamp is invalid.
+	 */
+	static int64_t parse_time(const std::string & stamp) {
+		std::tm t{};
+		if (std::sscanf(stamp.c_str(), "%d-%d-%d %d:%d:%d", &t.tm_year, &t.tm_mon, &t.tm_mday,
+				&t.tm_hour, &t.tm_min, &t.tm_sec) != 6)
+			return 0;
+		t.tm_year -= 1900;
+		t.tm_mon -= 1;
+		return timegm(&t);
+	}
+
+	/** \brief Find the entries of a list array in a modem reply.
+	 *	\param reply: modem reply.
+	 *	\param field: list member name.
+	 *	\returns list, or nullptr if there's none.
+	 */
+	static const rj::Value * reply_list(const rj::Value & reply, const char * field) {
+		if (!reply.IsObject()) return nullptr;
+		auto list = reply.FindMember(field);
+		return list != reply.MemberEnd() && list->value.IsArray() ? &list->value : nullptr;
+	}
+
+
+	Archive::~Archive() {
+		this->close();
+	}
+
+
+	bool Archive::open(const std::string & path, const bool compress, const size_t reserve) {
+		this->close();
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (this->fd < 0) {
+			LOG_E("Cannot open archive ", path, ": ", strerror(errno));
+			return false;
+		}
+		struct stat st;
+		if (fstat(this->fd, &st) != 0) {
+			LOG_E("Cannot access archive ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		bool is_new = st.st_size == 0;
+		this->capacity = is_new ? kInitialSize : st.st_size;
+		if (is_new && ftruncate(this->fd, this->capacity) != 0) {
+			LOG_E("Cannot resize archive ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		// reserve the address space once, so that the mapping never moves when the file grows
+		this->reserved = std::max(reserve, this->capacity);
+		auto addr = mmap(nullptr, this->reserved, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+		if (addr == MAP_FAILED) {
+			LOG_E("Cannot map archive ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		this->base = static_cast<char*>(addr);
+
+		auto header = reinterpret_cast<ArchiveHeader*>(this->base);
+		if (is_new) {
+			std::memcpy(header->magic, kArchiveMagic, sizeof(kArchiveMagic));
+			header->version = kArchiveVersion;
+			header->end = kDataOffset;
+		} else if (this->capacity < kDataOffset || std::memcmp(header->magic, kArchiveMagic, sizeof(kArchiveMagic))
+				|| header->version != kArchiveVersion) {
+			LOG_E("File ", path, " isn't an archive.");
+			munmap(this->base, this->reserved);
+			this->base = nullptr;
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+#if TPLINK_ARCHIVE_COMPRESSION
+		this->compress = compress;
+#else
+		if (compress)
+			LOG_E("Archive compression isn't built in; blocks are stored uncompressed.");
+		this->compress = false;
+#endif
+		this->recover();
+		LOG_I("Opened archive ", path, " with ", this->locations.size(), " entries.");
+		return true;
+	}
+
+
+	void Archive::close() {
+		this->flush();
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->base != nullptr) {
+			munmap(this->base, this->reserved);
+			this->base = nullptr;
+		}
+		if (this->fd >= 0) {
+			::close(this->fd);
+			this->fd = -1;
+		}
+		this->pending.clear();
+		this->pending_count = 0;
+		this->locations.clear();
+		this->times.clear();
+		this->hashes.clear();
+		this->by_sender.clear();
+		this->by_level.clear();
+		for (auto & list: this->by_kind)
+			list.clear();
+		this->by_word.clear();
+		this->by_time.clear();
+		this->by_time_sorted = 0;
+		this->cache.clear();
+		this->cache_next = 0;
+		this->capacity = 0;
+		this->reserved = 0;
+	}
+
+
+	bool Archive::is_open() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->base != nullptr;
+	}
+
+
+	bool Archive::recover() {
+		auto header = reinterpret_cast<ArchiveHeader*>(this->base);
+		if (header->end < kDataOffset || header->end > this->capacity) {
+			LOG_E("Archive is truncated; dropping blocks past ", this->capacity, " bytes.");
+			header->end = std::max<uint64_t>(std::min<uint64_t>(header->end, this->capacity), kDataOffset);
+		}
+		auto pos = kDataOffset;
+		while (pos < header->end) {
+			BlockHeader b;
+			bool valid = header->end - pos >= sizeof(b);
+			if (valid) {
+				std::memcpy(&b, this->base + pos, sizeof(b));
+				valid = b.stored_size <= header->end - pos - sizeof(b)
+					&& fnv1a(this->base + pos + sizeof(b), b.stored_size) == b.checksum;
+			}
+			if (!valid) {
+				LOG_E("Archive is damaged at offset ", pos, "; dropping ", header->end - pos, " bytes.");
+				header->end = pos;
+				return false;
+			}
+			size_t size;
+			auto data = this->block_data(pos, size);
+			if (data == nullptr) {
+				LOG_E("Cannot read archive block at offset ", pos, "; skipping ", b.count, " entries.");
+			} else {
+				size_t p = 0;
+				for (uint32_t i=0; i<b.count; i++) {
+					ArchiveEntry e;
+					auto n = decode_record(data, size, p, e);
+					if (n == 0) break;
+					this->index(e, Location{pos, uint32_t(p)}, fnv1a(data + p, n));
+					p += n;
+				}
+			}
+			pos += sizeof(b) + align8(b.stored_size);
+		}
+		this->sort_by_time();
+		return true;
+	}
+
+
+	bool Archive::ensure_capacity(const uint64_t size) {
+		if (size <= this->capacity) return true;
+		auto new_capacity = this->capacity;
+		while (new_capacity < size)
+			new_capacity *= 2;
+		new_capacity = std::min(new_capacity, this->reserved);
+		if (new_capacity < size) {
+			LOG_E("Archive is full.");
+			return false;
+		}
+		if (ftruncate(this->fd, new_capacity) != 0) {
+			LOG_E("Cannot resize archive: ", strerror(errno));
+			return false;
+		}
+		this->capacity = new_capacity;
+		return true;
+	}
+
+
+	void Archive::index(ArchiveEntry & e, const Location loc, const uint64_t hash) {
+		auto id = uint32_t(this->locations.size());
+		e.id = id;
+		this->locations.push_back(loc);
+		this->times.push_back(e.time);
+		this->by_time.push_back(id);
+		// on a hash collision, the first entry keeps the hash
+		this->hashes.emplace(hash, id);
+		this->by_kind[size_t(e.kind)].push_back(id);
+		if (!e.sender.empty())
+			this->by_sender[e.sender].push_back(id);
+		if (e.kind == ArchiveKind::Log)
+			this->by_level[e.level].push_back(id);
+		std::vector<std::string> words;
+		split_words(e.text, words);
+		for (auto & w: words) {
+			auto & list = this->by_word[w];
+			if (list.empty() || list.back() != id)
+				list.push_back(id);
+		}
+	}
+
+
+	bool Archive::append(ArchiveEntry & e) {
+		if (this->base == nullptr || e.kind > ArchiveKind::Log) return false;
+		if (this->locations.size() >= UINT32_MAX) {
+			LOG_E("Archive is full.");
+			return false;
+		}
+		if (this->pending.size() >= kBlockLimit && !this->seal())
+			return false;
+		auto pos = this->pending.size();
+		encode(e, this->pending);
+		auto size = this->pending.size() - pos;
+		auto hash = fnv1a(this->pending.data() + pos, size);
+		auto known = this->hashes.find(hash);
+		bool unreadable = false;
+		if (known != this->hashes.end()) {
+			// compare contents, in case of a hash collision; an entry that can't be read doesn't count
+			size_t n;
+			auto loc = this->locations[known->second];
+			auto data = this->block_data(loc.block, n);
+			if (data != nullptr && loc.pos + size <= n && std::memcmp(data + loc.pos, this->pending.data() + pos, size) == 0) {
+				this->pending.resize(pos);
+				return false;
+			}
+			unreadable = data == nullptr;
+		}
+		this->index(e, Location{0, uint32_t(pos)}, hash);
+		// later duplicates are compared with the new entry
+		if (unreadable)
+			this->hashes[hash] = uint32_t(e.id);
+		this->pending_count++;
+		return true;
+	}
+
+
+	bool Archive::seal() {
+		if (this->pending_count == 0) return true;
+		auto data = this->pending.data();
+		auto stored_size = this->pending.size();
+		uint32_t flags = 0;
+#if TPLINK_ARCHIVE_COMPRESSION
+		std::string packed;
+		if (this->compress) {
+			uLongf n = compressBound(stored_size);
+			packed.resize(n);
+			// kept uncompressed if it doesn't shrink
+			if (compress2(reinterpret_cast<Bytef*>(&packed[0]), &n, reinterpret_cast<const Bytef*>(data), stored_size,
+					Z_DEFAULT_COMPRESSION) == Z_OK && n < stored_size) {
+				data = packed.data();
+				stored_size = n;
+				flags |= kCompressed;
+			}
+		}
+#endif
+		auto header = reinterpret_cast<ArchiveHeader*>(this->base);
+		auto offset = header->end;
+		auto end = offset + sizeof(BlockHeader) + align8(stored_size);
+		if (!this->ensure_capacity(end))
+			return false;
+		BlockHeader b;
+		b.stored_size = uint32_t(stored_size);
+		b.raw_size = uint32_t(this->pending.size());
+		b.count = this->pending_count;
+		b.flags = flags;
+		b.checksum = fnv1a(data, stored_size);
+		std::memcpy(this->base + offset, &b, sizeof(b));
+		std::memcpy(this->base + offset + sizeof(b), data, stored_size);
+		header->end = end;
+
+		for (auto id = this->locations.size() - this->pending_count; id < this->locations.size(); id++)
+			this->locations[id].block = offset;
+		if (flags & kCompressed) {
+			// entries just written are likely to be read soon
+			if (this->cache.size() < kCacheSize) this->cache.emplace_back();
+			auto & slot = this->cache[this->cache_next++ % this->cache.size()];
+			slot.first = offset;
+			slot.second.swap(this->pending);
+		}
+		this->pending.clear();
+		this->pending_count = 0;
+		return true;
+	}
+
+
+	const char * Archive::block_data(const uint64_t block, size_t & size) const {
+		if (block == 0) {
+			size = this->pending.size();
+			return this->pending.data();
+		}
+		BlockHeader b;
+		std::memcpy(&b, this->base + block, sizeof(b));
+		if (!(b.flags & kCompressed)) {
+			size = b.raw_size;
+			return b.raw_size == b.stored_size ? this->base + block + sizeof(b) : nullptr;
+		}
+		for (auto & slot: this->cache) {
+			if (slot.first == block) {
+				size = slot.second.size();
+				return slot.second.data();
+			}
+		}
+#if TPLINK_ARCHIVE_COMPRESSION
+		std::string contents(b.raw_size, '\0');
+		uLongf n = b.raw_size;
+		if (uncompress(reinterpret_cast<Bytef*>(&contents[0]), &n, reinterpret_cast<const Bytef*>(this->base + block + sizeof(b)),
+				b.stored_size) != Z_OK || n != b.raw_size)
+			return nullptr;
+		if (this->cache.size() < kCacheSize) this->cache.emplace_back();
+		auto & slot = this->cache[this->cache_next++ % this->cache.size()];
+		slot.first = block;
+		slot.second.swap(contents);
+		size = slot.second.size();
+		return slot.second.data();
+#else
+		return nullptr;
+#endif
+	}
+
+
+	void Archive::sort_by_time() const {
+		if (this->by_time_sorted == this->by_time.size()) return;
+		auto & times = this->times;
+		auto earlier = [&times](const uint32_t a, const uint32_t b) {
+			return times[a] < times[b] || (times[a] == times[b] && a < b);
+		};
+		// sort new entries, and merge them with the others
+		auto middle = this->by_time.begin() + this->by_time_sorted;
+		std::sort(middle, this->by_time.end(), earlier);
+		std::inplace_merge(this->by_time.begin(), middle, this->by_time.end(), earlier);
+		this->by_time_sorted = this->by_time.size();
+	}
+
+
+	bool Archive::decode(const uint32_t id, ArchiveEntry & e) const {
+		if (id >= this->locations.size()) return false;
+		auto loc = this->locations[id];
+		size_t size;
+		auto data = this->block_data(loc.block, size);
+		if (data == nullptr || decode_record(data, size, loc.pos, e) == 0) return false;
+		e.id = id;
+		return true;
+	}
+
+
+	bool Archive::add(const ArchiveEntry & entry) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto e = entry;
+		return this->append(e);
+	}
+
+
+	size_t Archive::add_sms(const rj::Value & reply, const MailboxCode box) {
+		auto list = reply_list(reply, "messageList");
+		if (list == nullptr) return 0;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		size_t added = 0;
+		for (auto m = list->Begin(); m != list->End(); ++m) {
+			if (!m->IsObject()) continue;
+			ArchiveEntry e;
+			if (box == MailboxCode::Inbox) {
+				e.kind = ArchiveKind::Inbox;
+				e.sender = string_member(*m, "from");
+				e.time = parse_time(string_member(*m, "receivedTime"));
+			} else {
+				e.kind = ArchiveKind::Outbox;
+				e.sender = string_member(*m, "to");
+				e.time = parse_time(string_member(*m, "sendTime"));
+			}
+			e.text = string_member(*m, "content");
+			if (this->append(e)) added++;
+		}
+		return added;
+	}
+
+
+	size_t Archive::add_log(const rj::Value & reply) {
+		auto list = reply_list(reply, "logList");
+		if (list == nullptr) return 0;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		size_t added = 0;
+		for (auto l = list->Begin(); l != list->End(); ++l) {
+			if (!l->IsObject()) continue;
+			ArchiveEntry e;
+			e.kind = ArchiveKind::Log;
+			e.time = parse_time(string_member(*l, "time"));
+			e.level = int_member(*l, "level");
+			e.type = int_member(*l, "type");
+			e.text = string_member(*l, "content");
+			if (this->append(e)) added++;
+		}
+		return added;
+	}
+
+
+	size_t Archive::fetch(const TPLink_M7350 & modem) {
+		size_t added = this->add_sms(modem.read_sms(MailboxCode::Inbox), MailboxCode::Inbox);
+		added += this->add_sms(modem.read_sms(MailboxCode::Outbox), MailboxCode::Outbox);
+		added += this->add_log(modem.get_log());
+		this->flush();
+		return added;
+	}
+
+
+	bool Archive::flush() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->base == nullptr) return false;
+		if (!this->seal()) return false;
+		auto end = reinterpret_cast<ArchiveHeader*>(this->base)->end;
+		if (msync(this->base, end, MS_SYNC) != 0) {
+			LOG_E("Cannot sync archive: ", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+
+	size_t Archive::size() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->locations.size();
+	}
+
+
+	bool Archive::get(const uint64_t id, ArchiveEntry & entry) const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return id < this->locations.size() && this->decode(uint32_t(id), entry);
+	}
+
+
+	std::vector<ArchiveEntry> Archive::find(const ArchiveQuery & query) const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::vector<ArchiveEntry> entries;
+		if (query.from >= query.to) return entries;
+
+		// lists of entries matching each criterion, sorted by identifier
+		std::vector<const std::vector<uint32_t>*> lists;
+		if (query.kind != ArchiveKind::Any) {
+			if (query.kind > ArchiveKind::Log) return entries;
+			lists.push_back(&this->by_kind[size_t(query.kind)]);
+		}
+		if (!query.sender.empty()) {
+			auto it = this->by_sender.find(query.sender);
+			if (it == this->by_sender.end()) return entries;
+			lists.push_back(&it->second);
+		}
+		if (query.level >= 0) {
+			auto it = this->by_level.find(query.level);
+			if (it == this->by_level.end()) return entries;
+			lists.push_back(&it->second);
+		}
+		std::vector<std::string> words;
+		split_words(query.text, words);
+		for (auto & w: words) {
+			auto it = this->by_word.find(w);
+			if (it == this->by_word.end()) return entries;
+			lists.push_back(&it->second);
+		}
+		std::sort(lists.begin(), lists.end(), [](const std::vector<uint32_t> * a, const std::vector<uint32_t> * b) {
+			return a->size() < b->size();
+		});
+		if (!lists.empty() && lists[0]->empty()) return entries;
+
+		this->sort_by_time();
+		auto & times = this->times;
+		auto first = std::lower_bound(this->by_time.begin(), this->by_time.end(), query.from,
+			[&times](const uint32_t id, const int64_t t) { return times[id] < t; });
+		auto last = std::lower_bound(first, this->by_time.end(), query.to,
+			[&times](const uint32_t id, const int64_t t) { return times[id] < t; });
+
+		std::vector<uint32_t> ids;
+		size_t range = last - first;
+		// walking the time range backwards stops after about limit * range / matching entries steps
+		if (lists.empty() || range < lists[0]->size()
+				|| (query.limit > 0 && query.limit*(range/lists[0]->size() + 1) < lists[0]->size())) {
+			// check entries of time range against the lists, latest first
+			for (auto it = last; it != first && (query.limit == 0 || ids.size() < query.limit); ) {
+				--it;
+				bool match = true;
+				for (auto list: lists) {
+					if (!std::binary_search(list->begin(), list->end(), *it)) {
+						match = false;
+						break;
+					}
+				}
+				if (match) ids.push_back(*it);
+			}
+			std::reverse(ids.begin(), ids.end());
+		} else {
+			// walk the shortest list, and look its entries up in the other ones, which are searched from where
+			// the previous lookup ended
+			std::vector<std::vector<uint32_t>::const_iterator> cursors;
+			for (auto list: lists)
+				cursors.push_back(list->begin());
+			for (auto id: *lists[0]) {
+				if (times[id] < query.from || times[id] >= query.to) continue;
+				bool match = true;
+				for (size_t j=1; j<lists.size() && match; j++) {
+					cursors[j] = std::lower_bound(cursors[j], lists[j]->end(), id);
+					match = cursors[j] != lists[j]->end() && *cursors[j] == id;
+				}
+				if (match) ids.push_back(id);
+			}
+			std::sort(ids.begin(), ids.end(), [&times](const uint32_t a, const uint32_t b) {
+				return times[a] < times[b] || (times[a] == times[b] && a < b);
+			});
+		}
+
+		if (query.limit > 0 && ids.size() > query.limit)
+			ids.erase(ids.begin(), ids.end() - query.limit);
+		// decode in file order, so that each compressed block is uncompressed once
+		std::vector<size_t> order(ids.size());
+		for (size_t i=0; i<order.size(); i++)
+			order[i] = i;
+		auto & locations = this->locations;
+		std::sort(order.begin(), order.end(), [&ids, &locations](const size_t a, const size_t b) {
+			return locations[ids[a]].block < locations[ids[b]].block;
+		});
+		std::vector<ArchiveEntry> decoded(ids.size());
+		std::vector<bool> ok(ids.size(), false);
+		for (auto i: order)
+			ok[i] = this->decode(ids[i], decoded[i]);
+		entries.reserve(ids.size());
+		for (size_t i=0; i<ids.size(); i++) {
+			if (ok[i])
+				entries.push_back(std::move(decoded[i]));
+		}
+		return entries;
+	}
+}
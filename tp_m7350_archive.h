@@ -0,0 +1,269 @@
+/** \file tp_m7350_archive.h
+ *  Local archive of TP-Link M7350 SMS and log entries, stored in an append-only
+ *  memory-mapped file, with indexes for queries by sender, time, log level and words.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Origin of an archived entry. */
+	enum class ArchiveKind : uint8_t {
+		Inbox = 0, ///< received SMS
+		Outbox = 1, ///< sent SMS
+		Log = 2, ///< modem log entry
+		Any = 255 ///< any origin, in queries
+	};
+
+	/** \brief An archived SMS or log entry. */
+	struct ArchiveEntry {
+		/** \brief Entry identifier, in order of archiving */
+		uint64_t id = 0;
+		/** \brief Origin */
+		ArchiveKind kind = ArchiveKind::Log;
+		/** \brief Time of reception, sending or logging, in seconds since the Unix epoch (modem clock taken as UTC) */
+		int64_t time = 0;
+		/** \brief Sender of received SMS, recipient of sent SMS; empty for log entries */
+		std::string sender;
+		/** \brief Log level; -1 for SMS */
+		int level = -1;
+		/** \brief Log type; -1 for SMS */
+		int type = -1;
+		/** \brief Message or log text */
+		std::string text;
+	};
+
+	/** \brief Criteria of an archive query; entries must match all of them. */
+	struct ArchiveQuery {
+		/** \brief Origin */
+		ArchiveKind kind = ArchiveKind::Any;
+		/** \brief Sender or recipient; empty for any */
+		std::string sender;
+		/** \brief Log level; -1 for any */
+		int level = -1;
+		/** \brief Start of time range (inclusive), in seconds since the Unix epoch */
+		int64_t from = INT64_MIN;
+		/** \brief End of time range (exclusive), in seconds since the Unix epoch */
+		int64_t to = INT64_MAX;
+		/** \brief Words that must all appear in text, case-insensitive; empty for any */
+		std::string text;
+		/** \brief Maximum number of entries, keeping the latest ones; 0 for no limit */
+		size_t limit = 0;
+	};
+
+	/** \brief Append-only archive of SMS and log entries, backed by a memory-mapped file.
+	 *
+	 *  Entries are appended to blocks of about 16 kB, which are written to the
+	 *  file when full or when the archive is flushed; with option
+	 *  -DTPLINK_ARCHIVE_COMPRESSION=1, blocks can be compressed with zlib, which
+	 *  typically shrinks SMS and log text 3 to 5 times. Entries whose contents
+	 *  (origin, time, sender, level, type and text) were archived already are
+	 *  skipped, so that the same lists can be archived repeatedly as they are
+	 *  read from the modem.
+	 *
+	 *  Indexes are kept in memory and rebuilt when opening: entries by sender,
+	 *  by log level, by origin, by time, and an inverted index from words to
+	 *  entries. Queries intersect the lists of their criteria, starting with
+	 *  the shortest or walking the time range backwards when a limit is given,
+	 *  and only decode the entries they return; with millions of entries,
+	 *  selective queries take well under a millisecond. Results scattered over
+	 *  many compressed blocks take longer, as each block is uncompressed.
+	 *
+	 *  Entries not flushed yet are lost if the process dies. Methods may be
+	 *  called from any thread.
+	 */
+	class Archive {
+	private:
+    /** \brief Position of an entry. */
+    struct Location {
+      /** \brief Block offset in file; 0 for the block being filled */
+      uint64_t block;
+      /** \brief Entry offset in uncompressed block */
+      uint32_t pos;
+    };
+
+    /** \brief File descriptor */
+    int fd = -1;
+
+    /** \brief Start of mapped file */
+    char * base = nullptr;
+
+    /** \brief Size of reserved address space */
+    size_t reserved = 0;
+
+    /** \brief Current file size */
+    size_t capacity = 0;
+
+    /** \brief True if new blocks are compressed */
+    bool compress = false;
+
+    /** \brief Block being filled, uncompressed */
+    std::string pending;
+
+    /** \brief Number of entries in block being filled */
+    uint32_t pending_count = 0;
+
+    /** \brief Entry positions, by identifier */
+    std::vector<Location> locations;
+
+    /** \brief Entry times, by identifier */
+    std::vector<int64_t> times;
+
+    /** \brief Entry identifiers, by content hash */
+    std::unordered_map<uint64_t, uint32_t> hashes;
+
+    /** \brief Entry identifiers, by sender */
+    std::unordered_map<std::string, std::vector<uint32_t> > by_sender;
+
+    /** \brief Entry identifiers, by log level */
+    std::unordered_map<int, std::vector<uint32_t> > by_level;
+
+    /** \brief Entry identifiers, by origin */
+    std::vector<uint32_t> by_kind[3];
+
+    /** \brief Entry identifiers, by word */
+    std::unordered_map<std::string, std::vector<uint32_t> > by_word;
+
+    /** \brief Entry identifiers, sorted by time before queries */
+    mutable std::vector<uint32_t> by_time;
+
+    /** \brief Number of leading by_time entries that are sorted */
+    mutable size_t by_time_sorted = 0;
+
+    /** \brief Recently uncompressed blocks: offset and contents */
+    mutable std::vector<std::pair<uint64_t, std::string> > cache;
+
+    /** \brief Next cache slot to replace */
+    mutable size_t cache_next = 0;
+
+    /** \brief Guards file, indexes and cache */
+    mutable std::mutex mutex;
+
+    /** \brief Make sure the file can hold given size.
+     *  \param size: required size in bytes.
+     *  \returns true if successful, false if the reserved space is exhausted.
+     */
+    bool ensure_capacity(const uint64_t size);
+
+    /** \brief Index entries of the file; called on opening.
+     *  \returns true if archive is consistent, false if damaged blocks were dropped.
+     */
+    bool recover();
+
+    /** \brief Add an entry to indexes.
+     *  \param e: entry; its identifier is set.
+     *  \param loc: entry position.
+     *  \param hash: content hash.
+     */
+    void index(ArchiveEntry & e, const Location loc, const uint64_t hash);
+
+    /** \brief Append an entry, unless it's archived already.
+     *  \param e: entry; its identifier is set if it's appended.
+     *  \returns true if entry was appended, false otherwise.
+     */
+    bool append(ArchiveEntry & e);
+
+    /** \brief Write block being filled to file.
+     *  \returns true if successful, false otherwise.
+     */
+    bool seal();
+
+    /** \brief Get uncompressed contents of a block.
+     *  \param block: block offset; 0 for block being filled.
+     *  \param size: receives contents size.
+     *  \returns start of contents, or nullptr if block can't be read.
+     */
+    const char * block_data(const uint64_t block, size_t & size) const;
+
+    /** \brief Sort entries added to by_time since last sort. */
+    void sort_by_time() const;
+
+    /** \brief Decode an entry.
+     *  \param id: entry identifier.
+     *  \param e: receives entry.
+     *  \returns true if successful, false otherwise.
+     */
+    bool decode(const uint32_t id, ArchiveEntry & e) const;
+
+	public:
+    /** \brief Default constructor. */
+    Archive() = default;
+
+    Archive(const Archive &) = delete;
+    Archive & operator=(const Archive &) = delete;
+
+    /** \brief Destructor; flushes and closes the archive. */
+    ~Archive();
+
+    /** \brief Open given archive, creating it if necessary.
+     *  \param path: archive file path.
+     *  \param compress: if true, compress new blocks; needs option -DTPLINK_ARCHIVE_COMPRESSION=1.
+     *  \param reserve: maximum archive size in bytes.
+     *  \returns true if successful, false otherwise.
+     */
+    bool open(const std::string & path, const bool compress = false, const size_t reserve = size_t(1) << 32);
+
+    /** \brief Flush and close the archive. */
+    void close();
+
+    /** \brief Check whether an archive is open.
+     *  \returns true if an archive is open, false otherwise.
+     */
+    bool is_open() const;
+
+    /** \brief Archive an entry, unless it's archived already.
+     *  \param entry: entry; its identifier is ignored.
+     *  \returns true if entry was added, false if it was there already or the archive is full.
+     */
+    bool add(const ArchiveEntry & entry);
+
+    /** \brief Archive messages of a read_sms() reply.
+     *  \param reply: modem reply, with a messageList array.
+     *  \param box: mailbox messages were read from.
+     *  \returns number of messages added.
+     */
+    size_t add_sms(const rj::Value & reply, const MailboxCode box);
+
+    /** \brief Archive entries of a get_log() reply.
+     *  \param reply: modem reply, with a logList array.
+     *  \returns number of entries added.
+     */
+    size_t add_log(const rj::Value & reply);
+
+    /** \brief Read inbox, outbox and log of a modem, archive their entries and flush the archive.
+     *  \param modem: logged-in modem session.
+     *  \returns number of entries added.
+     */
+    size_t fetch(const TPLink_M7350 & modem);
+
+    /** \brief Write archived entries to disk.
+     *  \returns true if successful, false otherwise.
+     */
+    bool flush();
+
+    /** \brief Get number of archived entries.
+     *  \returns number of entries.
+     */
+    size_t size() const;
+
+    /** \brief Get an archived entry.
+     *  \param id: entry identifier.
+     *  \param entry: receives entry.
+     *  \returns true if successful, false if there's no such entry.
+     */
+    bool get(const uint64_t id, ArchiveEntry & entry) const;
+
+    /** \brief Find entries matching given criteria.
+     *  \param query: criteria.
+     *  \returns matching entries, in time order.
+     */
+    std::vector<ArchiveEntry> find(const ArchiveQuery & query) const;
+	};
+}
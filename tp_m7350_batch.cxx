@@ -0,0 +1,352 @@
+/** \file tp_m7350_batch.cxx
+ *	Batches of operations run over a single TP-Link M7350 session.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_batch.h"
+#include "tp_m7350_codec.h"
+#include "tp_m7350_loop.h"
+#include <deque>
+#include <memory>
+#include <cstring>
+
+namespace tplink {
+
+	using Clock = std::chrono::steady_clock;
+
+	/** \brief Get a string member of an object.
+	 *	\param o: JSON object.
+	 *	\param name: member name.
+	 *	\returns member value, or nullptr if there is no such string member.
+	 */
+	static const char * string_member(const rj::Value & o, const char * name) {
+		auto it = o.FindMember(name);
+		return it != o.MemberEnd() && it->value.IsString() ? it->value.GetString() : nullptr;
+	}
+
+	/** \brief Check that an object has a module name and an action code.
+	 *	\param o: JSON object.
+	 *	\returns true if both are present.
+	 */
+	static bool has_module(const rj::Value & o) {
+		auto action = o.FindMember("action");
+		return string_member(o, "module") != nullptr && action != o.MemberEnd() && action->value.IsInt();
+	}
+
+	/** \brief Get mailbox given by the "box" member of an object; inbox by default.
+	 *	\param o: JSON object.
+	 *	\returns mailbox code.
+	 */
+	static MailboxCode mailbox(const rj::Value & o) {
+		auto box = string_member(o, "box");
+		return box != nullptr && std::strcmp(box, "outbox") == 0 ? MailboxCode::Outbox : MailboxCode::Inbox;
+	}
+
+	/** \brief Check that a reply doesn't report a failure.
+	 *	\param d: modem reply.
+	 *	\returns true if reply is an object with no result code, or with a success code.
+	 */
+	static bool reply_ok(const rj::Document & d) {
+		if (!d.IsObject()) return false;
+		auto result = d.FindMember("result");
+		return result == d.MemberEnd() || result->value == WebReturnCode::Success;
+	}
+
+
+	bool Batch::parse(const std::string & text, std::string & error) {
+		this->steps.clear();
+		size_t pos = 0, line_n = 0;
+		while (pos < text.size()) {
+			auto eol = text.find('\n', pos);
+			if (eol == std::string::npos) eol = text.size();
+			auto line = text.substr(pos, eol - pos);
+			pos = eol + 1;
+			line_n++;
+			auto begin = line.find_first_not_of(" \t\r");
+			if (begin == std::string::npos || line[begin] == '#') continue;
+
+			auto fail = [this, &error, line_n](const std::string & what) {
+				error = "line " + std::to_string(line_n) + ": " + what;
+				this->steps.clear();
+				return false;
+			};
+			Step step;
+			if (step.args.Parse(line.c_str()).HasParseError() || !step.args.IsObject())
+				return fail("not a JSON object");
+			auto & a = step.args;
+			auto op = string_member(a, "op");
+			if (op == nullptr) return fail("no operation");
+			step.op = op;
+			auto data = a.FindMember("data");
+			bool has_data = data != a.MemberEnd();
+			if (has_data && !data->value.IsObject()) return fail("data must be an object");
+
+			if (step.op == "get" || step.op == "request") {
+				if (!has_module(a)) return fail("no module or action");
+				step.read = step.op == "get";
+			} else if (step.op == "set") {
+				if (!has_module(a) || !has_data) return fail("no module, action or data");
+				step.read = false;
+			} else if (step.op == "get_status" || step.op == "get_connected_devices" || step.op == "get_log" || step.op == "read_sms") {
+				step.read = true;
+			} else if (step.op == "send_sms") {
+				if (string_member(a, "number") == nullptr || string_member(a, "message") == nullptr)
+					return fail("no number or message");
+				step.read = false;
+			} else if (step.op == "delete_sms") {
+				auto indices = a.FindMember("indices");
+				if (indices != a.MemberEnd()) {
+					if (!indices->value.IsArray()) return fail("indices must be an array");
+					for (auto i = indices->value.Begin(); i != indices->value.End(); ++i)
+						if (!i->IsInt()) return fail("indices must be integers");
+				} else if (string_member(a, "older_than") == nullptr) {
+					return fail("no indices or older_than");
+				}
+				step.read = false;
+			} else {
+				return fail("unknown operation " + step.op);
+			}
+			this->steps.push_back(std::move(step));
+		}
+		return true;
+	}
+
+
+	void Batch::set_concurrency(const size_t concurrency) {
+		this->concurrency = std::max<size_t>(concurrency, 1);
+	}
+
+
+	size_t Batch::size() const {
+		return this->steps.size();
+	}
+
+
+	size_t Batch::run(TPLink_M7350 & session, const Report & report) const {
+		auto t0 = Clock::now();
+		size_t failed = 0;
+		for (size_t i=0; i<this->steps.size();) {
+			if (this->steps[i].read) {
+				auto j = i;
+				while (j < this->steps.size() && this->steps[j].read) j++;
+				failed += this->run_reads(session, i, j, report, t0);
+				i = j;
+			} else {
+				failed += !this->run_write(session, i, report, t0);
+				i++;
+			}
+		}
+		return failed;
+	}
+
+
+	size_t Batch::run_reads(TPLink_M7350 & session, const size_t first, const size_t last, const Report & report, const Clock::time_point t0) const {
+		using std::chrono::duration_cast;
+		using std::chrono::microseconds;
+		using Data = std::shared_ptr<rj::Document>;
+
+		size_t succeeded = 0;
+		auto finish = [&](const size_t index, const Clock::time_point start, const bool ok, rj::Document && reply) {
+			auto now = Clock::now();
+			succeeded += ok;
+			report(BatchResult{index + 1, this->steps[index].op, ok, std::move(reply),
+				duration_cast<microseconds>(start - t0), duration_cast<microseconds>(now - start)});
+		};
+
+		EpollLoop loop;
+		if (!loop.is_open()) return last - first;
+		auto & driver = loop.driver();
+		{
+			// requests wait here until fewer than the limit are in flight
+			std::deque<std::function<void()> > queue;
+			size_t in_flight = 0;
+			auto pump = [&] {
+				while (in_flight < this->concurrency && !queue.empty()) {
+					auto start = std::move(queue.front());
+					queue.pop_front();
+					in_flight++;
+					start();
+				}
+			};
+			auto send = [&](const std::string & module, const int action, Data data, std::function<void(rj::Document)> done) {
+				queue.push_back([&, module, action, data, done] {
+					session.request_async(driver, module, action, *data, [&, done](rj::Document d) {
+						in_flight--;
+						done(std::move(d));
+						pump();
+					});
+				});
+			};
+
+			for (size_t i=first; i<last; i++) {
+				auto & s = this->steps[i];
+				auto start = Clock::now();
+				auto data = std::make_shared<rj::Document>();
+				data->SetObject();
+				auto & allocator = data->GetAllocator();
+				std::string module, field;
+				int action = 0;
+				if (s.op == "get") {
+					module = string_member(s.args, "module");
+					action = s.args["action"].GetInt();
+					if (s.args.HasMember("data"))
+						data->CopyFrom(s.args["data"], allocator);
+				} else if (s.op == "get_status") {
+					module = Modules::Status;
+				} else if (s.op == "get_connected_devices") {
+					module = Modules::ConnectedDevices;
+					action = ConnectedDevicesOptions::GetConfiguration;
+				} else if (s.op == "get_log") {
+					module = Modules::Log;
+					action = LogOptions::GetLog;
+					field = "logList";
+					data->AddMember("type", 0, allocator);
+					data->AddMember("level", 0, allocator);
+				} else if (s.op == "read_sms") {
+					module = Modules::Message;
+					action = MessageOptions::ReadMessage;
+					field = "messageList";
+					data->AddMember("box", static_cast<uint8_t>(mailbox(s.args)), allocator);
+				}
+
+				if (field.empty()) {
+					send(module, action, data, [&finish, i, start](rj::Document d) {
+						auto ok = reply_ok(d);
+						finish(i, start, ok, std::move(d));
+					});
+					continue;
+				}
+
+				// paged list: first page gives the number of items, then other pages are fetched at once
+				data->AddMember("amountPerPage", 8, allocator);
+				data->AddMember("pageNumber", 1, allocator);
+				send(module, action, data, [&, i, start, module, action, data, field](rj::Document page) {
+					auto total = page.IsObject() ? page.FindMember("totalNumber") : page.MemberEnd();
+					if (!page.IsObject() || total == page.MemberEnd() || !total->value.IsInt()) {
+						finish(i, start, false, std::move(page));
+						return;
+					}
+					struct Pages {
+						std::vector<rj::Document> pages;
+						size_t missing;
+						bool ok = true;
+					};
+					auto n = std::max(1, (total->value.GetInt() + 7)/8);
+					auto pages = std::make_shared<Pages>();
+					pages->pages.resize(n);
+					pages->pages[0] = std::move(page);
+					pages->missing = n - 1;
+					auto complete = [&finish, i, start, field, pages] {
+						rj::Document response;
+						response.SetObject();
+						response.AddMember(rj::Value(field.c_str(), response.GetAllocator()), rj::Value(rj::kArrayType), response.GetAllocator());
+						// failed pages are null documents
+						for (auto & p: pages->pages)
+							if (p.IsObject())
+								append_page(response, field, p);
+						finish(i, start, pages->ok, std::move(response));
+					};
+					if (pages->missing == 0) {
+						complete();
+						return;
+					}
+					for (int p=2; p<=n; p++) {
+						auto page_data = std::make_shared<rj::Document>();
+						page_data->CopyFrom(*data, page_data->GetAllocator());
+						(*page_data)["pageNumber"] = p;
+						send(module, action, page_data, [pages, p, complete](rj::Document d) {
+							pages->ok = pages->ok && reply_ok(d);
+							pages->pages[p - 1] = std::move(d);
+							if (--pages->missing == 0) complete();
+						});
+					}
+				});
+			}
+
+			pump();
+			loop.run([&in_flight, &queue] { return in_flight > 0 || !queue.empty(); });
+		}
+		return (last - first) - succeeded;
+	}
+
+
+	bool Batch::run_write(TPLink_M7350 & session, const size_t index, const Report & report, const Clock::time_point t0) const {
+		using std::chrono::duration_cast;
+		using std::chrono::microseconds;
+
+		auto & s = this->steps[index];
+		auto & a = s.args;
+		auto start = Clock::now();
+		rj::Document reply;
+		bool ok = false;
+		if (s.op == "set" || s.op == "request") {
+			auto module = string_member(a, "module");
+			auto action = a["action"].GetInt();
+			if (a.HasMember("data")) {
+				rj::Document data;
+				data.CopyFrom(a["data"], data.GetAllocator());
+				reply = session.request(module, action, data);
+			} else {
+				reply = session.request(module, action);
+			}
+			ok = s.op == "set" ? reply.IsObject() && reply.HasMember("result") && reply["result"] == WebReturnCode::Success : reply.IsObject();
+		} else if (s.op == "send_sms") {
+			int8_t result;
+			ok = session.send_sms(string_member(a, "number"), string_member(a, "message"), result);
+			reply.SetObject();
+			reply.AddMember("result", result, reply.GetAllocator());
+		} else if (s.op == "delete_sms") {
+			auto box = mailbox(a);
+			std::vector<int> indices;
+			ok = true;
+			if (a.HasMember("indices")) {
+				auto & list = a["indices"];
+				for (auto i = list.Begin(); i != list.End(); ++i)
+					indices.push_back(i->GetInt());
+			} else {
+				// time stamps read as "YYYY-MM-DD hh:mm:ss" compare as strings
+				auto older_than = string_member(a, "older_than");
+				auto messages = session.read_sms(box);
+				auto list = messages.IsObject() ? messages.FindMember("messageList") : messages.MemberEnd();
+				ok = messages.IsObject() && list != messages.MemberEnd() && list->value.IsArray();
+				if (ok) {
+					for (auto m = list->value.Begin(); m != list->value.End(); ++m) {
+						if (!m->IsObject()) continue;
+						auto time = string_member(*m, box == MailboxCode::Inbox ? "receivedTime" : "sendTime");
+						auto i = m->FindMember("index");
+						if (time != nullptr && std::strcmp(time, older_than) < 0 && i != m->MemberEnd() && i->value.IsInt())
+							indices.push_back(i->value.GetInt());
+					}
+				}
+			}
+			if (ok && !indices.empty())
+				ok = session.delete_sms(box, indices);
+			reply.SetObject();
+			rj::Value deleted(rj::kArrayType);
+			if (ok)
+				for (auto i: indices)
+					deleted.PushBack(i, reply.GetAllocator());
+			reply.AddMember("deleted", deleted, reply.GetAllocator());
+		}
+		auto now = Clock::now();
+		report(BatchResult{index + 1, s.op, ok, std::move(reply),
+			duration_cast<microseconds>(start - t0), duration_cast<microseconds>(now - start)});
+		return ok;
+	}
+
+
+	std::string Batch::to_json(const BatchResult & result) {
+		rj::Document d;
+		d.SetObject();
+		auto & allocator = d.GetAllocator();
+		d.AddMember("step", static_cast<uint64_t>(result.step), allocator);
+		d.AddMember("op", rj::Value(result.op.c_str(), allocator), allocator);
+		d.AddMember("ok", result.ok, allocator);
+		d.AddMember("start_us", static_cast<int64_t>(result.start.count()), allocator);
+		d.AddMember("duration_us", static_cast<int64_t>(result.duration.count()), allocator);
+		rj::Value reply;
+		reply.CopyFrom(result.reply, allocator);
+		d.AddMember("reply", reply, allocator);
+		return stringify(d);
+	}
+}
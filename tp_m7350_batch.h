@@ -0,0 +1,125 @@
+/** \file tp_m7350_batch.h
+ *  Batches of operations run over a single TP-Link M7350 session.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Result of a batch step. */
+	struct BatchResult {
+		/** \brief Step number, from 1 */
+		size_t step;
+		/** \brief Operation name */
+		std::string op;
+		/** \brief True if operation succeeded */
+		bool ok;
+		/** \brief Modem reply, or a summary for operations made of several requests */
+		rj::Document reply;
+		/** \brief Time at which step started, from start of batch */
+		std::chrono::microseconds start;
+		/** \brief Step duration */
+		std::chrono::microseconds duration;
+	};
+
+	/** \brief A list of operations run in order over one session.
+	 *
+	 *  Operations are given as JSON objects, one per line; empty lines and
+	 *  lines starting with # are ignored. Each object has an "op" member:
+	 *  - get: request with "module", "action" and optional "data";
+	 *  - set: send "data" with "module" and "action"; succeeds if modem reports success;
+	 *  - request: like get, but may change modem state;
+	 *  - get_status, get_connected_devices, get_log;
+	 *  - read_sms: read messages of "box" ("inbox" or "outbox");
+	 *  - send_sms: send "message" to "number";
+	 *  - delete_sms: delete messages of "box" with given "indices", or older
+	 *    than "older_than" (a time such as "2021-01-31 23:59:59").
+	 *
+	 *  Consecutive reads (get, get_status, get_connected_devices, get_log,
+	 *  read_sms) run concurrently, through non-blocking requests; pages of
+	 *  paged lists are fetched concurrently as well. Other operations run one
+	 *  at a time, once reads before them completed, and before reads after
+	 *  them start. Sessions with a transport (see TPLink_M7350::set_transport)
+	 *  run all requests one at a time through it.
+	 */
+	class Batch {
+	public:
+    /** \brief Called with the result of each step, as steps complete. */
+    using Report = std::function<void(BatchResult &&)>;
+
+	private:
+    /** \brief A parsed operation. */
+    struct Step {
+      /** \brief Operation object, as given */
+      rj::Document args;
+      /** \brief Operation name */
+      std::string op;
+      /** \brief True if operation only reads */
+      bool read;
+    };
+
+    /** \brief Operations, in order */
+    std::vector<Step> steps;
+
+    /** \brief Maximum number of requests in flight during reads */
+    size_t concurrency = 4;
+
+    /** \brief Run consecutive reads concurrently.
+     *  \param session: logged-in session.
+     *  \param first: index of first read.
+     *  \param last: index after last read.
+     *  \param report: called with result of each step.
+     *  \param t0: start time of batch.
+     *  \returns number of failed steps.
+     */
+    size_t run_reads(TPLink_M7350 & session, const size_t first, const size_t last, const Report & report, const std::chrono::steady_clock::time_point t0) const;
+
+    /** \brief Run an operation that may change modem state.
+     *  \param session: logged-in session.
+     *  \param index: step index.
+     *  \param report: called with result of step.
+     *  \param t0: start time of batch.
+     *  \returns true if step succeeded.
+     */
+    bool run_write(TPLink_M7350 & session, const size_t index, const Report & report, const std::chrono::steady_clock::time_point t0) const;
+
+	public:
+    /** \brief Parse operations, replacing those already held.
+     *  \param text: operations, one JSON object per line.
+     *  \param error: receives a description of the first invalid line, if any.
+     *  \returns true if all operations are valid, false otherwise.
+     */
+    bool parse(const std::string & text, std::string & error);
+
+    /** \brief Set maximum number of requests in flight during reads.
+     *  \param concurrency: number of requests; at least 1.
+     */
+    void set_concurrency(const size_t concurrency);
+
+    /** \brief Get number of operations.
+     *  \returns number of operations.
+     */
+    size_t size() const;
+
+    /** \brief Run operations over a session.
+     *  \param session: logged-in session; must not be used elsewhere meanwhile.
+     *  \param report: called with result of each step, from the calling thread.
+     *  \returns number of failed steps.
+     */
+    size_t run(TPLink_M7350 & session, const Report & report) const;
+
+    /** \brief Format a step result as a JSON line (without line end).
+     *  \param result: step result.
+     *  \returns JSON text.
+     */
+    static std::string to_json(const BatchResult & result);
+	};
+}
@@ -0,0 +1,191 @@
+/** \file tp_m7350_codec.cxx
+ *	Hashing, encoding, encryption and serialization routines used to talk to
+ *	TP-Link M7350 web gateways.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_codec.h"
+#include "tplink_m7350.h"
+#include "tp_m7350_metrics.h"
+#include "tp_m7350_trace.h"
+#include <vector>
+#include <iomanip>
+#include <sstream>
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+#include <openssl/bn.h>
+#include <openssl/bio.h>
+#include <openssl/param_build.h>
+
+namespace tplink {
+
+	std::string compute_md5_hash(const std::string & str) {
+		unsigned char digest[16];
+		// digest functions from OpenSSL
+		auto ctx = UniquePointer<EVP_MD_CTX, EVP_MD_CTX_free>(EVP_MD_CTX_new());
+		EVP_MD_CTX_init(ctx.get());
+		EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr);
+		EVP_DigestUpdate(ctx.get(), str.data(), str.size());
+		EVP_DigestFinal_ex(ctx.get(), digest, nullptr);
+
+		std::ostringstream res;
+		for (int i=0; i<16; i++)
+			res << std::setfill('0') << std::setw(2) << std::hex << static_cast<unsigned int>(digest[i]);
+
+		return res.str();
+	}
+
+
+	std::string b64_encode(const std::string & data) {
+		auto b64 = UniquePointer<BIO, BIO_free>(BIO_new(BIO_f_base64()));
+		BIO_set_flags(b64.get(), BIO_FLAGS_BASE64_NO_NL);
+		auto sink = UniquePointer<BIO, BIO_free>(BIO_new(BIO_s_mem()));
+		BIO_push(b64.get(), sink.get());
+		BIO_write(b64.get(), data.data(), data.size());
+		BIO_flush(b64.get());
+		char* encoded;
+		auto len = BIO_get_mem_data(sink.get(), &encoded);
+		return std::string(encoded, len);
+	}
+
+
+	std::string b64_decode(const std::string & data) {
+		auto b64 = UniquePointer<BIO, BIO_free>(BIO_new(BIO_f_base64()));
+		BIO_set_flags(b64.get(), BIO_FLAGS_BASE64_NO_NL);
+		auto source = UniquePointer<BIO, BIO_free>(BIO_new(BIO_s_mem()));
+		BIO_puts(source.get(), data.c_str());
+		std::string decoded(data.size(), '\0');
+		BIO_push(b64.get(), source.get());
+		auto len = BIO_read(b64.get(), &decoded[0], data.size());
+		decoded.resize(len > 0 ? len : 0);
+		return decoded;
+	}
+
+
+	std::string aes_encrypt(const std::string & data, const unsigned char * key, const unsigned char * iv) {
+		auto ctx = UniquePointer<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
+		assert(ctx);
+
+		// padding adds up to one block
+		std::string ciphertext(data.size() + 16, '\0');
+		auto out = reinterpret_cast<unsigned char*>(&ciphertext[0]);
+		int ciphertext_len = 0, len = 0;
+		verify(EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, key, iv)==1);
+		verify(EVP_EncryptUpdate(ctx.get(), out, &ciphertext_len, reinterpret_cast<const unsigned char*>(data.c_str()), data.size())==1);
+		verify(EVP_EncryptFinal_ex(ctx.get(), out + ciphertext_len, &len)==1);
+		ciphertext.resize(ciphertext_len + len);
+
+		return b64_encode(ciphertext);
+	}
+
+
+	std::string aes_decrypt(const std::string & data, const unsigned char * key, const unsigned char * iv) {
+		auto ctx = UniquePointer<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
+		assert(ctx);
+
+		auto ciphertext = b64_decode(data);
+		std::string plaintext(ciphertext.size() + 16, '\0');
+		auto out = reinterpret_cast<unsigned char*>(&plaintext[0]);
+		int plaintext_len = 0, len = 0;
+		verify(EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, key, iv)==1);
+		verify(EVP_DecryptUpdate(ctx.get(), out, &plaintext_len, reinterpret_cast<const unsigned char*>(ciphertext.c_str()), ciphertext.size())==1);
+		verify(EVP_DecryptFinal_ex(ctx.get(), out + plaintext_len, &len)==1);
+		plaintext.resize(plaintext_len + len);
+
+		return plaintext;
+	}
+
+
+	EVP_PKEY * rsa_public_key(const std::string & modulus, const std::string & exponent) {
+		auto params_build = UniquePointer<OSSL_PARAM_BLD, OSSL_PARAM_BLD_free>(OSSL_PARAM_BLD_new());
+		assert(params_build);
+		BIGNUM * bn = nullptr;
+		BN_hex2bn(&bn, modulus.c_str());
+		auto bn_mod = UniquePointer<BIGNUM, BN_free>(bn);
+		assert(bn_mod);
+		bn = nullptr;
+		BN_hex2bn(&bn, exponent.c_str());
+		auto bn_exp = UniquePointer<BIGNUM, BN_free>(bn);
+		assert(bn_exp);
+
+		verify(OSSL_PARAM_BLD_push_BN(params_build.get(), "n", bn_mod.get())==1);
+		verify(OSSL_PARAM_BLD_push_BN(params_build.get(), "e", bn_exp.get())==1);
+		verify(OSSL_PARAM_BLD_push_BN(params_build.get(), "d", nullptr)==1);
+		auto params = UniquePointer<OSSL_PARAM, OSSL_PARAM_free>(OSSL_PARAM_BLD_to_param(params_build.get()));
+		assert(params);
+
+		// create key object
+		auto ctx = UniquePointer<EVP_PKEY_CTX, EVP_PKEY_CTX_free>(EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr));
+		assert(ctx);
+		verify(EVP_PKEY_fromdata_init(ctx.get())==1);
+		EVP_PKEY * pkey = nullptr;
+		verify(EVP_PKEY_fromdata(ctx.get(), &pkey, EVP_PKEY_PUBLIC_KEY, params.get())==1);
+		assert(pkey);
+		return pkey;
+	}
+
+
+	std::string rsa_encrypt(const std::string & data, EVP_PKEY * key) {
+		auto key_size = EVP_PKEY_get_bits(key)/8;
+
+		// create encryption context
+		auto ctx = UniquePointer<EVP_PKEY_CTX, EVP_PKEY_CTX_free>(EVP_PKEY_CTX_new(key, nullptr));
+		verify(EVP_PKEY_encrypt_init(ctx.get())>0);
+		verify(EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_NO_PADDING)>0);
+		// RSA with no padding can only encode strings that are the same size as the modulus;
+		// need to split data into chunks and pad last chunk
+		unsigned int last_chunk_size = data.size() % key_size;
+		unsigned int n_chunks = data.size()/key_size + (last_chunk_size>0);
+		auto encrypted_size = n_chunks*key_size;
+		std::vector<unsigned char> ciphertext;
+		ciphertext.resize(encrypted_size);
+		size_t offset = 0;
+		while (n_chunks--) {
+			size_t ciphertext_len = 0;
+			if (n_chunks == 0) {
+				std::vector<unsigned char> plaintext;
+				plaintext.resize(key_size);
+				std::copy(data.begin()+offset, data.end(), plaintext.begin());
+				EVP_PKEY_encrypt(ctx.get(), &ciphertext[offset], &ciphertext_len, plaintext.data(), key_size);
+			} else {
+				EVP_PKEY_encrypt(ctx.get(), &ciphertext[offset], &ciphertext_len, reinterpret_cast<const unsigned char*>(&data[offset]), key_size);
+				offset += key_size;
+			}
+		}
+
+		auto result = std::string(reinterpret_cast<char*>(ciphertext.data()), encrypted_size);
+		return result;
+	}
+
+
+	std::string rsa_encrypt(const std::string & data, const std::string & modulus, const std::string & exponent) {
+		auto key = UniquePointer<EVP_PKEY, EVP_PKEY_free>(rsa_public_key(modulus, exponent));
+		return rsa_encrypt(data, key.get());
+	}
+
+
+	std::string stringify(const rj::Value & d) {
+		TP_METRICS_PHASE(Stringify);
+		TP_TRACE_SCOPE(trace_span, "stringify");
+		rj::StringBuffer s;
+		rj::Writer<rj::StringBuffer> writer(s);
+		d.Accept(writer);
+		return s.GetString();
+	}
+
+
+	void append_page(rj::Document & response, const std::string & field, const rj::Value & page) {
+		if (!page.IsObject()) return;
+		auto items = page.FindMember(field.c_str());
+		if (items == page.MemberEnd() || !items->value.IsArray()) return;
+		rj::Document::AllocatorType & allocator = response.GetAllocator();
+		auto & list = response[field.c_str()];
+		for (rj::Value::ConstValueIterator itr = items->value.Begin(); itr != items->value.End(); ++itr) {
+			rj::Value obj(rj::kObjectType);
+			obj.CopyFrom(*itr, allocator);
+			list.PushBack(obj, allocator);
+		}
+	}
+}
@@ -0,0 +1,96 @@
+/** \file tp_m7350_codec.h
+ *  Hashing, encoding, encryption and serialization routines used to talk to
+ *  TP-Link M7350 web gateways. They don't depend on a session, so that they
+ *  can be tested and benchmarked on their own.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <cassert>
+#include <rapidjson/document.h>
+#include <openssl/types.h>
+
+namespace tplink {
+
+	namespace rj = rapidjson;
+
+	/** \brief Assert that a condition holds; unlike assert, the condition is also evaluated when NDEBUG is set.
+	 *  \param condition: condition to check.
+	 */
+	inline void verify(const bool condition) {
+		assert(condition);
+		(void)condition;
+	}
+
+	/** \brief Compute the MD5 hash of a string.
+	 *  \param str: string to compute MD5 hash for.
+	 *  \returns MD5 hash in hexadecimal format.
+	 */
+	std::string compute_md5_hash(const std::string & str);
+
+	/** \brief Encode a string in base64.
+	 *  \param data: string to encode.
+	 *  \returns base64-encoded string.
+	 */
+	std::string b64_encode(const std::string & data);
+
+	/** \brief Decode a base64-encoded string.
+	 *  \param data: base64-encoded string.
+	 *  \returns decoded string.
+	 */
+	std::string b64_decode(const std::string & data);
+
+	/** \brief Encrypt data with AES-128 in CBC mode, and encode result in base64.
+	 *  \param data: data to encrypt.
+	 *  \param key: 16-byte key.
+	 *  \param iv: 16-byte initialization vector.
+	 *  \returns base64-encoded encrypted data.
+	 */
+	std::string aes_encrypt(const std::string & data, const unsigned char * key, const unsigned char * iv);
+
+	/** \brief Decrypt base64-encoded data encrypted with AES-128 in CBC mode.
+	 *  \param data: base64-encoded encrypted data.
+	 *  \param key: 16-byte key.
+	 *  \param iv: 16-byte initialization vector.
+	 *  \returns decrypted data.
+	 */
+	std::string aes_decrypt(const std::string & data, const unsigned char * key, const unsigned char * iv);
+
+	/** \brief Encrypt data with an RSA public key, without padding.
+	 *  Data is split into chunks of the modulus size; the last one is padded with zeros.
+	 *  \param data: data to encrypt.
+	 *  \param modulus: key modulus, in hexadecimal.
+	 *  \param exponent: key public exponent, in hexadecimal.
+	 *  \returns encrypted data.
+	 */
+	std::string rsa_encrypt(const std::string & data, const std::string & modulus, const std::string & exponent);
+
+	/** \brief Build a RSA public key from its parameters, to encrypt several times with it.
+	 *  \param modulus: key modulus, in hexadecimal.
+	 *  \param exponent: key public exponent, in hexadecimal.
+	 *  \returns key, to be freed with EVP_PKEY_free.
+	 */
+	EVP_PKEY * rsa_public_key(const std::string & modulus, const std::string & exponent);
+
+	/** \brief Encrypt data with a RSA public key, without padding.
+	 *  Data is split into chunks of the modulus size; the last one is padded with zeros.
+	 *  \param data: data to encrypt.
+	 *  \param key: key built with rsa_public_key.
+	 *  \returns encrypted data.
+	 */
+	std::string rsa_encrypt(const std::string & data, EVP_PKEY * key);
+
+	/** \brief Converts a RapidJSON object to string.
+	 *  \param d: RapidJSON object to stringify.
+	 *  \returns a string containing the input JSON object.
+	 */
+	std::string stringify(const rj::Value & d);
+
+	/** \brief Append the items of one page of a data array to a response.
+	 *  \param response: response object holding the array being built.
+	 *  \param field: name of data array.
+	 *  \param page: page, as returned by modem; nothing is done if it isn't an object with such an array.
+	 */
+	void append_page(rj::Document & response, const std::string & field, const rj::Value & page);
+}
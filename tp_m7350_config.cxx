@@ -0,0 +1,298 @@
+/** \file tp_m7350_config.cxx
+ *	Snapshot, restore and desired-state updates of the configuration of a TP-Link M7350 modem.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_config.h"
+#include "tp_m7350_loop.h"
+#include <deque>
+#include <memory>
+#include <algorithm>
+
+namespace tplink {
+
+	/** \brief Version of snapshot documents */
+	static const int snapshot_version = 1;
+
+	/** \brief Configuration requests of a module. */
+	struct ConfigModule {
+		/** \brief Module name */
+		const std::string & name;
+		/** \brief Action fetching configuration */
+		int get;
+		/** \brief Action setting configuration; -1 if module can't be restored */
+		int set;
+		/** \brief Restore stage; modules of a stage are restored concurrently */
+		int stage;
+	};
+
+	/** \brief Last restore stage */
+	static const int last_stage = 4;
+
+	/** \brief Saved modules, in restore order */
+	static const ConfigModule config_modules[] = {
+		{Modules::LAN, LANOptions::GetConfiguration, LANOptions::SetConfiguration, 0},
+		{Modules::WAN, WANOptions::GetConfiguration, WANOptions::SetConfiguration, 1},
+		{Modules::ALG, ALGOptions::GetConfiguration, ALGOptions::SetConfiguration, 2},
+		{Modules::DMZ, DMZOptions::GetConfiguration, DMZOptions::SetConfiguration, 2},
+		{Modules::PortTriggering, PortTriggeringOptions::GetConfiguration, PortTriggeringOptions::SetConfiguration, 2},
+		{Modules::VirtualServer, VirtualServerOptions::GetConfiguration, VirtualServerOptions::SetConfiguration, 2},
+		{Modules::UPnP, UPnPOptions::GetConfiguration, UPnPOptions::SetConfiguration, 2},
+		{Modules::MACFilters, MACFiltersOptions::GetBlackList, MACFiltersOptions::SetBlackList, 2},
+		{Modules::FlowStat, FlowStatOptions::GetConfiguration, FlowStatOptions::SetConfiguration, 2},
+		{Modules::PowerSave, PowerSavingOptions::GetConfiguration, PowerSavingOptions::SetConfiguration, 2},
+		{Modules::StorageShare, StorageShareOptions::GetConfiguration, StorageShareOptions::SetConfiguration, 2},
+		{Modules::Time, TimeOptions::GetConfiguration, TimeOptions::SetConfiguration, 2},
+		{Modules::APBridge, APBridgeOptions::GetConfiguration, APBridgeOptions::SetConfiguration, 3},
+		{Modules::WPS, WPSOptions::GetConfiguration, WPSOptions::SetConfiguration, 3},
+		{Modules::WLAN, WLANOptions::GetConfiguration, WLANOptions::SetConfiguration, 4},
+		{Modules::SimLock, SIMLockOptions::GetConfiguration, -1, -1},
+		{Modules::Voice, VoiceOptions::GetConfiguration, -1, -1},
+		{Modules::Update, FirmwareUpdateOptions::GetConfiguration, -1, -1},
+	};
+
+
+	/** \brief Run requests through an event loop, a limited number at a time.
+	 *	\param loop: event loop.
+	 *	\param requests: functions starting a request; they take a function to call once request completed.
+	 *	\param concurrency: maximum number of requests in flight.
+	 *	\returns true if loop ran until all requests completed.
+	 */
+	static bool run_requests(EpollLoop & loop, std::deque<std::function<void(std::function<void()>)> > && requests, const size_t concurrency) {
+		size_t in_flight = 0;
+		std::function<void()> pump = [&] {
+			while (in_flight < concurrency && !requests.empty()) {
+				auto start = std::move(requests.front());
+				requests.pop_front();
+				in_flight++;
+				start([&] {
+					in_flight--;
+					pump();
+				});
+			}
+		};
+		pump();
+		return loop.run([&] { return in_flight > 0 || !requests.empty(); });
+	}
+
+
+	void ConfigBackup::set_concurrency(const size_t concurrency) {
+		this->concurrency = std::max<size_t>(concurrency, 1);
+	}
+
+
+	rj::Document ConfigBackup::snapshot(TPLink_M7350 & session) {
+		this->failures.clear();
+		rj::Document doc;
+		doc.SetObject();
+		auto & allocator = doc.GetAllocator();
+		doc.AddMember("version", snapshot_version, allocator);
+		doc.AddMember("firmware", NEW_FIRMWARE ? "new" : "old", allocator);
+		doc.AddMember("address", rj::Value(session.get_address().c_str(), allocator), allocator);
+		rj::Value modules(rj::kObjectType);
+
+		// replies complete in any order; they are stored in table order
+		std::vector<rj::Document> replies(std::size(config_modules));
+		EpollLoop loop;
+		std::deque<std::function<void(std::function<void()>)> > requests;
+		for (size_t i=0; i<replies.size(); i++) {
+			requests.push_back([&, i](std::function<void()> done) {
+				auto & m = config_modules[i];
+				session.request_async(loop.driver(), m.name, m.get, [&, i, done](rj::Document d) {
+					replies[i] = std::move(d);
+					done();
+				});
+			});
+		}
+		// replies of requests abandoned by a failed loop stay null
+		run_requests(loop, std::move(requests), this->concurrency);
+
+		for (size_t i=0; i<replies.size(); i++) {
+			auto & d = replies[i];
+			auto name = config_modules[i].name.c_str();
+			if (!d.IsObject() || d.ObjectEmpty() || (d.HasMember("result") && d["result"] != WebReturnCode::Success)) {
+				LOG_E("Couldn't fetch configuration of module ", name);
+				this->failures.push_back(name);
+				continue;
+			}
+			d.RemoveMember("result");
+			modules.AddMember(rj::Value(name, allocator), rj::Value(d, allocator), allocator);
+		}
+		doc.AddMember("modules", modules, allocator);
+		return doc;
+	}
+
+
+	bool ConfigBackup::validate(const rj::Document & snapshot, std::string & error) {
+		if (!snapshot.IsObject() || !snapshot.HasMember("version") || !snapshot["version"].IsInt()) {
+			error = "not a configuration snapshot";
+			return false;
+		}
+		if (snapshot["version"].GetInt() != snapshot_version) {
+			error = "unsupported snapshot version " + std::to_string(snapshot["version"].GetInt());
+			return false;
+		}
+		// settings layouts differ between firmware generations
+		auto firmware = snapshot.FindMember("firmware");
+		if (firmware == snapshot.MemberEnd() || !firmware->value.IsString()
+			|| firmware->value != (NEW_FIRMWARE ? "new" : "old")) {
+			error = "snapshot was taken from another firmware generation";
+			return false;
+		}
+		auto modules = snapshot.FindMember("modules");
+		if (modules == snapshot.MemberEnd() || !modules->value.IsObject()) {
+			error = "snapshot has no modules";
+			return false;
+		}
+		for (auto m = modules->value.MemberBegin(); m != modules->value.MemberEnd(); m++) {
+			if (!m->value.IsObject()) {
+				error = std::string("configuration of module ") + m->name.GetString() + " isn't an object";
+				return false;
+			}
+		}
+		return true;
+	}
+
+
+	bool ConfigBackup::restore(TPLink_M7350 & session, const rj::Document & snapshot, const std::vector<std::string> & modules) {
+		this->failures.clear();
+		std::string error;
+		if (!validate(snapshot, error)) {
+			LOG_E("Couldn't restore configuration: ", error);
+			return false;
+		}
+		for (auto & name: modules) {
+			auto known = std::find_if(std::begin(config_modules), std::end(config_modules),
+				[&name](const ConfigModule & m) { return m.name == name && m.set >= 0; });
+			if (known == std::end(config_modules) || !snapshot["modules"].HasMember(name.c_str())) {
+				LOG_E("Can't restore module ", name);
+				this->failures.push_back(name);
+			}
+		}
+
+		const auto & saved = snapshot["modules"];
+		bool aborted = false;
+		for (int stage=0; stage<=last_stage && !aborted; stage++) {
+			// a module whose request never completes counts as failed
+			std::vector<std::pair<const ConfigModule *, bool> > results;
+			EpollLoop loop;
+			std::deque<std::function<void(std::function<void()>)> > requests;
+			for (auto & m: config_modules) {
+				if (m.stage != stage || !saved.HasMember(m.name.c_str())) continue;
+				if (!modules.empty() && std::find(modules.begin(), modules.end(), m.name) == modules.end()) continue;
+				auto data = std::make_shared<rj::Document>();
+				data->CopyFrom(saved[m.name.c_str()], data->GetAllocator());
+				results.emplace_back(&m, false);
+				auto index = results.size() - 1;
+				requests.push_back([&, data, index](std::function<void()> done) {
+					auto m = results[index].first;
+					session.send_data_async(loop.driver(), m->name, m->set, *data, [&, index, done](bool ok) {
+						results[index].second = ok;
+						done();
+					});
+				});
+			}
+			// later stages depend on this one
+			aborted = !run_requests(loop, std::move(requests), this->concurrency);
+			for (auto & r: results) {
+				if (r.second) continue;
+				LOG_E("Couldn't restore configuration of module ", r.first->name);
+				this->failures.push_back(r.first->name);
+			}
+		}
+		return this->failures.empty();
+	}
+
+
+	const std::vector<std::string> & ConfigBackup::failed() const {
+		return this->failures;
+	}
+
+
+	std::vector<std::string> ConfigBackup::modules() {
+		std::vector<std::string> names;
+		for (auto & m: config_modules)
+			names.push_back(m.name);
+		return names;
+	}
+
+
+	ConfigState::ConfigState(const std::chrono::milliseconds max_age) : max_age(max_age) {}
+
+
+	ApplyResult ConfigState::apply(TPLink_M7350 & session, const std::string & module, const rj::Value & desired) {
+		auto m = std::find_if(std::begin(config_modules), std::end(config_modules),
+			[&module](const ConfigModule & m) { return m.name == module && m.set >= 0; });
+		if (m == std::end(config_modules) || !desired.IsObject()) {
+			LOG_E("Can't apply configuration of module ", module);
+			return ApplyResult::Failed;
+		}
+
+		auto now = Clock::now();
+		auto cached = this->cache.find(module);
+		if (cached == this->cache.end() || now - cached->second.fetched >= this->max_age) {
+			auto d = session.request(m->name, m->get);
+			if (!d.IsObject() || d.ObjectEmpty() || (d.HasMember("result") && d["result"] != WebReturnCode::Success)) {
+				LOG_E("Couldn't fetch configuration of module ", module);
+				this->cache.erase(module);
+				return ApplyResult::Failed;
+			}
+			d.RemoveMember("result");
+			auto & entry = this->cache[module];
+			entry.config.Swap(d);
+			entry.fetched = now;
+			cached = this->cache.find(module);
+		}
+
+		auto & current = cached->second.config;
+		rj::Document changes;
+		changes.SetObject();
+		auto & allocator = changes.GetAllocator();
+		for (auto member = desired.MemberBegin(); member != desired.MemberEnd(); member++) {
+			auto was = current.FindMember(member->name);
+			if (was != current.MemberEnd() && was->value == member->value) continue;
+			changes.AddMember(rj::Value(member->name, allocator), rj::Value(member->value, allocator), allocator);
+		}
+		if (changes.ObjectEmpty()) return ApplyResult::Unchanged;
+
+		// same as the set_* methods, with changed members only
+		auto reply = session.request(m->name, m->set, changes);
+		if (!reply.IsObject() || !reply.HasMember("result") || reply["result"] != WebReturnCode::Success) {
+			// modem may have taken part of the changes
+			this->cache.erase(cached);
+			return ApplyResult::Failed;
+		}
+		for (auto member = changes.MemberBegin(); member != changes.MemberEnd(); member++) {
+			auto was = current.FindMember(member->name);
+			if (was != current.MemberEnd())
+				was->value.CopyFrom(member->value, current.GetAllocator());
+			else
+				current.AddMember(rj::Value(member->name, current.GetAllocator()), rj::Value(member->value, current.GetAllocator()), current.GetAllocator());
+		}
+		return ApplyResult::Applied;
+	}
+
+
+	void ConfigState::load(const rj::Document & snapshot) {
+		std::string error;
+		if (!ConfigBackup::validate(snapshot, error)) {
+			LOG_E("Couldn't load configuration: ", error);
+			return;
+		}
+		auto now = Clock::now();
+		const auto & modules = snapshot["modules"];
+		for (auto m = modules.MemberBegin(); m != modules.MemberEnd(); m++) {
+			auto & entry = this->cache[m->name.GetString()];
+			entry.config.CopyFrom(m->value, entry.config.GetAllocator());
+			entry.fetched = now;
+		}
+	}
+
+
+	void ConfigState::invalidate(const std::string & module) {
+		if (module.empty())
+			this->cache.clear();
+		else
+			this->cache.erase(module);
+	}
+}
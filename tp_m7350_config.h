@@ -0,0 +1,143 @@
+/** \file tp_m7350_config.h
+ *  Snapshot, restore and desired-state updates of the configuration of a TP-Link M7350 modem.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Takes and restores snapshots of all module configurations.
+	 *
+	 *  A snapshot is a JSON document of the form
+	 *  {"version": 1, "firmware": "old"|"new", "address": "...",
+	 *   "modules": {"lan": {...}, "wlan": {...}, ...}}
+	 *  holding the reply to the configuration request of each module, without
+	 *  its result code. Modules without a configuration setter (simLock, voice,
+	 *  update) are saved for reference but never restored.
+	 *
+	 *  Modules are fetched concurrently. They are restored in stages, modules
+	 *  of a stage concurrently: LAN first, as DMZ, virtual servers and MAC
+	 *  filters refer to LAN addresses; then WAN; then services (ALG, DMZ, port
+	 *  triggering, virtual servers, UPnP, MAC filters, flow statistics, power
+	 *  saving, storage sharing, time); then AP bridge and WPS; and WLAN last,
+	 *  as it restarts the access point clients may be connected through.
+	 *  Restoring a LAN configuration with another modem address ends the
+	 *  session; remaining stages then fail. Sessions with a transport (see
+	 *  TPLink_M7350::set_transport) send requests one at a time through it.
+	 */
+	class ConfigBackup {
+	private:
+    /** \brief Maximum number of requests in flight */
+    size_t concurrency = 4;
+
+    /** \brief Modules that failed during last snapshot or restore */
+    std::vector<std::string> failures;
+
+	public:
+    /** \brief Set maximum number of requests in flight.
+     *  \param concurrency: number of requests; at least 1.
+     */
+    void set_concurrency(const size_t concurrency);
+
+    /** \brief Fetch configuration of all modules.
+     *  \param session: logged-in session; must not be used elsewhere meanwhile.
+     *  \returns snapshot document; modules that couldn't be fetched are missing (see failed()).
+     */
+    rj::Document snapshot(TPLink_M7350 & session);
+
+    /** \brief Restore configurations of a snapshot.
+     *  \param session: logged-in session; must not be used elsewhere meanwhile.
+     *  \param snapshot: snapshot document.
+     *  \param modules: names of modules to restore; all modules of snapshot if empty.
+     *  \returns true if all modules were restored, false otherwise (see failed()).
+     */
+    bool restore(TPLink_M7350 & session, const rj::Document & snapshot, const std::vector<std::string> & modules = {});
+
+    /** \brief Get modules that failed during last snapshot or restore.
+     *  \returns module names.
+     */
+    const std::vector<std::string> & failed() const;
+
+    /** \brief Check that a document is a snapshot this library can restore.
+     *  \param snapshot: document to check.
+     *  \param error: receives a description of the problem, if any.
+     *  \returns true if snapshot is valid, false otherwise.
+     */
+    static bool validate(const rj::Document & snapshot, std::string & error);
+
+    /** \brief Get names of modules held in snapshots.
+     *  \returns module names, in restore order.
+     */
+    static std::vector<std::string> modules();
+	};
+
+	/** \brief Outcome of applying a desired configuration. */
+	enum class ApplyResult {
+		Unchanged, ///< Configuration already matched; nothing was sent
+		Applied, ///< Changed members were sent and accepted
+		Failed, ///< Configuration couldn't be fetched, or modem rejected changes
+	};
+
+	/** \brief Applies desired module configurations, sending only what changed.
+	 *
+	 *  The desired configuration of a module is compared member by member with
+	 *  its current configuration, taken from a cache or fetched from the modem
+	 *  once the cached copy is older than the maximum age. Nothing is sent if
+	 *  all members match, which spares the modem from restarting Wi-Fi or WAN
+	 *  for nothing; otherwise, only changed members are sent. Members are
+	 *  compared as a whole: a nested object with one changed member is sent
+	 *  entirely.
+	 *
+	 *  The cache isn't aware of changes made through other means (set_*
+	 *  methods, web interface); call invalidate() after such changes.
+	 */
+	class ConfigState {
+	private:
+    using Clock = std::chrono::steady_clock;
+
+    /** \brief A cached module configuration. */
+    struct Entry {
+      /** \brief Configuration, without result code */
+      rj::Document config;
+      /** \brief Time at which configuration was fetched */
+      Clock::time_point fetched;
+    };
+
+    /** \brief Maximum age of cached configurations */
+    std::chrono::milliseconds max_age;
+
+    /** \brief Cached configurations, by module */
+    std::unordered_map<std::string, Entry> cache;
+
+	public:
+    /** \brief Constructor.
+     *  \param max_age: maximum age of cached configurations; 0 to always fetch them.
+     */
+    explicit ConfigState(const std::chrono::milliseconds max_age = std::chrono::minutes(1));
+
+    /** \brief Bring a module to a desired configuration.
+     *  \param session: logged-in session.
+     *  \param module: module name, as in snapshots (see ConfigBackup::modules()).
+     *  \param desired: JSON object with desired values; members left out are left unchanged.
+     *  \returns outcome.
+     */
+    ApplyResult apply(TPLink_M7350 & session, const std::string & module, const rj::Value & desired);
+
+    /** \brief Seed cache with the configurations of a snapshot.
+     *  \param snapshot: snapshot document, taken from the same session (see ConfigBackup).
+     */
+    void load(const rj::Document & snapshot);
+
+    /** \brief Forget cached configuration of a module, so that it's fetched on next use.
+     *  \param module: module name; all modules if empty.
+     */
+    void invalidate(const std::string & module = std::string());
+	};
+}
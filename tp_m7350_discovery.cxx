@@ -0,0 +1,209 @@
+/** \file tp_m7350_discovery.cxx
+ *	Discovery of TP-Link M7350 web gateways on a network range.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_discovery.h"
+#include <vector>
+#include <memory>
+#include <arpa/inet.h>
+#include "rapidjson/writer.h"
+#include "rapidjson/stringbuffer.h"
+
+namespace tplink {
+
+	/** \brief Largest reply accepted from a probed host; gateway replies are far smaller. */
+	static constexpr size_t kMaxReplySize = 16384;
+
+	/** \brief A probe in flight. */
+	struct Probe {
+		UniquePointer<CURL, curl_easy_cleanup> handle;
+		/** \brief Reply data */
+		std::string buffer;
+		/** \brief Probed address */
+		std::string address;
+		/** \brief Time at which probe was sent */
+		std::chrono::steady_clock::time_point start;
+	};
+
+	/* CURL writer callback; gives up on hosts sending more than any gateway would */
+	static size_t probe_writer(char * data, size_t size, size_t nmemb, std::string * buffer) {
+		if (buffer->size() + size*nmemb > kMaxReplySize) return 0;
+		buffer->append(data, size*nmemb);
+		return size*nmemb;
+	}
+
+	/** \brief Build body of probe request.
+	 *	\returns serialized request.
+	 */
+	static std::string probe_request() {
+		rj::Document req;
+		req.SetObject();
+		req.AddMember("module", rj::StringRef(Modules::Authenticator.c_str(), Modules::Authenticator.size()), req.GetAllocator());
+		req.AddMember("action", AuthenticatorOptions::Load, req.GetAllocator());
+		rj::StringBuffer s;
+		rj::Writer<rj::StringBuffer> writer(s);
+		req.Accept(writer);
+		return s.GetString();
+	}
+
+	/** \brief Format an IPv4 address.
+	 *	\param ip: address, in host byte order.
+	 *	\returns dotted address.
+	 */
+	static std::string format_ip(const uint32_t ip) {
+		return std::to_string(ip >> 24) + "." + std::to_string((ip >> 16) & 0xff) + "."
+			+ std::to_string((ip >> 8) & 0xff) + "." + std::to_string(ip & 0xff);
+	}
+
+
+	void Discovery::set_timeout(const std::chrono::milliseconds timeout) {
+		this->timeout = timeout;
+	}
+
+
+	void Discovery::set_concurrency(const size_t concurrency) {
+		this->concurrency = std::max<size_t>(1, concurrency);
+	}
+
+
+	void Discovery::set_port(const uint16_t port) {
+		this->port = port;
+	}
+
+
+	void Discovery::cancel() {
+		this->cancelled = true;
+	}
+
+
+	const DiscoveryStats & Discovery::stats() const {
+		return this->last_stats;
+	}
+
+
+	bool Discovery::parse_range(const std::string & range, uint32_t & first, uint32_t & last) {
+		auto slash = range.find('/');
+		auto host = range.substr(0, slash);
+		int prefix = 32;
+		if (slash != std::string::npos) {
+			auto bits = range.substr(slash+1);
+			if (bits.empty() || bits.size() > 2 || bits.find_first_not_of("0123456789") != std::string::npos)
+				return false;
+			prefix = std::stoi(bits);
+			if (prefix > 32) return false;
+		}
+		in_addr addr;
+		if (inet_pton(AF_INET, host.c_str(), &addr) != 1) return false;
+		uint32_t ip = ntohl(addr.s_addr);
+		uint32_t mask = prefix == 0 ? 0 : ~uint32_t(0) << (32 - prefix);
+		first = ip & mask;
+		last = first | ~mask;
+		if (prefix < 31) {
+			first++;
+			last--;
+		}
+		return true;
+	}
+
+
+	bool Discovery::scan(const std::string & range, const std::function<void(const DiscoveredGateway &)> & found) {
+		uint32_t first, last;
+		if (!parse_range(range, first, last)) {
+			LOG_E("Invalid network range: ", range);
+			return false;
+		}
+		this->cancelled = false;
+		this->last_stats = DiscoveryStats();
+
+		auto multi = UniquePointer<CURLM, curl_multi_cleanup>(curl_multi_init());
+		assert(multi);
+		static const std::string request = probe_request();
+		auto suffix = (this->port == 80 ? "" : ":" + std::to_string(this->port));
+
+		uint64_t next = first;
+		const uint64_t end = uint64_t(last) + 1;
+		auto n_probes = static_cast<size_t>(std::min<uint64_t>(this->concurrency, end - next));
+		std::vector<std::unique_ptr<Probe> > probes;
+		std::vector<Probe*> idle;
+		for (size_t i=0; i<n_probes; i++) {
+			auto p = std::make_unique<Probe>();
+			p->handle = UniquePointer<CURL, curl_easy_cleanup>(curl_easy_init());
+			auto h = p->handle.get();
+			curl_easy_setopt(h, CURLOPT_PRIVATE, p.get());
+			curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, probe_writer);
+			curl_easy_setopt(h, CURLOPT_WRITEDATA, &p->buffer);
+			curl_easy_setopt(h, CURLOPT_POSTFIELDS, request.c_str());
+			curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, static_cast<long>(request.size()));
+			curl_easy_setopt(h, CURLOPT_TIMEOUT_MS, static_cast<long>(this->timeout.count()));
+			curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L);
+			// every host is contacted once; don't keep connections around
+			curl_easy_setopt(h, CURLOPT_FORBID_REUSE, 1L);
+			idle.push_back(p.get());
+			probes.push_back(std::move(p));
+		}
+
+		int running = 0;
+		for (;;) {
+			// start probes on the next hosts
+			while (!idle.empty() && next < end && !this->cancelled) {
+				auto p = idle.back();
+				idle.pop_back();
+				p->address = format_ip(static_cast<uint32_t>(next++)) + suffix;
+				p->buffer.clear();
+				auto url = "http://" + p->address + "/cgi-bin/auth_cgi";
+				curl_easy_setopt(p->handle.get(), CURLOPT_URL, url.c_str());
+				p->start = std::chrono::steady_clock::now();
+				curl_multi_add_handle(multi.get(), p->handle.get());
+				this->last_stats.probed++;
+			}
+			curl_multi_perform(multi.get(), &running);
+			// collect finished probes
+			int n_msgs;
+			while (auto msg = curl_multi_info_read(multi.get(), &n_msgs)) {
+				if (msg->msg != CURLMSG_DONE) continue;
+				Probe * p;
+				curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, reinterpret_cast<char**>(&p));
+				auto result = msg->data.result;
+				curl_multi_remove_handle(multi.get(), msg->easy_handle);
+				idle.push_back(p);
+				if (result == CURLE_OPERATION_TIMEDOUT) {
+					this->last_stats.timed_out++;
+					continue;
+				}
+				if (result != CURLE_OK && result != CURLE_WRITE_ERROR) continue;
+				// gateways reply with a login nonce
+				rj::Document d;
+				d.Parse(p->buffer.c_str());
+				bool is_gateway = false;
+				if (result == CURLE_OK && d.IsObject()) {
+					auto nonce = d.FindMember("nonce");
+					is_gateway = nonce != d.MemberEnd() && nonce->value.IsString() && nonce->value.GetStringLength() > 0;
+				}
+				if (!is_gateway) {
+					this->last_stats.other++;
+					continue;
+				}
+				DiscoveredGateway gateway;
+				gateway.address = p->address;
+				gateway.latency = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - p->start);
+				auto rsa_mod = d.FindMember("rsaMod");
+				if (rsa_mod != d.MemberEnd() && rsa_mod->value.IsString() && rsa_mod->value.GetStringLength() > 0) {
+					gateway.new_firmware = true;
+					gateway.rsa_modulus = rsa_mod->value.GetString();
+				}
+				this->last_stats.found++;
+				found(gateway);
+			}
+			if (this->cancelled || (running == 0 && next >= end)) break;
+			// wait for activity unless more probes can start right away
+			if (idle.empty() || next >= end)
+				curl_multi_poll(multi.get(), nullptr, 0, 100, nullptr);
+		}
+
+		// a cancelled scan leaves probes in flight
+		for (auto & p: probes)
+			curl_multi_remove_handle(multi.get(), p->handle.get());
+		return true;
+	}
+}
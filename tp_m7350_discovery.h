@@ -0,0 +1,108 @@
+/** \file tp_m7350_discovery.h
+ *  Discovery of TP-Link M7350 web gateways on a network range.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief A gateway found by discovery. */
+	struct DiscoveredGateway {
+		/** \brief Gateway address, as accepted by TPLink_M7350::set_address */
+		std::string address;
+		/** \brief True for firmwares from M7350(EU)_V5_201019 on, which encrypt their traffic */
+		bool new_firmware = false;
+		/** \brief RSA modulus announced by gateway (new firmwares only) */
+		std::string rsa_modulus;
+		/** \brief Time between sending the probe and receiving the reply */
+		std::chrono::microseconds latency{0};
+	};
+
+	/** \brief Counters of a discovery scan. */
+	struct DiscoveryStats {
+		/** \brief Number of hosts probed */
+		size_t probed = 0;
+		/** \brief Number of gateways found */
+		size_t found = 0;
+		/** \brief Number of hosts that replied with something else than a gateway */
+		size_t other = 0;
+		/** \brief Number of hosts that didn't reply within timeout */
+		size_t timed_out = 0;
+	};
+
+	/** \brief Find gateways on a network range.
+	 *
+	 *  Every host of the range gets the unauthenticated request that starts a
+	 *  login (authenticator module, action AuthenticatorOptions::Load) on
+	 *  cgi-bin/auth_cgi. Hosts replying with a login nonce are gateways; those
+	 *  that also announce an RSA modulus run a new firmware. Probes run
+	 *  concurrently through a CURL multi handle, each with its own deadline, and
+	 *  gateways are reported as soon as they reply.
+	 */
+	class Discovery {
+	private:
+    /** \brief Per-host timeout, including connection */
+    std::chrono::milliseconds timeout{1000};
+
+    /** \brief Maximum number of probes in flight */
+    size_t concurrency = 1024;
+
+    /** \brief Port of web interface */
+    uint16_t port = 80;
+
+    /** \brief Set to stop a running scan */
+    std::atomic<bool> cancelled{false};
+
+    /** \brief Counters of last scan */
+    DiscoveryStats last_stats;
+
+	public:
+    /** \brief Set per-host timeout.
+     *  \param timeout: maximum time to wait for a host, connection included.
+     */
+    void set_timeout(const std::chrono::milliseconds timeout);
+
+    /** \brief Set maximum number of probes in flight.
+     *  \param concurrency: number of probes; each uses a socket.
+     */
+    void set_concurrency(const size_t concurrency);
+
+    /** \brief Set port of web interface.
+     *  \param port: port number.
+     */
+    void set_port(const uint16_t port);
+
+    /** \brief Probe every host of a network range.
+     *  Blocks until all hosts have been probed or the scan is cancelled.
+     *  \param range: IPv4 range in CIDR notation (e.g. 10.1.0.0/16); a single address is a /32.
+     *  \param found: called from the calling thread for each gateway, as soon as it replies.
+     *  \returns true if successful, false if range is invalid.
+     */
+    bool scan(const std::string & range, const std::function<void(const DiscoveredGateway &)> & found);
+
+    /** \brief Stop a running scan; may be called from any thread. */
+    void cancel();
+
+    /** \brief Get counters of last scan.
+     *  \returns counters.
+     */
+    const DiscoveryStats & stats() const;
+
+    /** \brief Parse an IPv4 range in CIDR notation.
+     *  Network and broadcast addresses are left out of ranges larger than /31.
+     *  \param range: range to parse.
+     *  \param first: receives first host address, in host byte order.
+     *  \param last: receives last host address, in host byte order.
+     *  \returns true if successful, false otherwise.
+     */
+    static bool parse_range(const std::string & range, uint32_t & first, uint32_t & last);
+	};
+}
@@ -24,32 +24,32 @@ namespace tplink {
         RestoreConf, Time, Log, APBridge, Voice,
         UPnP, DMZ, ALG, VirtualServer, PortTriggering;
     };
-    const std::string Modules::Authenticator = "authenticator";
-    const std::string Modules::WebServer = "webServer";
-    const std::string Modules::Status = "status";
-    const std::string Modules::WAN = "wan";
-    const std::string Modules::SimLock = "simLock";
-    const std::string Modules::Message = "message";
-    const std::string Modules::WLAN = "wlan";
-    const std::string Modules::WPS = "wps";
-    const std::string Modules::PowerSave = "power_save";
-    const std::string Modules::FlowStat = "flowstat";
-    const std::string Modules::ConnectedDevices = "connectedDevices";
-    const std::string Modules::MACFilters = "macFilters";
-    const std::string Modules::LAN = "lan";
-    const std::string Modules::Update = "update";
-    const std::string Modules::StorageShare = "storageShare";
-    const std::string Modules::Reboot = "reboot";
-    const std::string Modules::RestoreConf = "restoreDefaults";
-    const std::string Modules::Time = "time";
-    const std::string Modules::Log = "log";
-    const std::string Modules::APBridge = "apBridge";
-    const std::string Modules::Voice = "voice";
-    const std::string Modules::UPnP = "upnp";
-    const std::string Modules::DMZ = "dmz";
-    const std::string Modules::ALG = "alg";
-    const std::string Modules::VirtualServer = "virtualServer";
-    const std::string Modules::PortTriggering = "portTrigger";
+    inline const std::string Modules::Authenticator = "authenticator";
+    inline const std::string Modules::WebServer = "webServer";
+    inline const std::string Modules::Status = "status";
+    inline const std::string Modules::WAN = "wan";
+    inline const std::string Modules::SimLock = "simLock";
+    inline const std::string Modules::Message = "message";
+    inline const std::string Modules::WLAN = "wlan";
+    inline const std::string Modules::WPS = "wps";
+    inline const std::string Modules::PowerSave = "power_save";
+    inline const std::string Modules::FlowStat = "flowstat";
+    inline const std::string Modules::ConnectedDevices = "connectedDevices";
+    inline const std::string Modules::MACFilters = "macFilters";
+    inline const std::string Modules::LAN = "lan";
+    inline const std::string Modules::Update = "update";
+    inline const std::string Modules::StorageShare = "storageShare";
+    inline const std::string Modules::Reboot = "reboot";
+    inline const std::string Modules::RestoreConf = "restoreDefaults";
+    inline const std::string Modules::Time = "time";
+    inline const std::string Modules::Log = "log";
+    inline const std::string Modules::APBridge = "apBridge";
+    inline const std::string Modules::Voice = "voice";
+    inline const std::string Modules::UPnP = "upnp";
+    inline const std::string Modules::DMZ = "dmz";
+    inline const std::string Modules::ALG = "alg";
+    inline const std::string Modules::VirtualServer = "virtualServer";
+    inline const std::string Modules::PortTriggering = "portTrigger";
 
 
     /** \brief Options for WLAN security type. */
@@ -57,15 +57,15 @@ namespace tplink {
         static const std::string
         NoPassword, WEP, WPA_TKIP, WPA_AES, WPA2_TKIP, WPA2_AES, WPA_WPA2, IEEE8201X, Unknown;
     };
-    const std::string APSecurity::NoPassword = "noPassword";
-    const std::string APSecurity::WEP = "wepSecurity";
-    const std::string APSecurity::WPA_TKIP = "wpaTkipSecurity";
-    const std::string APSecurity::WPA_AES = "wpaAesSecurity";
-    const std::string APSecurity::WPA2_TKIP = "wpa2TkipSecurity";
-    const std::string APSecurity::WPA2_AES = "wpa2AesSecurity";
-    const std::string APSecurity::WPA_WPA2 = "wpaWpa2Security";
-    const std::string APSecurity::IEEE8201X = "ieee8021XSecurity";
-    const std::string APSecurity::Unknown = "unknownSecurity";
+    inline const std::string APSecurity::NoPassword = "noPassword";
+    inline const std::string APSecurity::WEP = "wepSecurity";
+    inline const std::string APSecurity::WPA_TKIP = "wpaTkipSecurity";
+    inline const std::string APSecurity::WPA_AES = "wpaAesSecurity";
+    inline const std::string APSecurity::WPA2_TKIP = "wpa2TkipSecurity";
+    inline const std::string APSecurity::WPA2_AES = "wpa2AesSecurity";
+    inline const std::string APSecurity::WPA_WPA2 = "wpaWpa2Security";
+    inline const std::string APSecurity::IEEE8201X = "ieee8021XSecurity";
+    inline const std::string APSecurity::Unknown = "unknownSecurity";
 
     /** \brief Options for Application Layer Gateway module. */
     struct ALGOptions {
@@ -73,8 +73,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t ALGOptions::GetConfiguration = 0;
-    const uint8_t ALGOptions::SetConfiguration = 1;
+    inline const uint8_t ALGOptions::GetConfiguration = 0;
+    inline const uint8_t ALGOptions::SetConfiguration = 1;
 
 
     /** \brief Options for access point bridge module. */
@@ -86,11 +86,11 @@ namespace tplink {
         ScanAP, ///< Scan for access points
         CheckConnectionStatus; ///< Check connection status
     };
-    const uint8_t APBridgeOptions::GetConfiguration = 0;
-    const uint8_t APBridgeOptions::SetConfiguration = 1;
-    const uint8_t APBridgeOptions::ConnectAP = 2;
-    const uint8_t APBridgeOptions::ScanAP = 3;
-    const uint8_t APBridgeOptions::CheckConnectionStatus = 4;
+    inline const uint8_t APBridgeOptions::GetConfiguration = 0;
+    inline const uint8_t APBridgeOptions::SetConfiguration = 1;
+    inline const uint8_t APBridgeOptions::ConnectAP = 2;
+    inline const uint8_t APBridgeOptions::ScanAP = 3;
+    inline const uint8_t APBridgeOptions::CheckConnectionStatus = 4;
 
 
     /** \brief Options for authenticator module. */
@@ -102,11 +102,11 @@ namespace tplink {
         Logout, ///< Log out
         Update; ///< Update
     };
-    const uint8_t AuthenticatorOptions::Load = 0;
-    const uint8_t AuthenticatorOptions::Login = 1;
-    const uint8_t AuthenticatorOptions::GetAttempts = 2;
-    const uint8_t AuthenticatorOptions::Logout = 3;
-    const uint8_t AuthenticatorOptions::Update = 4;
+    inline const uint8_t AuthenticatorOptions::Load = 0;
+    inline const uint8_t AuthenticatorOptions::Login = 1;
+    inline const uint8_t AuthenticatorOptions::GetAttempts = 2;
+    inline const uint8_t AuthenticatorOptions::Logout = 3;
+    inline const uint8_t AuthenticatorOptions::Update = 4;
 
 
     /** \brief Options for ConnectedDevices module. */
@@ -118,9 +118,9 @@ namespace tplink {
     #endif
         ;
     };
-    const uint8_t ConnectedDevicesOptions::GetConfiguration = 0;
+    inline const uint8_t ConnectedDevicesOptions::GetConfiguration = 0;
     #if NEW_FIRMWARE==1
-    const uint8_t ConnectedDevicesOptions::EditName = 1;
+    inline const uint8_t ConnectedDevicesOptions::EditName = 1;
     #endif
 
 
@@ -130,8 +130,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t DMZOptions::GetConfiguration = 0;
-    const uint8_t DMZOptions::SetConfiguration = 1;
+    inline const uint8_t DMZOptions::GetConfiguration = 0;
+    inline const uint8_t DMZOptions::SetConfiguration = 1;
 
 
     /** \brief Options for flow statistics module. */
@@ -140,8 +140,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t FlowStatOptions::GetConfiguration = 0;
-    const uint8_t FlowStatOptions::SetConfiguration = 1;
+    inline const uint8_t FlowStatOptions::GetConfiguration = 0;
+    inline const uint8_t FlowStatOptions::SetConfiguration = 1;
 
 
     /** \brief Options for LAN module. */
@@ -150,8 +150,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t LANOptions::GetConfiguration = 0;
-    const uint8_t LANOptions::SetConfiguration = 1;
+    inline const uint8_t LANOptions::GetConfiguration = 0;
+    inline const uint8_t LANOptions::SetConfiguration = 1;
 
 
     /** \brief Options for log module. */
@@ -164,12 +164,12 @@ namespace tplink {
         GetMdLog, ///< Get log settings
         SetMdLog; ///< Set log settings
     };
-    const uint8_t LogOptions::GetLog = 0;
-    const uint8_t LogOptions::ClearLog = 1;
-    const uint8_t LogOptions::SaveLog = 2;
-    const uint8_t LogOptions::Refresh = 3;
-    const uint8_t LogOptions::GetMdLog = 4;
-    const uint8_t LogOptions::SetMdLog = 5;
+    inline const uint8_t LogOptions::GetLog = 0;
+    inline const uint8_t LogOptions::ClearLog = 1;
+    inline const uint8_t LogOptions::SaveLog = 2;
+    inline const uint8_t LogOptions::Refresh = 3;
+    inline const uint8_t LogOptions::GetMdLog = 4;
+    inline const uint8_t LogOptions::SetMdLog = 5;
 
 
     /** \brief Options for MAC filter module. */
@@ -178,8 +178,8 @@ namespace tplink {
         GetBlackList, ///< Get black list
         SetBlackList; ///< Set black list
     };
-    const uint8_t MACFiltersOptions::GetBlackList = 0;
-    const uint8_t MACFiltersOptions::SetBlackList = 1;
+    inline const uint8_t MACFiltersOptions::GetBlackList = 0;
+    inline const uint8_t MACFiltersOptions::SetBlackList = 1;
 
 
     /** \brief Options for message (SMS) module. */
@@ -194,14 +194,14 @@ namespace tplink {
         MarkAsRead, ///< Mark message as read
         GetSendStatus; ///< Get send status
     };
-    const uint8_t MessageOptions::GetConfiguration = 0;
-    const uint8_t MessageOptions::SetConfiguration = 1;
-    const uint8_t MessageOptions::ReadMessage = 2;
-    const uint8_t MessageOptions::SendMessage = 3;
-    const uint8_t MessageOptions::SaveMessage = 4;
-    const uint8_t MessageOptions::DeleteMessage = 5;
-    const uint8_t MessageOptions::MarkAsRead = 6;
-    const uint8_t MessageOptions::GetSendStatus = 7;
+    inline const uint8_t MessageOptions::GetConfiguration = 0;
+    inline const uint8_t MessageOptions::SetConfiguration = 1;
+    inline const uint8_t MessageOptions::ReadMessage = 2;
+    inline const uint8_t MessageOptions::SendMessage = 3;
+    inline const uint8_t MessageOptions::SaveMessage = 4;
+    inline const uint8_t MessageOptions::DeleteMessage = 5;
+    inline const uint8_t MessageOptions::MarkAsRead = 6;
+    inline const uint8_t MessageOptions::GetSendStatus = 7;
 
 
     /** \brief Options for port triggering module. */
@@ -211,9 +211,9 @@ namespace tplink {
         SetConfiguration, ///< Set configuration
         DeleteEntry; ///< Delete port triggering entry
     };
-    const uint8_t PortTriggeringOptions::GetConfiguration = 0;
-    const uint8_t PortTriggeringOptions::SetConfiguration = 1;
-    const uint8_t PortTriggeringOptions::DeleteEntry = 2;
+    inline const uint8_t PortTriggeringOptions::GetConfiguration = 0;
+    inline const uint8_t PortTriggeringOptions::SetConfiguration = 1;
+    inline const uint8_t PortTriggeringOptions::DeleteEntry = 2;
 
 
     /** \brief Options for power saving module. */
@@ -222,8 +222,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t PowerSavingOptions::GetConfiguration = 0;
-    const uint8_t PowerSavingOptions::SetConfiguration = 1;
+    inline const uint8_t PowerSavingOptions::GetConfiguration = 0;
+    inline const uint8_t PowerSavingOptions::SetConfiguration = 1;
 
 
     /** \brief Options for reboot module. */
@@ -232,8 +232,8 @@ namespace tplink {
         Reboot, ///< Reboot
         Shutdown; ///< Shutdown
     };
-    const uint8_t RebootOptions::Reboot = 0;
-    const uint8_t RebootOptions::Shutdown = 1;
+    inline const uint8_t RebootOptions::Reboot = 0;
+    inline const uint8_t RebootOptions::Shutdown = 1;
 
 
     /** \brief Options for SIM lock module. */
@@ -247,13 +247,13 @@ namespace tplink {
         UnlockPUK, ///< Unlock PUK
         AutoUnlock; ///< Auto unlock
     };
-    const uint8_t SIMLockOptions::GetConfiguration = 0;
-    const uint8_t SIMLockOptions::EnablePIN = 1;
-    const uint8_t SIMLockOptions::DisablePIN = 2;
-    const uint8_t SIMLockOptions::UpdatePIN = 3;
-    const uint8_t SIMLockOptions::UnlockPIN = 4;
-    const uint8_t SIMLockOptions::UnlockPUK = 5;
-    const uint8_t SIMLockOptions::AutoUnlock = 6;
+    inline const uint8_t SIMLockOptions::GetConfiguration = 0;
+    inline const uint8_t SIMLockOptions::EnablePIN = 1;
+    inline const uint8_t SIMLockOptions::DisablePIN = 2;
+    inline const uint8_t SIMLockOptions::UpdatePIN = 3;
+    inline const uint8_t SIMLockOptions::UnlockPIN = 4;
+    inline const uint8_t SIMLockOptions::UnlockPUK = 5;
+    inline const uint8_t SIMLockOptions::AutoUnlock = 6;
 
 
     /** \brief Options for storage sharing module. */
@@ -262,8 +262,8 @@ namespace tplink {
         GetConfiguration, ///< Get configuration
         SetConfiguration; ///< Set configuration
     };
-    const uint8_t StorageShareOptions::GetConfiguration = 0;
-    const uint8_t StorageShareOptions::SetConfiguration = 1;
+    inline const uint8_t StorageShareOptions::GetConfiguration = 0;
+    inline const uint8_t StorageShareOptions::SetConfiguration = 1;
 
 
     /** \brief Options for time module. */
@@ -273,9 +273,9 @@ namespace tplink {
         SetConfiguration, ///< Set configuration
         QueryTime; ///< Query time
     };
-    const uint8_t TimeOptions::GetConfiguration = 0;
-    const uint8_t TimeOptions::SetConfiguration = 1;
-    const uint8_t TimeOptions::QueryTime = 2;
+    inline const uint8_t TimeOptions::GetConfiguration = 0;
+    inline const uint8_t TimeOptions::SetConfiguration = 1;
+    inline const uint8_t TimeOptions::QueryTime = 2;
 
 
     /** \brief Options for firmware update module. */
@@ -290,14 +290,14 @@ namespace tplink {
         StartUpgrade, ///< Start upgrade
         ClearCache; ///< Clear cache
     };
-    const uint8_t FirmwareUpdateOptions::GetConfiguration = 0;
-    const uint8_t FirmwareUpdateOptions::CheckNew = 1;
-    const uint8_t FirmwareUpdateOptions::ServerUpdate = 2;
-    const uint8_t FirmwareUpdateOptions::PauseLoad = 3;
-    const uint8_t FirmwareUpdateOptions::RequestLoadPercentage = 4;
-    const uint8_t FirmwareUpdateOptions::CheckUploadResult = 5;
-    const uint8_t FirmwareUpdateOptions::StartUpgrade = 6;
-    const uint8_t FirmwareUpdateOptions::ClearCache = 7;
+    inline const uint8_t FirmwareUpdateOptions::GetConfiguration = 0;
+    inline const uint8_t FirmwareUpdateOptions::CheckNew = 1;
+    inline const uint8_t FirmwareUpdateOptions::ServerUpdate = 2;
+    inline const uint8_t FirmwareUpdateOptions::PauseLoad = 3;
+    inline const uint8_t FirmwareUpdateOptions::RequestLoadPercentage = 4;
+    inline const uint8_t FirmwareUpdateOptions::CheckUploadResult = 5;
+    inline const uint8_t FirmwareUpdateOptions::StartUpgrade = 6;
+    inline const uint8_t FirmwareUpdateOptions::ClearCache = 7;
 
 
     /** \brief Options for UPnP module. */
@@ -307,9 +307,9 @@ namespace tplink {
         SetConfiguration, ///< Set configuration
         GetUPnPDeviceList; ///< Get UPnP device list
     };
-    const uint8_t UPnPOptions::GetConfiguration = 0;
-    const uint8_t UPnPOptions::SetConfiguration = 1;
-    const uint8_t UPnPOptions::GetUPnPDeviceList = 2;
+    inline const uint8_t UPnPOptions::GetConfiguration = 0;
+    inline const uint8_t UPnPOptions::SetConfiguration = 1;
+    inline const uint8_t UPnPOptions::GetUPnPDeviceList = 2;
 
 
     /** \brief Options for virtual server module. */
@@ -319,9 +319,9 @@ namespace tplink {
         SetConfiguration, ///< Set configuration
         DeleteVirtualServer; ///< Delete virtual server
     };
-    const uint8_t VirtualServerOptions::GetConfiguration = 0;
-    const uint8_t VirtualServerOptions::SetConfiguration = 1;
-    const uint8_t VirtualServerOptions::DeleteVirtualServer = 2;
+    inline const uint8_t VirtualServerOptions::GetConfiguration = 0;
+    inline const uint8_t VirtualServerOptions::SetConfiguration = 1;
+    inline const uint8_t VirtualServerOptions::DeleteVirtualServer = 2;
 
 
     /** \brief Options for voice module. */
@@ -332,10 +332,10 @@ namespace tplink {
         CancelUSSD, ///< Cancel USSD
         GetSendStatus; ///< Get send status
     };
-    const uint8_t VoiceOptions::GetConfiguration = 0;
-    const uint8_t VoiceOptions::SendUSSD = 1;
-    const uint8_t VoiceOptions::CancelUSSD = 2;
-    const uint8_t VoiceOptions::GetSendStatus = 3;
+    inline const uint8_t VoiceOptions::GetConfiguration = 0;
+    inline const uint8_t VoiceOptions::SendUSSD = 1;
+    inline const uint8_t VoiceOptions::CancelUSSD = 2;
+    inline const uint8_t VoiceOptions::GetSendStatus = 3;
 
 
     /** \brief Options for WAN module. */
@@ -359,21 +359,21 @@ namespace tplink {
     #endif
         ;
     };
-    const uint8_t WANOptions::GetConfiguration = 0;
-    const uint8_t WANOptions::SetConfiguration = 1;
-    const uint8_t WANOptions::AddProfile = 2;
-    const uint8_t WANOptions::DeleteProfile = 3;
-    const uint8_t WANOptions::SetNetworkSelectionMode = 8;
-    const uint8_t WANOptions::QueryAvailableNetworks = 9;
-    const uint8_t WANOptions::GetNetworkSelectionStatus = 10;
-    const uint8_t WANOptions::GetDisconnectionReason = 11;
-    const uint8_t WANOptions::CancelSearch = 14;
-    const uint8_t WANOptions::UpdateISP = 15;
+    inline const uint8_t WANOptions::GetConfiguration = 0;
+    inline const uint8_t WANOptions::SetConfiguration = 1;
+    inline const uint8_t WANOptions::AddProfile = 2;
+    inline const uint8_t WANOptions::DeleteProfile = 3;
+    inline const uint8_t WANOptions::SetNetworkSelectionMode = 8;
+    inline const uint8_t WANOptions::QueryAvailableNetworks = 9;
+    inline const uint8_t WANOptions::GetNetworkSelectionStatus = 10;
+    inline const uint8_t WANOptions::GetDisconnectionReason = 11;
+    inline const uint8_t WANOptions::CancelSearch = 14;
+    inline const uint8_t WANOptions::UpdateISP = 15;
 #if NEW_FIRMWARE==1
-    const uint8_t WANOptions::BandSearch = 16;
-    const uint8_t WANOptions::GetBandSearchStatus = 17;
-    const uint8_t WANOptions::SetSelectedBand = 18;
-    const uint8_t WANOptions::CancelBandSearch = 19;
+    inline const uint8_t WANOptions::BandSearch = 16;
+    inline const uint8_t WANOptions::GetBandSearchStatus = 17;
+    inline const uint8_t WANOptions::SetSelectedBand = 18;
+    inline const uint8_t WANOptions::CancelBandSearch = 19;
 #endif
 
 
@@ -391,14 +391,14 @@ namespace tplink {
     #endif
         ;
     };
-    const uint8_t WebServerOptions::GetLanguage = 0;
-    const uint8_t WebServerOptions::SetLanguage = 1;
-    const uint8_t WebServerOptions::KeepAlive = 2;
-    const uint8_t WebServerOptions::UnsetDefault = 3;
-    const uint8_t WebServerOptions::GetModuleList = 4;
-    const uint8_t WebServerOptions::GetFeatureList = 5;
+    inline const uint8_t WebServerOptions::GetLanguage = 0;
+    inline const uint8_t WebServerOptions::SetLanguage = 1;
+    inline const uint8_t WebServerOptions::KeepAlive = 2;
+    inline const uint8_t WebServerOptions::UnsetDefault = 3;
+    inline const uint8_t WebServerOptions::GetModuleList = 4;
+    inline const uint8_t WebServerOptions::GetFeatureList = 5;
     #if NEW_FIRMWARE==1
-    const uint8_t WebServerOptions::GetInfoWithoutAuthentication = 6;
+    inline const uint8_t WebServerOptions::GetInfoWithoutAuthentication = 6;
     #endif
 
     /** \brief Options for WLAN module. */
@@ -408,9 +408,9 @@ namespace tplink {
         SetConfiguration, ///< Set configuration
         SetNoWLAN; ///< Set no WLAN
     };
-    const uint8_t WLANOptions::GetConfiguration = 0;
-    const uint8_t WLANOptions::SetConfiguration = 1;
-    const uint8_t WLANOptions::SetNoWLAN = 2;
+    inline const uint8_t WLANOptions::GetConfiguration = 0;
+    inline const uint8_t WLANOptions::SetConfiguration = 1;
+    inline const uint8_t WLANOptions::SetNoWLAN = 2;
 
 
     /** \brief Options for WPS module. */
@@ -421,10 +421,10 @@ namespace tplink {
         Start, ///< Start
         Cancel; ///< Cancel
     };
-    const uint8_t WPSOptions::GetConfiguration = 0;
-    const uint8_t WPSOptions::SetConfiguration = 1;
-    const uint8_t WPSOptions::Start = 2;
-    const uint8_t WPSOptions::Cancel = 3;
+    inline const uint8_t WPSOptions::GetConfiguration = 0;
+    inline const uint8_t WPSOptions::SetConfiguration = 1;
+    inline const uint8_t WPSOptions::Start = 2;
+    inline const uint8_t WPSOptions::Cancel = 3;
 
 
     ///< \brief Return codes for auth_cgi access point. */
@@ -434,9 +434,9 @@ namespace tplink {
         DontMatch, ///< One or more parameters were incorrect
         Failure; ///< Command failed to execute
     };
-    const int8_t AuthReturnCode::Success = 0;
-    const int8_t AuthReturnCode::DontMatch = 1;
-    const int8_t AuthReturnCode::Failure = 2;
+    inline const int8_t AuthReturnCode::Success = 0;
+    inline const int8_t AuthReturnCode::DontMatch = 1;
+    inline const int8_t AuthReturnCode::Failure = 2;
 
 	///< \brief Return codes for web_cgi access point. */
     struct WebReturnCode {
@@ -445,9 +445,9 @@ namespace tplink {
         KickedOut, ///< Given token validity has been cancelled
         TokenError; ///< Given token doesn't match stored one
     };
-    const int8_t WebReturnCode::Success = 0;
-    const int8_t WebReturnCode::KickedOut = -2;
-    const int8_t WebReturnCode::TokenError = -3;
+    inline const int8_t WebReturnCode::Success = 0;
+    inline const int8_t WebReturnCode::KickedOut = -2;
+    inline const int8_t WebReturnCode::TokenError = -3;
     
 	///< \brief Return codes for 'send message' function. */
     struct MessageReturnCode {
@@ -458,11 +458,11 @@ namespace tplink {
         SendFailureSaveFailure, ///< Message not sent and not saved
         Sending; ///< Currently sending
     };
-    const int8_t MessageReturnCode::SendSuccessSaveSuccess = 0;
-    const int8_t MessageReturnCode::SendSuccessSaveFailure = 1;
-    const int8_t MessageReturnCode::SendFailureSaveSuccess = 2;
-    const int8_t MessageReturnCode::SendFailureSaveFailure = 3;
-    const int8_t MessageReturnCode::Sending = 4;
+    inline const int8_t MessageReturnCode::SendSuccessSaveSuccess = 0;
+    inline const int8_t MessageReturnCode::SendSuccessSaveFailure = 1;
+    inline const int8_t MessageReturnCode::SendFailureSaveSuccess = 2;
+    inline const int8_t MessageReturnCode::SendFailureSaveFailure = 3;
+    inline const int8_t MessageReturnCode::Sending = 4;
 
 	///< \brief Mailbox codes. */
     enum class MailboxCode : uint8_t {
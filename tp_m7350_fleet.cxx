@@ -0,0 +1,131 @@
+/** \file tp_m7350_fleet.cxx
+ *	Fleet manager driving many TP-Link M7350 sessions from a single process.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_fleet.h"
+
+namespace tplink {
+
+	void Fleet::lock_share(CURL *, curl_lock_data data, curl_lock_access, void * userptr) {
+		static_cast<Fleet*>(userptr)->share_locks[data].lock();
+	}
+
+
+	void Fleet::unlock_share(CURL *, curl_lock_data data, void * userptr) {
+		static_cast<Fleet*>(userptr)->share_locks[data].unlock();
+	}
+
+
+	Fleet::Fleet(const size_t threads) {
+		this->share = UniquePointer<CURLSH, curl_share_cleanup>(curl_share_init());
+		assert(this->share);
+		curl_share_setopt(this->share.get(), CURLSHOPT_LOCKFUNC, lock_share);
+		curl_share_setopt(this->share.get(), CURLSHOPT_UNLOCKFUNC, unlock_share);
+		curl_share_setopt(this->share.get(), CURLSHOPT_USERDATA, this);
+		curl_share_setopt(this->share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+		curl_share_setopt(this->share.get(), CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+
+		auto n = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+		for (size_t i=0; i<n; i++)
+			this->workers.emplace_back(&Fleet::run, this);
+	}
+
+
+	Fleet::~Fleet() {
+		this->stop_polling();
+		{
+			std::lock_guard<std::mutex> lock(this->task_mutex);
+			this->running = false;
+			this->task_cv.notify_all();
+		}
+		for (auto & w: this->workers)
+			w.join();
+		// sessions must let go of the share handle before it is cleaned up
+		this->members.clear();
+	}
+
+
+	void Fleet::run() {
+		for (;;) {
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(this->task_mutex);
+				this->task_cv.wait(lock, [this]{ return !this->running || !this->tasks.empty(); });
+				if (this->tasks.empty()) return;
+				task = std::move(this->tasks.front());
+				this->tasks.pop_front();
+			}
+			task();
+		}
+	}
+
+
+	void Fleet::post(std::function<void()> && task) {
+		std::lock_guard<std::mutex> lock(this->task_mutex);
+		this->tasks.push_back(std::move(task));
+		this->task_cv.notify_one();
+	}
+
+
+	size_t Fleet::add(const std::string & modem_address, const std::string & password) {
+		auto m = std::make_unique<Member>();
+		m->address = modem_address;
+		m->session = std::make_unique<TPLink_M7350>(modem_address, password);
+		m->session->set_share_handle(this->share.get());
+		this->members.push_back(std::move(m));
+		return this->members.size() - 1;
+	}
+
+
+	size_t Fleet::size() const {
+		return this->members.size();
+	}
+
+
+	const std::string & Fleet::address(const size_t index) const {
+		return this->members[index]->address;
+	}
+
+
+	std::vector<bool> Fleet::login_all(const size_t concurrency) {
+		auto results = this->for_each<char>([](TPLink_M7350 & modem, size_t) -> char {
+			return modem.login();
+		}, concurrency);
+		return std::vector<bool>(results.begin(), results.end());
+	}
+
+
+	std::vector<rj::Document> Fleet::get_status_all(const size_t concurrency) {
+		return this->for_each<rj::Document>([](TPLink_M7350 & modem, size_t) {
+			return modem.get_status();
+		}, concurrency);
+	}
+
+
+	bool Fleet::start_polling(const std::chrono::milliseconds interval, const std::function<void(TPLink_M7350 &, size_t)> & op, const size_t concurrency) {
+		if (this->polling.exchange(true)) return false;
+		this->poller = std::thread([this, interval, op, concurrency]{
+			while (this->polling) {
+				auto next = std::chrono::steady_clock::now() + interval;
+				this->for_each<char>([&op](TPLink_M7350 & modem, size_t index) -> char {
+					op(modem, index);
+					return 0;
+				}, concurrency);
+				std::unique_lock<std::mutex> lock(this->poll_mutex);
+				this->poll_cv.wait_until(lock, next, [this]{ return !this->polling; });
+			}
+		});
+		return true;
+	}
+
+
+	void Fleet::stop_polling() {
+		if (!this->polling.exchange(false)) return;
+		{
+			std::lock_guard<std::mutex> lock(this->poll_mutex);
+			this->poll_cv.notify_all();
+		}
+		this->poller.join();
+	}
+}
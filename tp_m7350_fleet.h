@@ -0,0 +1,193 @@
+/** \file tp_m7350_fleet.h
+ *  Fleet manager driving many TP-Link M7350 sessions from a single process.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <functional>
+#include <chrono>
+#include <algorithm>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Manage a fleet of modems.
+	 *
+	 *  All sessions share one CURL share handle, so that DNS lookups and open
+	 *  connections are cached fleet-wide. Operations run on a small pool of worker
+	 *  threads rather than one thread per modem; operations on the same modem are
+	 *  serialized. Fleet-wide operations run on at most a given number of modems
+	 *  at a time.
+	 */
+	class Fleet {
+	private:
+    /** \brief A managed modem. */
+    struct Member {
+      std::string address;
+      std::unique_ptr<TPLink_M7350> session;
+      /** \brief Serializes operations on the session */
+      std::mutex mutex;
+    };
+
+    /** \brief CURL share handle */
+    UniquePointer<CURLSH, curl_share_cleanup> share;
+
+    /** \brief Locks for shared CURL data, one per data type */
+    std::mutex share_locks[CURL_LOCK_DATA_LAST];
+
+    /** \brief Managed modems */
+    std::vector<std::unique_ptr<Member> > members;
+
+    /** \brief Worker threads */
+    std::vector<std::thread> workers;
+
+    /** \brief Pending tasks */
+    std::deque<std::function<void()> > tasks;
+
+    /** \brief Guards task queue */
+    std::mutex task_mutex;
+
+    /** \brief Signals workers that tasks are available */
+    std::condition_variable task_cv;
+
+    /** \brief True while workers run */
+    bool running = true;
+
+    /** \brief Polling thread */
+    std::thread poller;
+
+    /** \brief True while polling thread runs */
+    std::atomic<bool> polling{false};
+
+    /** \brief Wakes polling thread up when stopping */
+    std::condition_variable poll_cv;
+
+    /** \brief Mutex for #poll_cv */
+    std::mutex poll_mutex;
+
+    /** \brief Worker thread main loop. */
+    void run();
+
+    /** \brief Queue a task for the worker pool.
+     *  \param task: task to run.
+     */
+    void post(std::function<void()> && task);
+
+    /** \brief CURL share lock callback. */
+    static void lock_share(CURL * handle, curl_lock_data data, curl_lock_access access, void * userptr);
+
+    /** \brief CURL share unlock callback. */
+    static void unlock_share(CURL * handle, curl_lock_data data, void * userptr);
+
+	public:
+    /** \brief Constructor.
+     *  \param threads: number of worker threads; 0 uses the number of CPU cores.
+     */
+    explicit Fleet(const size_t threads = 0);
+
+    Fleet(const Fleet &) = delete;
+    Fleet & operator=(const Fleet &) = delete;
+
+    /** \brief Destructor; waits for running tasks and stops workers. */
+    ~Fleet();
+
+    /** \brief Add a modem to the fleet.
+     *  \param modem_address: IP or DNS address of modem.
+     *  \param password: modem admin password.
+     *  \returns modem index.
+     */
+    size_t add(const std::string & modem_address, const std::string & password);
+
+    /** \brief Get number of modems.
+     *  \returns number of modems.
+     */
+    size_t size() const;
+
+    /** \brief Get address of a modem.
+     *  \param index: modem index.
+     *  \returns modem address.
+     */
+    const std::string & address(const size_t index) const;
+
+    /** \brief Run an operation on one modem from the worker pool.
+     *  \param index: modem index.
+     *  \param op: operation to run with the modem session.
+     *  \returns a future holding the operation result.
+     */
+    template <typename Operation>
+    auto submit(const size_t index, Operation op) -> std::future<decltype(op(std::declval<TPLink_M7350 &>()))> {
+      using Result = decltype(op(std::declval<TPLink_M7350 &>()));
+      auto task = std::make_shared<std::packaged_task<Result()> >([this, index, op]() mutable {
+        auto & m = *this->members[index];
+        std::lock_guard<std::mutex> lock(m.mutex);
+        return op(*m.session);
+      });
+      auto result = task->get_future();
+      this->post([task]{ (*task)(); });
+      return result;
+    }
+
+    /** \brief Run an operation on every modem, with bounded concurrency.
+     *  \param op: operation to run with each modem session; gets the session and the modem index.
+     *  \param concurrency: maximum number of modems handled at once; 0 means as many as worker threads.
+     *  \returns operation results, in modem order.
+     */
+    template <typename Result>
+    std::vector<Result> for_each(const std::function<Result(TPLink_M7350 &, size_t)> & op, size_t concurrency = 0) {
+      std::vector<Result> results(this->members.size());
+      if (concurrency == 0 || concurrency > this->workers.size())
+        concurrency = this->workers.size();
+      concurrency = std::min(concurrency, this->members.size());
+      // each lane takes the next modem until none is left
+      std::atomic<size_t> next{0};
+      std::vector<std::future<void> > lanes;
+      for (size_t l=0; l<concurrency; l++) {
+        auto lane = std::make_shared<std::packaged_task<void()> >([this, &op, &next, &results]{
+          for (size_t i = next++; i < this->members.size(); i = next++) {
+            auto & m = *this->members[i];
+            std::lock_guard<std::mutex> lock(m.mutex);
+            results[i] = op(*m.session, i);
+          }
+        });
+        lanes.push_back(lane->get_future());
+        this->post([lane]{ (*lane)(); });
+      }
+      for (auto & lane: lanes)
+        lane.get();
+      return results;
+    }
+
+    /** \brief Log in to every modem.
+     *  \param concurrency: maximum number of modems handled at once; 0 means as many as worker threads.
+     *  \returns login results, in modem order.
+     */
+    std::vector<bool> login_all(const size_t concurrency = 0);
+
+    /** \brief Retrieve information from status module of every modem.
+     *  \param concurrency: maximum number of modems handled at once; 0 means as many as worker threads.
+     *  \returns JSON objects with modem replies, in modem order.
+     */
+    std::vector<rj::Document> get_status_all(const size_t concurrency = 0);
+
+    /** \brief Start polling all modems periodically.
+     *  \param interval: time between the start of two polls.
+     *  \param op: operation to run with each modem session; gets the session and the modem index.
+     *  \param concurrency: maximum number of modems handled at once; 0 means as many as worker threads.
+     *  \returns true if successful, false if already polling.
+     */
+    bool start_polling(const std::chrono::milliseconds interval, const std::function<void(TPLink_M7350 &, size_t)> & op, const size_t concurrency = 0);
+
+    /** \brief Stop periodic polling. */
+    void stop_polling();
+	};
+}
@@ -0,0 +1,241 @@
+/** \file tp_m7350_gateway.cxx
+ *	SMS gateway spreading outgoing messages over a pool of TP-Link M7350 modems.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_gateway.h"
+#include <algorithm>
+
+namespace tplink {
+
+	/** \brief Weight of the latest sample in the latency moving average */
+	static const double kLatencySmoothing = 0.2;
+
+
+	SMSGateway::~SMSGateway() {
+		this->stop();
+	}
+
+
+	size_t SMSGateway::add_modem(const std::string & modem_address, const std::string & password) {
+		auto modem = std::make_unique<Modem>();
+		modem->address = modem_address;
+		modem->session = std::make_unique<TPLink_M7350>(modem_address, password);
+		this->modems.push_back(std::move(modem));
+		return this->modems.size() - 1;
+	}
+
+
+	void SMSGateway::set_max_attempts(const unsigned int attempts) {
+		this->max_attempts = std::max(attempts, 1u);
+	}
+
+
+	void SMSGateway::set_failure_policy(const unsigned int consecutive_failures, const std::chrono::milliseconds relogin_delay) {
+		this->failure_threshold = std::max(consecutive_failures, 1u);
+		this->relogin_delay = relogin_delay;
+	}
+
+
+	bool SMSGateway::start() {
+		if (this->running.exchange(true)) return false;
+		this->start_time = std::chrono::steady_clock::now();
+		// log in to all modems at once
+		std::vector<std::future<bool> > logins;
+		for (auto & m: this->modems)
+			logins.push_back(std::async(std::launch::async, [&m]{ return m->session->login(); }));
+		size_t healthy = 0;
+		for (size_t i=0; i<this->modems.size(); i++) {
+			auto success = logins[i].get();
+			this->modems[i]->healthy = success;
+			healthy += success;
+			if (!success)
+				LOG_E("Couldn't log in to ", this->modems[i]->address, "; will retry.");
+		}
+		for (size_t i=0; i<this->modems.size(); i++)
+			this->modems[i]->worker = std::thread(&SMSGateway::run, this, i);
+		LOG_I("SMS gateway started with ", healthy, "/", this->modems.size(), " healthy modem(s).");
+		return healthy > 0;
+	}
+
+
+	void SMSGateway::stop() {
+		if (!this->running.exchange(false)) return;
+		for (auto & m: this->modems) {
+			std::lock_guard<std::mutex> lock(m->mutex);
+			m->cv.notify_all();
+		}
+		for (auto & m: this->modems) {
+			if (m->worker.joinable())
+				m->worker.join();
+			// resolve whatever is left
+			std::lock_guard<std::mutex> lock(m->mutex);
+			for (auto & job: m->queue) {
+				job.done.set_value(false);
+				this->failed++;
+			}
+			m->queue.clear();
+			m->depth = 0;
+		}
+	}
+
+
+	std::future<bool> SMSGateway::send_sms(const std::string & phone_number, const std::string & message) {
+		Job job;
+		job.phone_number = phone_number;
+		job.message = message;
+		auto result = job.done.get_future();
+		this->route(std::move(job));
+		return result;
+	}
+
+
+	bool SMSGateway::route(Job && job) {
+		// modems without latency sample yet are assumed to be average
+		double prior = 0;
+		size_t samples = 0;
+		for (auto & m: this->modems) {
+			auto latency = m->latency_ms.load();
+			if (latency > 0) {
+				prior += latency;
+				samples++;
+			}
+		}
+		prior = samples > 0 ? prior/samples : 1.0;
+
+		// a modem may be evicted between choosing it and queuing the job: choose again then
+		while (true) {
+			size_t best = SIZE_MAX;
+			double best_cost = 0;
+			for (size_t i=0; i<this->modems.size(); i++) {
+				auto & m = *this->modems[i];
+				// avoid the modem that just failed, unless there is no other choice
+				if (!m.healthy || (i == job.last_modem && this->modems.size() > 1)) continue;
+				auto latency = m.latency_ms.load();
+				auto cost = (m.depth + 1) * (latency > 0 ? latency : prior);
+				if (best == SIZE_MAX || cost < best_cost) {
+					best = i;
+					best_cost = cost;
+				}
+			}
+			if (best == SIZE_MAX && job.last_modem < this->modems.size() && this->modems[job.last_modem]->healthy)
+				best = job.last_modem;
+			if (best == SIZE_MAX || !this->running) {
+				LOG_E("No modem available to send message to ", job.phone_number, ".");
+				this->failed++;
+				job.done.set_value(false);
+				return false;
+			}
+
+			auto & m = *this->modems[best];
+			std::lock_guard<std::mutex> lock(m.mutex);
+			// evict marks modems unhealthy under their lock, before draining their queue
+			if (!m.healthy) continue;
+			m.queue.push_back(std::move(job));
+			m.depth++;
+			m.cv.notify_one();
+			return true;
+		}
+	}
+
+
+	void SMSGateway::evict(const size_t index) {
+		auto & m = *this->modems[index];
+		std::deque<Job> jobs;
+		{
+			std::lock_guard<std::mutex> lock(m.mutex);
+			m.healthy = false;
+			jobs.swap(m.queue);
+			m.depth = 0;
+		}
+		LOG_E("Modem ", m.address, " marked unhealthy; moving ", jobs.size(), " message(s) to other modems.");
+		for (auto & job: jobs) {
+			job.last_modem = index;
+			this->route(std::move(job));
+		}
+	}
+
+
+	void SMSGateway::run(const size_t index) {
+		auto & m = *this->modems[index];
+		while (this->running) {
+			if (!m.healthy) {
+				if (m.session->login()) {
+					LOG_I("Modem ", m.address, " is back.");
+					m.consecutive_failures = 0;
+					m.healthy = true;
+				} else {
+					std::unique_lock<std::mutex> lock(m.mutex);
+					m.cv.wait_for(lock, this->relogin_delay, [this]{ return !this->running; });
+					continue;
+				}
+			}
+
+			Job job;
+			{
+				std::unique_lock<std::mutex> lock(m.mutex);
+				m.cv.wait(lock, [this, &m]{ return !this->running || !m.queue.empty(); });
+				if (!this->running) break;
+				job = std::move(m.queue.front());
+				m.queue.pop_front();
+			}
+
+			auto t0 = std::chrono::steady_clock::now();
+			int8_t result;
+			m.session->send_sms(job.phone_number, job.message, result);
+			std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - t0;
+			auto latency = m.latency_ms.load();
+			m.latency_ms = latency == 0 ? elapsed.count() : (1 - kLatencySmoothing)*latency + kLatencySmoothing*elapsed.count();
+			m.depth--;
+
+			// a message that was sent but not saved on the modem is still delivered
+			if (result == MessageReturnCode::SendSuccessSaveSuccess || result == MessageReturnCode::SendSuccessSaveFailure) {
+				m.sent++;
+				m.consecutive_failures = 0;
+				job.done.set_value(true);
+				continue;
+			}
+
+			m.failed++;
+			job.attempts++;
+			job.last_modem = index;
+			LOG_E("Modem ", m.address, " couldn't send message to ", job.phone_number, " (status ", static_cast<int>(result), ").");
+			if (result < 0 || ++m.consecutive_failures >= this->failure_threshold)
+				this->evict(index);
+
+			// only retry messages known not to have left the modem: -1 means the modem didn't
+			// accept it; a message accepted with an unknown outcome (Sending) may have been sent
+			auto retry = result < 0 || result == MessageReturnCode::SendFailureSaveSuccess
+				|| result == MessageReturnCode::SendFailureSaveFailure;
+			if (!retry || job.attempts >= this->max_attempts) {
+				this->failed++;
+				job.done.set_value(false);
+			} else {
+				this->retried++;
+				this->route(std::move(job));
+			}
+		}
+	}
+
+
+	GatewayStats SMSGateway::stats() const {
+		GatewayStats s;
+		s.sent = 0;
+		s.failed = this->failed;
+		s.retried = this->retried;
+		for (auto & m: this->modems) {
+			ModemStats ms;
+			ms.address = m->address;
+			ms.healthy = m->healthy;
+			ms.queue_depth = m->depth;
+			ms.latency_ms = m->latency_ms;
+			ms.sent = m->sent;
+			ms.failed = m->failed;
+			s.sent += ms.sent;
+			s.modems.push_back(ms);
+		}
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - this->start_time;
+		s.throughput = elapsed.count() > 0 ? s.sent / elapsed.count() : 0;
+		return s;
+	}
+}
@@ -0,0 +1,180 @@
+/** \file tp_m7350_gateway.h
+ *  SMS gateway spreading outgoing messages over a pool of TP-Link M7350 modems.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <future>
+#include <chrono>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Statistics for one modem of a gateway. */
+	struct ModemStats {
+		/** \brief Modem address */
+		std::string address;
+		/** \brief True if the modem currently accepts messages */
+		bool healthy;
+		/** \brief Number of queued messages */
+		size_t queue_depth;
+		/** \brief Moving average of send latency, in milliseconds */
+		double latency_ms;
+		/** \brief Number of messages sent successfully */
+		uint64_t sent;
+		/** \brief Number of failed send attempts */
+		uint64_t failed;
+	};
+
+	/** \brief Aggregate statistics of a gateway. */
+	struct GatewayStats {
+		/** \brief Number of messages sent successfully */
+		uint64_t sent;
+		/** \brief Number of messages given up on */
+		uint64_t failed;
+		/** \brief Number of attempts moved to another modem */
+		uint64_t retried;
+		/** \brief Successful messages per second since start */
+		double throughput;
+		/** \brief Per-modem statistics */
+		std::vector<ModemStats> modems;
+	};
+
+	/** \brief One logical SMS gateway backed by several modems.
+	 *
+	 *  Each modem has its own session, queue and worker thread. A message goes to
+	 *  the healthy modem with the lowest expected wait, estimated as
+	 *  (queue depth + 1) * average send latency. When a modem doesn't accept a
+	 *  message or reports it couldn't send it, the message is tried on another
+	 *  modem, up to a maximum number of attempts; messages accepted with an
+	 *  unknown outcome are given up on, as they may have been sent. A modem that
+	 *  fails repeatedly, or can't log in, is marked unhealthy: its queue is moved
+	 *  to the other modems and it tries to log in again periodically.
+	 */
+	class SMSGateway {
+	private:
+    /** \brief A message to send. */
+    struct Job {
+      std::string phone_number;
+      std::string message;
+      unsigned int attempts = 0;
+      /** \brief Index of modem tried last */
+      size_t last_modem = SIZE_MAX;
+      std::promise<bool> done;
+    };
+
+    /** \brief A modem of the pool. */
+    struct Modem {
+      std::string address;
+      std::unique_ptr<TPLink_M7350> session;
+      std::deque<Job> queue;
+      std::mutex mutex;
+      std::condition_variable cv;
+      std::thread worker;
+      std::atomic<bool> healthy{false};
+      std::atomic<size_t> depth{0};
+      std::atomic<double> latency_ms{0};
+      std::atomic<uint64_t> sent{0};
+      std::atomic<uint64_t> failed{0};
+      unsigned int consecutive_failures = 0;
+    };
+
+    /** \brief Modem pool */
+    std::vector<std::unique_ptr<Modem> > modems;
+
+    /** \brief True while workers run */
+    std::atomic<bool> running{false};
+
+    /** \brief Time at which gateway was started */
+    std::chrono::steady_clock::time_point start_time;
+
+    /** \brief Maximum number of attempts per message */
+    unsigned int max_attempts = 3;
+
+    /** \brief Number of consecutive failures that marks a modem unhealthy */
+    unsigned int failure_threshold = 3;
+
+    /** \brief Time between two login attempts of an unhealthy modem */
+    std::chrono::milliseconds relogin_delay{5000};
+
+    /** \brief Number of messages given up on */
+    std::atomic<uint64_t> failed{0};
+
+    /** \brief Number of attempts moved to another modem */
+    std::atomic<uint64_t> retried{0};
+
+    /** \brief Worker loop of a modem.
+     *  \param index: modem index.
+     */
+    void run(const size_t index);
+
+    /** \brief Queue a message on the best modem.
+     *  \param job: message to send.
+     *  \returns true if queued, false if no modem could take it (job is then resolved).
+     */
+    bool route(Job && job);
+
+    /** \brief Mark a modem unhealthy and move its queue to other modems.
+     *  \param index: modem index.
+     */
+    void evict(const size_t index);
+
+	public:
+    /** \brief Default constructor. */
+    SMSGateway() = default;
+
+    SMSGateway(const SMSGateway &) = delete;
+    SMSGateway & operator=(const SMSGateway &) = delete;
+
+    /** \brief Destructor; stops workers. */
+    ~SMSGateway();
+
+    /** \brief Add a modem to the pool. Must be called before #start.
+     *  \param modem_address: IP or DNS address of modem.
+     *  \param password: modem admin password.
+     *  \returns modem index.
+     */
+    size_t add_modem(const std::string & modem_address, const std::string & password);
+
+    /** \brief Set maximum number of attempts per message.
+     *  \param attempts: number of attempts (at least 1).
+     */
+    void set_max_attempts(const unsigned int attempts);
+
+    /** \brief Set when a modem is considered unhealthy and how often it tries to recover.
+     *  \param consecutive_failures: number of consecutive failed sends.
+     *  \param relogin_delay: time between two login attempts.
+     */
+    void set_failure_policy(const unsigned int consecutive_failures, const std::chrono::milliseconds relogin_delay);
+
+    /** \brief Log in to all modems and start workers.
+     *  \returns true if at least one modem is healthy, false otherwise.
+     */
+    bool start();
+
+    /** \brief Stop workers. Queued messages are resolved as failed. */
+    void stop();
+
+    /** \brief Queue a message.
+     *  \param phone_number: recipient number.
+     *  \param message: text message.
+     *  \returns a future resolving to true once the message is sent, or false if all attempts failed.
+     */
+    std::future<bool> send_sms(const std::string & phone_number, const std::string & message);
+
+    /** \brief Get gateway statistics.
+     *  \returns statistics snapshot.
+     */
+    GatewayStats stats() const;
+	};
+}
@@ -0,0 +1,322 @@
+/** \file tp_m7350_http.cxx
+ *	Minimal HTTP/1.1 client for the small POST requests sent to TP-Link M7350
+ *	web gateways.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_http.h"
+#include "tp_m7350_log.h"
+#include <cstring>
+#include <cctype>
+#include <cstdlib>
+#include <cerrno>
+#include <charconv>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+namespace tplink {
+
+	/** \brief Reply headers that matter to the client. */
+	struct ReplyHeader {
+		/** \brief Size of status line and headers, including final empty line */
+		size_t size = 0;
+		/** \brief Body length, or -1 if not given */
+		long content_length = -1;
+		/** \brief True if body is chunked */
+		bool chunked = false;
+		/** \brief True if server closes connection after reply */
+		bool close = false;
+	};
+
+	/** \brief Compare a header name, ignoring case.
+	 *	\param line: header line.
+	 *	\param length: line length.
+	 *	\param name: lower-case header name, followed by colon.
+	 *	\returns true if line starts with name.
+	 */
+	static bool header_is(const char * line, const size_t length, const char * name) {
+		auto n = std::strlen(name);
+		if (length < n) return false;
+		for (size_t i=0; i<n; i++)
+			if (std::tolower(static_cast<unsigned char>(line[i])) != name[i]) return false;
+		return true;
+	}
+
+	/** \brief Parse status line and headers of a reply.
+	 *	\param data: received data.
+	 *	\param length: number of bytes received.
+	 *	\param header: where to store parsed headers.
+	 *	\returns true if headers are complete, false otherwise.
+	 */
+	static bool parse_header(const char * data, const size_t length, ReplyHeader & header) {
+		const char * end = nullptr;
+		for (size_t i=0; i+3<length; i++) {
+			if (data[i] == '\r' && data[i+1] == '\n' && data[i+2] == '\r' && data[i+3] == '\n') {
+				end = data + i;
+				break;
+			}
+		}
+		if (end == nullptr) return false;
+		header = ReplyHeader();
+		header.size = end - data + 4;
+		header.close = length > 8 && std::memcmp(data, "HTTP/1.0", 8) == 0;
+		auto line = static_cast<const char*>(std::memchr(data, '\n', end - data));
+		while (line != nullptr && line < end) {
+			line++;
+			auto eol = static_cast<const char*>(std::memchr(line, '\r', end + 2 - line));
+			size_t n = eol - line;
+			auto value = static_cast<const char*>(std::memchr(line, ':', n));
+			if (value != nullptr) {
+				value++;
+				while (*value == ' ' || *value == '\t') value++;
+				if (header_is(line, n, "content-length:")) {
+					header.content_length = std::strtol(value, nullptr, 10);
+				} else if (header_is(line, n, "transfer-encoding:")) {
+					header.chunked = std::strstr(std::string(value, eol).c_str(), "chunked") != nullptr;
+				} else if (header_is(line, n, "connection:")) {
+					header.close = header_is(value, eol - value, "close");
+				}
+			}
+			line = static_cast<const char*>(std::memchr(line, '\n', end + 2 - line));
+		}
+		return true;
+	}
+
+	/** \brief Progress of chunked body decoding, kept between reads. */
+	struct ChunkDecoder {
+		/** \brief Offset in body of first byte not decoded yet */
+		size_t pos = 0;
+		/** \brief True once final chunk is read */
+		bool trailers = false;
+	};
+
+	/** \brief Largest accepted chunk */
+	static const unsigned long kMaxChunkSize = 1ul << 30;
+
+	/** \brief Decode the complete chunks of a chunked body received so far.
+	 *	\param data: body, as received.
+	 *	\param length: number of bytes received.
+	 *	\param state: decoding progress; decoding resumes from there.
+	 *	\param body: where to append decoded chunks.
+	 *	\returns 1 if body is complete, 0 if more data is needed, -1 if body is malformed.
+	 */
+	static int decode_chunked(const char * data, const size_t length, ChunkDecoder & state, std::string & body) {
+		for (;;) {
+			auto eol = static_cast<const char*>(std::memchr(data + state.pos, '\n', length - state.pos));
+			if (eol == nullptr) return 0;
+			auto line = data + state.pos;
+			auto next = static_cast<size_t>(eol - data) + 1;
+			if (state.trailers) {
+				// trailers up to an empty line
+				state.pos = next;
+				if (eol == line || (eol == line + 1 && *line == '\r')) return 1;
+				continue;
+			}
+			// size line: hexadecimal size, then maybe extensions after a semicolon
+			auto end = eol > line && eol[-1] == '\r' ? eol - 1 : eol;
+			unsigned long chunk = 0;
+			auto parsed = std::from_chars(line, end, chunk, 16);
+			if (parsed.ec != std::errc() || chunk > kMaxChunkSize
+					|| (parsed.ptr != end && *parsed.ptr != ';' && *parsed.ptr != ' ' && *parsed.ptr != '\t'))
+				return -1;
+			if (chunk == 0) {
+				state.pos = next;
+				state.trailers = true;
+				continue;
+			}
+			if (length - next < chunk + 2) return 0;
+			if (data[next + chunk] != '\r' || data[next + chunk + 1] != '\n') return -1;
+			body.append(data + next, chunk);
+			state.pos = next + chunk + 2;
+		}
+	}
+
+
+	HttpTransport::HttpTransport(const std::chrono::milliseconds timeout, const size_t buffer_size) : timeout(timeout) {
+		this->header.reserve(256);
+		this->buffer.resize(std::max<size_t>(buffer_size, 1024));
+	}
+
+
+	HttpTransport::~HttpTransport() {
+		this->disconnect();
+	}
+
+
+	bool HttpTransport::wait(const short events) const {
+		pollfd p = {this->fd, events, 0};
+		int r;
+		do {
+			r = ::poll(&p, 1, this->timeout.count());
+		} while (r < 0 && errno == EINTR);
+		return r > 0 && (p.revents & (events | POLLHUP | POLLERR));
+	}
+
+
+	bool HttpTransport::connect(const std::string & host, const std::string & port) {
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo * addresses = nullptr;
+		if (::getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+			LOG_E("Couldn't resolve ", host);
+			return false;
+		}
+		for (auto a = addresses; a != nullptr; a = a->ai_next) {
+			this->fd = ::socket(a->ai_family, a->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, a->ai_protocol);
+			if (this->fd < 0) continue;
+			int one = 1;
+			::setsockopt(this->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			if (::connect(this->fd, a->ai_addr, a->ai_addrlen) == 0) break;
+			if (errno == EINPROGRESS && this->wait(POLLOUT)) {
+				int error = 0;
+				socklen_t len = sizeof(error);
+				::getsockopt(this->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+				if (error == 0) break;
+			}
+			this->disconnect();
+		}
+		::freeaddrinfo(addresses);
+		if (this->fd < 0) LOG_E("Couldn't connect to ", host, ":", port);
+		return this->fd >= 0;
+	}
+
+
+	void HttpTransport::disconnect() {
+		if (this->fd >= 0) ::close(this->fd);
+		this->fd = -1;
+		this->connected_to.clear();
+	}
+
+
+	int HttpTransport::exchange(const std::string & data, std::string & reply, const bool reused) {
+		// send headers and body in one call
+		iovec iov[2] = {
+			{const_cast<char*>(this->header.data()), this->header.size()},
+			{const_cast<char*>(data.data()), data.size()}
+		};
+		msghdr msg{};
+		msg.msg_iov = iov;
+		msg.msg_iovlen = 2;
+		size_t left = this->header.size() + data.size();
+		while (left > 0) {
+			auto n = ::sendmsg(this->fd, &msg, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN && this->wait(POLLOUT)) continue;
+				return reused ? -1 : 0;
+			}
+			left -= n;
+			while (n > 0 && msg.msg_iovlen > 0) {
+				auto step = std::min<size_t>(n, msg.msg_iov->iov_len);
+				msg.msg_iov->iov_base = static_cast<char*>(msg.msg_iov->iov_base) + step;
+				msg.msg_iov->iov_len -= step;
+				n -= step;
+				if (msg.msg_iov->iov_len == 0) {
+					msg.msg_iov++;
+					msg.msg_iovlen--;
+				}
+			}
+		}
+
+		// read reply
+		size_t length = 0;
+		ReplyHeader header;
+		ChunkDecoder chunks;
+		bool have_header = false;
+		reply.clear();
+		for (;;) {
+			if (length == this->buffer.size())
+				this->buffer.resize(2*this->buffer.size());
+			auto n = ::recv(this->fd, this->buffer.data() + length, this->buffer.size() - length, 0);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				if (errno == EAGAIN) {
+					if (this->wait(POLLIN)) continue;
+					return 0; // timed out; request may have been processed, don't resend
+				}
+				return (reused && length == 0) ? -1 : 0;
+			}
+			if (n == 0) {
+				// connection closed; fine only if body is delimited by end of connection
+				if (length == 0) return reused ? -1 : 0;
+				if (have_header && header.content_length < 0 && !header.chunked) {
+					reply.assign(this->buffer.data() + header.size, length - header.size);
+					this->disconnect();
+					return 1;
+				}
+				return 0;
+			}
+			length += n;
+			if (!have_header) {
+				have_header = parse_header(this->buffer.data(), length, header);
+				if (!have_header) continue;
+			}
+			auto body = this->buffer.data() + header.size;
+			auto body_length = length - header.size;
+			bool complete = false;
+			if (header.chunked) {
+				auto decoded = decode_chunked(body, body_length, chunks, reply);
+				if (decoded < 0) {
+					LOG_E("Malformed chunked reply.");
+					return 0;
+				}
+				complete = decoded == 1;
+			} else if (header.content_length >= 0 && body_length >= static_cast<size_t>(header.content_length)) {
+				reply.assign(body, header.content_length);
+				complete = true;
+			}
+			if (complete) {
+				if (header.close) this->disconnect();
+				return 1;
+			}
+		}
+	}
+
+
+	std::string HttpTransport::post(const std::string & url, const std::string & data) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (url.compare(0, 7, "http://") != 0) {
+			LOG_E("Unsupported URL: ", url);
+			return "";
+		}
+		auto slash = url.find('/', 7);
+		auto authority = url.substr(7, slash == std::string::npos ? std::string::npos : slash - 7);
+		auto colon = authority.rfind(':');
+		if (colon != std::string::npos && authority.find(']', colon) != std::string::npos)
+			colon = std::string::npos; // IPv6 address without port
+		auto host = authority.substr(0, colon);
+		if (host.size() > 1 && host.front() == '[' && host.back() == ']')
+			host = host.substr(1, host.size() - 2);
+		auto port = colon == std::string::npos ? std::string("80") : authority.substr(colon + 1);
+
+		char size[24];
+		auto size_end = std::to_chars(size, size + sizeof(size), data.size()).ptr;
+		this->header.clear();
+		this->header.append("POST ").append(slash == std::string::npos ? "/" : url.c_str() + slash)
+			.append(" HTTP/1.1\r\nHost: ").append(authority)
+			.append("\r\nAccept: */*\r\nContent-Type: application/x-www-form-urlencoded\r\nContent-Length: ")
+			.append(size, size_end).append("\r\n\r\n");
+
+		std::string reply;
+		for (int attempt=0; attempt<2; attempt++) {
+			bool reused = this->fd >= 0 && this->connected_to == authority;
+			if (!reused) {
+				this->disconnect();
+				if (!this->connect(host, port)) return "";
+				this->connected_to = authority;
+			}
+			auto r = this->exchange(data, reply, reused);
+			if (r == 1) return reply;
+			this->disconnect();
+			if (r == 0) break;
+		}
+		LOG_E("Request to ", url, " failed.");
+		return "";
+	}
+}
@@ -0,0 +1,84 @@
+/** \file tp_m7350_http.h
+ *  Minimal HTTP/1.1 client for the small POST requests sent to TP-Link M7350
+ *  web gateways.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include "tp_m7350_transport.h"
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+
+namespace tplink {
+
+	/** \brief Transport sending requests over a keep-alive connection, without CURL.
+	 *
+	 *  Request line, headers and body go out with a single writev, and replies
+	 *  are read into a buffer that is kept from one request to the next. Only
+	 *  what gateways need is supported: plain HTTP, Content-Length or chunked
+	 *  replies, and connections closed by the server. A closed keep-alive
+	 *  connection is reopened once per request. The transport holds a single
+	 *  connection; sessions sharing it take turns.
+	 */
+	class HttpTransport : public Transport {
+	private:
+    /** \brief Socket of current connection, or -1 */
+    int fd = -1;
+
+    /** \brief Host and port of current connection */
+    std::string connected_to;
+
+    /** \brief Request line and headers */
+    std::string header;
+
+    /** \brief Reply buffer */
+    std::vector<char> buffer;
+
+    /** \brief Timeout of connection and of each read or write */
+    std::chrono::milliseconds timeout;
+
+    /** \brief Serializes requests */
+    std::mutex mutex;
+
+    /** \brief Open a connection.
+     *  \param host: host name or IP address.
+     *  \param port: TCP port.
+     *  \returns true if connected, false otherwise.
+     */
+    bool connect(const std::string & host, const std::string & port);
+
+    /** \brief Close current connection. */
+    void disconnect();
+
+    /** \brief Send request on current connection and read reply.
+     *  \param data: request body.
+     *  \param reply: where to store reply body.
+     *  \param reused: true if connection was used before; failures before any reply byte are then retried.
+     *  \returns 1 if request succeeded, 0 if it failed, -1 if it should be retried on a new connection.
+     */
+    int exchange(const std::string & data, std::string & reply, const bool reused);
+
+    /** \brief Wait until socket is ready.
+     *  \param events: poll events to wait for.
+     *  \returns true if ready, false on timeout or error.
+     */
+    bool wait(const short events) const;
+
+	public:
+    /** \brief Constructor.
+     *  \param timeout: timeout of connection and of each read or write.
+     *  \param buffer_size: initial size of reply buffer; it grows as needed.
+     */
+    explicit HttpTransport(const std::chrono::milliseconds timeout = std::chrono::milliseconds(10000), const size_t buffer_size = 16384);
+
+    HttpTransport(const HttpTransport &) = delete;
+    HttpTransport & operator=(const HttpTransport &) = delete;
+
+    /** \brief Destructor; closes connection. */
+    ~HttpTransport();
+
+    std::string post(const std::string & url, const std::string & data) override;
+	};
+}
@@ -0,0 +1,174 @@
+/** \file tp_m7350_inbox.cxx
+ *	Inbound SMS receiver for the TP-Link M7350 interface.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_inbox.h"
+#include <algorithm>
+#include <functional>
+
+namespace tplink {
+
+	/** \brief Compute an identity for a message.
+	 *	Indices alone aren't enough, since the modem reuses them once messages are deleted.
+	 *	\param sms: message.
+	 *	\returns message identity.
+	 */
+	static uint64_t message_identity(const SMS & sms) {
+		std::hash<std::string> h;
+		uint64_t id = static_cast<uint64_t>(sms.index);
+		id = id * 1099511628211u ^ h(sms.from);
+		id = id * 1099511628211u ^ h(sms.received_time);
+		id = id * 1099511628211u ^ h(sms.content);
+		return id;
+	}
+
+	/** \brief Get a string member of a JSON object.
+	 *	\param v: JSON object.
+	 *	\param name: member name.
+	 *	\returns member value, or an empty string if it doesn't exist.
+	 */
+	static std::string string_member(const rj::Value & v, const char * name) {
+		auto itr = v.FindMember(name);
+		if (itr == v.MemberEnd() || !itr->value.IsString()) return "";
+		return std::string(itr->value.GetString(), itr->value.GetStringLength());
+	}
+
+
+	SMSReceiver::SMSReceiver(const TPLink_M7350 & modem, const size_t capacity)
+		: modem(&modem), messages(capacity), processed(2*capacity) {}
+
+
+	SMSReceiver::~SMSReceiver() {
+		this->stop();
+	}
+
+
+	void SMSReceiver::set_poll_interval(const std::chrono::milliseconds interval) {
+		this->poll_interval = interval;
+	}
+
+
+	void SMSReceiver::set_delete_batch(const size_t batch_size, const std::chrono::milliseconds max_delay) {
+		this->delete_batch_size = std::max<size_t>(batch_size, 1);
+		this->delete_delay = max_delay;
+	}
+
+
+	bool SMSReceiver::start() {
+		if (this->running.exchange(true)) return false;
+		this->worker = std::thread(&SMSReceiver::run, this);
+		return true;
+	}
+
+
+	void SMSReceiver::stop() {
+		if (!this->running.exchange(false)) return;
+		{
+			std::lock_guard<std::mutex> lock(this->wait_mutex);
+			this->wake_up.notify_all();
+		}
+		if (this->worker.joinable())
+			this->worker.join();
+		this->flush_deletions(true);
+	}
+
+
+	void SMSReceiver::run() {
+		LOG_I("SMS receiver started.");
+		while (this->running) {
+			this->poll();
+			std::unique_lock<std::mutex> lock(this->wait_mutex);
+			this->wake_up.wait_for(lock, this->poll_interval, [this]{ return !this->running; });
+		}
+		LOG_I("SMS receiver stopped.");
+	}
+
+
+	void SMSReceiver::flush_deletions(const bool force) {
+		int index;
+		while (this->processed.pop(index)) {
+			if (this->to_delete.empty())
+				this->oldest_ack = std::chrono::steady_clock::now();
+			this->to_delete.push_back(index);
+		}
+		if (this->to_delete.empty()) return;
+		if (!force && this->to_delete.size() < this->delete_batch_size
+				&& std::chrono::steady_clock::now() - this->oldest_ack < this->delete_delay)
+			return;
+
+		LOG_D("Deleting ", this->to_delete.size(), " message(s) from inbox.");
+		if (this->modem->delete_sms(MailboxCode::Inbox, this->to_delete))
+			this->to_delete.clear();
+		else
+			LOG_E("Couldn't delete processed messages; will retry.");
+	}
+
+
+	size_t SMSReceiver::poll() {
+		// delete first, so that the read returns fewer pages
+		this->flush_deletions(false);
+
+		auto d = this->modem->read_sms(MailboxCode::Inbox);
+		if (!d.IsObject() || !d.HasMember("messageList") || !d["messageList"].IsArray()) {
+			LOG_E("Couldn't read inbox.");
+			return 0;
+		}
+
+		size_t published = 0;
+		std::unordered_set<uint64_t> listed;
+		for (auto itr = d["messageList"].Begin(); itr != d["messageList"].End(); ++itr) {
+			if (!itr->IsObject() || !itr->HasMember("index") || !(*itr)["index"].IsInt()) continue;
+			SMS sms;
+			sms.index = (*itr)["index"].GetInt();
+			sms.from = string_member(*itr, "from");
+			sms.content = string_member(*itr, "content");
+			sms.received_time = string_member(*itr, "receivedTime");
+			auto id = message_identity(sms);
+			listed.insert(id);
+			if (this->seen.count(id)) continue;
+			// a message that doesn't fit is published with a later poll
+			if (!this->messages.push(std::move(sms))) continue;
+			this->seen.insert(id);
+			published++;
+		}
+		// forget messages that aren't on the modem anymore
+		for (auto itr = this->seen.begin(); itr != this->seen.end(); ) {
+			if (listed.count(*itr)) ++itr;
+			else itr = this->seen.erase(itr);
+		}
+
+		if (published > 0) {
+			std::lock_guard<std::mutex> lock(this->wait_mutex);
+			this->available.notify_all();
+		}
+		return published;
+	}
+
+
+	bool SMSReceiver::try_receive(SMS & sms) {
+		return this->messages.pop(sms);
+	}
+
+
+	bool SMSReceiver::receive(SMS & sms, const std::chrono::milliseconds timeout) {
+		if (this->messages.pop(sms)) return true;
+		auto deadline = std::chrono::steady_clock::now() + timeout;
+		std::unique_lock<std::mutex> lock(this->wait_mutex);
+		for (;;) {
+			if (this->messages.pop(sms)) return true;
+			if (this->available.wait_until(lock, deadline) == std::cv_status::timeout)
+				return this->messages.pop(sms);
+		}
+	}
+
+
+	bool SMSReceiver::acknowledge(const int index) {
+		return this->processed.push(index);
+	}
+
+
+	size_t SMSReceiver::backlog() const {
+		return this->messages.size();
+	}
+}
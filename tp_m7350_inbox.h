@@ -0,0 +1,163 @@
+/** \file tp_m7350_inbox.h
+ *  Inbound SMS receiver for the TP-Link M7350 interface. A background thread
+ *  polls the modem inbox, publishes new messages to consumer threads and
+ *  deletes processed messages in batches.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <unordered_set>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+#include "tp_m7350_queue.h"
+
+namespace tplink {
+
+	/** \brief A received text message. */
+	struct SMS {
+		/** \brief Message index in modem mailbox */
+		int index = -1;
+		/** \brief Sender number */
+		std::string from;
+		/** \brief Message text */
+		std::string content;
+		/** \brief Time of reception, as reported by the modem */
+		std::string received_time;
+	};
+
+	/** \brief Publish incoming SMS as events.
+	 *
+	 *  The receiver polls the inbox with TPLink_M7350::read_sms and pushes each
+	 *  message it hasn't seen yet into a lock-free queue. Consumers take messages
+	 *  with #try_receive or #receive and call #acknowledge once they are done with
+	 *  them. Acknowledged indices are collected and deleted from the modem with a
+	 *  single request when enough of them have accumulated, or when the oldest one
+	 *  has waited long enough. Deleting before each read keeps the inbox, and thus
+	 *  the polls, short.
+	 *
+	 *  The receiver uses the session from its polling thread; while it runs, the
+	 *  session mustn't be used elsewhere.
+	 */
+	class SMSReceiver {
+	private:
+    /** \brief Modem session */
+    const TPLink_M7350 * modem;
+
+    /** \brief Messages waiting for a consumer */
+    LockFreeQueue<SMS> messages;
+
+    /** \brief Indices of processed messages, waiting for deletion */
+    LockFreeQueue<int> processed;
+
+    /** \brief Identities of messages already published */
+    std::unordered_set<uint64_t> seen;
+
+    /** \brief Indices to delete with the next batch */
+    std::vector<int> to_delete;
+
+    /** \brief Time at which the oldest index in #to_delete was acknowledged */
+    std::chrono::steady_clock::time_point oldest_ack;
+
+    /** \brief Time between two polls */
+    std::chrono::milliseconds poll_interval{1000};
+
+    /** \brief Number of indices that triggers a deletion */
+    size_t delete_batch_size = 32;
+
+    /** \brief Maximum time an acknowledged message stays on the modem */
+    std::chrono::milliseconds delete_delay{10000};
+
+    /** \brief Polling thread */
+    std::thread worker;
+
+    /** \brief True while polling thread runs */
+    std::atomic<bool> running{false};
+
+    /** \brief Mutex for waiting consumers and polling thread */
+    std::mutex wait_mutex;
+
+    /** \brief Signals consumers that messages are available */
+    std::condition_variable available;
+
+    /** \brief Wakes polling thread up when stopping */
+    std::condition_variable wake_up;
+
+    /** \brief Polling thread main loop. */
+    void run();
+
+    /** \brief Delete acknowledged messages if a batch is due.
+     *  \param force: if true, delete whatever has been acknowledged.
+     */
+    void flush_deletions(const bool force);
+
+	public:
+    /** \brief Constructor.
+     *  \param modem: logged-in modem session.
+     *  \param capacity: maximum number of messages waiting for a consumer.
+     */
+    explicit SMSReceiver(const TPLink_M7350 & modem, const size_t capacity = 1024);
+
+    SMSReceiver(const SMSReceiver &) = delete;
+    SMSReceiver & operator=(const SMSReceiver &) = delete;
+
+    /** \brief Destructor; stops polling. */
+    ~SMSReceiver();
+
+    /** \brief Set time between two inbox polls.
+     *  \param interval: poll interval.
+     */
+    void set_poll_interval(const std::chrono::milliseconds interval);
+
+    /** \brief Set when processed messages are deleted.
+     *  \param batch_size: number of acknowledged messages that triggers a deletion.
+     *  \param max_delay: maximum time an acknowledged message stays on the modem.
+     */
+    void set_delete_batch(const size_t batch_size, const std::chrono::milliseconds max_delay);
+
+    /** \brief Start polling thread.
+     *  \returns true if successful, false if already running.
+     */
+    bool start();
+
+    /** \brief Stop polling thread and delete acknowledged messages. */
+    void stop();
+
+    /** \brief Poll inbox once from the calling thread.
+     *  This can be used instead of the polling thread.
+     *  \returns number of new messages published.
+     */
+    size_t poll();
+
+    /** \brief Take a message without waiting.
+     *  \param sms: receives the message.
+     *  \returns true if a message was available, false otherwise.
+     */
+    bool try_receive(SMS & sms);
+
+    /** \brief Take a message, waiting for one if necessary.
+     *  \param sms: receives the message.
+     *  \param timeout: maximum waiting time.
+     *  \returns true if a message was received, false on timeout.
+     */
+    bool receive(SMS & sms, const std::chrono::milliseconds timeout);
+
+    /** \brief Mark a message as processed; it will be deleted with the next batch.
+     *  \param index: message index (see SMS::index).
+     *  \returns true if successful, false if too many acknowledgements are pending.
+     */
+    bool acknowledge(const int index);
+
+    /** \brief Get number of messages waiting for a consumer.
+     *  \returns number of messages.
+     */
+    size_t backlog() const;
+	};
+}
@@ -0,0 +1,137 @@
+/** \file tp_m7350_log.cxx
+ *	Asynchronous logger for the TP-Link M7350 interface.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_log.h"
+
+namespace tplink {
+
+	/** \brief Letter identifying a log level.
+	 *	\param level: log level.
+	 *	\returns letter.
+	 */
+	static char level_letter(const LogLevel level) {
+		switch (level) {
+			case LogLevel::Verbose: return 'V';
+			case LogLevel::Debug: return 'D';
+			case LogLevel::Info: return 'I';
+			case LogLevel::Error: return 'E';
+			default: return '?';
+		}
+	}
+
+
+	// defined here only, so that programs built with other debug settings share the library's default
+#ifndef NDEBUG
+	std::atomic<LogLevel> Logger::threshold{LogLevel::Verbose};
+#else
+	std::atomic<LogLevel> Logger::threshold{LogLevel::Off};
+#endif
+
+
+	void StreamSink::write(const LogRecord & record) {
+		this->out << level_letter(record.level) << ":[" << record.file << "|" << record.line << "] " << record.message() << '\n';
+	}
+
+
+	void StreamSink::flush() {
+		this->out.flush();
+	}
+
+
+	Logger::Logger() : records(4096), sink(std::make_shared<StreamSink>()) {
+		this->writer = std::thread(&Logger::run, this);
+	}
+
+
+	Logger::~Logger() {
+		{
+			std::lock_guard<std::mutex> lock(this->cv_mutex);
+			this->running = false;
+			this->cv.notify_all();
+		}
+		this->writer.join();
+	}
+
+
+	Logger & Logger::instance() {
+		static Logger logger;
+		return logger;
+	}
+
+
+	void Logger::submit(LogRecord & record) {
+		if (!this->records.push(std::move(record))) {
+			this->dropped_records.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		this->queued.fetch_add(1, std::memory_order_release);
+		// writer thread wakes up on its own after a while anyway; this only shortens the wait
+		if (this->idle.load(std::memory_order_relaxed))
+			this->cv.notify_all();
+	}
+
+
+	void Logger::run() {
+		LogRecord r;
+		uint64_t reported_drops = 0;
+		for (;;) {
+			bool any = false;
+			{
+				std::lock_guard<std::mutex> lock(this->sink_mutex);
+				while (this->records.pop(r)) {
+					this->sink->write(r);
+					this->written.fetch_add(1, std::memory_order_release);
+					any = true;
+				}
+				// tell about messages lost since last batch
+				auto drops = this->dropped();
+				if (drops > reported_drops) {
+					LogRecord note;
+					note.level = LogLevel::Error;
+					note.file = __FILENAME__;
+					note.line = __LINE__;
+					note.time = std::chrono::system_clock::now();
+					append(note, "Log queue full; dropped ");
+					append(note, drops - reported_drops);
+					append(note, " message(s).");
+					this->sink->write(note);
+					reported_drops = drops;
+					any = true;
+				}
+				if (any) this->sink->flush();
+			}
+			std::unique_lock<std::mutex> lock(this->cv_mutex);
+			if (any) this->cv.notify_all(); // for threads waiting in flush
+			if (!this->running && this->records.size() == 0) return;
+			this->idle = true;
+			this->cv.wait_for(lock, std::chrono::milliseconds(50), [this]{
+				return !this->running || this->records.size() > 0;
+			});
+			this->idle = false;
+		}
+	}
+
+
+	void Logger::set_sink(std::shared_ptr<LogSink> sink) {
+		std::lock_guard<std::mutex> lock(this->sink_mutex);
+		this->sink->flush();
+		this->sink = std::move(sink);
+	}
+
+
+	void Logger::flush() {
+		auto target = this->queued.load(std::memory_order_acquire);
+		std::unique_lock<std::mutex> lock(this->cv_mutex);
+		this->cv.notify_all();
+		this->cv.wait(lock, [this, target]{
+			return this->written.load(std::memory_order_acquire) >= target || !this->running;
+		});
+	}
+
+
+	uint64_t Logger::dropped() const {
+		return this->dropped_records.load(std::memory_order_relaxed);
+	}
+}
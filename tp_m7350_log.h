@@ -0,0 +1,264 @@
+/** \file tp_m7350_log.h
+ *  Asynchronous logger for the TP-Link M7350 interface. Messages are formatted
+ *  by the calling thread into fixed-size records, handed to a background
+ *  thread through a lock-free queue, and written to a pluggable sink.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <string_view>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <charconv>
+#include <type_traits>
+#include <cstring>
+#include <cstdio>
+#include <cstdint>
+
+#include "tp_m7350_queue.h"
+
+namespace tplink {
+
+	/** \brief Log levels, from most to least verbose. */
+	enum class LogLevel : uint8_t {
+		Verbose,
+		Debug,
+		Info,
+		Error,
+		Off ///< Disables logging
+	};
+
+	/** \brief A log message. */
+	struct LogRecord {
+		/** \brief Maximum message length; longer messages are truncated */
+		static constexpr size_t kMaxLength = 232;
+
+		/** \brief Message level */
+		LogLevel level = LogLevel::Info;
+		/** \brief Source file name */
+		const char * file = "";
+		/** \brief Source line */
+		int line = 0;
+		/** \brief Time at which message was logged */
+		std::chrono::system_clock::time_point time;
+		/** \brief Message length */
+		uint16_t length = 0;
+		/** \brief Message text; not null-terminated */
+		char text[kMaxLength];
+
+		/** \brief Get message text.
+		 *  \returns message.
+		 */
+		std::string_view message() const { return std::string_view(this->text, this->length); }
+	};
+
+	/** \brief Destination of log messages.
+	 *  Sinks are only called from the logger thread, so they need no locking.
+	 */
+	class LogSink {
+	public:
+    virtual ~LogSink() = default;
+
+    /** \brief Write a message.
+     *  \param record: message.
+     */
+    virtual void write(const LogRecord & record) = 0;
+
+    /** \brief Flush written messages; called after each batch. */
+    virtual void flush() {}
+	};
+
+	/** \brief Write log messages to a stream, as "L:[file|line] message". */
+	class StreamSink : public LogSink {
+	private:
+    std::ostream & out;
+	public:
+    /** \brief Constructor.
+     *  \param out: output stream; must outlive the sink.
+     */
+    explicit StreamSink(std::ostream & out = std::cout) : out(out) {}
+    void write(const LogRecord & record) override;
+    void flush() override;
+	};
+
+	/** \brief Process-wide asynchronous logger.
+	 *
+	 *  Messages below the current level cost a single relaxed load: the LOG_*
+	 *  macros check the level before evaluating their arguments. Enabled
+	 *  messages are formatted into a LogRecord by the calling thread and pushed
+	 *  into a bounded lock-free queue; if it is full, the message is dropped
+	 *  rather than blocking the caller. A background thread writes queued
+	 *  records to the sink and flushes it once per batch.
+	 */
+	class Logger {
+	private:
+    /** \brief Current level; its default depends on how the library was built, not on the including program */
+    static std::atomic<LogLevel> threshold;
+
+    /** \brief Records waiting to be written */
+    LockFreeQueue<LogRecord> records;
+
+    /** \brief Message destination */
+    std::shared_ptr<LogSink> sink;
+
+    /** \brief Guards #sink */
+    std::mutex sink_mutex;
+
+    /** \brief Writer thread */
+    std::thread writer;
+
+    /** \brief True while writer thread runs */
+    std::atomic<bool> running{true};
+
+    /** \brief True while writer thread waits for records */
+    std::atomic<bool> idle{false};
+
+    /** \brief Wakes writer thread up, and flushing threads once records are written */
+    std::condition_variable cv;
+
+    /** \brief Mutex for #cv */
+    std::mutex cv_mutex;
+
+    /** \brief Number of records queued */
+    std::atomic<uint64_t> queued{0};
+
+    /** \brief Number of records written */
+    std::atomic<uint64_t> written{0};
+
+    /** \brief Number of records dropped because queue was full */
+    std::atomic<uint64_t> dropped_records{0};
+
+    Logger();
+
+    /** \brief Writer thread main loop. */
+    void run();
+
+    /** \brief Queue a formatted record.
+     *  \param record: record to queue.
+     */
+    void submit(LogRecord & record);
+
+    /** \brief Append text to a record.
+     *  \param r: record.
+     *  \param s: text.
+     *  \param n: text length.
+     */
+    static void append(LogRecord & r, const char * s, size_t n) {
+      n = std::min(n, LogRecord::kMaxLength - r.length);
+      std::memcpy(r.text + r.length, s, n);
+      r.length += n;
+    }
+
+    /** \brief Append a value to a record, formatted as std::ostream would.
+     *  \param r: record.
+     *  \param value: value to format.
+     */
+    template <typename T>
+    static void append(LogRecord & r, const T & value) {
+      using U = std::decay_t<T>;
+      if constexpr (std::is_same_v<U, char>) {
+        append(r, &value, 1);
+      } else if constexpr (std::is_same_v<U, const char *> || std::is_same_v<U, char *>) {
+        append(r, value, std::strlen(value));
+      } else if constexpr (std::is_convertible_v<const T &, std::string_view>) {
+        std::string_view v(value);
+        append(r, v.data(), v.size());
+      } else if constexpr (std::is_integral_v<U> && !std::is_same_v<U, bool>) {
+        char buffer[24];
+        auto res = std::to_chars(buffer, buffer + sizeof(buffer), value);
+        append(r, buffer, res.ptr - buffer);
+      } else if constexpr (std::is_floating_point_v<U>) {
+        char buffer[32];
+        auto n = std::snprintf(buffer, sizeof(buffer), "%g", static_cast<double>(value));
+        append(r, buffer, std::min<size_t>(n, sizeof(buffer) - 1));
+      } else {
+        std::ostringstream s;
+        s << value;
+        auto str = s.str();
+        append(r, str.data(), str.size());
+      }
+    }
+
+	public:
+    /** \brief Get process-wide logger.
+     *  \returns logger.
+     */
+    static Logger & instance();
+
+    Logger(const Logger &) = delete;
+    Logger & operator=(const Logger &) = delete;
+
+    /** \brief Destructor; writes pending records and stops writer thread. */
+    ~Logger();
+
+    /** \brief Set minimum level of logged messages.
+     *  The default is LogLevel::Verbose in debug builds and LogLevel::Off otherwise.
+     *  \param level: minimum level.
+     */
+    static void set_level(const LogLevel level) {
+      threshold.store(level, std::memory_order_relaxed);
+    }
+
+    /** \brief Get minimum level of logged messages.
+     *  \returns level.
+     */
+    static LogLevel level() {
+      return threshold.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Check whether messages of a given level are logged.
+     *  \param level: message level.
+     *  \returns true if logged, false otherwise.
+     */
+    static bool enabled(const LogLevel level) {
+      return level != LogLevel::Off && level >= threshold.load(std::memory_order_relaxed);
+    }
+
+    /** \brief Set message destination. The default sink writes to std::cout.
+     *  \param sink: new sink.
+     */
+    void set_sink(std::shared_ptr<LogSink> sink);
+
+    /** \brief Wait until messages logged so far are written and flushed. */
+    void flush();
+
+    /** \brief Get number of messages dropped because queue was full.
+     *  \returns number of messages.
+     */
+    uint64_t dropped() const;
+
+    /** \brief Log a message.
+     *  \param level: message level.
+     *  \param file: source file name.
+     *  \param line: source line.
+     *  \param args: message parts, concatenated.
+     */
+    template <typename... Args>
+    void log(const LogLevel level, const char * file, const int line, const Args &... args) {
+      LogRecord r;
+      r.level = level;
+      r.file = file;
+      r.line = line;
+      r.time = std::chrono::system_clock::now();
+      (append(r, args), ...);
+      this->submit(r);
+    }
+	};
+
+  #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
+  #define TP_LOG(level, ...) do { \
+      if (tplink::Logger::enabled(level)) \
+        tplink::Logger::instance().log(level, __FILENAME__, __LINE__, __VA_ARGS__); \
+    } while (0)
+  #define LOG_V(...) TP_LOG(tplink::LogLevel::Verbose, __VA_ARGS__)
+  #define LOG_D(...) TP_LOG(tplink::LogLevel::Debug, __VA_ARGS__)
+  #define LOG_I(...) TP_LOG(tplink::LogLevel::Info, __VA_ARGS__)
+  #define LOG_E(...) TP_LOG(tplink::LogLevel::Error, __VA_ARGS__)
+}
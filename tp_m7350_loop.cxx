@@ -0,0 +1,191 @@
+/** \file tp_m7350_loop.cxx
+ *	Non-blocking requests driven by an external event loop, using CURL's
+ *	multi socket interface.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_loop.h"
+#include "tp_m7350_codec.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/epoll.h>
+
+namespace tplink {
+
+	/* CURL writer callback (collect server response) */
+	static size_t loop_writer(char * data, size_t size, size_t nmemb, std::string * writer_data) {
+		writer_data->append(data, size*nmemb);
+		return size*nmemb;
+	}
+
+
+	int LoopDriver::on_socket([[maybe_unused]] CURL * easy, curl_socket_t fd, int what, void * driver, [[maybe_unused]] void * socket_data) {
+		auto self = static_cast<LoopDriver*>(driver);
+		SocketInterest interest;
+		switch (what) {
+			case CURL_POLL_IN: interest = SocketInterest::Read; break;
+			case CURL_POLL_OUT: interest = SocketInterest::Write; break;
+			case CURL_POLL_INOUT: interest = SocketInterest::ReadWrite; break;
+			default: interest = SocketInterest::None; break;
+		}
+		self->socket_callback(fd, interest);
+		return 0;
+	}
+
+
+	int LoopDriver::on_timer([[maybe_unused]] CURLM * multi, long timeout_ms, void * driver) {
+		static_cast<LoopDriver*>(driver)->timer_callback(timeout_ms);
+		return 0;
+	}
+
+
+	LoopDriver::LoopDriver(SocketCallback on_socket, TimerCallback on_timer)
+			: multi(curl_multi_init()), socket_callback(std::move(on_socket)), timer_callback(std::move(on_timer)) {
+		verify(curl_multi_setopt(this->multi.get(), CURLMOPT_SOCKETFUNCTION, LoopDriver::on_socket) == CURLM_OK);
+		verify(curl_multi_setopt(this->multi.get(), CURLMOPT_SOCKETDATA, this) == CURLM_OK);
+		verify(curl_multi_setopt(this->multi.get(), CURLMOPT_TIMERFUNCTION, LoopDriver::on_timer) == CURLM_OK);
+		verify(curl_multi_setopt(this->multi.get(), CURLMOPT_TIMERDATA, this) == CURLM_OK);
+	}
+
+
+	LoopDriver::~LoopDriver() {
+		for (auto & t: this->transfers)
+			curl_multi_remove_handle(this->multi.get(), t.first);
+		this->transfers.clear();
+	}
+
+
+	void LoopDriver::set_share_handle(CURLSH * share) {
+		this->share = share;
+		for (auto & h: this->idle)
+			curl_easy_setopt(h.get(), CURLOPT_SHARE, share);
+	}
+
+
+	void LoopDriver::post(const std::string & url, std::string data, Completion done) {
+		auto t = std::make_unique<Transfer>();
+		if (!this->idle.empty()) {
+			t->easy = std::move(this->idle.back());
+			this->idle.pop_back();
+		} else {
+			t->easy = UniquePointer<CURL, curl_easy_cleanup>(curl_easy_init());
+			auto h = t->easy.get();
+			verify(curl_easy_setopt(h, CURLOPT_WRITEFUNCTION, loop_writer) == CURLE_OK);
+			verify(curl_easy_setopt(h, CURLOPT_NOSIGNAL, 1L) == CURLE_OK);
+			if (this->share != nullptr)
+				verify(curl_easy_setopt(h, CURLOPT_SHARE, this->share) == CURLE_OK);
+		}
+		t->data = std::move(data);
+		t->done = std::move(done);
+		auto h = t->easy.get();
+		verify(curl_easy_setopt(h, CURLOPT_URL, url.c_str()) == CURLE_OK);
+		verify(curl_easy_setopt(h, CURLOPT_WRITEDATA, &t->reply) == CURLE_OK);
+		verify(curl_easy_setopt(h, CURLOPT_POSTFIELDSIZE, static_cast<long>(t->data.size())) == CURLE_OK);
+		verify(curl_easy_setopt(h, CURLOPT_POSTFIELDS, t->data.c_str()) == CURLE_OK);
+		this->transfers.emplace(h, std::move(t));
+		// CURL asks for an immediate timeout through the timer callback to start the request
+		verify(curl_multi_add_handle(this->multi.get(), h) == CURLM_OK);
+	}
+
+
+	void LoopDriver::socket_ready(const int fd, const bool readable, const bool writable, const bool error) {
+		int mask = (readable ? CURL_CSELECT_IN : 0) | (writable ? CURL_CSELECT_OUT : 0) | (error ? CURL_CSELECT_ERR : 0);
+		curl_multi_socket_action(this->multi.get(), fd, mask, &this->running);
+		this->process_completions();
+	}
+
+
+	void LoopDriver::timeout() {
+		curl_multi_socket_action(this->multi.get(), CURL_SOCKET_TIMEOUT, 0, &this->running);
+		this->process_completions();
+	}
+
+
+	size_t LoopDriver::pending() const {
+		return this->transfers.size();
+	}
+
+
+	void LoopDriver::process_completions() {
+		int n_msgs;
+		while (auto msg = curl_multi_info_read(this->multi.get(), &n_msgs)) {
+			if (msg->msg != CURLMSG_DONE) continue;
+			auto h = msg->easy_handle;
+			auto ok = msg->data.result == CURLE_OK;
+			curl_multi_remove_handle(this->multi.get(), h);
+			auto it = this->transfers.find(h);
+			if (it == this->transfers.end()) continue;
+			auto t = std::move(it->second);
+			this->transfers.erase(it);
+			this->idle.push_back(std::move(t->easy));
+			// may start new requests
+			t->done(ok, std::move(t->reply));
+		}
+	}
+
+
+	EpollLoop::EpollLoop() : fd(::epoll_create1(EPOLL_CLOEXEC)) {
+		if (this->fd < 0) {
+			LOG_E("Couldn't create event loop: ", std::strerror(errno));
+			return;
+		}
+		this->loop_driver = std::make_unique<LoopDriver>([this](int socket, SocketInterest interest) {
+			if (interest == SocketInterest::None) {
+				::epoll_ctl(this->fd, EPOLL_CTL_DEL, socket, nullptr);
+				return;
+			}
+			epoll_event ev{};
+			ev.events = (interest != SocketInterest::Write ? uint32_t(EPOLLIN) : 0) | (interest != SocketInterest::Read ? uint32_t(EPOLLOUT) : 0);
+			ev.data.fd = socket;
+			if (::epoll_ctl(this->fd, EPOLL_CTL_MOD, socket, &ev) != 0)
+				::epoll_ctl(this->fd, EPOLL_CTL_ADD, socket, &ev);
+		}, [this](long timeout_ms) {
+			this->timer_set = timeout_ms >= 0;
+			this->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+		});
+	}
+
+
+	EpollLoop::~EpollLoop() {
+		this->loop_driver.reset();
+		if (this->fd >= 0) ::close(this->fd);
+	}
+
+
+	bool EpollLoop::is_open() const {
+		return this->fd >= 0;
+	}
+
+
+	LoopDriver & EpollLoop::driver() {
+		return *this->loop_driver;
+	}
+
+
+	bool EpollLoop::run(const std::function<bool()> & busy) {
+		if (!this->is_open()) return false;
+		while (busy()) {
+			int wait = -1;
+			if (this->timer_set)
+				wait = std::max<long>(0, std::chrono::duration_cast<std::chrono::milliseconds>(this->deadline - std::chrono::steady_clock::now()).count());
+			epoll_event events[16];
+			int n = ::epoll_wait(this->fd, events, 16, wait);
+			if (n < 0 && errno == EINTR) continue;
+			if (n < 0) {
+				LOG_E("Event loop failed: ", std::strerror(errno));
+				return false;
+			}
+			for (int k=0; k<n; k++) {
+				auto e = events[k].events;
+				this->loop_driver->socket_ready(events[k].data.fd, e & EPOLLIN, e & EPOLLOUT, e & (EPOLLERR | EPOLLHUP));
+			}
+			// CURL timeouts may expire while sockets are busy
+			if (this->timer_set && std::chrono::steady_clock::now() >= this->deadline) {
+				this->timer_set = false;
+				this->loop_driver->timeout();
+			}
+		}
+		return true;
+	}
+}
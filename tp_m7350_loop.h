@@ -0,0 +1,181 @@
+/** \file tp_m7350_loop.h
+ *  Non-blocking requests driven by an external event loop (epoll, libuv,
+ *  asio...), using CURL's multi socket interface.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Events a socket must be watched for. */
+	enum class SocketInterest : uint8_t {
+		None = 0, ///< Stop watching socket
+		Read = 1,
+		Write = 2,
+		ReadWrite = 3
+	};
+
+	/** \brief Runs HTTP POST requests without threads or blocking calls, on behalf of an event loop.
+	 *
+	 *  The driver tells the loop which sockets to watch through the socket
+	 *  callback, and when to call timeout() through the timer callback. The
+	 *  loop reports readiness with socket_ready(), and requests make progress
+	 *  within these calls; completion callbacks are called from them as well.
+	 *  Completion callbacks may start new requests; socket and timer callbacks
+	 *  must not call the driver. All calls must be made from the loop thread.
+	 */
+	class LoopDriver {
+	public:
+    /** \brief Called when a socket must be watched for other events.
+     *  \param fd: socket.
+     *  \param interest: events to watch for; SocketInterest::None to stop watching.
+     */
+    using SocketCallback = std::function<void(int fd, SocketInterest interest)>;
+
+    /** \brief Called when the timer must be rearmed.
+     *  \param timeout_ms: time after which timeout() must be called; -1 to disarm timer.
+     */
+    using TimerCallback = std::function<void(long timeout_ms)>;
+
+    /** \brief Called when a request completes.
+     *  \param ok: true if a reply was received, false if request failed.
+     *  \param reply: server reply.
+     */
+    using Completion = std::function<void(bool ok, std::string && reply)>;
+
+	private:
+    /** \brief A request in progress. */
+    struct Transfer {
+      UniquePointer<CURL, curl_easy_cleanup> easy;
+      std::string data;
+      std::string reply;
+      Completion done;
+    };
+
+    /** \brief CURL multi handle */
+    UniquePointer<CURLM, curl_multi_cleanup> multi;
+
+    /** \brief Easy handles of finished requests, for reuse */
+    std::vector<UniquePointer<CURL, curl_easy_cleanup> > idle;
+
+    /** \brief Requests in progress, by easy handle */
+    std::unordered_map<CURL*, std::unique_ptr<Transfer> > transfers;
+
+    /** \brief Tells loop which sockets to watch */
+    SocketCallback socket_callback;
+
+    /** \brief Tells loop when to call timeout() */
+    TimerCallback timer_callback;
+
+    /** \brief Number of requests started by curl_multi_socket_action */
+    int running = 0;
+
+    /** \brief Share handle given to new easy handles */
+    CURLSH * share = nullptr;
+
+    /** \brief CURL socket callback; forwards to #socket_callback. */
+    static int on_socket(CURL * easy, curl_socket_t fd, int what, void * driver, void * socket_data);
+
+    /** \brief CURL timer callback; forwards to #timer_callback. */
+    static int on_timer(CURLM * multi, long timeout_ms, void * driver);
+
+    /** \brief Call completion callbacks of finished requests. */
+    void process_completions();
+
+	public:
+    /** \brief Constructor.
+     *  \param on_socket: called when a socket must be watched for other events.
+     *  \param on_timer: called when the timer must be rearmed.
+     */
+    LoopDriver(SocketCallback on_socket, TimerCallback on_timer);
+
+    LoopDriver(const LoopDriver &) = delete;
+    LoopDriver & operator=(const LoopDriver &) = delete;
+
+    /** \brief Destructor; abandons requests in progress without calling their completion callbacks. */
+    ~LoopDriver();
+
+    /** \brief Share DNS cache and connections with other drivers or sessions.
+     *  \param share: CURL share handle, or nullptr to stop sharing.
+     */
+    void set_share_handle(CURLSH * share);
+
+    /** \brief Start a HTTP POST request.
+     *  \param url: URL to send request to.
+     *  \param data: POST data.
+     *  \param done: called once request completes.
+     */
+    void post(const std::string & url, std::string data, Completion done);
+
+    /** \brief Tell driver that a socket is ready.
+     *  \param fd: socket.
+     *  \param readable: true if socket is readable.
+     *  \param writable: true if socket is writable.
+     *  \param error: true if an error occurred on socket.
+     */
+    void socket_ready(const int fd, const bool readable, const bool writable, const bool error = false);
+
+    /** \brief Tell driver that the timer expired. */
+    void timeout();
+
+    /** \brief Get number of requests in progress.
+     *  \returns number of requests.
+     */
+    size_t pending() const;
+	};
+
+	/** \brief Runs a LoopDriver on an epoll instance of its own, for callers without an event loop.
+	 *
+	 *  Requests are started through driver(); run() then waits for socket
+	 *  events and timeouts, and lets the driver process them, for as long as
+	 *  the caller has work in progress. All calls must be made from one thread.
+	 */
+	class EpollLoop {
+	private:
+    /** \brief epoll file descriptor */
+    int fd = -1;
+
+    /** \brief True if driver asked for a timeout */
+    bool timer_set = false;
+
+    /** \brief Time at which driver timeout expires */
+    std::chrono::steady_clock::time_point deadline;
+
+    /** \brief Driver; destroyed first, as it may still report sockets */
+    std::unique_ptr<LoopDriver> loop_driver;
+
+	public:
+    /** \brief Constructor. */
+    EpollLoop();
+
+    EpollLoop(const EpollLoop &) = delete;
+    EpollLoop & operator=(const EpollLoop &) = delete;
+
+    /** \brief Destructor; abandons requests in progress. */
+    ~EpollLoop();
+
+    /** \brief Check if loop could be created.
+     *  \returns true if loop is usable.
+     */
+    bool is_open() const;
+
+    /** \brief Get driver to start requests with.
+     *  \returns driver.
+     */
+    LoopDriver & driver();
+
+    /** \brief Process events until there is no more work.
+     *  \param busy: called between events; returns true while work is in progress.
+     *  \returns true if loop ran until work was done, false if it failed.
+     */
+    bool run(const std::function<bool()> & busy);
+	};
+}
@@ -0,0 +1,295 @@
+/** \file tp_m7350_metrics.cxx
+ *	Latency and throughput metrics for the phases of TP-Link M7350 requests.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_metrics.h"
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <sstream>
+#include <algorithm>
+
+namespace tplink {
+	namespace metrics {
+
+		const char * phase_name(const Phase phase) {
+			switch (phase) {
+				case Phase::BuildRequestObject: return "build_request_object";
+				case Phase::Stringify: return "stringify";
+				case Phase::Encrypt: return "encrypt";
+				case Phase::PostRequest: return "post_request";
+				case Phase::AESDecrypt: return "aes_decrypt";
+				case Phase::ParseResponse: return "parse_response";
+			}
+			return "";
+		}
+
+
+		size_t LatencyHistogram::bucket(const uint64_t ns) {
+			if (ns < 32) return ns;
+			size_t msb = 63 - __builtin_clzll(ns);
+			size_t shift = msb - 4;
+			size_t index = 16*shift + (ns >> shift);
+			return std::min(index, kBuckets - 1);
+		}
+
+
+		uint64_t LatencyHistogram::bucket_lower(const size_t index) {
+			if (index < 32) return index;
+			return uint64_t(16 + index % 16) << (index/16 - 1);
+		}
+
+
+		void LatencyHistogram::record(const uint64_t ns) {
+			add(this->counts[bucket(ns)], 1);
+			add(this->count, 1);
+			add(this->sum, ns);
+			if (ns > this->max.load(std::memory_order_relaxed))
+				this->max.store(ns, std::memory_order_relaxed);
+		}
+
+
+		void HistogramSnapshot::merge(const HistogramSnapshot & other) {
+			if (this->counts.size() < other.counts.size())
+				this->counts.resize(other.counts.size());
+			for (size_t i=0; i<other.counts.size(); i++)
+				this->counts[i] += other.counts[i];
+			this->count += other.count;
+			this->sum += other.sum;
+			this->max = std::max(this->max, other.max);
+		}
+
+
+		uint64_t HistogramSnapshot::percentile(const double q) const {
+			if (this->count == 0) return 0;
+			auto rank = static_cast<uint64_t>(std::ceil(std::min(1.0, std::max(0.0, q)) * this->count));
+			rank = std::max<uint64_t>(rank, 1);
+			uint64_t seen = 0;
+			for (size_t i=0; i<this->counts.size(); i++) {
+				seen += this->counts[i];
+				if (seen >= rank)
+					return std::min(LatencyHistogram::bucket_lower(i), this->max);
+			}
+			return this->max;
+		}
+
+
+		double HistogramSnapshot::mean() const {
+			return this->count > 0 ? static_cast<double>(this->sum) / this->count : 0;
+		}
+
+
+		/** \brief Identifies a kind of request. */
+		struct SeriesKey {
+			std::string module;
+			int action;
+		};
+
+		/** \brief Looks up series without building a key. */
+		struct SeriesKeyView {
+			const std::string & module;
+			int action;
+		};
+
+		/** \brief Orders series keys; transparent, to look series up with a view. */
+		struct SeriesKeyLess {
+			using is_transparent = void;
+			template <typename A, typename B>
+			bool operator()(const A & a, const B & b) const {
+				int c = a.module.compare(b.module);
+				return c < 0 || (c == 0 && a.action < b.action);
+			}
+		};
+
+		using SeriesMap = std::map<SeriesKey, std::unique_ptr<Series>, SeriesKeyLess>;
+
+		/** \brief Metrics recorded by one thread. */
+		struct ThreadMetrics {
+			/** \brief Guards insertions into #series against snapshots */
+			std::mutex mutex;
+			SeriesMap series;
+			/** \brief Series of the request being recorded */
+			Series * current = nullptr;
+		};
+
+		/** \brief Metrics of all threads. */
+		struct Registry {
+			std::mutex mutex;
+			/** \brief Metrics of running threads */
+			std::vector<ThreadMetrics*> threads;
+			/** \brief Metrics left by threads that have exited */
+			std::map<std::pair<std::string, int>, SeriesSnapshot> retired;
+		};
+
+		static Registry & registry() {
+			static Registry r;
+			return r;
+		}
+
+		/** \brief Copy the counters of a series.
+		 *	\param s: series.
+		 *	\param snap: snapshot to add counters to.
+		 */
+		static void accumulate(const Series & s, SeriesSnapshot & snap) {
+			snap.requests += s.requests.load(std::memory_order_relaxed);
+			snap.bytes_sent += s.bytes_sent.load(std::memory_order_relaxed);
+			snap.bytes_received += s.bytes_received.load(std::memory_order_relaxed);
+			for (size_t p=0; p<kPhaseCount; p++) {
+				auto & h = s.phases[p];
+				HistogramSnapshot hs;
+				hs.counts.resize(LatencyHistogram::kBuckets);
+				for (size_t i=0; i<LatencyHistogram::kBuckets; i++)
+					hs.counts[i] = h.counts[i].load(std::memory_order_relaxed);
+				hs.count = h.count.load(std::memory_order_relaxed);
+				hs.sum = h.sum.load(std::memory_order_relaxed);
+				hs.max = h.max.load(std::memory_order_relaxed);
+				snap.phases[p].merge(hs);
+			}
+		}
+
+		/** \brief Registers the metrics of a thread, and folds them into the retired ones when it exits. */
+		struct ThreadHandle {
+			ThreadMetrics * metrics;
+			ThreadHandle() : metrics(new ThreadMetrics()) {
+				auto & r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.threads.push_back(this->metrics);
+			}
+			~ThreadHandle() {
+				auto & r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				r.threads.erase(std::find(r.threads.begin(), r.threads.end(), this->metrics));
+				for (auto & s: this->metrics->series) {
+					auto & snap = r.retired[{s.first.module, s.first.action}];
+					accumulate(*s.second, snap);
+				}
+				delete this->metrics;
+			}
+		};
+
+		static ThreadMetrics & thread_metrics() {
+			static thread_local ThreadHandle handle;
+			return *handle.metrics;
+		}
+
+
+		void begin_request(const std::string & module, const int action) {
+			auto & t = thread_metrics();
+			auto itr = t.series.find(SeriesKeyView{module, action});
+			if (itr == t.series.end()) {
+				std::lock_guard<std::mutex> lock(t.mutex);
+				itr = t.series.emplace(SeriesKey{module, action}, std::make_unique<Series>()).first;
+			}
+			t.current = itr->second.get();
+			add(t.current->requests, 1);
+		}
+
+
+		Series & current() {
+			auto & t = thread_metrics();
+			if (t.current == nullptr) {
+				// phases recorded outside of any request
+				std::lock_guard<std::mutex> lock(t.mutex);
+				t.current = t.series.emplace(SeriesKey{"none", 0}, std::make_unique<Series>()).first->second.get();
+			}
+			return *t.current;
+		}
+
+
+		std::vector<SeriesSnapshot> snapshot() {
+			auto & r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			auto merged = r.retired;
+			for (auto t: r.threads) {
+				std::lock_guard<std::mutex> thread_lock(t->mutex);
+				for (auto & s: t->series)
+					accumulate(*s.second, merged[{s.first.module, s.first.action}]);
+			}
+			std::vector<SeriesSnapshot> result;
+			for (auto & m: merged) {
+				m.second.module = m.first.first;
+				m.second.action = m.first.second;
+				result.push_back(std::move(m.second));
+			}
+			return result;
+		}
+
+
+		void reset() {
+			auto & r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			r.retired.clear();
+			for (auto t: r.threads) {
+				std::lock_guard<std::mutex> thread_lock(t->mutex);
+				for (auto & s: t->series) {
+					s.second->requests = 0;
+					s.second->bytes_sent = 0;
+					s.second->bytes_received = 0;
+					for (auto & h: s.second->phases) {
+						for (auto & c: h.counts)
+							c = 0;
+						h.count = 0;
+						h.sum = 0;
+						h.max = 0;
+					}
+				}
+			}
+		}
+
+
+		std::string to_prometheus(const std::vector<SeriesSnapshot> & series) {
+			// histogram bucket bounds, in seconds
+			static const double bounds[] = {
+				1e-6, 2.5e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4,
+				1e-3, 2.5e-3, 5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10
+			};
+			std::ostringstream out;
+			auto labels = [](const SeriesSnapshot & s) {
+				return "module=\"" + s.module + "\",action=\"" + std::to_string(s.action) + "\"";
+			};
+
+			out << "# HELP tplink_requests_total Number of requests sent to modems.\n";
+			out << "# TYPE tplink_requests_total counter\n";
+			for (auto & s: series)
+				out << "tplink_requests_total{" << labels(s) << "} " << s.requests << "\n";
+			out << "# HELP tplink_sent_bytes_total Number of bytes posted to modems.\n";
+			out << "# TYPE tplink_sent_bytes_total counter\n";
+			for (auto & s: series)
+				out << "tplink_sent_bytes_total{" << labels(s) << "} " << s.bytes_sent << "\n";
+			out << "# HELP tplink_received_bytes_total Number of bytes received from modems.\n";
+			out << "# TYPE tplink_received_bytes_total counter\n";
+			for (auto & s: series)
+				out << "tplink_received_bytes_total{" << labels(s) << "} " << s.bytes_received << "\n";
+
+			out << "# HELP tplink_phase_duration_seconds Duration of request phases.\n";
+			out << "# TYPE tplink_phase_duration_seconds histogram\n";
+			for (auto & s: series) {
+				for (size_t p=0; p<kPhaseCount; p++) {
+					auto & h = s.phases[p];
+					if (h.count == 0) continue;
+					auto l = labels(s) + ",phase=\"" + phase_name(static_cast<Phase>(p)) + "\"";
+					// a bucket counts towards a bound if all of its values are below it
+					size_t i = 0;
+					uint64_t cumulated = 0;
+					for (auto b: bounds) {
+						auto bound_ns = static_cast<uint64_t>(b*1e9);
+						for (; i<h.counts.size() && LatencyHistogram::bucket_lower(i+1) <= bound_ns; i++)
+							cumulated += h.counts[i];
+						out << "tplink_phase_duration_seconds_bucket{" << l << ",le=\"" << b << "\"} " << cumulated << "\n";
+					}
+					out << "tplink_phase_duration_seconds_bucket{" << l << ",le=\"+Inf\"} " << h.count << "\n";
+					out << "tplink_phase_duration_seconds_sum{" << l << "} " << h.sum*1e-9 << "\n";
+					out << "tplink_phase_duration_seconds_count{" << l << "} " << h.count << "\n";
+				}
+			}
+			return out.str();
+		}
+
+
+		std::string prometheus() {
+			return to_prometheus(snapshot());
+		}
+	}
+}
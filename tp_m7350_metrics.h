@@ -0,0 +1,228 @@
+/** \file tp_m7350_metrics.h
+ *  Latency and throughput metrics for the phases of TP-Link M7350 requests.
+ *  Recording is compiled in only if TPLINK_METRICS is set to 1; the snapshot
+ *  functions are always available and return nothing when it isn't.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#ifndef TPLINK_METRICS
+#define TPLINK_METRICS 0
+#endif
+
+namespace tplink {
+	namespace metrics {
+
+		/** \brief Phases of a request. */
+		enum class Phase : uint8_t {
+			BuildRequestObject, ///< Building the request JSON object
+			Stringify, ///< Serializing the request
+			Encrypt, ///< Encrypting and signing the request (new firmwares)
+			PostRequest, ///< HTTP round trip
+			AESDecrypt, ///< Decrypting the reply (new firmwares)
+			ParseResponse ///< Parsing the reply
+		};
+
+		/** \brief Number of phases */
+		constexpr size_t kPhaseCount = 6;
+
+		/** \brief Get name of a phase.
+		 *  \param phase: phase.
+		 *  \returns phase name, as used in the Prometheus dump.
+		 */
+		const char * phase_name(const Phase phase);
+
+		/** \brief Latency histogram with logarithmic buckets.
+		 *
+		 *  Values below 32 ns have a bucket each; above, each power of two is split
+		 *  into 16 buckets, so that values are known within 1/16 of their magnitude.
+		 *  Values from 2^35 ns (about 34 s) on fall in the last bucket. A histogram
+		 *  has a single writer; counts are atomic only so that they can be read
+		 *  while being written.
+		 */
+		class LatencyHistogram {
+		public:
+      /** \brief Number of buckets */
+      static constexpr size_t kBuckets = 16*32;
+
+      /** \brief Record a value.
+       *  \param ns: value, in nanoseconds.
+       */
+      void record(const uint64_t ns);
+
+      /** \brief Get bucket index of a value.
+       *  \param ns: value, in nanoseconds.
+       *  \returns bucket index.
+       */
+      static size_t bucket(const uint64_t ns);
+
+      /** \brief Get smallest value falling into a bucket.
+       *  \param index: bucket index.
+       *  \returns value, in nanoseconds.
+       */
+      static uint64_t bucket_lower(const size_t index);
+
+      /** \brief Bucket counts */
+      std::array<std::atomic<uint64_t>, kBuckets> counts{};
+      /** \brief Number of values */
+      std::atomic<uint64_t> count{0};
+      /** \brief Sum of values */
+      std::atomic<uint64_t> sum{0};
+      /** \brief Largest value */
+      std::atomic<uint64_t> max{0};
+		};
+
+		/** \brief Snapshot of a latency histogram. */
+		struct HistogramSnapshot {
+			/** \brief Bucket counts; see LatencyHistogram */
+			std::vector<uint64_t> counts;
+			/** \brief Number of values */
+			uint64_t count = 0;
+			/** \brief Sum of values, in nanoseconds */
+			uint64_t sum = 0;
+			/** \brief Largest value, in nanoseconds */
+			uint64_t max = 0;
+
+			/** \brief Add counts of another histogram.
+			 *  \param other: histogram to merge.
+			 */
+			void merge(const HistogramSnapshot & other);
+
+			/** \brief Get value at given quantile.
+			 *  \param q: quantile, between 0 and 1.
+			 *  \returns value, in nanoseconds; lower bound of the bucket holding it.
+			 */
+			uint64_t percentile(const double q) const;
+
+			/** \brief Get mean value.
+			 *  \returns mean, in nanoseconds.
+			 */
+			double mean() const;
+		};
+
+		/** \brief Snapshot of the metrics of one kind of request. */
+		struct SeriesSnapshot {
+			/** \brief Module name */
+			std::string module;
+			/** \brief Action code */
+			int action = 0;
+			/** \brief Number of requests */
+			uint64_t requests = 0;
+			/** \brief Number of bytes posted */
+			uint64_t bytes_sent = 0;
+			/** \brief Number of bytes received */
+			uint64_t bytes_received = 0;
+			/** \brief Latency of each phase, indexed by Phase */
+			std::array<HistogramSnapshot, kPhaseCount> phases;
+		};
+
+		/** \brief Take a snapshot of metrics recorded by all threads so far.
+		 *  \returns one entry per module and action, sorted.
+		 */
+		std::vector<SeriesSnapshot> snapshot();
+
+		/** \brief Format a snapshot in Prometheus text exposition format.
+		 *  \param series: snapshot to format.
+		 *  \returns text.
+		 */
+		std::string to_prometheus(const std::vector<SeriesSnapshot> & series);
+
+		/** \brief Format current metrics in Prometheus text exposition format.
+		 *  \returns text.
+		 */
+		std::string prometheus();
+
+		/** \brief Reset all metrics. Values being recorded at the same time may be lost. */
+		void reset();
+
+		/** \brief Metrics of one kind of request, recorded by one thread. */
+		struct Series {
+			std::atomic<uint64_t> requests{0};
+			std::atomic<uint64_t> bytes_sent{0};
+			std::atomic<uint64_t> bytes_received{0};
+			std::array<LatencyHistogram, kPhaseCount> phases;
+		};
+
+		/** \brief Start recording a new request on calling thread.
+		 *  Following phases of the thread are recorded for this module and action.
+		 *  \param module: module name.
+		 *  \param action: action code.
+		 */
+		void begin_request(const std::string & module, const int action);
+
+		/** \brief Get series of the request being recorded on calling thread.
+		 *  \returns series.
+		 */
+		Series & current();
+
+		/** \brief Record the duration of a phase, from construction to destruction. */
+		class PhaseTimer {
+		private:
+      Phase phase;
+      std::chrono::steady_clock::time_point start;
+		public:
+      explicit PhaseTimer(const Phase phase) : phase(phase), start(std::chrono::steady_clock::now()) {}
+      ~PhaseTimer() {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start);
+        current().phases[static_cast<size_t>(this->phase)].record(elapsed.count());
+      }
+      PhaseTimer(const PhaseTimer &) = delete;
+      PhaseTimer & operator=(const PhaseTimer &) = delete;
+		};
+
+		/** \brief Add to a per-thread counter without a locked instruction; the calling thread is the only writer.
+		 *  \param counter: counter.
+		 *  \param n: value to add.
+		 */
+		inline void add(std::atomic<uint64_t> & counter, const uint64_t n) {
+			counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+		}
+
+		/** \brief Record the duration of a phase that ends in a later call, such as a request run by an event loop.
+		 *  The phase counts toward the request being recorded on the calling thread at construction;
+		 *  it must end on that thread.
+		 */
+		class PendingPhase {
+		private:
+      Series * series;
+      Phase phase;
+      std::chrono::steady_clock::time_point start;
+		public:
+      explicit PendingPhase(const Phase phase) : series(&current()), phase(phase), start(std::chrono::steady_clock::now()) {}
+
+      /** \brief Record phase duration and transferred bytes.
+       *  \param sent: number of bytes sent.
+       *  \param received: number of bytes received.
+       */
+      void finish(const uint64_t sent, const uint64_t received) {
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - this->start);
+        this->series->phases[static_cast<size_t>(this->phase)].record(elapsed.count());
+        add(this->series->bytes_sent, sent);
+        add(this->series->bytes_received, received);
+      }
+		};
+	}
+}
+
+#if TPLINK_METRICS==1
+  #define TP_METRICS_CONCAT_(a, b) a##b
+  #define TP_METRICS_CONCAT(a, b) TP_METRICS_CONCAT_(a, b)
+  #define TP_METRICS_REQUEST(module, action) tplink::metrics::begin_request(module, action)
+  #define TP_METRICS_PHASE(phase) tplink::metrics::PhaseTimer TP_METRICS_CONCAT(tp_metrics_timer_, __LINE__)(tplink::metrics::Phase::phase)
+  #define TP_METRICS_BYTES(sent, received) do { \
+      auto & tp_metrics_series = tplink::metrics::current(); \
+      tplink::metrics::add(tp_metrics_series.bytes_sent, sent); \
+      tplink::metrics::add(tp_metrics_series.bytes_received, received); \
+    } while (0)
+#else
+  #define TP_METRICS_REQUEST(module, action)
+  #define TP_METRICS_PHASE(phase)
+  #define TP_METRICS_BYTES(sent, received)
+#endif
@@ -0,0 +1,441 @@
+/** \file tp_m7350_outbox.cxx
+ *	Persistent SMS outbox for the TP-Link M7350 interface.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_outbox.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tplink {
+
+	/* Journal layout:
+		[header, kDataOffset bytes][record][record]...
+	Each record is a RecordHeader followed by the recipient number and the message
+	text, padded to a multiple of 8 bytes. Only the state, result and attempts fields
+	of a record change once it has been written. */
+
+	/** \brief Journal file identifier */
+	static const char kJournalMagic[8] = {'T','P','O','U','T','B','O','X'};
+
+	/** \brief Journal format version */
+	static const uint32_t kJournalVersion = 1;
+
+	/** \brief Offset of first record */
+	static const uint64_t kDataOffset = 64;
+
+	/** \brief Initial journal file size */
+	static const size_t kInitialSize = 64*1024;
+
+	/** \brief Journal header, stored at offset 0. */
+	struct JournalHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t reserved;
+		uint64_t head; ///< first entry without a recorded outcome
+		uint64_t committed; ///< end of durable data
+		uint64_t next_sequence; ///< sequence number of next entry
+	};
+	static_assert(sizeof(JournalHeader) <= kDataOffset, "journal header too large");
+
+	/** \brief Record header. */
+	struct RecordHeader {
+		uint32_t size; ///< record size including header and padding
+		uint32_t checksum; ///< checksum of number and message
+		uint64_t sequence;
+		uint32_t message_size;
+		uint16_t number_size;
+		uint8_t state;
+		int8_t result;
+		uint8_t attempts;
+		uint8_t reserved[7];
+	};
+	static_assert(sizeof(RecordHeader) == 32, "unexpected record header size");
+
+	/** \brief Compute the FNV-1a hash of record data.
+	 *	\param number: recipient number.
+	 *	\param number_size: size of recipient number.
+	 *	\param message: text message.
+	 *	\param message_size: size of text message.
+	 *	\returns 32-bit hash.
+	 */
+	static uint32_t record_checksum(const char * number, const size_t number_size, const char * message, const size_t message_size) {
+		uint32_t h = 2166136261u;
+		for (size_t i=0; i<number_size; i++)
+			h = (h ^ static_cast<uint8_t>(number[i])) * 16777619u;
+		for (size_t i=0; i<message_size; i++)
+			h = (h ^ static_cast<uint8_t>(message[i])) * 16777619u;
+		return h;
+	}
+
+
+	SMSOutbox::SMSOutbox(const std::string & path) {
+		this->open(path);
+	}
+
+
+	SMSOutbox::~SMSOutbox() {
+		this->close();
+	}
+
+
+	bool SMSOutbox::open(const std::string & path, const size_t reserve) {
+		this->close();
+		this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (this->fd < 0) {
+			LOG_E("Cannot open outbox journal ", path, ": ", strerror(errno));
+			return false;
+		}
+		struct stat st;
+		if (fstat(this->fd, &st) != 0) {
+			LOG_E("Cannot access outbox journal ", path, ": ", strerror(errno));
+			this->close();
+			return false;
+		}
+		bool is_new = st.st_size == 0;
+		this->capacity = is_new ? kInitialSize : st.st_size;
+		if (is_new && ftruncate(this->fd, this->capacity) != 0) {
+			LOG_E("Cannot resize outbox journal ", path, ": ", strerror(errno));
+			this->close();
+			return false;
+		}
+		// reserve the address space once, so that the mapping never moves when the file grows
+		this->reserved = std::max(reserve, this->capacity);
+		auto addr = mmap(nullptr, this->reserved, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+		if (addr == MAP_FAILED) {
+			LOG_E("Cannot map outbox journal ", path, ": ", strerror(errno));
+			this->base = nullptr;
+			this->close();
+			return false;
+		}
+		this->base = static_cast<char*>(addr);
+
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		if (is_new) {
+			std::memcpy(header->magic, kJournalMagic, sizeof(kJournalMagic));
+			header->version = kJournalVersion;
+			header->head = kDataOffset;
+			header->committed = kDataOffset;
+			header->next_sequence = 1;
+			if (!this->sync_range(0, kDataOffset)) {
+				this->close();
+				return false;
+			}
+		} else if (std::memcmp(header->magic, kJournalMagic, sizeof(kJournalMagic)) || header->version != kJournalVersion) {
+			LOG_E("File ", path, " isn't an outbox journal.");
+			this->close();
+			return false;
+		}
+
+		if (!this->recover()) {
+			this->close();
+			return false;
+		}
+		LOG_I("Opened outbox journal ", path, " with ", this->pending(), " pending message(s).");
+		return true;
+	}
+
+
+	void SMSOutbox::close() {
+		if (this->base != nullptr) {
+			this->wait_committed(this->tail);
+			munmap(this->base, this->reserved);
+			this->base = nullptr;
+		}
+		if (this->fd >= 0) {
+			::close(this->fd);
+			this->fd = -1;
+		}
+		this->tail = 0;
+		this->capacity = 0;
+		this->reserved = 0;
+	}
+
+
+	bool SMSOutbox::is_open() const {
+		return this->base != nullptr;
+	}
+
+
+	void SMSOutbox::set_max_attempts(const unsigned int attempts) {
+		this->max_attempts = std::max(attempts, 1u);
+	}
+
+
+	bool SMSOutbox::recover() {
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		if (header->committed < kDataOffset || header->committed > this->capacity
+				|| header->head < kDataOffset || header->head > header->committed) {
+			LOG_E("Outbox journal header is corrupted.");
+			return false;
+		}
+		// verify committed records; a damaged record ends the journal
+		auto offset = header->head;
+		while (offset < header->committed) {
+			auto record = reinterpret_cast<const RecordHeader*>(this->base + offset);
+			auto data = this->base + offset + sizeof(RecordHeader);
+			if (header->committed - offset < sizeof(RecordHeader) || record->size < sizeof(RecordHeader)
+					|| record->size > header->committed - offset
+					|| sizeof(RecordHeader) + record->number_size + record->message_size > record->size
+					|| record->checksum != record_checksum(data, record->number_size, data + record->number_size, record->message_size)) {
+				LOG_E("Outbox journal is damaged at offset ", offset, "; discarding what follows.");
+				header->committed = offset;
+				break;
+			}
+			offset += record->size;
+		}
+		this->tail = header->committed;
+		return true;
+	}
+
+
+	bool SMSOutbox::sync_range(const uint64_t begin, const uint64_t end) const {
+		if (end <= begin) return true;
+		static const uint64_t page_size = sysconf(_SC_PAGESIZE);
+		auto start = begin - begin % page_size;
+		if (msync(this->base + start, end - start, MS_SYNC) != 0) {
+			LOG_E("Cannot sync outbox journal: ", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+
+	bool SMSOutbox::ensure_capacity(const uint64_t size) {
+		if (size <= this->capacity) return true;
+		auto new_capacity = this->capacity;
+		while (new_capacity < size)
+			new_capacity *= 2;
+		new_capacity = std::min(new_capacity, this->reserved);
+		if (new_capacity < size) {
+			LOG_E("Outbox journal is full.");
+			return false;
+		}
+		if (ftruncate(this->fd, new_capacity) != 0) {
+			LOG_E("Cannot resize outbox journal: ", strerror(errno));
+			return false;
+		}
+		this->capacity = new_capacity;
+		return true;
+	}
+
+
+	uint64_t SMSOutbox::append(const std::string & phone_number, const std::string & message) {
+		if (phone_number.size() > UINT16_MAX || message.size() > UINT32_MAX/2) {
+			LOG_E("Message too large for outbox.");
+			return 0;
+		}
+		auto size = (sizeof(RecordHeader) + phone_number.size() + message.size() + 7) & ~uint64_t(7);
+		if (!this->ensure_capacity(this->tail + size))
+			return 0;
+
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		auto record = reinterpret_cast<RecordHeader*>(this->base + this->tail);
+		auto data = this->base + this->tail + sizeof(RecordHeader);
+		std::memset(record, 0, size);
+		record->size = size;
+		record->sequence = header->next_sequence++;
+		record->number_size = phone_number.size();
+		record->message_size = message.size();
+		record->state = static_cast<uint8_t>(OutboxState::Pending);
+		record->result = -1;
+		std::memcpy(data, phone_number.data(), phone_number.size());
+		std::memcpy(data + phone_number.size(), message.data(), message.size());
+		record->checksum = record_checksum(data, phone_number.size(), data + phone_number.size(), message.size());
+
+		this->tail += size;
+		return this->tail;
+	}
+
+
+	bool SMSOutbox::wait_committed(const uint64_t offset) {
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (header->committed < offset) {
+			if (this->syncing) {
+				// another thread is syncing; it may cover our data too
+				this->committed_cv.wait(lock);
+				continue;
+			}
+			// become the syncing thread for everything appended so far
+			this->syncing = true;
+			auto begin = header->committed;
+			auto end = this->tail;
+			lock.unlock();
+			// data must reach the disk before the header points past it
+			auto success = this->sync_range(begin, end);
+			if (success) {
+				lock.lock();
+				header->committed = end;
+				lock.unlock();
+				success = this->sync_range(0, kDataOffset);
+			}
+			lock.lock();
+			this->syncing = false;
+			this->committed_cv.notify_all();
+			if (!success) return false;
+		}
+		return true;
+	}
+
+
+	bool SMSOutbox::enqueue(const std::string & phone_number, const std::string & message) {
+		if (!this->is_open()) {
+			LOG_E("Outbox journal isn't open.");
+			return false;
+		}
+		uint64_t offset;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			offset = this->append(phone_number, message);
+		}
+		return offset > 0 && this->wait_committed(offset);
+	}
+
+
+	bool SMSOutbox::enqueue(const std::vector<std::pair<std::string, std::string> > & messages) {
+		if (!this->is_open()) {
+			LOG_E("Outbox journal isn't open.");
+			return false;
+		}
+		uint64_t offset = 0;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			for (auto & m: messages) {
+				offset = this->append(m.first, m.second);
+				if (offset == 0) return false;
+			}
+		}
+		return this->wait_committed(offset);
+	}
+
+
+	OutboxEntry SMSOutbox::read_entry(const uint64_t offset) const {
+		auto record = reinterpret_cast<const RecordHeader*>(this->base + offset);
+		auto data = this->base + offset + sizeof(RecordHeader);
+		OutboxEntry entry;
+		entry.sequence = record->sequence;
+		entry.phone_number.assign(data, record->number_size);
+		entry.message.assign(data + record->number_size, record->message_size);
+		entry.state = static_cast<OutboxState>(record->state);
+		entry.result = record->result;
+		entry.attempts = record->attempts;
+		return entry;
+	}
+
+
+	size_t SMSOutbox::drain(const TPLink_M7350 & modem, const std::function<void(const OutboxEntry &)> & callback) {
+		if (!this->is_open()) {
+			LOG_E("Outbox journal isn't open.");
+			return 0;
+		}
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		size_t processed = 0;
+		for (;;) {
+			OutboxEntry entry;
+			uint64_t offset, size;
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				offset = header->head;
+				if (offset >= header->committed) break;
+				auto record = reinterpret_cast<RecordHeader*>(this->base + offset);
+				size = record->size;
+				entry = this->read_entry(offset);
+			}
+			auto record = reinterpret_cast<RecordHeader*>(this->base + offset);
+
+			while (entry.state != OutboxState::Done) {
+				// record the attempt before the message leaves, so that a restart knows about it
+				{
+					std::lock_guard<std::mutex> lock(this->mutex);
+					record->state = static_cast<uint8_t>(OutboxState::Sending);
+					record->attempts = ++entry.attempts;
+				}
+				if (!this->sync_range(offset, offset + sizeof(RecordHeader)))
+					return processed;
+
+				int8_t result;
+				modem.send_sms(entry.phone_number, entry.message, result);
+				if (result < 0) {
+					// the modem didn't accept the message; leave the entry for a later drain
+					LOG_E("Cannot send message ", entry.sequence, "; stopping outbox drain.");
+					std::lock_guard<std::mutex> lock(this->mutex);
+					record->state = static_cast<uint8_t>(OutboxState::Pending);
+					record->attempts = --entry.attempts;
+					return processed;
+				}
+				entry.result = result;
+				// a message that was sent but not saved on the modem is still delivered
+				auto delivered = result == MessageReturnCode::SendSuccessSaveSuccess
+					|| result == MessageReturnCode::SendSuccessSaveFailure;
+				// a message accepted by the modem with an unknown outcome may have been sent: never send it again
+				auto unknown = result == MessageReturnCode::Sending;
+				entry.state = (delivered || unknown || entry.attempts >= this->max_attempts) ? OutboxState::Done : OutboxState::Pending;
+				std::lock_guard<std::mutex> lock(this->mutex);
+				record->result = result;
+				record->state = static_cast<uint8_t>(entry.state);
+			}
+
+			// outcome must be durable before the head moves past the entry
+			if (!this->sync_range(offset, offset + sizeof(RecordHeader)))
+				return processed;
+			{
+				std::lock_guard<std::mutex> lock(this->mutex);
+				header->head = offset + size;
+			}
+			if (!this->sync_range(0, kDataOffset))
+				return processed;
+
+			processed++;
+			if (callback) callback(entry);
+		}
+		return processed;
+	}
+
+
+	size_t SMSOutbox::pending() const {
+		if (!this->is_open()) return 0;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto header = reinterpret_cast<const JournalHeader*>(this->base);
+		size_t count = 0;
+		for (auto offset = header->head; offset < header->committed; ) {
+			auto record = reinterpret_cast<const RecordHeader*>(this->base + offset);
+			if (record->state != static_cast<uint8_t>(OutboxState::Done)) count++;
+			offset += record->size;
+		}
+		return count;
+	}
+
+
+	std::vector<OutboxEntry> SMSOutbox::entries() const {
+		std::vector<OutboxEntry> result;
+		if (!this->is_open()) return result;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto header = reinterpret_cast<const JournalHeader*>(this->base);
+		for (auto offset = kDataOffset; offset < header->committed; ) {
+			result.push_back(this->read_entry(offset));
+			offset += reinterpret_cast<const RecordHeader*>(this->base + offset)->size;
+		}
+		return result;
+	}
+
+
+	bool SMSOutbox::compact() {
+		if (!this->is_open()) return false;
+		auto header = reinterpret_cast<JournalHeader*>(this->base);
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->syncing || this->tail != header->committed || header->head != header->committed)
+				return false;
+			header->head = kDataOffset;
+			header->committed = kDataOffset;
+			this->tail = kDataOffset;
+		}
+		return this->sync_range(0, kDataOffset);
+	}
+}
@@ -0,0 +1,198 @@
+/** \file tp_m7350_outbox.h
+ *  Persistent SMS outbox for the TP-Link M7350 interface. Messages are
+ *  appended to a memory-mapped journal and flushed to disk in groups, then
+ *  drained through a logged-in TPLink_M7350 session. The journal records the
+ *  outcome of every message, so that a process restarted in the middle of a
+ *  sending loop resumes where it stopped.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <utility>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief State of an outbox entry. */
+	enum class OutboxState : uint8_t {
+		Pending = 0, ///< Not sent yet
+		Sending = 1, ///< Handed to the modem; outcome unknown if found after a restart
+		Done = 2 ///< Outcome recorded
+	};
+
+	/** \brief Copy of an outbox journal entry. */
+	struct OutboxEntry {
+		/** \brief Sequence number, unique within a journal */
+		uint64_t sequence;
+		/** \brief Recipient number */
+		std::string phone_number;
+		/** \brief Message text */
+		std::string message;
+		/** \brief Entry state */
+		OutboxState state;
+		/** \brief Last send status (see MessageReturnCode), or -1 if never sent;
+		 *  MessageReturnCode::Sending if the modem accepted the message but its outcome is unknown */
+		int8_t result;
+		/** \brief Number of send attempts */
+		uint8_t attempts;
+	};
+
+	/** \brief Crash-safe SMS outbox backed by a memory-mapped journal.
+	 *
+	 *  Entries are appended at the journal tail and become durable once a
+	 *  commit has synced them to disk. Concurrent callers of #enqueue share a
+	 *  single sync (group commit): the first waiter syncs everything appended so
+	 *  far, the others wait for it to complete.
+	 *
+	 *  The journal stores a head offset (first entry without a recorded outcome)
+	 *  and a committed offset (end of durable data). On opening, anything past
+	 *  the committed offset is discarded, and draining resumes at the head.
+	 *  Entries found in #OutboxState::Sending after a restart may or may not have
+	 *  been sent; they are sent again, so delivery is at-least-once.
+	 */
+	class SMSOutbox {
+	private:
+    /** \brief Journal file descriptor */
+    int fd = -1;
+
+    /** \brief Start of mapped journal */
+    char * base = nullptr;
+
+    /** \brief Size of reserved address space */
+    size_t reserved = 0;
+
+    /** \brief Current journal file size */
+    size_t capacity = 0;
+
+    /** \brief End of appended data (not necessarily durable) */
+    uint64_t tail = 0;
+
+    /** \brief True while a thread is syncing the journal */
+    bool syncing = false;
+
+    /** \brief Maximum number of send attempts per entry */
+    unsigned int max_attempts = 1;
+
+    /** \brief Guards tail, capacity and commit state */
+    mutable std::mutex mutex;
+
+    /** \brief Signals the end of a commit */
+    std::condition_variable committed_cv;
+
+    /** \brief Append a record at the journal tail.
+     *  \param phone_number: recipient number.
+     *  \param message: text message.
+     *  \returns journal offset past the new record, or 0 if the journal is full.
+     */
+    uint64_t append(const std::string & phone_number, const std::string & message);
+
+    /** \brief Wait until given offset is durable, syncing the journal if no other thread does.
+     *  \param offset: journal offset to wait for.
+     *  \returns true if successful, false if syncing failed.
+     */
+    bool wait_committed(const uint64_t offset);
+
+    /** \brief Flush a journal range to disk.
+     *  \param begin: start offset.
+     *  \param end: end offset.
+     *  \returns true if successful, false otherwise.
+     */
+    bool sync_range(const uint64_t begin, const uint64_t end) const;
+
+    /** \brief Make sure the journal file can hold given size.
+     *  \param size: required size in bytes.
+     *  \returns true if successful, false if the reserved space is exhausted.
+     */
+    bool ensure_capacity(const uint64_t size);
+
+    /** \brief Verify journal content and set tail; called on opening.
+     *  \returns true if journal is consistent, false otherwise.
+     */
+    bool recover();
+
+    /** \brief Copy the record located at given offset.
+     *  \param offset: record offset.
+     *  \returns entry copy.
+     */
+    OutboxEntry read_entry(const uint64_t offset) const;
+
+	public:
+    /** \brief Default constructor. */
+    SMSOutbox() = default;
+
+    /** \brief Constructor opening given journal.
+     *  \param path: journal file path.
+     */
+    explicit SMSOutbox(const std::string & path);
+
+    SMSOutbox(const SMSOutbox &) = delete;
+    SMSOutbox & operator=(const SMSOutbox &) = delete;
+
+    /** \brief Destructor; syncs and closes the journal. */
+    ~SMSOutbox();
+
+    /** \brief Open given journal, creating it if necessary.
+     *  \param path: journal file path.
+     *  \param reserve: maximum journal size in bytes.
+     *  \returns true if successful, false otherwise.
+     */
+    bool open(const std::string & path, const size_t reserve = size_t(1) << 28);
+
+    /** \brief Sync and close the journal. */
+    void close();
+
+    /** \brief Check whether a journal is open.
+     *  \returns true if a journal is open, false otherwise.
+     */
+    bool is_open() const;
+
+    /** \brief Set how many times a message is tried before its failure is final.
+     *  \param attempts: maximum number of attempts (at least 1).
+     */
+    void set_max_attempts(const unsigned int attempts);
+
+    /** \brief Add a message to the outbox. Returns once the message is durable.
+     *  \param phone_number: recipient number.
+     *  \param message: text message.
+     *  \returns true if successful, false otherwise.
+     */
+    bool enqueue(const std::string & phone_number, const std::string & message);
+
+    /** \brief Add several messages to the outbox with a single sync.
+     *  \param messages: list of (recipient number, text message) pairs.
+     *  \returns true if successful, false otherwise.
+     */
+    bool enqueue(const std::vector<std::pair<std::string, std::string> > & messages);
+
+    /** \brief Send pending messages through given session.
+     *  Outcomes are recorded in the journal as they arrive. Draining stops at the
+     *  end of committed data, or when the session can't send anymore.
+     *  \param modem: logged-in modem session.
+     *  \param callback: optional function called with each entry once its outcome is recorded.
+     *  \returns number of entries processed.
+     */
+    size_t drain(const TPLink_M7350 & modem, const std::function<void(const OutboxEntry &)> & callback = nullptr);
+
+    /** \brief Get number of committed entries without a recorded outcome.
+     *  \returns number of entries.
+     */
+    size_t pending() const;
+
+    /** \brief List committed entries still held in the journal.
+     *  \returns list of entry copies.
+     */
+    std::vector<OutboxEntry> entries() const;
+
+    /** \brief Drop all entries if every one of them has a recorded outcome.
+     *  \returns true if journal was emptied, false otherwise.
+     */
+    bool compact();
+	};
+}
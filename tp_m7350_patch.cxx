@@ -0,0 +1,415 @@
+/** \file tp_m7350_patch.cxx
+ *	JSON patches (RFC 6902) between successive replies of a TP-Link M7350 modem.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_patch.h"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+namespace tplink {
+
+	struct HashNode {
+		/** \brief Hash of value */
+		uint64_t hash = 0;
+		/** \brief Hashes of array elements or object members, in value order */
+		std::vector<HashNode> children;
+	};
+
+	using Allocator = rj::Document::AllocatorType;
+
+	/** \brief Mix bits of a 64-bit value (splitmix64 finalizer).
+	 *	\param x: value.
+	 *	\returns mixed value.
+	 */
+	static uint64_t mix(uint64_t x) {
+		x ^= x >> 30;
+		x *= 0xbf58476d1ce4e5b9ull;
+		x ^= x >> 27;
+		x *= 0x94d049bb133111ebull;
+		return x ^ (x >> 31);
+	}
+
+	/** \brief Compute 64-bit FNV-1a hash of a byte string.
+	 *	\param s: bytes.
+	 *	\param size: number of bytes.
+	 *	\returns hash.
+	 */
+	static uint64_t fnv1a(const char * s, const size_t size) {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (size_t i=0; i<size; i++) {
+			h ^= static_cast<unsigned char>(s[i]);
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+
+	/** \brief Hash a JSON value and its subtrees.
+	 *	\param v: value.
+	 *	\param node: receives hashes.
+	 */
+	static void hash_tree(const rj::Value & v, HashNode & node) {
+		uint64_t h = mix(static_cast<uint64_t>(v.GetType()) + 1);
+		if (v.IsString()) {
+			h ^= fnv1a(v.GetString(), v.GetStringLength());
+		} else if (v.IsNumber()) {
+			uint64_t bits;
+			if (v.IsInt64()) {
+				bits = static_cast<uint64_t>(v.GetInt64());
+			} else if (v.IsUint64()) {
+				bits = v.GetUint64();
+			} else {
+				double d = v.GetDouble();
+				std::memcpy(&bits, &d, sizeof(bits));
+				h = ~h;
+			}
+			h ^= mix(bits);
+		} else if (v.IsArray()) {
+			node.children.resize(v.Size());
+			size_t i = 0;
+			for (auto e = v.Begin(); e != v.End(); e++, i++) {
+				hash_tree(*e, node.children[i]);
+				h = mix(h ^ node.children[i].hash);
+			}
+		} else if (v.IsObject()) {
+			// member order doesn't matter
+			node.children.resize(v.MemberCount());
+			size_t i = 0;
+			for (auto m = v.MemberBegin(); m != v.MemberEnd(); m++, i++) {
+				hash_tree(m->value, node.children[i]);
+				h += mix(fnv1a(m->name.GetString(), m->name.GetStringLength()) ^ mix(node.children[i].hash));
+			}
+		}
+		node.hash = h;
+	}
+
+	/** \brief Escape a member name for a JSON pointer.
+	 *	\param name: member name.
+	 *	\returns pointer token.
+	 */
+	static std::string escape(const rj::Value & name) {
+		std::string token;
+		for (auto p = name.GetString(), end = p + name.GetStringLength(); p != end; p++) {
+			if (*p == '~') token += "~0";
+			else if (*p == '/') token += "~1";
+			else token += *p;
+		}
+		return token;
+	}
+
+	/** \brief Append an operation to a patch.
+	 *	\param patch: patch array.
+	 *	\param op: operation name.
+	 *	\param path: target pointer.
+	 *	\param value: operation value, or nullptr for remove.
+	 *	\param allocator: patch allocator.
+	 */
+	static void push_op(rj::Value & patch, const char * op, const std::string & path, const rj::Value * value, Allocator & allocator) {
+		rj::Value o(rj::kObjectType);
+		o.AddMember("op", rj::StringRef(op), allocator);
+		o.AddMember("path", rj::Value(path.c_str(), allocator), allocator);
+		if (value != nullptr)
+			o.AddMember("value", rj::Value(*value, allocator), allocator);
+		patch.PushBack(o, allocator);
+	}
+
+	/** \brief Add operations turning a value into another, skipping subtrees with equal hashes.
+	 *	\param a: original value.
+	 *	\param ha: hashes of original value.
+	 *	\param b: new value.
+	 *	\param hb: hashes of new value.
+	 *	\param path: pointer to values.
+	 *	\param patch: patch array.
+	 *	\param allocator: patch allocator.
+	 */
+	static void diff(const rj::Value & a, const HashNode & ha, const rj::Value & b, const HashNode & hb, const std::string & path, rj::Value & patch, Allocator & allocator) {
+		if (ha.hash == hb.hash) return;
+		if (a.IsObject() && b.IsObject()) {
+			size_t j = 0;
+			for (auto m = b.MemberBegin(); m != b.MemberEnd(); m++, j++) {
+				auto child = path + '/' + escape(m->name);
+				auto was = a.FindMember(m->name);
+				if (was == a.MemberEnd())
+					push_op(patch, "add", child, &m->value, allocator);
+				else
+					diff(was->value, ha.children[was - a.MemberBegin()], m->value, hb.children[j], child, patch, allocator);
+			}
+			for (auto m = a.MemberBegin(); m != a.MemberEnd(); m++) {
+				if (!b.HasMember(m->name))
+					push_op(patch, "remove", path + '/' + escape(m->name), nullptr, allocator);
+			}
+		} else if (a.IsArray() && b.IsArray()) {
+			// only the middle part, between common head and tail, changed
+			size_t na = a.Size(), nb = b.Size(), head = 0, tail = 0;
+			while (head < na && head < nb && ha.children[head].hash == hb.children[head].hash) head++;
+			while (tail < na - head && tail < nb - head && ha.children[na - 1 - tail].hash == hb.children[nb - 1 - tail].hash) tail++;
+			size_t ma = na - head - tail, mb = nb - head - tail, common = std::min(ma, mb);
+			for (size_t k=head; k<head + common; k++)
+				diff(a[rj::SizeType(k)], ha.children[k], b[rj::SizeType(k)], hb.children[k], path + '/' + std::to_string(k), patch, allocator);
+			for (size_t k=head + common; k<head + mb; k++)
+				push_op(patch, "add", path + '/' + std::to_string(k), &b[rj::SizeType(k)], allocator);
+			// each removal shifts following elements down
+			for (size_t k=common; k<ma; k++)
+				push_op(patch, "remove", path + '/' + std::to_string(head + common), nullptr, allocator);
+		} else {
+			push_op(patch, "replace", path, &b, allocator);
+		}
+	}
+
+
+	rj::Document json_diff(const rj::Value & from, const rj::Value & to) {
+		HashNode hf, ht;
+		hash_tree(from, hf);
+		hash_tree(to, ht);
+		rj::Document patch;
+		patch.SetArray();
+		diff(from, hf, to, ht, "", patch, patch.GetAllocator());
+		return patch;
+	}
+
+
+	/** \brief Split a JSON pointer into unescaped tokens.
+	 *	\param pointer: JSON pointer.
+	 *	\param tokens: receives tokens.
+	 *	\returns true if pointer is valid.
+	 */
+	static bool parse_pointer(const std::string & pointer, std::vector<std::string> & tokens) {
+		tokens.clear();
+		if (pointer.empty()) return true;
+		if (pointer[0] != '/') return false;
+		for (size_t i=1; i<=pointer.size(); i++) {
+			if (i == 1 || pointer[i - 1] == '/') tokens.emplace_back();
+			if (i == pointer.size()) break;
+			char c = pointer[i];
+			if (c == '/') continue;
+			if (c == '~') {
+				if (i + 1 >= pointer.size() || (pointer[i + 1] != '0' && pointer[i + 1] != '1')) return false;
+				c = pointer[++i] == '0' ? '~' : '/';
+			}
+			tokens.back() += c;
+		}
+		return true;
+	}
+
+	/** \brief Parse an array index token.
+	 *	\param token: pointer token.
+	 *	\param size: array size.
+	 *	\param end_ok: true if index may equal size (or be "-"), as for additions.
+	 *	\param index: receives index.
+	 *	\returns true if token is a valid index.
+	 */
+	static bool parse_index(const std::string & token, const size_t size, const bool end_ok, size_t & index) {
+		if (token == "-" && end_ok) {
+			index = size;
+			return true;
+		}
+		if (token.empty() || token.size() > 9 || (token.size() > 1 && token[0] == '0')) return false;
+		index = 0;
+		for (auto c: token) {
+			if (c < '0' || c > '9') return false;
+			index = index*10 + (c - '0');
+		}
+		return index < size || (end_ok && index == size);
+	}
+
+	/** \brief Find value designated by pointer tokens.
+	 *	\param root: document root.
+	 *	\param tokens: pointer tokens.
+	 *	\param count: number of tokens to follow.
+	 *	\returns value, or nullptr if there is none.
+	 */
+	static rj::Value * find(rj::Value & root, const std::vector<std::string> & tokens, const size_t count) {
+		auto v = &root;
+		for (size_t i=0; i<count; i++) {
+			if (v->IsObject()) {
+				auto m = v->FindMember(tokens[i].c_str());
+				if (m == v->MemberEnd()) return nullptr;
+				v = &m->value;
+			} else if (v->IsArray()) {
+				size_t index;
+				if (!parse_index(tokens[i], v->Size(), false, index)) return nullptr;
+				v = &(*v)[rj::SizeType(index)];
+			} else {
+				return nullptr;
+			}
+		}
+		return v;
+	}
+
+	const rj::Value * json_get(const rj::Value & root, const std::string & pointer) {
+		std::vector<std::string> tokens;
+		if (!parse_pointer(pointer, tokens)) return nullptr;
+		return find(const_cast<rj::Value &>(root), tokens, tokens.size());
+	}
+
+
+	/** \brief Insert a value at pointer location.
+	 *	\param root: document root.
+	 *	\param tokens: pointer tokens.
+	 *	\param value: value to insert; moved from.
+	 *	\param allocator: document allocator.
+	 *	\returns true if value was inserted.
+	 */
+	static bool add(rj::Value & root, const std::vector<std::string> & tokens, rj::Value & value, Allocator & allocator) {
+		if (tokens.empty()) {
+			root = value;
+			return true;
+		}
+		auto parent = find(root, tokens, tokens.size() - 1);
+		if (parent == nullptr) return false;
+		auto & key = tokens.back();
+		if (parent->IsObject()) {
+			auto m = parent->FindMember(key.c_str());
+			if (m != parent->MemberEnd())
+				m->value = value;
+			else
+				parent->AddMember(rj::Value(key.c_str(), allocator), value, allocator);
+			return true;
+		}
+		size_t index;
+		if (!parent->IsArray() || !parse_index(key, parent->Size(), true, index)) return false;
+		parent->PushBack(value, allocator);
+		// bring new element down to its place
+		for (size_t i=parent->Size() - 1; i>index; i--)
+			(*parent)[rj::SizeType(i)].Swap((*parent)[rj::SizeType(i - 1)]);
+		return true;
+	}
+
+	/** \brief Remove the value at pointer location.
+	 *	\param root: document root.
+	 *	\param tokens: pointer tokens; not empty.
+	 *	\param removed: receives removed value, if not nullptr.
+	 *	\returns true if value was removed.
+	 */
+	static bool remove(rj::Value & root, const std::vector<std::string> & tokens, rj::Value * removed) {
+		auto parent = find(root, tokens, tokens.size() - 1);
+		if (parent == nullptr) return false;
+		auto & key = tokens.back();
+		if (parent->IsObject()) {
+			auto m = parent->FindMember(key.c_str());
+			if (m == parent->MemberEnd()) return false;
+			if (removed != nullptr) *removed = m->value;
+			parent->EraseMember(m);
+			return true;
+		}
+		size_t index;
+		if (!parent->IsArray() || !parse_index(key, parent->Size(), false, index)) return false;
+		if (removed != nullptr) *removed = (*parent)[rj::SizeType(index)];
+		parent->Erase(parent->Begin() + index);
+		return true;
+	}
+
+	/** \brief Get a string member of a patch operation.
+	 *	\param op: operation object.
+	 *	\param name: member name.
+	 *	\param value: receives member value.
+	 *	\returns true if member exists and is a string.
+	 */
+	static bool string_member(const rj::Value & op, const char * name, std::string & value) {
+		auto m = op.FindMember(name);
+		if (m == op.MemberEnd() || !m->value.IsString()) return false;
+		value.assign(m->value.GetString(), m->value.GetStringLength());
+		return true;
+	}
+
+
+	bool json_patch(rj::Document & document, const rj::Value & patch, std::string & error) {
+		if (!patch.IsArray()) {
+			error = "patch isn't an array";
+			return false;
+		}
+		// operations apply to a copy, swapped in once all succeeded
+		rj::Document work;
+		work.CopyFrom(document, work.GetAllocator());
+		auto & allocator = work.GetAllocator();
+		std::vector<std::string> path, from;
+		size_t n = 0;
+		for (auto o = patch.Begin(); o != patch.End(); o++, n++) {
+			auto failed = [&error, n](const char * what) {
+				error = "operation " + std::to_string(n) + ": " + what;
+				return false;
+			};
+			std::string op, pointer, source;
+			if (!o->IsObject() || !string_member(*o, "op", op) || !string_member(*o, "path", pointer))
+				return failed("op and path are required");
+			if (!parse_pointer(pointer, path)) return failed("invalid path");
+			auto value = o->FindMember("value");
+			bool has_value = value != o->MemberEnd();
+
+			if (op == "add" || op == "replace" || op == "test") {
+				if (!has_value) return failed("value is required");
+				if (op == "test") {
+					auto target = find(work, path, path.size());
+					if (target == nullptr || !(*target == value->value)) return failed("test failed");
+					continue;
+				}
+				if (op == "replace" && find(work, path, path.size()) == nullptr) return failed("path doesn't exist");
+				rj::Value v(value->value, allocator);
+				if (op == "replace" && !path.empty()) {
+					*find(work, path, path.size()) = v;
+				} else if (!add(work, path, v, allocator)) {
+					return failed("path can't be added to");
+				}
+			} else if (op == "remove") {
+				if (path.empty() || !remove(work, path, nullptr)) return failed("path doesn't exist");
+			} else if (op == "move" || op == "copy") {
+				if (!string_member(*o, "from", source) || !parse_pointer(source, from)) return failed("invalid from");
+				auto origin = find(work, from, from.size());
+				if (origin == nullptr) return failed("from doesn't exist");
+				rj::Value v;
+				if (op == "copy") {
+					v.CopyFrom(*origin, allocator);
+				} else {
+					// a value can't move into itself
+					if (pointer.compare(0, source.size(), source) == 0 && (pointer.size() == source.size() || pointer[source.size()] == '/')) {
+						if (pointer.size() == source.size()) continue;
+						return failed("can't move a value into itself");
+					}
+					if (from.empty()) return failed("can't move root");
+					remove(work, from, &v);
+				}
+				if (!add(work, path, v, allocator)) return failed("path can't be added to");
+			} else {
+				return failed("unknown operation");
+			}
+		}
+		document.Swap(work);
+		return true;
+	}
+
+
+	SnapshotDiff::SnapshotDiff() {}
+
+
+	SnapshotDiff::~SnapshotDiff() {}
+
+
+	rj::Document SnapshotDiff::update(const rj::Value & snapshot) {
+		auto hashes = std::make_unique<HashNode>();
+		hash_tree(snapshot, *hashes);
+		rj::Document patch;
+		patch.SetArray();
+		if (this->hashes == nullptr)
+			push_op(patch, "replace", "", &snapshot, patch.GetAllocator());
+		else
+			diff(this->previous, *this->hashes, snapshot, *hashes, "", patch, patch.GetAllocator());
+		// a fresh document, as allocators don't reclaim memory of replaced values
+		rj::Document next;
+		next.CopyFrom(snapshot, next.GetAllocator());
+		this->previous.Swap(next);
+		this->hashes = std::move(hashes);
+		return patch;
+	}
+
+
+	const rj::Document & SnapshotDiff::current() const {
+		return this->previous;
+	}
+
+
+	void SnapshotDiff::reset() {
+		this->previous.SetNull();
+		this->hashes.reset();
+	}
+}
@@ -0,0 +1,89 @@
+/** \file tp_m7350_patch.h
+ *  JSON patches (RFC 6902) between successive replies of a TP-Link M7350 modem.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <memory>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Hash of a JSON value and of its children. */
+	struct HashNode;
+
+	/** \brief Compute a patch turning a JSON value into another.
+	 *
+	 *  The patch is an array of RFC 6902 operations (add, remove, replace),
+	 *  with paths given as JSON pointers. Subtrees are compared by hash, so
+	 *  that only changed branches are walked; elements inserted in or removed
+	 *  from the middle of an array are found by skipping the elements arrays
+	 *  start and end with.
+	 *  \param from: original value.
+	 *  \param to: new value.
+	 *  \returns patch; an empty array if values are equal.
+	 */
+	rj::Document json_diff(const rj::Value & from, const rj::Value & to);
+
+	/** \brief Apply a patch to a JSON document.
+	 *
+	 *  Supports all RFC 6902 operations (add, remove, replace, move, copy,
+	 *  test). The patch is applied entirely or not at all.
+	 *  \param document: document to modify.
+	 *  \param patch: array of operations.
+	 *  \param error: receives a description of the first failed operation, if any.
+	 *  \returns true if patch was applied, false otherwise.
+	 */
+	bool json_patch(rj::Document & document, const rj::Value & patch, std::string & error);
+
+	/** \brief Find the value designated by a JSON pointer (RFC 6901).
+	 *  \param root: JSON value.
+	 *  \param pointer: JSON pointer, e.g. "/wan/signalStrength"; empty for root.
+	 *  \returns value, or nullptr if there is none.
+	 */
+	const rj::Value * json_get(const rj::Value & root, const std::string & pointer);
+
+	/** \brief Turns successive snapshots of a document into patches.
+	 *
+	 *  Keeps the last snapshot with the hashes of its subtrees, so that each
+	 *  new snapshot is hashed once and compared in time proportional to what
+	 *  changed. Typical use is to store or forward patches between successive
+	 *  get_status() or get_connected_devices() replies instead of full replies;
+	 *  the receiver rebuilds them with json_patch.
+	 *
+	 *  Equal hashes are taken for equal values; with 64-bit hashes, a change
+	 *  going unnoticed is negligibly unlikely.
+	 */
+	class SnapshotDiff {
+	private:
+    /** \brief Last snapshot */
+    rj::Document previous;
+
+    /** \brief Hashes of last snapshot; nullptr before first snapshot */
+    std::unique_ptr<HashNode> hashes;
+
+	public:
+    /** \brief Constructor. */
+    SnapshotDiff();
+
+    /** \brief Destructor. */
+    ~SnapshotDiff();
+
+    /** \brief Compute changes since last snapshot, and keep new snapshot.
+     *  \param snapshot: new snapshot.
+     *  \returns patch; an empty array if nothing changed, or a patch replacing
+     *  the whole document for the first snapshot.
+     */
+    rj::Document update(const rj::Value & snapshot);
+
+    /** \brief Get last snapshot.
+     *  \returns last snapshot; null before first snapshot.
+     */
+    const rj::Document & current() const;
+
+    /** \brief Forget last snapshot; next update returns a whole document. */
+    void reset();
+	};
+}
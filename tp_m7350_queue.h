@@ -0,0 +1,132 @@
+/** \file tp_m7350_queue.h
+ *  Bounded lock-free queue used to hand data between threads.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstddef>
+
+namespace tplink {
+
+	/** \brief Bounded multi-producer, multi-consumer lock-free queue.
+	 *
+	 *  Each cell carries a sequence number telling whether it is ready to be
+	 *  written or read at a given position (D. Vyukov's bounded MPMC queue).
+	 *  Producers and consumers only contend on their own position counter, and
+	 *  neither blocks: push fails when the queue is full, pop fails when it is empty.
+	 *
+	 *  \tparam T: stored type; must be default-constructible and movable.
+	 */
+	template <typename T>
+	class LockFreeQueue {
+	private:
+    /** \brief Queue cell. */
+    struct Cell {
+      std::atomic<size_t> sequence;
+      T data;
+    };
+
+    /** \brief Cell storage */
+    std::unique_ptr<Cell[]> cells;
+
+    /** \brief Capacity - 1; capacity is a power of 2 */
+    size_t mask;
+
+    /** \brief Next position to write */
+    alignas(64) std::atomic<size_t> write_pos{0};
+
+    /** \brief Next position to read */
+    alignas(64) std::atomic<size_t> read_pos{0};
+
+	public:
+    /** \brief Constructor.
+     *  \param capacity: minimum number of items the queue can hold; rounded up to a power of 2.
+     */
+    explicit LockFreeQueue(const size_t capacity) {
+      size_t size = 2;
+      while (size < capacity) size <<= 1;
+      this->cells.reset(new Cell[size]);
+      this->mask = size - 1;
+      for (size_t i=0; i<size; i++)
+        this->cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    LockFreeQueue(const LockFreeQueue &) = delete;
+    LockFreeQueue & operator=(const LockFreeQueue &) = delete;
+
+    /** \brief Append an item.
+     *  \param value: item to append; moved from if successful.
+     *  \returns true if successful, false if queue is full.
+     */
+    bool push(T && value) {
+      auto pos = this->write_pos.load(std::memory_order_relaxed);
+      for (;;) {
+        auto & cell = this->cells[pos & this->mask];
+        auto seq = cell.sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos);
+        if (diff == 0) {
+          if (this->write_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            cell.data = std::move(value);
+            cell.sequence.store(pos + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = this->write_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /** \brief Append a copy of an item.
+     *  \param value: item to append.
+     *  \returns true if successful, false if queue is full.
+     */
+    bool push(const T & value) {
+      T copy(value);
+      return this->push(std::move(copy));
+    }
+
+    /** \brief Remove the oldest item.
+     *  \param value: receives the item.
+     *  \returns true if successful, false if queue is empty.
+     */
+    bool pop(T & value) {
+      auto pos = this->read_pos.load(std::memory_order_relaxed);
+      for (;;) {
+        auto & cell = this->cells[pos & this->mask];
+        auto seq = cell.sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<std::ptrdiff_t>(seq) - static_cast<std::ptrdiff_t>(pos + 1);
+        if (diff == 0) {
+          if (this->read_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+            value = std::move(cell.data);
+            cell.sequence.store(pos + this->mask + 1, std::memory_order_release);
+            return true;
+          }
+        } else if (diff < 0) {
+          return false;
+        } else {
+          pos = this->read_pos.load(std::memory_order_relaxed);
+        }
+      }
+    }
+
+    /** \brief Get approximate number of queued items.
+     *  \returns number of items; may be outdated as soon as it returns.
+     */
+    size_t size() const {
+      auto w = this->write_pos.load(std::memory_order_relaxed);
+      auto r = this->read_pos.load(std::memory_order_relaxed);
+      return w > r ? w - r : 0;
+    }
+
+    /** \brief Get queue capacity.
+     *  \returns maximum number of items.
+     */
+    size_t capacity() const {
+      return this->mask + 1;
+    }
+	};
+}
@@ -0,0 +1,126 @@
+/** \file tp_m7350_scheduler.cxx
+ *	Priority scheduling and rate limiting of requests to a TP-Link M7350 modem.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_scheduler.h"
+#include <algorithm>
+
+namespace tplink {
+
+	Scheduler::Scheduler(const SchedulerOptions & options) : options(options) {
+		this->tokens = this->options.burst;
+		this->refilled = Clock::now();
+		auto n = std::max<size_t>(this->options.concurrency, 1);
+		for (size_t i=0; i<n; i++)
+			this->workers.emplace_back(&Scheduler::work, this);
+	}
+
+
+	Scheduler::~Scheduler() {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->running = false;
+			this->cv.notify_all();
+		}
+		for (auto & w: this->workers)
+			w.join();
+		// breaks futures of requests still queued
+		for (auto & c: this->classes)
+			c.queues.clear();
+	}
+
+
+	void Scheduler::enqueue(const Priority priority, const std::string & caller, Task && task) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto & c = this->classes[static_cast<size_t>(priority)];
+		if (priority == Priority::Background && c.size >= this->options.max_background) {
+			this->dropped++;
+			return;
+		}
+		auto & q = c.queues[caller];
+		if (q.empty()) c.turns.push_back(caller);
+		q.push_back(std::move(task));
+		c.size++;
+		this->cv.notify_one();
+	}
+
+
+	Scheduler::Task Scheduler::pop(Class & c) {
+		auto caller = std::move(c.turns.front());
+		c.turns.pop_front();
+		auto it = c.queues.find(caller);
+		auto task = std::move(it->second.front());
+		it->second.pop_front();
+		if (it->second.empty())
+			c.queues.erase(it);
+		else
+			c.turns.push_back(std::move(caller)); // caller goes to the back of the line
+		c.size--;
+		return task;
+	}
+
+
+	void Scheduler::refill() {
+		auto now = Clock::now();
+		std::chrono::duration<double> elapsed = now - this->refilled;
+		this->tokens = std::min(this->options.burst, this->tokens + elapsed.count()*this->options.rate);
+		this->refilled = now;
+	}
+
+
+	void Scheduler::work() {
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (this->running) {
+			size_t p = 0;
+			while (p < 3 && this->classes[p].size == 0) p++;
+			if (p == 3) {
+				this->cv.wait(lock);
+				continue;
+			}
+			auto & c = this->classes[p];
+			auto & head = c.queues.find(c.turns.front())->second.front();
+			bool background = p == static_cast<size_t>(Priority::Background);
+			if (background && Clock::now() - head.queued > this->options.max_delay) {
+				this->pop(c);
+				this->dropped++;
+				continue;
+			}
+			if (this->options.rate > 0) {
+				this->refill();
+				// a request costing more than the bucket holds goes once it is full
+				auto need = std::min(head.cost + (background ? this->options.reserve : 0.0), this->options.burst);
+				if (this->tokens < need) {
+					// new requests wake the worker up, in case they come first
+					this->cv.wait_for(lock, std::chrono::duration<double>((need - this->tokens)/this->options.rate));
+					continue;
+				}
+				this->tokens -= head.cost;
+			}
+			auto task = this->pop(c);
+			this->started++;
+			lock.unlock();
+			task.run();
+			task.run = nullptr;
+			lock.lock();
+		}
+	}
+
+
+	size_t Scheduler::queued(const Priority priority) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->classes[static_cast<size_t>(priority)].size;
+	}
+
+
+	uint64_t Scheduler::dispatched() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->started;
+	}
+
+
+	uint64_t Scheduler::shed() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->dropped;
+	}
+}
@@ -0,0 +1,181 @@
+/** \file tp_m7350_scheduler.h
+ *  Priority scheduling and rate limiting of requests to a TP-Link M7350 modem.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+namespace tplink {
+
+	/** \brief Priority classes of scheduled requests. */
+	enum class Priority : uint8_t {
+		Interactive = 0, ///< Requests a user waits for (send_sms, set_wlan_settings...)
+		Normal = 1,
+		Background = 2, ///< Periodic polls (get_status, get_log...); may be shed
+	};
+
+	/** \brief Scheduler settings. */
+	struct SchedulerOptions {
+		/** \brief Sustained request rate, in requests per second; 0 for no limit */
+		double rate = 10.0;
+		/** \brief Number of requests that may be sent in a burst */
+		double burst = 5.0;
+		/** \brief Maximum number of requests run at once */
+		size_t concurrency = 1;
+		/** \brief Tokens background requests leave for interactive ones */
+		double reserve = 1.0;
+		/** \brief Maximum number of queued background requests; more are shed */
+		size_t max_background = 64;
+		/** \brief Background requests queued for longer than this are shed */
+		std::chrono::milliseconds max_delay{5000};
+	};
+
+	/** \brief Runs requests to one modem by priority, within a rate and concurrency limit.
+	 *
+	 *  Requests are operations submitted with a priority and a caller name.
+	 *  A queued request of a higher priority class always starts first; within
+	 *  a class, callers take turns, so that a caller submitting many requests
+	 *  can't hold back the others. Each request costs tokens from a bucket
+	 *  refilled at the given rate and holding at most burst tokens; requests
+	 *  wait for tokens when the bucket is empty.
+	 *
+	 *  Background requests are deferred under pressure: they only start if
+	 *  enough tokens are left for an interactive request arriving next. They are
+	 *  shed when their queue is full, or when they waited for longer than the
+	 *  maximum delay; the future of a shed request holds a std::future_error
+	 *  with code std::future_errc::broken_promise.
+	 *
+	 *  Operations run on scheduler threads, as many as the concurrency limit.
+	 *  With a limit above 1, operations must be safe to run at the same time,
+	 *  e.g. by going through a SingleFlight or through different sessions.
+	 */
+	class Scheduler {
+	private:
+    using Clock = std::chrono::steady_clock;
+
+    /** \brief A queued request. */
+    struct Task {
+      /** \brief Runs the operation and sets its future; destroying it unrun breaks the future */
+      std::function<void()> run;
+      /** \brief Number of tokens taken by request */
+      double cost;
+      /** \brief Time at which request was queued */
+      Clock::time_point queued;
+    };
+
+    /** \brief Queues of one priority class. */
+    struct Class {
+      /** \brief Queued requests, by caller */
+      std::unordered_map<std::string, std::deque<Task> > queues;
+      /** \brief Callers with queued requests, in turn order */
+      std::deque<std::string> turns;
+      /** \brief Number of queued requests */
+      size_t size = 0;
+    };
+
+    /** \brief Scheduler settings */
+    SchedulerOptions options;
+
+    /** \brief Queues, by priority */
+    Class classes[3];
+
+    /** \brief Tokens in bucket */
+    double tokens;
+
+    /** \brief Time at which #tokens was last updated */
+    Clock::time_point refilled;
+
+    /** \brief Guards queues, bucket and counters */
+    std::mutex mutex;
+
+    /** \brief Signals new requests and stop requests */
+    std::condition_variable cv;
+
+    /** \brief True while scheduler runs */
+    bool running = true;
+
+    /** \brief Worker threads */
+    std::vector<std::thread> workers;
+
+    /** \brief Number of requests started */
+    uint64_t started = 0;
+
+    /** \brief Number of requests shed */
+    uint64_t dropped = 0;
+
+    /** \brief Queue a request.
+     *  \param priority: priority class.
+     *  \param caller: caller name.
+     *  \param task: request.
+     */
+    void enqueue(const Priority priority, const std::string & caller, Task && task);
+
+    /** \brief Remove next request of a priority class.
+     *  \param c: priority class.
+     *  \returns request.
+     */
+    Task pop(Class & c);
+
+    /** \brief Add tokens accumulated since last refill. */
+    void refill();
+
+    /** \brief Worker thread loop. */
+    void work();
+
+	public:
+    /** \brief Constructor.
+     *  \param options: scheduler settings.
+     */
+    explicit Scheduler(const SchedulerOptions & options = SchedulerOptions());
+
+    Scheduler(const Scheduler &) = delete;
+    Scheduler & operator=(const Scheduler &) = delete;
+
+    /** \brief Destructor; waits for running requests and sheds queued ones. */
+    ~Scheduler();
+
+    /** \brief Queue an operation.
+     *  \param priority: priority class.
+     *  \param caller: caller name, used to share the modem fairly among callers.
+     *  \param op: operation to run; takes no argument.
+     *  \param cost: number of tokens taken by the operation, e.g. number of requests it sends.
+     *  \returns a future holding the operation result.
+     */
+    template <typename Operation>
+    auto submit(const Priority priority, const std::string & caller, Operation op, const double cost = 1.0) -> std::future<decltype(op())> {
+      using Result = decltype(op());
+      auto task = std::make_shared<std::packaged_task<Result()> >(std::move(op));
+      auto result = task->get_future();
+      this->enqueue(priority, caller, Task{[task]{ (*task)(); }, cost, Clock::now()});
+      return result;
+    }
+
+    /** \brief Get number of queued requests of a priority class.
+     *  \param priority: priority class.
+     *  \returns number of requests.
+     */
+    size_t queued(const Priority priority);
+
+    /** \brief Get number of requests started since construction.
+     *  \returns number of requests.
+     */
+    uint64_t dispatched();
+
+    /** \brief Get number of background requests shed since construction.
+     *  \returns number of requests.
+     */
+    uint64_t shed();
+	};
+}
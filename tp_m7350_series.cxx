@@ -0,0 +1,570 @@
+/** \file tp_m7350_series.cxx
+ *	Time series of TP-Link M7350 modem counters, stored in a memory-mapped file.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_series.h"
+#include "tp_m7350_patch.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace tplink {
+
+	/* Store layout:
+		[header, kBlockSize bytes][block][block]...
+	Each block is a BlockHeader followed by a bit stream, most significant bit
+	first. The first sample has its time in the header and its value as 64 raw
+	bits; each following sample has its time as a delta of deltas, then its value
+	XORed with the previous one:
+		time: 0 (same delta) | 10 + 7 bits | 110 + 9 bits | 1110 + 12 bits | 1111 + 64 bits
+		value: 0 (same value) | 10 + bits in previous window | 11 + 5 bits leading zeros + 6 bits length - 1 + bits
+	Header counters are updated once the sample bits are written. */
+
+	/** \brief Store file identifier */
+	static const char kStoreMagic[8] = {'T','P','S','E','R','I','E','S'};
+
+	/** \brief Store format version */
+	static const uint32_t kStoreVersion = 1;
+
+	/** \brief Block size, and offset of first block */
+	static const uint64_t kBlockSize = 4096;
+
+	/** \brief Initial store file size */
+	static const size_t kInitialSize = 64*1024;
+
+	/** \brief Largest encoded sample, in bits */
+	static const uint32_t kMaxSampleBits = (4 + 64) + (2 + 5 + 6 + 64);
+
+	/** \brief Store header, stored at offset 0. */
+	struct StoreHeader {
+		char magic[8];
+		uint32_t version;
+		uint32_t block_size;
+		uint64_t blocks; ///< number of allocated blocks
+	};
+
+	/** \brief Block header. */
+	struct BlockHeader {
+		char series[SeriesStore::max_name_size + 1]; ///< series name, NUL-terminated
+		uint32_t count; ///< number of samples
+		uint32_t bits; ///< size of bit stream
+		int64_t first_time;
+		int64_t last_time;
+		double min;
+		double max;
+		double sum;
+		uint64_t reserved;
+	};
+	static_assert(sizeof(BlockHeader) == 96, "unexpected block header size");
+
+	/** \brief Size of a block bit stream, in bits */
+	static const uint32_t kStreamBits = (kBlockSize - sizeof(BlockHeader))*8;
+
+	/** \brief Write bits to a block stream.
+	 *	\param stream: start of stream.
+	 *	\param pos: bit position; advanced past written bits.
+	 *	\param value: bits, in least significant bits.
+	 *	\param n: number of bits, up to 64.
+	 */
+	static void put_bits(uint8_t * stream, uint32_t & pos, const uint64_t value, const int n) {
+		for (int i=n-1; i>=0; i--, pos++) {
+			auto mask = uint8_t(0x80 >> (pos & 7));
+			if ((value >> i) & 1) stream[pos >> 3] |= mask;
+			else stream[pos >> 3] &= ~mask;
+		}
+	}
+
+	/** \brief Read bits from a block stream.
+	 *	\param stream: start of stream.
+	 *	\param pos: bit position; advanced past read bits.
+	 *	\param n: number of bits, up to 64.
+	 *	\returns bits, in least significant bits.
+	 */
+	static uint64_t get_bits(const uint8_t * stream, uint32_t & pos, const int n) {
+		uint64_t value = 0;
+		for (int i=0; i<n; i++, pos++)
+			value = (value << 1) | ((stream[pos >> 3] >> (7 - (pos & 7))) & 1);
+		return value;
+	}
+
+	/** \brief Get bits of a double.
+	 *	\param v: value.
+	 *	\returns bits.
+	 */
+	static uint64_t double_bits(const double v) {
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		return bits;
+	}
+
+	/** \brief Get a double from its bits.
+	 *	\param bits: bits.
+	 *	\returns value.
+	 */
+	static double bits_double(const uint64_t bits) {
+		double v;
+		std::memcpy(&v, &bits, sizeof(v));
+		return v;
+	}
+
+
+	SeriesStore::~SeriesStore() {
+		this->close();
+	}
+
+
+	bool SeriesStore::open(const std::string & path, const size_t reserve) {
+		this->close();
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		if (this->fd < 0) {
+			LOG_E("Cannot open series store ", path, ": ", strerror(errno));
+			return false;
+		}
+		struct stat st;
+		if (fstat(this->fd, &st) != 0) {
+			LOG_E("Cannot access series store ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		bool is_new = st.st_size == 0;
+		this->capacity = is_new ? kInitialSize : st.st_size;
+		if (is_new && ftruncate(this->fd, this->capacity) != 0) {
+			LOG_E("Cannot resize series store ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		// reserve the address space once, so that the mapping never moves when the file grows
+		this->reserved = std::max(reserve, this->capacity);
+		auto addr = mmap(nullptr, this->reserved, PROT_READ | PROT_WRITE, MAP_SHARED, this->fd, 0);
+		if (addr == MAP_FAILED) {
+			LOG_E("Cannot map series store ", path, ": ", strerror(errno));
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		this->base = static_cast<char*>(addr);
+
+		auto header = reinterpret_cast<StoreHeader*>(this->base);
+		if (is_new) {
+			std::memcpy(header->magic, kStoreMagic, sizeof(kStoreMagic));
+			header->version = kStoreVersion;
+			header->block_size = kBlockSize;
+			header->blocks = 0;
+		} else if (std::memcmp(header->magic, kStoreMagic, sizeof(kStoreMagic)) || header->version != kStoreVersion
+				|| header->block_size != kBlockSize) {
+			LOG_E("File ", path, " isn't a series store.");
+			munmap(this->base, this->reserved);
+			this->base = nullptr;
+			::close(this->fd);
+			this->fd = -1;
+			return false;
+		}
+		this->recover();
+		LOG_I("Opened series store ", path, " with ", this->series_index.size(), " series.");
+		return true;
+	}
+
+
+	void SeriesStore::close() {
+		this->flush();
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->base != nullptr) {
+			munmap(this->base, this->reserved);
+			this->base = nullptr;
+		}
+		if (this->fd >= 0) {
+			::close(this->fd);
+			this->fd = -1;
+		}
+		this->series_index.clear();
+		this->capacity = 0;
+		this->reserved = 0;
+	}
+
+
+	bool SeriesStore::is_open() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->base != nullptr;
+	}
+
+
+	bool SeriesStore::recover() {
+		auto header = reinterpret_cast<StoreHeader*>(this->base);
+		auto available = (this->capacity - kBlockSize)/kBlockSize;
+		if (header->blocks > available) {
+			LOG_E("Series store is truncated; ignoring ", header->blocks - available, " block(s).");
+			header->blocks = available;
+		}
+		for (uint64_t i=0; i<header->blocks; i++) {
+			auto offset = kBlockSize*(i + 1);
+			auto block = reinterpret_cast<BlockHeader*>(this->base + offset);
+			// damaged blocks are skipped
+			if (block->series[0] == '\0' || std::memchr(block->series, '\0', sizeof(block->series)) == nullptr
+					|| block->bits > kStreamBits || block->count == 0)
+				continue;
+			auto & s = this->series_index[block->series];
+			if (block->first_time <= s.last_time) continue;
+			s.blocks.push_back(offset);
+			s.last_time = block->last_time;
+		}
+		return true;
+	}
+
+
+	bool SeriesStore::ensure_capacity(const uint64_t size) {
+		if (size <= this->capacity) return true;
+		auto new_capacity = this->capacity;
+		while (new_capacity < size)
+			new_capacity *= 2;
+		new_capacity = std::min(new_capacity, this->reserved);
+		if (new_capacity < size) {
+			LOG_E("Series store is full.");
+			return false;
+		}
+		if (ftruncate(this->fd, new_capacity) != 0) {
+			LOG_E("Cannot resize series store: ", strerror(errno));
+			return false;
+		}
+		this->capacity = new_capacity;
+		return true;
+	}
+
+
+	bool SeriesStore::new_block(const std::string & name, Series & s) {
+		auto header = reinterpret_cast<StoreHeader*>(this->base);
+		auto offset = kBlockSize*(header->blocks + 1);
+		if (!this->ensure_capacity(offset + kBlockSize))
+			return false;
+		auto block = reinterpret_cast<BlockHeader*>(this->base + offset);
+		std::memset(block, 0, kBlockSize);
+		std::memcpy(block->series, name.c_str(), name.size());
+		header->blocks++;
+		s.blocks.push_back(offset);
+		s.open = OpenBlock();
+		s.open.offset = offset;
+		return true;
+	}
+
+
+	bool SeriesStore::append(const std::string & name, const int64_t time, const double value) {
+		if (name.empty() || name.size() > max_name_size) {
+			LOG_E("Invalid series name: ", name);
+			return false;
+		}
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->base == nullptr) return false;
+		auto & s = this->series_index[name];
+		if (time <= s.last_time) return false;
+
+		auto bits = double_bits(value);
+		auto block = s.open.offset != 0 ? reinterpret_cast<BlockHeader*>(this->base + s.open.offset) : nullptr;
+		if (block == nullptr || block->bits + kMaxSampleBits > kStreamBits) {
+			if (!this->new_block(name, s)) return false;
+			block = reinterpret_cast<BlockHeader*>(this->base + s.open.offset);
+			auto stream = reinterpret_cast<uint8_t*>(block + 1);
+			uint32_t pos = 0;
+			put_bits(stream, pos, bits, 64);
+			block->first_time = time;
+			block->min = value;
+			block->max = value;
+			block->bits = pos;
+		} else {
+			auto & o = s.open;
+			auto stream = reinterpret_cast<uint8_t*>(block + 1);
+			uint32_t pos = block->bits;
+			int64_t delta = time - o.time;
+			int64_t dod = delta - o.delta;
+			if (dod == 0) put_bits(stream, pos, 0, 1);
+			else if (dod >= -63 && dod <= 64) { put_bits(stream, pos, 0b10, 2); put_bits(stream, pos, dod + 63, 7); }
+			else if (dod >= -255 && dod <= 256) { put_bits(stream, pos, 0b110, 3); put_bits(stream, pos, dod + 255, 9); }
+			else if (dod >= -2047 && dod <= 2048) { put_bits(stream, pos, 0b1110, 4); put_bits(stream, pos, dod + 2047, 12); }
+			else { put_bits(stream, pos, 0b1111, 4); put_bits(stream, pos, static_cast<uint64_t>(dod), 64); }
+			o.delta = delta;
+
+			uint64_t x = bits ^ o.value;
+			if (x == 0) {
+				put_bits(stream, pos, 0, 1);
+			} else {
+				int leading = std::min(__builtin_clzll(x), 31), trailing = __builtin_ctzll(x);
+				if (o.leading >= 0 && leading >= o.leading && trailing >= o.trailing) {
+					put_bits(stream, pos, 0b10, 2);
+					put_bits(stream, pos, x >> o.trailing, 64 - o.leading - o.trailing);
+				} else {
+					int size = 64 - leading - trailing;
+					put_bits(stream, pos, 0b11, 2);
+					put_bits(stream, pos, leading, 5);
+					put_bits(stream, pos, size - 1, 6);
+					put_bits(stream, pos, x >> trailing, size);
+					o.leading = leading;
+					o.trailing = trailing;
+				}
+			}
+			block->bits = pos;
+			block->min = std::min(block->min, value);
+			block->max = std::max(block->max, value);
+		}
+		block->last_time = time;
+		block->sum += value;
+		block->count++;
+		s.open.time = time;
+		s.open.value = bits;
+		s.last_time = time;
+		return true;
+	}
+
+
+	bool SeriesStore::flush() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->base == nullptr) return true;
+		auto header = reinterpret_cast<const StoreHeader*>(this->base);
+		if (msync(this->base, kBlockSize*(header->blocks + 1), MS_SYNC) != 0) {
+			LOG_E("Cannot sync series store: ", strerror(errno));
+			return false;
+		}
+		return true;
+	}
+
+
+	std::vector<std::string> SeriesStore::series() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::vector<std::string> names;
+		for (auto & s: this->series_index)
+			names.push_back(s.first);
+		std::sort(names.begin(), names.end());
+		return names;
+	}
+
+
+	void SeriesStore::decode(const uint64_t offset, const int64_t from, const int64_t to, std::vector<Sample> & samples) const {
+		auto block = reinterpret_cast<const BlockHeader*>(this->base + offset);
+		auto stream = reinterpret_cast<const uint8_t*>(block + 1);
+		uint32_t pos = 0;
+		int64_t time = block->first_time, delta = 0;
+		uint64_t value = get_bits(stream, pos, 64);
+		int leading = 0, trailing = 0;
+		for (uint32_t i=0; i<block->count; i++) {
+			if (i > 0) {
+				int64_t dod;
+				if (get_bits(stream, pos, 1) == 0) dod = 0;
+				else if (get_bits(stream, pos, 1) == 0) dod = int64_t(get_bits(stream, pos, 7)) - 63;
+				else if (get_bits(stream, pos, 1) == 0) dod = int64_t(get_bits(stream, pos, 9)) - 255;
+				else if (get_bits(stream, pos, 1) == 0) dod = int64_t(get_bits(stream, pos, 12)) - 2047;
+				else dod = static_cast<int64_t>(get_bits(stream, pos, 64));
+				delta += dod;
+				time += delta;
+				if (get_bits(stream, pos, 1) == 1) {
+					if (get_bits(stream, pos, 1) == 1) {
+						leading = get_bits(stream, pos, 5);
+						trailing = 64 - leading - (int(get_bits(stream, pos, 6)) + 1);
+					}
+					value ^= get_bits(stream, pos, 64 - leading - trailing) << trailing;
+				}
+			}
+			if (time >= to) break;
+			if (time >= from)
+				samples.push_back(Sample{time, bits_double(value)});
+		}
+	}
+
+
+	std::vector<Sample> SeriesStore::query(const std::string & name, const int64_t from, const int64_t to) const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		std::vector<Sample> samples;
+		auto it = this->series_index.find(name);
+		if (this->base == nullptr || it == this->series_index.end()) return samples;
+		auto & blocks = it->second.blocks;
+		// blocks are in time order; skip those ending before range
+		auto first = std::partition_point(blocks.begin(), blocks.end(), [this, from](const uint64_t offset) {
+			return reinterpret_cast<const BlockHeader*>(this->base + offset)->last_time < from;
+		});
+		for (auto b = first; b != blocks.end(); b++) {
+			if (reinterpret_cast<const BlockHeader*>(this->base + *b)->first_time >= to) break;
+			this->decode(*b, from, to, samples);
+		}
+		return samples;
+	}
+
+
+	std::vector<Bucket> SeriesStore::downsample(const std::string & name, const int64_t from, const int64_t to, const int64_t step) const {
+		std::vector<Bucket> buckets;
+		if (step <= 0) return buckets;
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->series_index.find(name);
+		if (this->base == nullptr || it == this->series_index.end()) return buckets;
+
+		auto add = [&buckets, from, step](const int64_t time, const uint64_t count, const double min, const double max, const double sum) {
+			auto start = from + (time - from)/step*step;
+			if (buckets.empty() || buckets.back().time != start)
+				buckets.push_back(Bucket{start, 0, min, max, 0.0});
+			auto & b = buckets.back();
+			b.count += count;
+			b.min = std::min(b.min, min);
+			b.max = std::max(b.max, max);
+			b.mean += sum; // divided by count once all samples are in
+		};
+
+		auto & blocks = it->second.blocks;
+		auto first = std::partition_point(blocks.begin(), blocks.end(), [this, from](const uint64_t offset) {
+			return reinterpret_cast<const BlockHeader*>(this->base + offset)->last_time < from;
+		});
+		std::vector<Sample> samples;
+		for (auto b = first; b != blocks.end(); b++) {
+			auto block = reinterpret_cast<const BlockHeader*>(this->base + *b);
+			if (block->first_time >= to) break;
+			// a block within one interval is aggregated from its header
+			if (block->first_time >= from && block->last_time < to
+					&& (block->first_time - from)/step == (block->last_time - from)/step) {
+				add(block->first_time, block->count, block->min, block->max, block->sum);
+				continue;
+			}
+			samples.clear();
+			this->decode(*b, from, to, samples);
+			for (auto & s: samples)
+				add(s.time, 1, s.value, s.value, s.value);
+		}
+		for (auto & b: buckets)
+			b.mean /= b.count;
+		return buckets;
+	}
+
+
+	Collector::Collector(SeriesStore & store, const size_t capacity) : store(&store), queue(capacity) {
+		this->fields = {
+			{"rx_speed", "/wan/rxSpeed"},
+			{"tx_speed", "/wan/txSpeed"},
+			{"daily_bytes", "/wan/dailyStatistics"},
+			{"total_bytes", "/wan/totalStatistics"},
+			{"signal", "/wan/signalStrength"},
+			{"rssi", "/wan/rssi"},
+			{"connection", "/wan/connectStatus"},
+			{"network_type", "/wan/networkType"},
+			{"battery", "/battery/capacity"},
+			{"devices", "/connectedDevices/number"},
+		};
+	}
+
+
+	Collector::~Collector() {
+		this->stop();
+	}
+
+
+	void Collector::add_field(const std::string & name, const std::string & pointer) {
+		this->fields.emplace_back(name, pointer);
+	}
+
+
+	void Collector::clear_fields() {
+		this->fields.clear();
+	}
+
+
+	void Collector::set_sync_interval(const std::chrono::milliseconds interval) {
+		this->sync_interval = interval;
+	}
+
+
+	bool Collector::start() {
+		if (this->running.exchange(true)) return false;
+		this->worker = std::thread(&Collector::run, this);
+		return true;
+	}
+
+
+	void Collector::stop() {
+		{
+			std::lock_guard<std::mutex> lock(this->wait_mutex);
+			this->running = false;
+			this->wake_up.notify_all();
+		}
+		if (this->worker.joinable())
+			this->worker.join();
+		// samples queued after writer stopped
+		this->write_queued();
+		this->store->flush();
+	}
+
+
+	size_t Collector::write_queued() {
+		size_t n = 0;
+		Record r;
+		while (this->queue.pop(r)) {
+			this->store->append(r.series, r.sample.time, r.sample.value);
+			n++;
+		}
+		return n;
+	}
+
+
+	void Collector::run() {
+		auto synced = std::chrono::steady_clock::now();
+		while (this->running) {
+			if (this->write_queued() == 0) {
+				// nothing queued; check again shortly
+				std::unique_lock<std::mutex> lock(this->wait_mutex);
+				if (this->running)
+					this->wake_up.wait_for(lock, std::chrono::milliseconds(50));
+			}
+			if (std::chrono::steady_clock::now() - synced >= this->sync_interval) {
+				this->store->flush();
+				synced = std::chrono::steady_clock::now();
+			}
+		}
+	}
+
+
+	size_t Collector::record(const std::string & label, const rj::Value & reply, int64_t time) {
+		if (time < 0)
+			time = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		size_t n = 0;
+		for (auto & f: this->fields) {
+			auto v = json_get(reply, f.second);
+			if (v == nullptr) continue;
+			double value;
+			if (v->IsNumber()) {
+				value = v->GetDouble();
+			} else if (v->IsBool()) {
+				value = v->GetBool();
+			} else if (v->IsString()) {
+				// the modem reports some numbers as strings
+				char * end;
+				value = std::strtod(v->GetString(), &end);
+				if (end == v->GetString() || *end != '\0') continue;
+			} else {
+				continue;
+			}
+			n += this->record(label + '/' + f.first, time, value);
+		}
+		return n;
+	}
+
+
+	bool Collector::record(const std::string & series, const int64_t time, const double value) {
+		if (this->queue.push(Record{series, Sample{time, value}}))
+			return true;
+		this->dropped_samples++;
+		return false;
+	}
+
+
+	size_t Collector::sample(const std::string & label, const TPLink_M7350 & modem) {
+		auto status = modem.get_status();
+		if (!status.IsObject() || status.ObjectEmpty() || (status.HasMember("result") && status["result"] != WebReturnCode::Success))
+			return 0;
+		return this->record(label, status);
+	}
+
+
+	uint64_t Collector::dropped() const {
+		return this->dropped_samples;
+	}
+}
@@ -0,0 +1,321 @@
+/** \file tp_m7350_series.h
+ *  Time series of TP-Link M7350 modem counters (traffic, speeds, signal),
+ *  sampled from status replies and stored in a compact memory-mapped file.
+ *  Samples go through a lock-free queue to a writer thread, which encodes
+ *  them per series with delta-of-delta timestamps and XOR-compressed values.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#include "tplink_m7350.h"
+#include "tp_m7350_queue.h"
+
+namespace tplink {
+
+	/** \brief A sample of a time series. */
+	struct Sample {
+		/** \brief Time, in milliseconds since the Unix epoch */
+		int64_t time;
+		/** \brief Value */
+		double value;
+	};
+
+	/** \brief Aggregate of the samples of a time interval. */
+	struct Bucket {
+		/** \brief Start of interval, in milliseconds since the Unix epoch */
+		int64_t time;
+		/** \brief Number of samples */
+		uint64_t count;
+		/** \brief Smallest value */
+		double min;
+		/** \brief Largest value */
+		double max;
+		/** \brief Average value */
+		double mean;
+	};
+
+	/** \brief Append-only store of numeric time series, backed by a memory-mapped file.
+	 *
+	 *  The file holds fixed-size blocks; each block holds samples of one series,
+	 *  in time order, encoded as in Gorilla: timestamps as deltas of deltas and
+	 *  values as XOR with the previous value, with variable-length codes. A
+	 *  sample taken at a regular interval with an unchanged value takes 2 bits;
+	 *  counters that change take a few bytes. Block headers hold the time span,
+	 *  count, minimum, maximum and sum of their samples, so that range queries
+	 *  skip blocks outside the range, and downsampling to coarse intervals only
+	 *  decodes blocks straddling interval boundaries.
+	 *
+	 *  Samples of a series must come in time order; older ones are dropped.
+	 *  Blocks are written in place; flush() makes them durable. Reopening a
+	 *  store starts new blocks for each series. Methods may be called from any
+	 *  thread.
+	 */
+	class SeriesStore {
+	private:
+    /** \brief Encoder state of the block a series is appended to. */
+    struct OpenBlock {
+      /** \brief Block offset in file; 0 if series has no open block */
+      uint64_t offset = 0;
+      /** \brief Time of previous sample */
+      int64_t time = 0;
+      /** \brief Difference between times of two previous samples */
+      int64_t delta = 0;
+      /** \brief Bits of previous value */
+      uint64_t value = 0;
+      /** \brief Leading zeros of previous XOR window; -1 if none */
+      int leading = -1;
+      /** \brief Trailing zeros of previous XOR window */
+      int trailing = 0;
+    };
+
+    /** \brief Blocks of a series. */
+    struct Series {
+      /** \brief Block offsets, in time order */
+      std::vector<uint64_t> blocks;
+      /** \brief Block being appended to */
+      OpenBlock open;
+      /** \brief Time of last sample; older samples are dropped */
+      int64_t last_time = INT64_MIN;
+    };
+
+    /** \brief File descriptor */
+    int fd = -1;
+
+    /** \brief Start of mapped file */
+    char * base = nullptr;
+
+    /** \brief Size of reserved address space */
+    size_t reserved = 0;
+
+    /** \brief Current file size */
+    size_t capacity = 0;
+
+    /** \brief Series, by name */
+    std::unordered_map<std::string, Series> series_index;
+
+    /** \brief Guards file and index */
+    mutable std::mutex mutex;
+
+    /** \brief Make sure the file can hold given size.
+     *  \param size: required size in bytes.
+     *  \returns true if successful, false if the reserved space is exhausted.
+     */
+    bool ensure_capacity(const uint64_t size);
+
+    /** \brief Allocate a new block for a series.
+     *  \param name: series name.
+     *  \param s: series.
+     *  \returns true if successful, false if the store is full.
+     */
+    bool new_block(const std::string & name, Series & s);
+
+    /** \brief Index blocks; called on opening.
+     *  \returns true if store is consistent, false otherwise.
+     */
+    bool recover();
+
+    /** \brief Decode samples of a block.
+     *  \param offset: block offset.
+     *  \param from: start of time range (inclusive).
+     *  \param to: end of time range (exclusive).
+     *  \param samples: receives samples within range.
+     */
+    void decode(const uint64_t offset, const int64_t from, const int64_t to, std::vector<Sample> & samples) const;
+
+	public:
+    /** \brief Maximum length of series names */
+    static const size_t max_name_size = 39;
+
+    /** \brief Default constructor. */
+    SeriesStore() = default;
+
+    SeriesStore(const SeriesStore &) = delete;
+    SeriesStore & operator=(const SeriesStore &) = delete;
+
+    /** \brief Destructor; syncs and closes the store. */
+    ~SeriesStore();
+
+    /** \brief Open given store, creating it if necessary.
+     *  \param path: store file path.
+     *  \param reserve: maximum store size in bytes.
+     *  \returns true if successful, false otherwise.
+     */
+    bool open(const std::string & path, const size_t reserve = size_t(1) << 32);
+
+    /** \brief Sync and close the store. */
+    void close();
+
+    /** \brief Check whether a store is open.
+     *  \returns true if a store is open, false otherwise.
+     */
+    bool is_open() const;
+
+    /** \brief Append a sample to a series.
+     *  \param name: series name, at most max_name_size characters.
+     *  \param time: sample time, in milliseconds since the Unix epoch.
+     *  \param value: sample value.
+     *  \returns true if sample was stored, false if it's older than the last one or the store is full.
+     */
+    bool append(const std::string & name, const int64_t time, const double value);
+
+    /** \brief Write stored samples to disk.
+     *  \returns true if successful, false otherwise.
+     */
+    bool flush() const;
+
+    /** \brief List series names.
+     *  \returns series names.
+     */
+    std::vector<std::string> series() const;
+
+    /** \brief Get samples of a series within a time range.
+     *  \param name: series name.
+     *  \param from: start of time range (inclusive).
+     *  \param to: end of time range (exclusive).
+     *  \returns samples, in time order.
+     */
+    std::vector<Sample> query(const std::string & name, const int64_t from, const int64_t to) const;
+
+    /** \brief Aggregate samples of a series over regular intervals.
+     *  \param name: series name.
+     *  \param from: start of time range (inclusive).
+     *  \param to: end of time range (exclusive).
+     *  \param step: interval length, in milliseconds.
+     *  \returns one bucket per interval holding samples, in time order.
+     */
+    std::vector<Bucket> downsample(const std::string & name, const int64_t from, const int64_t to, const int64_t step) const;
+	};
+
+	/** \brief Extracts series from modem replies and stores them from a writer thread.
+	 *
+	 *  Each field names a series and a JSON pointer into replies; recording a
+	 *  reply for a label (e.g. a modem name) adds a sample to series
+	 *  "label/field" for each field found in it. Numbers, booleans and numeric
+	 *  strings are taken. Default fields cover status replies: speeds, traffic
+	 *  counters, signal, connection state, battery and connected devices; more
+	 *  can be added, e.g. for flowstat replies.
+	 *
+	 *  Recording only pushes samples to a lock-free queue, so that it can be
+	 *  done from polling threads without waiting for the disk; a writer thread
+	 *  appends them to the store, and syncs the store at regular intervals.
+	 *  Samples are dropped if the queue is full.
+	 */
+	class Collector {
+	private:
+    /** \brief A sample on its way to the store. */
+    struct Record {
+      /** \brief Series name */
+      std::string series;
+      /** \brief Sample */
+      Sample sample;
+    };
+
+    /** \brief Series store */
+    SeriesStore * store;
+
+    /** \brief Extracted fields: series name and JSON pointer */
+    std::vector<std::pair<std::string, std::string> > fields;
+
+    /** \brief Samples waiting for the writer thread */
+    LockFreeQueue<Record> queue;
+
+    /** \brief Number of samples dropped because queue was full */
+    std::atomic<uint64_t> dropped_samples{0};
+
+    /** \brief Time between two syncs of store */
+    std::chrono::milliseconds sync_interval{10000};
+
+    /** \brief Writer thread */
+    std::thread worker;
+
+    /** \brief True while writer thread runs */
+    std::atomic<bool> running{false};
+
+    /** \brief Mutex for writer thread wake-ups */
+    std::mutex wait_mutex;
+
+    /** \brief Wakes writer thread up when stopping */
+    std::condition_variable wake_up;
+
+    /** \brief Writer thread main loop. */
+    void run();
+
+    /** \brief Append queued samples to store.
+     *  \returns number of samples taken from queue.
+     */
+    size_t write_queued();
+
+	public:
+    /** \brief Constructor.
+     *  \param store: open series store; must outlive the collector.
+     *  \param capacity: maximum number of samples waiting for the writer thread.
+     */
+    explicit Collector(SeriesStore & store, const size_t capacity = 1 << 16);
+
+    Collector(const Collector &) = delete;
+    Collector & operator=(const Collector &) = delete;
+
+    /** \brief Destructor; stores queued samples and stops writer thread. */
+    ~Collector();
+
+    /** \brief Add a field extracted from replies.
+     *  \param name: field name, appended to labels to form series names.
+     *  \param pointer: JSON pointer to value in replies.
+     */
+    void add_field(const std::string & name, const std::string & pointer);
+
+    /** \brief Remove all fields, including default ones. */
+    void clear_fields();
+
+    /** \brief Set time between two syncs of store.
+     *  \param interval: sync interval.
+     */
+    void set_sync_interval(const std::chrono::milliseconds interval);
+
+    /** \brief Start writer thread.
+     *  \returns true if successful, false if already running.
+     */
+    bool start();
+
+    /** \brief Store queued samples and stop writer thread. */
+    void stop();
+
+    /** \brief Extract fields from a reply and queue them as samples.
+     *  Fields must not be changed meanwhile.
+     *  \param label: prefix of series names, e.g. modem name.
+     *  \param reply: modem reply.
+     *  \param time: sample time, in milliseconds since the Unix epoch; current time if negative.
+     *  \returns number of samples queued.
+     */
+    size_t record(const std::string & label, const rj::Value & reply, int64_t time = -1);
+
+    /** \brief Queue a single sample.
+     *  \param series: series name.
+     *  \param time: sample time, in milliseconds since the Unix epoch.
+     *  \param value: sample value.
+     *  \returns true if sample was queued, false if queue is full.
+     */
+    bool record(const std::string & series, const int64_t time, const double value);
+
+    /** \brief Get status of a modem and record it.
+     *  \param label: prefix of series names, e.g. modem name.
+     *  \param modem: logged-in modem session.
+     *  \returns number of samples queued.
+     */
+    size_t sample(const std::string & label, const TPLink_M7350 & modem);
+
+    /** \brief Get number of samples dropped because queue was full.
+     *  \returns number of samples.
+     */
+    uint64_t dropped() const;
+	};
+}
@@ -0,0 +1,106 @@
+/** \file tp_m7350_singleflight.cxx
+ *	Coalescing of identical concurrent requests to a TP-Link M7350 modem.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_singleflight.h"
+#include "tp_m7350_codec.h"
+
+namespace tplink {
+
+	/** \brief Compute 64-bit FNV-1a hash of a string.
+	 *	\param s: string.
+	 *	\returns hash.
+	 */
+	static uint64_t fnv1a(const std::string & s) {
+		uint64_t h = 0xcbf29ce484222325ull;
+		for (auto c: s) {
+			h ^= static_cast<unsigned char>(c);
+			h *= 0x100000001b3ull;
+		}
+		return h;
+	}
+
+
+	SingleFlight::SingleFlight(TPLink_M7350 & session) : session(session) {}
+
+
+	SingleFlight::Result SingleFlight::run(const std::string & module, const int action, const rj::Document * data) {
+		auto payload = data != nullptr ? stringify(*data) : std::string();
+		auto key = module + '/' + std::to_string(action) + '/' + std::to_string(fnv1a(payload));
+
+		std::shared_ptr<Flight> flight;
+		std::promise<Result> promise;
+		{
+			std::lock_guard<std::mutex> lock(this->flights_mutex);
+			auto it = this->flights.find(key);
+			if (it != this->flights.end() && it->second->data == payload) {
+				flight = it->second;
+			} else if (it == this->flights.end()) {
+				flight = std::make_shared<Flight>();
+				flight->data = payload;
+				flight->result = promise.get_future().share();
+				this->flights.emplace(key, flight);
+				flight = nullptr; // this thread leads
+			}
+			// on hash collision, the request is sent on its own
+		}
+		if (flight) {
+			this->joined.fetch_add(1, std::memory_order_relaxed);
+			return flight->result.get();
+		}
+
+		std::shared_ptr<const rj::Document> reply;
+		try {
+			std::lock_guard<std::mutex> lock(this->session_mutex);
+			this->sent.fetch_add(1, std::memory_order_relaxed);
+			reply = std::make_shared<const rj::Document>(data != nullptr
+				? this->session.request(module, action, *data)
+				: this->session.request(module, action));
+		} catch (...) {
+			std::lock_guard<std::mutex> lock(this->flights_mutex);
+			auto it = this->flights.find(key);
+			if (it != this->flights.end() && it->second->data == payload) this->flights.erase(it);
+			promise.set_exception(std::current_exception());
+			throw;
+		}
+		{
+			// later requests are sent anew
+			std::lock_guard<std::mutex> lock(this->flights_mutex);
+			auto it = this->flights.find(key);
+			if (it != this->flights.end() && it->second->data == payload) this->flights.erase(it);
+		}
+		promise.set_value(reply);
+		return reply;
+	}
+
+
+	SingleFlight::Result SingleFlight::request(const std::string & module, const int action) {
+		return this->run(module, action, nullptr);
+	}
+
+
+	SingleFlight::Result SingleFlight::request(const std::string & module, const int action, const rj::Document & data) {
+		return this->run(module, action, &data);
+	}
+
+
+	SingleFlight::Result SingleFlight::get_status() {
+		return this->run(Modules::Status, 0, nullptr);
+	}
+
+
+	SingleFlight::Result SingleFlight::get_connected_devices() {
+		return this->run(Modules::ConnectedDevices, ConnectedDevicesOptions::GetConfiguration, nullptr);
+	}
+
+
+	uint64_t SingleFlight::requests() const {
+		return this->sent.load(std::memory_order_relaxed);
+	}
+
+
+	uint64_t SingleFlight::coalesced() const {
+		return this->joined.load(std::memory_order_relaxed);
+	}
+}
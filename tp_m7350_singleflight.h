@@ -0,0 +1,120 @@
+/** \file tp_m7350_singleflight.h
+ *  Coalescing of identical concurrent requests to a TP-Link M7350 modem.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <memory>
+#include <mutex>
+#include <future>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+
+namespace tplink {
+
+	/** \brief Lets several threads use one session, merging identical requests in flight.
+	 *
+	 *  Requests are identified by module, action and a hash of their data.
+	 *  The first thread to make a request sends it; threads making the same
+	 *  request while it is in flight wait for it and get the same reply,
+	 *  which is therefore immutable. Requests made after it completes are
+	 *  sent again: nothing is cached. Different requests are sent one at a
+	 *  time, since a session can't be used by several threads at once.
+	 */
+	class SingleFlight {
+	public:
+    /** \brief Shared, immutable reply */
+    using Result = std::shared_ptr<const rj::Document>;
+
+	private:
+    /** \brief A request in flight. */
+    struct Flight {
+      /** \brief Serialized request data, to tell apart requests with colliding hashes */
+      std::string data;
+      /** \brief Reply, once received */
+      std::shared_future<Result> result;
+    };
+
+    /** \brief Session requests are sent through */
+    TPLink_M7350 & session;
+
+    /** \brief Serializes use of #session */
+    std::mutex session_mutex;
+
+    /** \brief Requests in flight, by module, action and data hash */
+    std::unordered_map<std::string, std::shared_ptr<Flight> > flights;
+
+    /** \brief Guards #flights */
+    std::mutex flights_mutex;
+
+    /** \brief Number of requests sent to modem */
+    std::atomic<uint64_t> sent{0};
+
+    /** \brief Number of requests that joined one in flight */
+    std::atomic<uint64_t> joined{0};
+
+    /** \brief Make a request, or join an identical one in flight.
+     *  \param module: name of module to query.
+     *  \param action: code of action to perform.
+     *  \param data: request data, or nullptr.
+     *  \returns modem reply.
+     */
+    Result run(const std::string & module, const int action, const rj::Document * data);
+
+	public:
+    /** \brief Constructor.
+     *  \param session: session to send requests through; it must outlive this object,
+     *    and must only be used through it while it exists.
+     */
+    explicit SingleFlight(TPLink_M7350 & session);
+
+    /** \brief Send a request, or wait for an identical one in flight.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \returns modem reply, or an empty object if request failed.
+     */
+    Result request(const std::string & module, const int action);
+
+    /** \brief Send a request carrying data, or wait for an identical one in flight.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \param data: JSON object whose members are added to the request.
+     *  \returns modem reply, or an empty object if request failed.
+     */
+    Result request(const std::string & module, const int action, const rj::Document & data);
+
+    /** \brief Get modem status; see TPLink_M7350::get_status.
+     *  \returns modem reply.
+     */
+    Result get_status();
+
+    /** \brief Get devices connected to modem; see TPLink_M7350::get_connected_devices.
+     *  \returns modem reply.
+     */
+    Result get_connected_devices();
+
+    /** \brief Run an operation with exclusive use of the session, e.g. to log in or send a message.
+     *  \param operation: callable taking a TPLink_M7350 reference.
+     *  \returns whatever operation returns.
+     */
+    template <typename Operation>
+    auto with_session(Operation && operation) {
+      std::lock_guard<std::mutex> lock(this->session_mutex);
+      return operation(this->session);
+    }
+
+    /** \brief Get number of requests sent to modem.
+     *  \returns number of requests.
+     */
+    uint64_t requests() const;
+
+    /** \brief Get number of requests served by joining one in flight.
+     *  \returns number of requests.
+     */
+    uint64_t coalesced() const;
+	};
+}
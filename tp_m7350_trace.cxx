@@ -0,0 +1,287 @@
+/** \file tp_m7350_trace.cxx
+ *	Timeline tracing of TP-Link M7350 requests.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_trace.h"
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+
+namespace tplink {
+	namespace trace {
+
+		/** \brief Single-producer, single-consumer span buffer of a thread.
+		 *	The thread writes at #head; #collect reads from #tail under the registry lock.
+		 */
+		struct Ring {
+			std::vector<SpanRecord> slots;
+			size_t mask;
+			std::atomic<uint64_t> head{0};
+			std::atomic<uint64_t> tail{0};
+			/** \brief Thread number shown in trace */
+			uint32_t tid;
+		};
+
+		/** \brief Spans of all threads. */
+		struct Registry {
+			std::mutex mutex;
+			/** \brief Buffers of running threads */
+			std::vector<Ring*> rings;
+			/** \brief Collected spans, with thread numbers */
+			std::vector<std::pair<uint32_t, SpanRecord> > spans;
+			/** \brief True while recording */
+			std::atomic<bool> recording{false};
+			/** \brief Capacity of new buffers */
+			std::atomic<size_t> capacity{4096};
+			/** \brief Number of spans dropped */
+			std::atomic<uint64_t> dropped{0};
+			/** \brief Next thread number */
+			uint32_t next_tid = 1;
+			/** \brief Origin of span times */
+			const std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+		};
+
+		static Registry & registry() {
+			static Registry r;
+			return r;
+		}
+
+		/** \brief Move spans out of a buffer; registry must be locked.
+		 *	\param r: registry.
+		 *	\param ring: buffer to drain.
+		 */
+		static void drain(Registry & r, Ring & ring) {
+			auto t = ring.tail.load(std::memory_order_relaxed);
+			auto h = ring.head.load(std::memory_order_acquire);
+			for (; t<h; t++)
+				r.spans.emplace_back(ring.tid, ring.slots[t & ring.mask]);
+			ring.tail.store(t, std::memory_order_release);
+		}
+
+		/** \brief Tracing state of a thread; hands buffered spans over when the thread exits. */
+		struct ThreadState {
+			Ring * ring = nullptr;
+			/** \brief Module of current request */
+			char module[sizeof(SpanRecord::module)] = {0};
+			/** \brief Action of current request */
+			int action = -1;
+
+			Ring & get_ring() {
+				if (this->ring == nullptr) {
+					auto & r = registry();
+					size_t capacity = 1;
+					while (capacity < r.capacity.load()) capacity <<= 1;
+					auto ring = new Ring();
+					ring->slots.resize(capacity);
+					ring->mask = capacity - 1;
+					std::lock_guard<std::mutex> lock(r.mutex);
+					ring->tid = r.next_tid++;
+					r.rings.push_back(ring);
+					this->ring = ring;
+				}
+				return *this->ring;
+			}
+
+			~ThreadState() {
+				if (this->ring == nullptr) return;
+				auto & r = registry();
+				std::lock_guard<std::mutex> lock(r.mutex);
+				drain(r, *this->ring);
+				r.rings.erase(std::find(r.rings.begin(), r.rings.end(), this->ring));
+				delete this->ring;
+			}
+		};
+
+		static ThreadState & thread_state() {
+			static thread_local ThreadState state;
+			return state;
+		}
+
+		/** \brief Copy a module name, truncating it to fit.
+		 *	\param dest: destination buffer, of SpanRecord::module size.
+		 *	\param module: module name.
+		 */
+		static void copy_module(char * dest, const std::string & module) {
+			auto n = std::min(module.size(), sizeof(SpanRecord::module) - 1);
+			std::memcpy(dest, module.data(), n);
+			dest[n] = 0;
+		}
+
+		/** \brief Get current time, relative to trace origin.
+		 *	\returns time in nanoseconds.
+		 */
+		static uint64_t now() {
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+		}
+
+
+		void start(const size_t capacity) {
+			auto & r = registry();
+			r.capacity = std::max<size_t>(capacity, 1);
+			r.recording = true;
+		}
+
+
+		void stop() {
+			registry().recording = false;
+		}
+
+
+		bool enabled() {
+			return registry().recording.load(std::memory_order_relaxed);
+		}
+
+
+		void collect() {
+			auto & r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			for (auto ring: r.rings)
+				drain(r, *ring);
+		}
+
+
+		void clear() {
+			auto & r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			for (auto ring: r.rings)
+				ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+			r.spans.clear();
+			r.dropped = 0;
+		}
+
+
+		uint64_t dropped() {
+			return registry().dropped.load();
+		}
+
+
+		void begin_request(const std::string & module, const int action) {
+			auto & t = thread_state();
+			copy_module(t.module, module);
+			t.action = action;
+		}
+
+
+		Span::Span(const char * name) : active(enabled()) {
+			if (!this->active) return;
+			this->record.name = name;
+			this->record.start = now();
+		}
+
+
+		Span::~Span() {
+			this->finish();
+		}
+
+
+		void Span::finish() {
+			if (!this->active) return;
+			this->active = false;
+			this->record.end = now();
+			auto & t = thread_state();
+			if (!this->has_request) {
+				std::memcpy(this->record.module, t.module, sizeof(t.module));
+				this->record.action = t.action;
+			}
+			auto & ring = t.get_ring();
+			auto h = ring.head.load(std::memory_order_relaxed);
+			if (h - ring.tail.load(std::memory_order_acquire) > ring.mask) {
+				registry().dropped.fetch_add(1, std::memory_order_relaxed);
+				return;
+			}
+			ring.slots[h & ring.mask] = this->record;
+			ring.head.store(h + 1, std::memory_order_release);
+		}
+
+
+		void Span::set_request(const std::string & module, const int action) {
+			copy_module(this->record.module, module);
+			this->record.action = action;
+			this->has_request = true;
+		}
+
+
+		void Span::set_current_request() {
+			auto & t = thread_state();
+			std::memcpy(this->record.module, t.module, sizeof(t.module));
+			this->record.action = t.action;
+			this->has_request = true;
+		}
+
+
+		void Span::set_page(const int page) {
+			this->record.page = page;
+		}
+
+
+		void Span::add_bytes(const uint64_t sent, const uint64_t received) {
+			this->record.bytes_sent += sent;
+			this->record.bytes_received += received;
+		}
+
+
+		/** \brief Write a string as JSON.
+		 *	\param out: output stream.
+		 *	\param s: string.
+		 */
+		static void write_string(std::ostream & out, const char * s) {
+			out << '"';
+			for (; *s; s++) {
+				if (*s == '"' || *s == '\\') out << '\\';
+				if (static_cast<unsigned char>(*s) >= 0x20) out << *s;
+			}
+			out << '"';
+		}
+
+
+		void write_chrome_trace(std::ostream & out) {
+			collect();
+			auto & r = registry();
+			std::lock_guard<std::mutex> lock(r.mutex);
+			std::sort(r.spans.begin(), r.spans.end(), [](const auto & a, const auto & b) {
+				return a.second.start < b.second.start;
+			});
+			auto pid = getpid();
+			auto flags = out.flags();
+			out.setf(std::ios::fixed);
+			out.precision(3);
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+			bool first = true;
+			for (auto & s: r.spans) {
+				auto & span = s.second;
+				out << (first ? "\n" : ",\n");
+				first = false;
+				out << "{\"name\":";
+				write_string(out, span.name);
+				out << ",\"cat\":\"tplink\",\"ph\":\"X\",\"pid\":" << pid << ",\"tid\":" << s.first
+					<< ",\"ts\":" << span.start/1e3 << ",\"dur\":" << (span.end - span.start)/1e3 << ",\"args\":{";
+				bool first_arg = true;
+				auto arg = [&](const char * name) -> std::ostream & {
+					out << (first_arg ? "\"" : ",\"") << name << "\":";
+					first_arg = false;
+					return out;
+				};
+				if (span.module[0]) write_string(arg("module"), span.module);
+				if (span.action >= 0) arg("action") << span.action;
+				if (span.page >= 0) arg("page") << span.page;
+				if (span.bytes_sent > 0) arg("bytes_sent") << span.bytes_sent;
+				if (span.bytes_received > 0) arg("bytes_received") << span.bytes_received;
+				out << "}}";
+			}
+			out << "\n]}\n";
+			out.flags(flags);
+		}
+
+
+		bool save(const std::string & path) {
+			std::ofstream out(path);
+			if (!out) return false;
+			write_chrome_trace(out);
+			return static_cast<bool>(out);
+		}
+	}
+}
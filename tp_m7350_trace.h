@@ -0,0 +1,144 @@
+/** \file tp_m7350_trace.h
+ *  Timeline tracing of TP-Link M7350 requests, exported as Chrome trace JSON
+ *  (readable with Perfetto or chrome://tracing). Spans are recorded only if
+ *  TPLINK_TRACING is set to 1, and only while tracing is started.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <ostream>
+#include <cstdint>
+
+#ifndef TPLINK_TRACING
+#define TPLINK_TRACING 0
+#endif
+
+namespace tplink {
+	namespace trace {
+
+		/** \brief A finished span. */
+		struct SpanRecord {
+			/** \brief Span name; must be a string literal */
+			const char * name = nullptr;
+			/** \brief Module name, possibly truncated */
+			char module[24] = {0};
+			/** \brief Action code, or -1 if none */
+			int action = -1;
+			/** \brief Page number, or -1 if none */
+			int page = -1;
+			/** \brief Number of bytes sent */
+			uint64_t bytes_sent = 0;
+			/** \brief Number of bytes received */
+			uint64_t bytes_received = 0;
+			/** \brief Start time, in nanoseconds since tracing started */
+			uint64_t start = 0;
+			/** \brief End time, in nanoseconds since tracing started */
+			uint64_t end = 0;
+		};
+
+		/** \brief Start recording spans.
+		 *  Each thread records into its own ring buffer; spans that don't fit are
+		 *  dropped until the buffer is drained by #collect.
+		 *  \param capacity: number of spans each thread can buffer; rounded up to a power of 2.
+		 */
+		void start(const size_t capacity = 4096);
+
+		/** \brief Stop recording spans. Recorded spans remain available. */
+		void stop();
+
+		/** \brief Check whether spans are being recorded.
+		 *  \returns true if recording, false otherwise.
+		 */
+		bool enabled();
+
+		/** \brief Move spans buffered by all threads to the trace.
+		 *  Call it regularly during long traces so that buffers don't fill up.
+		 */
+		void collect();
+
+		/** \brief Write trace in Chrome trace JSON format; collects buffered spans first.
+		 *  \param out: output stream.
+		 */
+		void write_chrome_trace(std::ostream & out);
+
+		/** \brief Write trace in Chrome trace JSON format to a file; collects buffered spans first.
+		 *  \param path: file path.
+		 *  \returns true if successful, false otherwise.
+		 */
+		bool save(const std::string & path);
+
+		/** \brief Discard collected spans. */
+		void clear();
+
+		/** \brief Get number of spans dropped because a buffer was full.
+		 *  \returns number of spans.
+		 */
+		uint64_t dropped();
+
+		/** \brief Set the request that following spans of calling thread belong to.
+		 *  \param module: module name.
+		 *  \param action: action code.
+		 */
+		void begin_request(const std::string & module, const int action);
+
+		/** \brief Record a span, from construction to destruction.
+		 *  Unless set explicitly, module and action are those of the request being
+		 *  made by the thread when the span ends.
+		 */
+		class Span {
+		private:
+      SpanRecord record;
+      bool active;
+      bool has_request = false;
+		public:
+      /** \brief Constructor.
+       *  \param name: span name; must be a string literal.
+       */
+      explicit Span(const char * name);
+
+      /** \brief Destructor; records span unless already finished. */
+      ~Span();
+
+      /** \brief Record span now rather than at destruction. */
+      void finish();
+
+      Span(const Span &) = delete;
+      Span & operator=(const Span &) = delete;
+
+      /** \brief Set request the span belongs to.
+       *  \param module: module name.
+       *  \param action: action code.
+       */
+      void set_request(const std::string & module, const int action);
+
+      /** \brief Set request the span belongs to from the request being made by the thread now,
+       *  for spans that end after the thread moved on to other requests.
+       */
+      void set_current_request();
+
+      /** \brief Set page number.
+       *  \param page: page number.
+       */
+      void set_page(const int page);
+
+      /** \brief Count transferred bytes.
+       *  \param sent: number of bytes sent.
+       *  \param received: number of bytes received.
+       */
+      void add_bytes(const uint64_t sent, const uint64_t received);
+		};
+	}
+}
+
+#if TPLINK_TRACING==1
+  #define TP_TRACE_REQUEST(module, action) tplink::trace::begin_request(module, action)
+  #define TP_TRACE_SCOPE(var, name) tplink::trace::Span var(name)
+  #define TP_TRACE(statement) statement
+#else
+  #define TP_TRACE_REQUEST(module, action)
+  #define TP_TRACE_SCOPE(var, name)
+  #define TP_TRACE(statement)
+#endif
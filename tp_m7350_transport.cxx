@@ -0,0 +1,254 @@
+/** \file tp_m7350_transport.cxx
+ *	Transports carrying requests to TP-Link M7350 web gateways, and recording
+ *	and replay of exchanged data.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_transport.h"
+#include "tp_m7350_log.h"
+#include <thread>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+namespace tplink {
+
+	/** \brief Recording file magic */
+	static const char kMagic[4] = {'T', 'P', 'R', 'R'};
+	/** \brief Recording file format version */
+	static const uint32_t kVersion = 1;
+
+	/** \brief Record types */
+	enum RecordType : uint8_t { ExchangeRecord = 1, KeysRecord = 2 };
+
+	/** \brief Size above which buffered records are written to file */
+	static const size_t kBufferSize = 64*1024;
+
+	template <typename T>
+	static void write_value(std::string & out, const T & value) {
+		out.append(reinterpret_cast<const char*>(&value), sizeof(T));
+	}
+
+	static void write_string(std::string & out, const std::string & s) {
+		write_value(out, static_cast<uint32_t>(s.size()));
+		out.append(s);
+	}
+
+	template <typename T>
+	static bool read_value(std::istream & in, T & value) {
+		return static_cast<bool>(in.read(reinterpret_cast<char*>(&value), sizeof(T)));
+	}
+
+	static bool read_string(std::istream & in, std::string & s) {
+		uint32_t size;
+		if (!read_value(in, size)) return false;
+		s.resize(size);
+		return static_cast<bool>(in.read(&s[0], size));
+	}
+
+
+	/** \brief Get path of a URL, without scheme and host.
+	 *	\param url: URL.
+	 *	\returns path.
+	 */
+	static std::string url_path(const std::string & url) {
+		auto host = url.find("://");
+		auto path = url.find('/', host == std::string::npos ? 0 : host + 3);
+		return path == std::string::npos ? std::string() : url.substr(path);
+	}
+
+
+	Recorder::Recorder(const std::string & path) {
+		// recordings hold session keys: not for other users' eyes
+		this->fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+		if (this->fd < 0 || ::fchmod(this->fd, 0600) != 0) {
+			LOG_E("Cannot open recording ", path, ": ", strerror(errno));
+			if (this->fd >= 0) ::close(this->fd);
+			this->fd = -1;
+			return;
+		}
+		this->buffer.append(kMagic, sizeof(kMagic));
+		write_value(this->buffer, kVersion);
+	}
+
+
+	Recorder::~Recorder() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->write_buffer();
+		if (this->fd >= 0)
+			::close(this->fd);
+	}
+
+
+	bool Recorder::is_open() const {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->fd >= 0 && !this->failed;
+	}
+
+
+	void Recorder::write_buffer() {
+		if (this->fd < 0 || this->failed) {
+			this->buffer.clear();
+			return;
+		}
+		size_t written = 0;
+		while (written < this->buffer.size()) {
+			auto n = ::write(this->fd, this->buffer.data() + written, this->buffer.size() - written);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) {
+				LOG_E("Cannot write recording: ", strerror(errno));
+				this->failed = true;
+				break;
+			}
+			written += n;
+		}
+		this->buffer.clear();
+	}
+
+
+	void Recorder::record(const std::string & url, const std::string & request, const std::string & reply,
+			const std::chrono::steady_clock::time_point start, const std::chrono::nanoseconds duration) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (!this->started) {
+			this->origin = start;
+			this->started = true;
+		}
+		write_value(this->buffer, static_cast<uint8_t>(ExchangeRecord));
+		write_value(this->buffer, static_cast<int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(start - this->origin).count()));
+		write_value(this->buffer, static_cast<int64_t>(duration.count()));
+		write_string(this->buffer, url);
+		write_string(this->buffer, request);
+		write_string(this->buffer, reply);
+		this->exchanges++;
+		if (this->buffer.size() >= kBufferSize)
+			this->write_buffer();
+	}
+
+
+	void Recorder::record_keys(const unsigned char * key, const unsigned char * iv) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		write_value(this->buffer, static_cast<uint8_t>(KeysRecord));
+		this->buffer.append(reinterpret_cast<const char*>(key), 16);
+		this->buffer.append(reinterpret_cast<const char*>(iv), 16);
+	}
+
+
+	void Recorder::flush() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->write_buffer();
+	}
+
+
+	uint64_t Recorder::size() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->exchanges;
+	}
+
+
+	ReplayTransport::ReplayTransport(const std::string & path, const bool pacing) : pacing(pacing) {
+		std::ifstream in(path, std::ios::binary);
+		char magic[4];
+		uint32_t version;
+		if (!in.read(magic, sizeof(magic)) || std::memcmp(magic, kMagic, sizeof(magic)) != 0
+				|| !read_value(in, version) || version != kVersion) {
+			LOG_E("Not a recording: ", path);
+			return;
+		}
+		uint8_t type;
+		while (read_value(in, type)) {
+			if (type == ExchangeRecord) {
+				Exchange e;
+				int64_t start, duration;
+				if (!read_value(in, start) || !read_value(in, duration) || !read_string(in, e.url)
+						|| !read_string(in, e.request) || !read_string(in, e.reply)) {
+					LOG_E("Truncated recording: ", path);
+					return;
+				}
+				e.start = std::chrono::nanoseconds(start);
+				e.duration = std::chrono::nanoseconds(duration);
+				this->exchanges.push_back(std::move(e));
+			} else if (type == KeysRecord) {
+				std::string k(32, '\0');
+				if (!in.read(&k[0], 32)) {
+					LOG_E("Truncated recording: ", path);
+					return;
+				}
+				this->keys.push_back(std::move(k));
+			} else {
+				LOG_E("Unknown record type in ", path);
+				return;
+			}
+		}
+		this->loaded = true;
+	}
+
+
+	bool ReplayTransport::is_open() const {
+		return this->loaded;
+	}
+
+
+	std::string ReplayTransport::post(const std::string & url, const std::string & data) {
+		const Exchange * e;
+		std::chrono::steady_clock::time_point due;
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			if (this->next_exchange >= this->exchanges.size()) {
+				LOG_E("Recording exhausted.");
+				return "";
+			}
+			e = &this->exchanges[this->next_exchange++];
+			if (url_path(e->url) != url_path(url) || e->request != data)
+				this->mismatched++;
+			if (!this->started) {
+				this->origin = std::chrono::steady_clock::now();
+				this->started = true;
+			}
+			due = this->origin + (e->start - this->exchanges.front().start);
+		}
+		if (this->pacing) {
+			std::this_thread::sleep_until(due);
+			std::this_thread::sleep_for(e->duration);
+		}
+		return e->reply;
+	}
+
+
+	bool ReplayTransport::session_keys(unsigned char * key, unsigned char * iv) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->next_keys >= this->keys.size()) return false;
+		auto & k = this->keys[this->next_keys++];
+		std::memcpy(key, k.data(), 16);
+		std::memcpy(iv, k.data() + 16, 16);
+		return true;
+	}
+
+
+	size_t ReplayTransport::size() const {
+		return this->exchanges.size();
+	}
+
+
+	size_t ReplayTransport::remaining() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->exchanges.size() - this->next_exchange;
+	}
+
+
+	uint64_t ReplayTransport::mismatches() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		return this->mismatched;
+	}
+
+
+	void ReplayTransport::rewind() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		this->next_exchange = 0;
+		this->next_keys = 0;
+		this->mismatched = 0;
+		// pacing starts again from the first exchange
+		this->started = false;
+	}
+}
@@ -0,0 +1,206 @@
+/** \file tp_m7350_transport.h
+ *  Transports carrying requests to TP-Link M7350 web gateways, and recording
+ *  and replay of exchanged data.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <mutex>
+#include <fstream>
+#include <chrono>
+#include <cstdint>
+
+namespace tplink {
+
+	/** \brief Carries POST requests to a web gateway, in place of the session's own CURL handle.
+	 *  A transport may be shared by several sessions, and must then be thread-safe.
+	 */
+	class Transport {
+	public:
+    virtual ~Transport() = default;
+
+    /** \brief Send a HTTP POST request and return reply.
+     *  \param url: URL to send request to.
+     *  \param data: POST data.
+     *  \returns server reply, or an empty string if request failed.
+     */
+    virtual std::string post(const std::string & url, const std::string & data) = 0;
+
+    /** \brief Provide the AES key and initialization vector of a new session.
+     *  Sessions generate random ones unless their transport provides them.
+     *  \param key: where to write 16-byte key.
+     *  \param iv: where to write 16-byte initialization vector.
+     *  \returns true if key and iv were provided, false otherwise.
+     */
+    virtual bool session_keys([[maybe_unused]] unsigned char * key, [[maybe_unused]] unsigned char * iv) { return false; }
+	};
+
+	/** \brief Records requests and replies of sessions to a file, for later replay.
+	 *
+	 *  The file is a sequence of binary records in host byte order, after a
+	 *  4-byte magic and a 4-byte version: an exchange holds its start time
+	 *  relative to the first one, its duration, URL, request and reply; a key
+	 *  record holds the AES key and iv generated by a session at login, so that
+	 *  replies of newer firmwares can be decrypted on replay. Records are
+	 *  written in the order in which requests complete. A recorder may be
+	 *  shared by several sessions.
+	 *
+	 *  As recordings hold session keys, the file is only readable by its owner.
+	 */
+	class Recorder {
+	private:
+    /** \brief Output file descriptor */
+    int fd = -1;
+
+    /** \brief Records not written to file yet */
+    std::string buffer;
+
+    /** \brief True once a write failed */
+    bool failed = false;
+
+    /** \brief Guards file and buffer */
+    mutable std::mutex mutex;
+
+    /** \brief Time of first exchange */
+    std::chrono::steady_clock::time_point origin;
+
+    /** \brief True once first exchange is recorded */
+    bool started = false;
+
+    /** \brief Number of exchanges recorded */
+    uint64_t exchanges = 0;
+
+    /** \brief Write buffer to file; called with mutex held. */
+    void write_buffer();
+
+	public:
+    /** \brief Constructor.
+     *  \param path: path of file to write; it is overwritten, and created with mode 0600.
+     */
+    explicit Recorder(const std::string & path);
+
+    Recorder(const Recorder &) = delete;
+    Recorder & operator=(const Recorder &) = delete;
+
+    /** \brief Destructor; writes buffered records and closes file. */
+    ~Recorder();
+
+    /** \brief Check whether file could be opened.
+     *  \returns true if file is open, false otherwise.
+     */
+    bool is_open() const;
+
+    /** \brief Record an exchange.
+     *  \param url: URL request was sent to.
+     *  \param request: POST data.
+     *  \param reply: server reply.
+     *  \param start: time at which request was sent.
+     *  \param duration: time until reply was received.
+     */
+    void record(const std::string & url, const std::string & request, const std::string & reply,
+        const std::chrono::steady_clock::time_point start, const std::chrono::nanoseconds duration);
+
+    /** \brief Record the AES key and iv of a session.
+     *  \param key: 16-byte key.
+     *  \param iv: 16-byte initialization vector.
+     */
+    void record_keys(const unsigned char * key, const unsigned char * iv);
+
+    /** \brief Write buffered records to file. */
+    void flush();
+
+    /** \brief Get number of exchanges recorded.
+     *  \returns number of exchanges.
+     */
+    uint64_t size();
+	};
+
+	/** \brief Serves replies from a recording, in recorded order.
+	 *
+	 *  Each request gets the reply of the next recorded exchange, whatever it
+	 *  asks for, so that a replay is deterministic even though requests of
+	 *  newer firmwares are signed with a sequence number. Requests whose data
+	 *  or URL path differ from the recorded ones are counted as mismatches;
+	 *  the gateway address doesn't matter. With pacing, each exchange waits
+	 *  until its recorded start, relative to the first one, and its reply is
+	 *  then delayed by the recorded round trip time; requests made later than
+	 *  recorded only wait for the round trip time.
+	 */
+	class ReplayTransport : public Transport {
+	private:
+    /** \brief A recorded exchange. */
+    struct Exchange {
+      std::chrono::nanoseconds start;
+      std::chrono::nanoseconds duration;
+      std::string url;
+      std::string request;
+      std::string reply;
+    };
+
+    /** \brief Recorded exchanges */
+    std::vector<Exchange> exchanges;
+
+    /** \brief Recorded session keys, 32 bytes each */
+    std::vector<std::string> keys;
+
+    /** \brief Next exchange to serve */
+    size_t next_exchange = 0;
+
+    /** \brief Next session keys to serve */
+    size_t next_keys = 0;
+
+    /** \brief Number of requests that differ from recording */
+    uint64_t mismatched = 0;
+
+    /** \brief If true, replay recorded start times and round trip times */
+    bool pacing;
+
+    /** \brief Time at which first exchange was served */
+    std::chrono::steady_clock::time_point origin;
+
+    /** \brief True once first exchange is served */
+    bool started = false;
+
+    /** \brief True if recording could be loaded */
+    bool loaded = false;
+
+    /** \brief Guards replay position */
+    std::mutex mutex;
+
+	public:
+    /** \brief Constructor.
+     *  \param path: path of recording.
+     *  \param pacing: if true, replay the recorded gaps between requests and round trip times.
+     */
+    explicit ReplayTransport(const std::string & path, const bool pacing = false);
+
+    /** \brief Check whether recording could be loaded.
+     *  \returns true if recording was loaded, false if it couldn't be read or is invalid.
+     */
+    bool is_open() const;
+
+    std::string post(const std::string & url, const std::string & data) override;
+
+    bool session_keys(unsigned char * key, unsigned char * iv) override;
+
+    /** \brief Get number of exchanges in recording.
+     *  \returns number of exchanges.
+     */
+    size_t size() const;
+
+    /** \brief Get number of exchanges not served yet.
+     *  \returns number of exchanges.
+     */
+    size_t remaining();
+
+    /** \brief Get number of requests that differ from recorded ones.
+     *  \returns number of requests.
+     */
+    uint64_t mismatches();
+
+    /** \brief Restart replay from first exchange. */
+    void rewind();
+	};
+}
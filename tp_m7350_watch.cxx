@@ -0,0 +1,208 @@
+/** \file tp_m7350_watch.cxx
+ *	Notifications of changes in TP-Link M7350 modem replies, with adaptive polling.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_watch.h"
+#include <algorithm>
+
+namespace tplink {
+
+	/** \brief Check if a JSON pointer designates a value inside another, or the same value.
+	 *	\param inner: pointer to check.
+	 *	\param outer: pointer to containing value.
+	 *	\returns true if inner is outer or starts with outer and a slash.
+	 */
+	static bool within(const std::string & inner, const std::string & outer) {
+		return inner.compare(0, outer.size(), outer) == 0 && (inner.size() == outer.size() || inner[outer.size()] == '/');
+	}
+
+	/** \brief Check if a patch may change the value at a pointer.
+	 *	\param patch: patch array.
+	 *	\param pointer: JSON pointer.
+	 *	\returns true if an operation targets the value, a value around it, or a
+	 *	sibling of such a value (array insertions and removals shift siblings).
+	 */
+	static bool affects(const rj::Value & patch, const std::string & pointer) {
+		for (auto o = patch.Begin(); o != patch.End(); o++) {
+			std::string path = (*o)["path"].GetString();
+			auto parent = path.substr(0, path.empty() ? 0 : path.rfind('/'));
+			if (within(pointer, path) || within(path, pointer) || within(pointer, parent))
+				return true;
+		}
+		return false;
+	}
+
+
+	Watcher::Watcher(const TPLink_M7350 & modem, const WatchOptions & options) : modem(&modem), options(options) {}
+
+
+	Watcher::~Watcher() {
+		this->stop();
+	}
+
+
+	uint64_t Watcher::subscribe(const std::string & module, const int action, const std::string & pointer, Callback callback) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto inserted = this->sources.try_emplace(std::make_pair(module, action));
+		auto & source = inserted.first->second;
+		if (inserted.second) {
+			source.module = module;
+			source.action = action;
+			source.interval = this->options.min_interval;
+		}
+		// new subscriber gets its initial value right away
+		source.due = Clock::now();
+		Subscription s;
+		s.id = this->next_id++;
+		s.pointer = pointer;
+		s.callback = std::make_shared<Callback>(std::move(callback));
+		source.subscriptions.push_back(std::move(s));
+		this->wake_up.notify_one();
+		return source.subscriptions.back().id;
+	}
+
+
+	void Watcher::unsubscribe(const uint64_t id) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		for (auto it = this->sources.begin(); it != this->sources.end(); it++) {
+			auto & subs = it->second.subscriptions;
+			auto s = std::find_if(subs.begin(), subs.end(), [id](const Subscription & s) { return s.id == id; });
+			if (s == subs.end()) continue;
+			subs.erase(s);
+			if (subs.empty()) this->sources.erase(it);
+			return;
+		}
+	}
+
+
+	bool Watcher::start() {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		if (this->running) return false;
+		this->running = true;
+		this->worker = std::thread(&Watcher::run, this);
+		return true;
+	}
+
+
+	void Watcher::stop() {
+		{
+			std::lock_guard<std::mutex> lock(this->mutex);
+			this->running = false;
+			this->wake_up.notify_all();
+		}
+		if (this->worker.joinable())
+			this->worker.join();
+	}
+
+
+	std::chrono::milliseconds Watcher::interval(const std::string & module, const int action) {
+		std::lock_guard<std::mutex> lock(this->mutex);
+		auto it = this->sources.find(std::make_pair(module, action));
+		return it != this->sources.end() ? it->second.interval : std::chrono::milliseconds(0);
+	}
+
+
+	rj::Document Watcher::fetch(const std::string & module, const int action) const {
+		if (this->options.scheduler == nullptr)
+			return this->modem->request(module, action);
+		auto modem = this->modem;
+		auto reply = this->options.scheduler->submit(Priority::Background, "watch", [modem, module, action] {
+			return modem->request(module, action);
+		});
+		try {
+			return reply.get();
+		} catch (const std::future_error &) {
+			// shed by scheduler
+			rj::Document d;
+			d.SetObject();
+			return d;
+		}
+	}
+
+
+	void Watcher::run() {
+		using std::chrono::milliseconds;
+		using std::chrono::duration_cast;
+
+		/* a callback to run once the lock is released */
+		struct Notification {
+			std::shared_ptr<Callback> callback;
+			std::string pointer;
+			std::unique_ptr<rj::Document> value;
+		};
+
+		std::unique_lock<std::mutex> lock(this->mutex);
+		while (this->running) {
+			auto next = this->sources.end();
+			for (auto it = this->sources.begin(); it != this->sources.end(); it++) {
+				if (next == this->sources.end() || it->second.due < next->second.due)
+					next = it;
+			}
+			if (next == this->sources.end()) {
+				this->wake_up.wait(lock);
+				continue;
+			}
+			if (Clock::now() < next->second.due) {
+				this->wake_up.wait_until(lock, next->second.due);
+				continue;
+			}
+
+			auto key = next->first;
+			lock.unlock();
+			auto t0 = Clock::now();
+			auto reply = this->fetch(key.first, key.second);
+			std::chrono::duration<double> latency = Clock::now() - t0;
+			lock.lock();
+			// source may have lost its subscribers meanwhile
+			auto it = this->sources.find(key);
+			if (it == this->sources.end()) continue;
+			auto & source = it->second;
+
+			bool ok = reply.IsObject() && !reply.ObjectEmpty()
+				&& (!reply.HasMember("result") || reply["result"] == WebReturnCode::Success);
+			bool changed = false;
+			std::vector<Notification> notifications;
+			if (ok) {
+				source.latency = source.latency.count() == 0 ? latency : 0.8*source.latency + 0.2*latency;
+				auto patch = source.diff.update(reply);
+				auto & current = source.diff.current();
+				for (auto & s: source.subscriptions) {
+					if (s.notified && !affects(patch, s.pointer)) continue;
+					auto value = json_get(current, s.pointer);
+					if (s.notified && (value != nullptr) == s.present && (value == nullptr || s.last == *value))
+						continue;
+					// a fresh document, as allocators don't reclaim memory of replaced values
+					rj::Document last;
+					if (value != nullptr) last.CopyFrom(*value, last.GetAllocator());
+					s.last.Swap(last);
+					s.present = value != nullptr;
+					s.notified = true;
+					changed = true;
+					Notification n{s.callback, s.pointer, nullptr};
+					if (value != nullptr) {
+						n.value = std::make_unique<rj::Document>();
+						n.value->CopyFrom(*value, n.value->GetAllocator());
+					}
+					notifications.push_back(std::move(n));
+				}
+			}
+
+			// poll faster while values change, slower while they don't, and back off on failures
+			auto interval = source.interval;
+			if (!ok) interval *= 2;
+			else if (changed) interval /= 2;
+			else interval += interval / 4;
+			interval = std::min(std::max(interval, this->options.min_interval), this->options.max_interval);
+			if (this->options.max_load > 0)
+				interval = std::max(interval, duration_cast<milliseconds>(source.latency / this->options.max_load));
+			source.interval = interval;
+			source.due = Clock::now() + interval;
+
+			lock.unlock();
+			for (auto & n: notifications)
+				(*n.callback)(n.pointer, n.value.get());
+			lock.lock();
+		}
+	}
+}
@@ -0,0 +1,174 @@
+/** \file tp_m7350_watch.h
+ *  Notifications of changes in TP-Link M7350 modem replies, with adaptive polling.
+ *  Author: Vincent Paeder
+ *  License: GPL v3
+ */
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+
+#include "tplink_m7350.h"
+#include "tp_m7350_patch.h"
+#include "tp_m7350_scheduler.h"
+
+namespace tplink {
+
+	/** \brief Watcher settings. */
+	struct WatchOptions {
+		/** \brief Shortest time between two polls of a request */
+		std::chrono::milliseconds min_interval{1000};
+		/** \brief Longest time between two polls of a request, unless the modem is slow */
+		std::chrono::milliseconds max_interval{60000};
+		/** \brief Largest fraction of time the modem may spend answering polls of a request */
+		double max_load = 0.05;
+		/** \brief If not nullptr, polls go through this scheduler as background requests */
+		Scheduler * scheduler = nullptr;
+	};
+
+	/** \brief Calls back subscribers when parts of modem replies change.
+	 *
+	 *  Subscriptions name a request (module and action, e.g. Modules::Status
+	 *  and 0) and a JSON pointer into its reply, e.g. "/wan/signalStrength" or
+	 *  "/connectedDevices/list". The watcher polls each subscribed request
+	 *  from a background thread, computes the patch from the previous reply
+	 *  (see SnapshotDiff), and calls back the subscribers whose part of the
+	 *  reply changed. Callbacks also get the initial value, after the first
+	 *  poll.
+	 *
+	 *  Each request is polled at its own interval, between the minimum and the
+	 *  maximum: the interval halves when a poll finds changes, and grows by a
+	 *  quarter when it doesn't. It never gets shorter than the reply latency
+	 *  divided by the maximum load, so that a slow modem is polled less often;
+	 *  failed polls double it.
+	 *
+	 *  The watcher uses the session from its polling thread; while it runs, the
+	 *  session mustn't be used elsewhere, unless all uses go through the same
+	 *  scheduler with a concurrency of 1.
+	 */
+	class Watcher {
+	public:
+    /** \brief Called with subscribed pointer and its new value, or nullptr if it's gone. */
+    using Callback = std::function<void(const std::string & pointer, const rj::Value * value)>;
+
+	private:
+    using Clock = std::chrono::steady_clock;
+
+    /** \brief A subscription. */
+    struct Subscription {
+      /** \brief Subscription identifier */
+      uint64_t id;
+      /** \brief JSON pointer into reply */
+      std::string pointer;
+      /** \brief Subscriber callback */
+      std::shared_ptr<Callback> callback;
+      /** \brief Last value passed to callback */
+      rj::Document last;
+      /** \brief True if last callback got a value */
+      bool present = false;
+      /** \brief True once callback got a value */
+      bool notified = false;
+    };
+
+    /** \brief A polled request. */
+    struct Source {
+      /** \brief Module name */
+      std::string module;
+      /** \brief Action code */
+      int action;
+      /** \brief Subscriptions to reply */
+      std::vector<Subscription> subscriptions;
+      /** \brief Previous replies */
+      SnapshotDiff diff;
+      /** \brief Time between polls */
+      std::chrono::milliseconds interval;
+      /** \brief Average reply latency */
+      std::chrono::duration<double> latency{0.0};
+      /** \brief Time of next poll */
+      Clock::time_point due;
+    };
+
+    /** \brief Modem session */
+    const TPLink_M7350 * modem;
+
+    /** \brief Watcher settings */
+    WatchOptions options;
+
+    /** \brief Polled requests, by module and action */
+    std::map<std::pair<std::string, int>, Source> sources;
+
+    /** \brief Next subscription identifier */
+    uint64_t next_id = 1;
+
+    /** \brief Polling thread */
+    std::thread worker;
+
+    /** \brief True while polling thread runs */
+    bool running = false;
+
+    /** \brief Guards sources and running flag */
+    std::mutex mutex;
+
+    /** \brief Wakes polling thread up on new subscriptions and when stopping */
+    std::condition_variable wake_up;
+
+    /** \brief Polling thread main loop. */
+    void run();
+
+    /** \brief Send a polled request.
+     *  \param module: module name.
+     *  \param action: action code.
+     *  \returns modem reply, or an empty object if request failed or was shed.
+     */
+    rj::Document fetch(const std::string & module, const int action) const;
+
+	public:
+    /** \brief Constructor.
+     *  \param modem: logged-in modem session.
+     *  \param options: watcher settings.
+     */
+    explicit Watcher(const TPLink_M7350 & modem, const WatchOptions & options = WatchOptions());
+
+    Watcher(const Watcher &) = delete;
+    Watcher & operator=(const Watcher &) = delete;
+
+    /** \brief Destructor; stops polling. */
+    ~Watcher();
+
+    /** \brief Subscribe to changes of part of a reply.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \param pointer: JSON pointer into reply; empty for whole reply.
+     *  \param callback: called from polling thread when value at pointer changes.
+     *  \returns subscription identifier.
+     */
+    uint64_t subscribe(const std::string & module, const int action, const std::string & pointer, Callback callback);
+
+    /** \brief Cancel a subscription. The callback may still run once if a poll is in progress.
+     *  \param id: subscription identifier.
+     */
+    void unsubscribe(const uint64_t id);
+
+    /** \brief Start polling thread.
+     *  \returns true if successful, false if already running.
+     */
+    bool start();
+
+    /** \brief Stop polling thread. */
+    void stop();
+
+    /** \brief Get current poll interval of a request.
+     *  \param module: module name.
+     *  \param action: action code.
+     *  \returns poll interval, or 0 if request isn't subscribed to.
+     */
+    std::chrono::milliseconds interval(const std::string & module, const int action);
+	};
+}
@@ -6,78 +6,27 @@
  *	License: GPL v3
  */
 #include "tplink_m7350.h"
+#include "tp_m7350_codec.h"
+#include "tp_m7350_metrics.h"
+#include "tp_m7350_trace.h"
+#include "tp_m7350_loop.h"
 #include <ctime>
-#include <iomanip>
+#include <chrono>
 #include <sstream>
+#include <cstring>
+#include <cstdlib>
+#include <cerrno>
 #include <iostream>
-#include "rapidjson/writer.h"
-#include "rapidjson/stringbuffer.h"
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 #include <openssl/evp.h>
 #include <openssl/rand.h>
-#include <openssl/rsa.h>
-#include <openssl/bn.h>
-#include <openssl/bio.h>
-#include <openssl/param_build.h>
 #include <openssl/err.h>
 
 namespace tplink {
 	
-	/** \brief Compute the MD5 hash of a string.
-	 *	\param str: string to compute MD5 hash for.
-	 *	\returns MD5 hash in hexadecimal format.
-	 */
-	static std::string compute_md5_hash(const std::string & str) {
-		unsigned char digest[16];
-		// digest functions from OpenSSL
-		auto ctx = UniquePointer<EVP_MD_CTX, EVP_MD_CTX_free>(EVP_MD_CTX_new());
-		EVP_MD_CTX_init(ctx.get());
-		EVP_DigestInit_ex(ctx.get(), EVP_md5(), nullptr);
-		EVP_DigestUpdate(ctx.get(), str.data(), str.size());
-		EVP_DigestFinal_ex(ctx.get(), digest, nullptr);
-		
-		std::ostringstream res;
-		for (int i=0; i<16; i++)
-			res << std::setfill('0') << std::setw(2) << std::hex << static_cast<unsigned int>(digest[i]);
-		
-		return res.str();
-	}
-
-	/** \brief Encode a string in base64.
-	 *	\param data: string to encode.
-	 *	\returns base64-encoded string.
-	 */
-	static std::string b64_encode(const std::string & data) {
-		auto b64 = UniquePointer<BIO, BIO_free>(BIO_new(BIO_f_base64()));
-		BIO_set_flags(b64.get(), BIO_FLAGS_BASE64_NO_NL);
-		auto sink = UniquePointer<BIO, BIO_free>(BIO_new(BIO_s_mem()));
-		BIO_push(b64.get(), sink.get());
-		BIO_write(b64.get(), data.data(), data.size());
-		BIO_flush(b64.get());
-		char* encoded;
-		auto len = BIO_get_mem_data(sink.get(), &encoded);
-		return std::string(encoded, len);
-	}
-
-	/** \brief Decode a base64-encoded string.
-	 *	\param data: base64-encoded string.
-	 *	\returns decoded string.
-	 */
-	static std::string b64_decode(const std::string & data) {
-		auto b64 = UniquePointer<BIO, BIO_free>(BIO_new(BIO_f_base64()));
-		BIO_set_flags(b64.get(), BIO_FLAGS_BASE64_NO_NL);
-		auto source = UniquePointer<BIO, BIO_free>(BIO_new(BIO_s_mem()));
-		auto sink = UniquePointer<BIO, BIO_free>(BIO_new(BIO_s_mem()));
-		BIO_puts(source.get(), data.c_str());
-		char buffer[data.size()];
-		BIO_push(b64.get(), source.get());
-		auto len = BIO_read(b64.get(), buffer, data.size());
-		BIO_flush(b64.get());
-		BIO_write(sink.get(), buffer, len);
-		char* decoded;
-		len = BIO_get_mem_data(sink.get(), &decoded);
-		return std::string(decoded, len);
-	}
-
 	/* CURL writer callback (collect server response) */
 	static int writer(char *data, size_t size, size_t nmemb, std::string *writer_data) {
 		if (writer_data == nullptr)
@@ -87,25 +36,13 @@ namespace tplink {
 		return size*nmemb;
 	}
 	
-	/** \brief Converts a RapidJSON object to string.
-	 *	\param d : RapidJSON object to stringify
-	 *	\returns a string containing the input JSON object.
-	 */
-	static std::string stringify(const rj::Document & d) {
-		rj::StringBuffer s;
-		rj::Writer<rj::StringBuffer> writer(s);
-		d.Accept(writer);
-		return s.GetString();
-	}
-	
-	
 	void TPLink_M7350::initialize() {
 		this->conn = UniquePointer<CURL, curl_easy_cleanup>(curl_easy_init());
 		// set error buffer for CURL
 		this->error_buffer.resize(CURL_ERROR_SIZE);
-		assert(curl_easy_setopt(this->conn.get(), CURLOPT_ERRORBUFFER, &this->error_buffer[0]) == CURLE_OK);
+		verify(curl_easy_setopt(this->conn.get(), CURLOPT_ERRORBUFFER, &this->error_buffer[0]) == CURLE_OK);
 		// set data writer function
-		assert(curl_easy_setopt(this->conn.get(), CURLOPT_WRITEFUNCTION, writer)  == CURLE_OK);
+		verify(curl_easy_setopt(this->conn.get(), CURLOPT_WRITEFUNCTION, writer)  == CURLE_OK);
 	}
 
 	
@@ -114,35 +51,153 @@ namespace tplink {
 	}
 
 
-	TPLink_M7350::TPLink_M7350(const std::string & modem_address, const std::string & password) {
+	TPLink_M7350::TPLink_M7350(const std::string & modem_address, const std::string & password, const WarmUp warm_up) {
 		this->initialize();
 		this->set_address(modem_address);
 		this->set_password(password);
+		this->set_warm_up(warm_up);
+	}
+
+
+	TPLink_M7350::TPLink_M7350(TPLink_M7350 && other) {
+		*this = std::move(other);
+	}
+
+
+	TPLink_M7350 & TPLink_M7350::operator=(TPLink_M7350 && other) {
+		if (this == &other) return *this;
+		// warm-up works on the object that started it
+		this->finish_warm_up();
+		other.finish_warm_up();
+		this->conn = std::move(other.conn);
+		this->error_buffer = std::move(other.error_buffer);
+		if (this->conn)
+			verify(curl_easy_setopt(this->conn.get(), CURLOPT_ERRORBUFFER, &this->error_buffer[0]) == CURLE_OK);
+		this->modem_address = std::move(other.modem_address);
+		this->auth_url = std::move(other.auth_url);
+		this->web_url = std::move(other.web_url);
+		this->password = std::move(other.password);
+		this->logged_in = other.logged_in;
+		this->token = std::move(other.token);
+		this->transport = std::move(other.transport);
+		this->recorder = std::move(other.recorder);
+		this->warm_up_mode = other.warm_up_mode;
+		this->login_request = std::move(other.login_request);
+		this->logged_in_early = other.logged_in_early;
+		this->session_cache = std::move(other.session_cache);
+		this->send_timeout = other.send_timeout;
+		this->send_poll_interval = other.send_poll_interval;
+	#if NEW_FIRMWARE==1
+		this->hash = std::move(other.hash);
+		std::memcpy(this->aes_key, other.aes_key, sizeof(this->aes_key));
+		std::memcpy(this->aes_iv, other.aes_iv, sizeof(this->aes_iv));
+		this->rsa_mod = std::move(other.rsa_mod);
+		this->rsa_exp = std::move(other.rsa_exp);
+		this->seq = other.seq;
+		this->rsa_key = std::move(other.rsa_key);
+	#endif // NEW_FIRMWARE
+		other.logged_in = false;
+		other.logged_in_early = false;
+		return *this;
+	}
+
+
+	TPLink_M7350::~TPLink_M7350() {
+		this->finish_warm_up();
+	}
+
+
+	void TPLink_M7350::set_warm_up(const WarmUp warm_up) {
+		this->warm_up_mode = warm_up;
+		this->start_warm_up();
+	}
+
+
+	void TPLink_M7350::set_send_status_polling(const std::chrono::milliseconds timeout, const std::chrono::milliseconds poll_interval) {
+		this->send_timeout = timeout;
+		this->send_poll_interval = poll_interval;
+	}
+
+
+	void TPLink_M7350::start_warm_up() {
+		this->finish_warm_up();
+		this->login_request.clear();
+		this->logged_in_early = false;
+		if (this->warm_up_mode == WarmUp::None) return;
+		this->warming = std::async(std::launch::async, [this, login = this->warm_up_mode == WarmUp::Login] {
+			LOG_I("Warming up connection to ", this->auth_url, " ...");
+			if (login && !this->session_cache.empty() && this->load_session(this->session_cache)) {
+				this->logged_in_early = true;
+				return;
+			}
+			// resolves address, connects, and gets nonce and RSA key
+			auto d = this->parse_response(this->post_request(this->auth_url, this->build_load_request()), false);
+			std::string req_json;
+			if (!this->build_login_request(d, req_json)) return;
+			if (!login) {
+				this->login_request = std::move(req_json);
+				return;
+			}
+			d = this->parse_response(this->post_request(this->auth_url, req_json), true);
+			this->logged_in_early = this->complete_login(d);
+		});
+	}
+
+
+	void TPLink_M7350::finish_warm_up() const {
+		if (this->warming.valid())
+			this->warming.get();
+	}
+
+
+	bool TPLink_M7350::authenticated() const {
+		this->finish_warm_up();
+		return this->logged_in;
 	}
 
 
 	std::string TPLink_M7350::post_request(const std::string & url, const std::string & data) const {
 		assert(this->conn != nullptr);
-		// set data buffer for CURL
 		std::string buffer;
-		assert(curl_easy_setopt(this->conn.get(), CURLOPT_WRITEDATA, &buffer) == CURLE_OK);
-		// set URL
-		assert(curl_easy_setopt(this->conn.get(), CURLOPT_URL, url.c_str()) == CURLE_OK);
-		// set POST data
-		curl_easy_setopt(this->conn.get(), CURLOPT_POSTFIELDSIZE, data.size());
-		curl_easy_setopt(this->conn.get(), CURLOPT_POSTFIELDS, data.c_str());
-		// access page
-		assert(curl_easy_perform(this->conn.get()) == CURLE_OK);
+		auto start = std::chrono::steady_clock::now();
+		if (this->transport) {
+			TP_METRICS_PHASE(PostRequest);
+			TP_TRACE_SCOPE(trace_span, "post_request");
+			buffer = this->transport->post(url, data);
+			TP_TRACE(trace_span.add_bytes(data.size(), buffer.size()));
+		} else {
+			// set data buffer for CURL
+			verify(curl_easy_setopt(this->conn.get(), CURLOPT_WRITEDATA, &buffer) == CURLE_OK);
+			// set URL
+			verify(curl_easy_setopt(this->conn.get(), CURLOPT_URL, url.c_str()) == CURLE_OK);
+			// set POST data
+			curl_easy_setopt(this->conn.get(), CURLOPT_POSTFIELDSIZE, data.size());
+			curl_easy_setopt(this->conn.get(), CURLOPT_POSTFIELDS, data.c_str());
+			// access page
+			TP_METRICS_PHASE(PostRequest);
+			TP_TRACE_SCOPE(trace_span, "post_request");
+			verify(curl_easy_perform(this->conn.get()) == CURLE_OK);
+			TP_TRACE(trace_span.add_bytes(data.size(), buffer.size()));
+		}
+		if (this->recorder)
+			this->recorder->record(url, data, buffer, start, std::chrono::steady_clock::now() - start);
+		TP_METRICS_BYTES(data.size(), buffer.size());
 		return buffer;
 	}
 
 	
 	rj::Document TPLink_M7350::parse_response(const std::string & data, const bool is_encrypted) const {
 		rj::Document d;
-		if (is_encrypted)
-			d.Parse(this->aes_decrypt(data).c_str());
-		else
+		if (is_encrypted) {
+			auto plaintext = this->aes_decrypt(data);
+			TP_METRICS_PHASE(ParseResponse);
+			TP_TRACE_SCOPE(trace_span, "parse_response");
+			d.Parse(plaintext.c_str());
+		} else {
+			TP_METRICS_PHASE(ParseResponse);
+			TP_TRACE_SCOPE(trace_span, "parse_response");
 			d.Parse(data.c_str());
+		}
 		
 		return d;
 	}
@@ -156,26 +211,29 @@ namespace tplink {
 		rj::Value a(rj::kArrayType);
 		rj::Document::AllocatorType & allocator = response.GetAllocator();
 		response.AddMember(rj::Value(rj::kStringType).SetString(field.c_str(), field.size(), allocator), a, allocator);
+		TP_TRACE_SCOPE(trace_span, "get_data_array");
+		TP_TRACE(trace_span.set_request(request["module"].GetString(), request["action"].GetInt()));
 		
+		// fetch one page of data
+		auto fetch_page = [this, &request]([[maybe_unused]] const int page_n) {
+			TP_TRACE_SCOPE(page_span, "get_data_array.page");
+			TP_TRACE(page_span.set_page(page_n));
+			auto req_json = this->encrypt(stringify(request), false);
+			auto reply = this->post_request(this->web_url, req_json);
+			TP_TRACE(page_span.add_bytes(req_json.size(), reply.size()));
+			return this->parse_response(reply, true);
+		};
 		// request data once to obtain the number of items in the array
-		auto req_json = this->encrypt(stringify(request), false);
-		auto d = this->parse_response(this->post_request(this->web_url, req_json), true);
+		auto d = fetch_page(1);
 		if (!d.HasMember("totalNumber")) return rj::Document();
 		auto cnt = d["totalNumber"].GetInt();
 		int page_n = 2; // page 1 has just been loaded
 		for (;;) {
-			if (d.HasMember(field.c_str())) {
-				for (rj::Value::ValueIterator itr = d[field.c_str()].Begin(); itr != d[field.c_str()].End(); ++itr) {
-					rj::Value obj(rj::kObjectType);
-					obj.CopyFrom(*itr, allocator);
-					response[field.c_str()].PushBack(obj, allocator);
-				}
-			}
+			append_page(response, field, d);
 			cnt -= 8;
 			if (cnt<=0) break;
-			request["pageNumber"] = page_n++;
-			req_json = this->encrypt(stringify(request), false);
-			d = this->parse_response(post_request(this->web_url, req_json), true);
+			request["pageNumber"] = page_n;
+			d = fetch_page(page_n++);
 		}
 		
 		return response;
@@ -183,14 +241,42 @@ namespace tplink {
 	
 
 	void TPLink_M7350::set_address(const std::string & modem_address) {
+		this->finish_warm_up();
 		// URLs of modem interface
 		this->modem_address = "http://" + modem_address;
 		this->auth_url = this->modem_address + "/cgi-bin/auth_cgi";
 		this->web_url = this->modem_address + "/cgi-bin/web_cgi";
+		this->start_warm_up();
+	}
+
+
+	std::string TPLink_M7350::get_address() const {
+		return this->modem_address.substr(std::strlen("http://"));
+	}
+
+	
+	void TPLink_M7350::set_share_handle(CURLSH * share) {
+		this->finish_warm_up();
+		verify(curl_easy_setopt(this->conn.get(), CURLOPT_SHARE, share) == CURLE_OK);
+	}
+
+
+	void TPLink_M7350::set_transport(std::shared_ptr<Transport> transport) {
+		this->finish_warm_up();
+		this->transport = std::move(transport);
+	}
+
+
+	void TPLink_M7350::set_recorder(std::shared_ptr<Recorder> recorder) {
+		this->finish_warm_up();
+		this->recorder = std::move(recorder);
 	}
 
 	
 	void TPLink_M7350::set_password(const std::string & password) {
+		this->finish_warm_up();
+		// a prepared login request carries the previous password
+		this->login_request.clear();
 		this->password = password;
 		#if NEW_FIRMWARE==1
 		this->hash = compute_md5_hash("admin"+this->password);
@@ -200,67 +286,17 @@ namespace tplink {
 	
 #if NEW_FIRMWARE==1
 	void TPLink_M7350::generate_aes_keys() {
-		assert(RAND_bytes(this->aes_key, 16));
-		assert(RAND_bytes(this->aes_iv, 16));
+		if (!this->transport || !this->transport->session_keys(this->aes_key, this->aes_iv)) {
+			verify(RAND_bytes(this->aes_key, 16));
+			verify(RAND_bytes(this->aes_iv, 16));
+		}
+		if (this->recorder)
+			this->recorder->record_keys(this->aes_key, this->aes_iv);
 	}
 
 
 	std::string TPLink_M7350::rsa_encrypt(const std::string & data) const {
-		auto params_build = UniquePointer<OSSL_PARAM_BLD, OSSL_PARAM_BLD_free>(OSSL_PARAM_BLD_new());
-		assert(params_build);
-		auto bn_mod = BN_new();
-		auto bn_exp = BN_new();
-		BN_hex2bn(&bn_mod, this->rsa_mod.c_str());
-		assert(bn_mod);
-		BN_hex2bn(&bn_exp, this->rsa_exp.c_str());
-		assert(bn_exp);
-
-		assert(OSSL_PARAM_BLD_push_BN(params_build.get(), "n", bn_mod)==1);
-		assert(OSSL_PARAM_BLD_push_BN(params_build.get(), "e", bn_exp)==1);
-		assert(OSSL_PARAM_BLD_push_BN(params_build.get(), "d", nullptr)==1);
-		auto params = UniquePointer<OSSL_PARAM, OSSL_PARAM_free>(OSSL_PARAM_BLD_to_param(params_build.get()));
-		assert(params);
-
-		// create key object
-		auto ctx = UniquePointer<EVP_PKEY_CTX, EVP_PKEY_CTX_free>(EVP_PKEY_CTX_new_id(EVP_PKEY_RSA, nullptr));
-		assert(ctx);
-		assert(EVP_PKEY_fromdata_init(ctx.get())==1);
-		auto pkey = EVP_PKEY_new();
-		assert(EVP_PKEY_fromdata(ctx.get(), &pkey, EVP_PKEY_PUBLIC_KEY, params.get())==1);
-		assert(pkey);
-		auto key_size = EVP_PKEY_get_bits(pkey)/8;
-
-		// create encryption context
-		ctx = UniquePointer<EVP_PKEY_CTX, EVP_PKEY_CTX_free>(EVP_PKEY_CTX_new(pkey, nullptr));
-		assert(EVP_PKEY_encrypt_init(ctx.get())>0);
-		assert(EVP_PKEY_CTX_set_rsa_padding(ctx.get(), RSA_NO_PADDING)>0);
-		// RSA with no padding can only encode strings that are the same size as the modulus;
-		// need to split data into chunks and pad last chunk
-		unsigned int last_chunk_size = data.size() % key_size;
-		unsigned int n_chunks = data.size()/key_size + (last_chunk_size>0);
-		auto encrypted_size = n_chunks*key_size;
-		std::vector<unsigned char> ciphertext;
-		ciphertext.resize(encrypted_size);
-		size_t offset = 0;
-		while (n_chunks--) {
-			size_t ciphertext_len = 0;
-			if (n_chunks == 0) {
-				std::vector<unsigned char> plaintext;
-				plaintext.resize(key_size);
-				std::copy(data.begin()+offset, data.end(), plaintext.begin());
-				EVP_PKEY_encrypt(ctx.get(), &ciphertext[offset], &ciphertext_len, plaintext.data(), key_size);
-			} else {
-				EVP_PKEY_encrypt(ctx.get(), &ciphertext[offset], &ciphertext_len, reinterpret_cast<const unsigned char*>(&data[offset]), key_size);
-				offset += key_size;
-			}
-		}
-
-		EVP_PKEY_free(pkey);
-		BN_free(bn_mod);
-		BN_free(bn_exp);
-
-		auto result = std::string(reinterpret_cast<char*>(ciphertext.data()), encrypted_size);
-		return result;
+		return tplink::rsa_encrypt(data, this->rsa_key.get());
 	}
 
 
@@ -282,39 +318,16 @@ namespace tplink {
 
 
 	std::string TPLink_M7350::aes_encrypt(const std::string & data) const {
-		auto ctx = UniquePointer<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
-		assert(ctx);
-
-		auto plaintext_len = data.size();
-
-		unsigned char ciphertext[plaintext_len];
-		int ciphertext_len = 0, len = 0;
-		assert(EVP_EncryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, this->aes_key, this->aes_iv)==1);
-		assert(EVP_EncryptUpdate(ctx.get(), ciphertext, &ciphertext_len, reinterpret_cast<const unsigned char*>(data.c_str()), plaintext_len)==1);
-		assert(EVP_EncryptFinal_ex(ctx.get(), ciphertext + ciphertext_len, &len)==1);
-		ciphertext_len += len;
-
-		auto result = b64_encode(std::string(reinterpret_cast<char*>(ciphertext), ciphertext_len));
-		return result;
+		return tplink::aes_encrypt(data, this->aes_key, this->aes_iv);
 	}
 #endif // NEW_FIRMWARE
 
 
 	std::string TPLink_M7350::aes_decrypt(const std::string & data) const {
 	#if NEW_FIRMWARE==1
-		auto ctx = UniquePointer<EVP_CIPHER_CTX, EVP_CIPHER_CTX_free>(EVP_CIPHER_CTX_new());
-		assert(ctx);
-
-		auto ciphertext = b64_decode(data);
-		unsigned char plaintext[data.size()];
-		int plaintext_len = 0, len = 0;
-		assert(EVP_DecryptInit_ex(ctx.get(), EVP_aes_128_cbc(), nullptr, this->aes_key, this->aes_iv)==1);
-		assert(EVP_DecryptUpdate(ctx.get(), plaintext, &plaintext_len, reinterpret_cast<const unsigned char*>(ciphertext.c_str()), ciphertext.size())==1);
-		assert(EVP_DecryptFinal_ex(ctx.get(), plaintext + plaintext_len, &len)==1);
-		plaintext_len += len;
-
-		auto result = std::string(reinterpret_cast<char*>(plaintext), plaintext_len);
-		return result;
+		TP_METRICS_PHASE(AESDecrypt);
+		TP_TRACE_SCOPE(trace_span, "aes_decrypt");
+		return tplink::aes_decrypt(data, this->aes_key, this->aes_iv);
 	#else
 		return data;
 	#endif // NEW_FIRMWARE
@@ -323,6 +336,8 @@ namespace tplink {
 
 	std::string TPLink_M7350::encrypt(const std::string & data, const bool include_aes_key) const {
 	#if NEW_FIRMWARE==1
+		TP_METRICS_PHASE(Encrypt);
+		TP_TRACE_SCOPE(trace_span, "encrypt");
 		auto encrypted = this->aes_encrypt(data);
 		auto signature = this->rsa_sign(encrypted.size(), include_aes_key);
 		return "{\"data\":\""+encrypted+"\",\"sign\":\""+signature+"\"}";
@@ -335,6 +350,10 @@ namespace tplink {
 	rj::Document TPLink_M7350::build_request_object(const std::string & module, const int action) const {
 		// this function creates a basic JSON object with commonly required fields
 		// {"module":"module name", "action":action_code, "token":"authentication token"}
+		TP_METRICS_REQUEST(module, action);
+		TP_METRICS_PHASE(BuildRequestObject);
+		TP_TRACE_REQUEST(module, action);
+		TP_TRACE_SCOPE(trace_span, "build_request_object");
 		rj::Document req;
 		req.SetObject();
 		req.AddMember("module","",req.GetAllocator());
@@ -349,10 +368,11 @@ namespace tplink {
 	
 
 	rj::Document TPLink_M7350::do_request(const std::string & module, const int action) const {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return nullptr;
 		}
+		TP_TRACE_SCOPE(trace_span, "do_request");
 		
 		auto req = this->build_request_object(module, action);
 		auto req_json = this->encrypt(stringify(req), false);
@@ -361,12 +381,7 @@ namespace tplink {
 	}
 
   
-	bool TPLink_M7350::send_data(const std::string & module, const int action, const rj::Document & data) const {
-		if (!this->logged_in) {
-			LOG_E("Not logged in! Try logging in first.");
-			return false;
-		}
-		
+	rj::Document TPLink_M7350::build_data_request(const std::string & module, const int action, const rj::Document & data) const {
 		// create a basic request object
 		auto req = this->build_request_object(module, action);
 		// add provided data to the object
@@ -375,7 +390,18 @@ namespace tplink {
 			auto value = rj::Value(itr->value, req.GetAllocator());
 			req.AddMember(name.Move(), value.Move(), req.GetAllocator());
 		}
+		return req;
+	}
+
+
+	bool TPLink_M7350::send_data(const std::string & module, const int action, const rj::Document & data) const {
+		if (!this->authenticated()) {
+			LOG_E("Not logged in! Try logging in first.");
+			return false;
+		}
+		TP_TRACE_SCOPE(trace_span, "send_data");
 		
+		auto req = this->build_data_request(module, action, data);
 		auto req_json = this->encrypt(stringify(req), false);
 		
 		auto d = this->parse_response(this->post_request(this->web_url, req_json), true);
@@ -427,17 +453,48 @@ namespace tplink {
 		std::string req_json; // for POST request data
 		rj::Document d; // for server replies
 		
+		this->finish_warm_up();
+		if (this->logged_in_early) {
+			this->logged_in_early = false;
+			if (this->logged_in) return true;
+		}
+		if (!this->session_cache.empty() && this->load_session(this->session_cache))
+			return true;
 		LOG_I("Attempting login into ", this->auth_url, " ...");
+		TP_TRACE_SCOPE(trace_span, "login");
+
+		if (!this->login_request.empty()) {
+			// warm-up already got a salt and prepared the request
+			TP_TRACE_SCOPE(authenticate_span, "login.authenticate");
+			d = this->parse_response(post_request(this->auth_url, this->login_request), true);
+			this->login_request.clear();
+			if (this->complete_login(d)) return true;
+			LOG_I("Prepared login request was rejected; starting over.");
+		}
 	
 		/* get password salt */
-		{
-			// build JSON request object
-			auto req = this->build_request_object(Modules::Authenticator, AuthenticatorOptions::Load);
-			// serialize
-			req_json = stringify(req);
-		}
+		TP_TRACE_SCOPE(load_span, "login.load");
 		// send request
-		d = this->parse_response(post_request(this->auth_url, req_json), false);
+		d = this->parse_response(post_request(this->auth_url, this->build_load_request()), false);
+		TP_TRACE(load_span.finish());
+		/* log in */
+		TP_TRACE_SCOPE(authenticate_span, "login.authenticate");
+		if (!this->build_login_request(d, req_json)) return false;
+		// send request
+		d = this->parse_response(post_request(this->auth_url, req_json), true);
+		return this->complete_login(d);
+	}
+
+
+	std::string TPLink_M7350::build_load_request() const {
+		// build JSON request object
+		auto req = this->build_request_object(Modules::Authenticator, AuthenticatorOptions::Load);
+		// serialize
+		return stringify(req);
+	}
+
+
+	bool TPLink_M7350::build_login_request(const rj::Document & d, std::string & req_json) {
 		// check that response is valid
 		if (!d.IsObject()) {
 			LOG_E("Modem didn't return a valid reply.");
@@ -454,30 +511,31 @@ namespace tplink {
 		}
 		
 		LOG_I("Got a valid reply from modem. Trying to authenticate...");
-		/* log in */
-		{
-		#if NEW_FIRMWARE==1
-			// generate new AES keys
-			this->generate_aes_keys();
-			// store RSA key and salt
-			this->rsa_mod = d["rsaMod"].GetString();
-			this->rsa_exp = d["rsaPubKey"].GetString();
-			auto seq_str = d["seqNum"].GetString();
-			if (strlen(seq_str)>0)
-				this->seq = std::stoi(seq_str);
-		#endif // NEW_FIRMWARE
-			// create salted password MD5 digest
-			auto spwd = this->password+":"+d["nonce"].GetString();
-			auto auth_digest =	compute_md5_hash(spwd);
-			// build JSON request object
-			auto req = this->build_request_object(Modules::Authenticator, AuthenticatorOptions::Login);
-			req.AddMember("digest", "", req.GetAllocator());
-			req["digest"].SetString(auth_digest.c_str(), auth_digest.size());
-			// serialize
-			req_json = this->encrypt(stringify(req), true);
-		}
-		// send request
-		d = this->parse_response(post_request(this->auth_url, req_json), true);
+	#if NEW_FIRMWARE==1
+		// generate new AES keys
+		this->generate_aes_keys();
+		// store RSA key and salt
+		this->rsa_mod = d["rsaMod"].GetString();
+		this->rsa_exp = d["rsaPubKey"].GetString();
+		this->rsa_key.reset(tplink::rsa_public_key(this->rsa_mod, this->rsa_exp));
+		auto seq_str = d["seqNum"].GetString();
+		if (strlen(seq_str)>0)
+			this->seq = std::stoi(seq_str);
+	#endif // NEW_FIRMWARE
+		// create salted password MD5 digest
+		auto spwd = this->password+":"+d["nonce"].GetString();
+		auto auth_digest =	compute_md5_hash(spwd);
+		// build JSON request object
+		auto req = this->build_request_object(Modules::Authenticator, AuthenticatorOptions::Login);
+		req.AddMember("digest", "", req.GetAllocator());
+		req["digest"].SetString(auth_digest.c_str(), auth_digest.size());
+		// serialize
+		req_json = this->encrypt(stringify(req), true);
+		return true;
+	}
+
+
+	bool TPLink_M7350::complete_login(const rj::Document & d) {
 		// check that server returned a valid auth token
 		if (!d.IsObject()) {
 			LOG_E("Modem didn't return a valid reply.");
@@ -495,11 +553,258 @@ namespace tplink {
 		
 		this->logged_in = true;
 		LOG_I("Login successful.");
+		if (!this->session_cache.empty())
+			this->store_session(this->session_cache);
+		return true;
+	}
+
+
+	void TPLink_M7350::set_session_cache(const std::string & path) {
+		this->finish_warm_up();
+		this->session_cache = path;
+	}
+
+
+	bool TPLink_M7350::save_session(const std::string & path) const {
+		this->finish_warm_up();
+		return this->store_session(path);
+	}
+
+
+	bool TPLink_M7350::restore_session(const std::string & path) {
+		this->finish_warm_up();
+		return this->load_session(path);
+	}
+
+
+	bool TPLink_M7350::store_session(const std::string & path) const {
+		rj::Document d;
+		d.SetObject();
+		auto & allocator = d.GetAllocator();
+		d.AddMember("version", 1, allocator);
+		d.AddMember("address", rj::Value(this->modem_address.c_str(), allocator), allocator);
+		d.AddMember("token", rj::Value(this->token.c_str(), allocator), allocator);
+	#if NEW_FIRMWARE==1
+		auto key = b64_encode(std::string(reinterpret_cast<const char*>(this->aes_key), 16));
+		auto iv = b64_encode(std::string(reinterpret_cast<const char*>(this->aes_iv), 16));
+		d.AddMember("key", rj::Value(key.c_str(), allocator), allocator);
+		d.AddMember("iv", rj::Value(iv.c_str(), allocator), allocator);
+		d.AddMember("seq", this->seq, allocator);
+		d.AddMember("rsaMod", rj::Value(this->rsa_mod.c_str(), allocator), allocator);
+		d.AddMember("rsaExp", rj::Value(this->rsa_exp.c_str(), allocator), allocator);
+		d.AddMember("hash", rj::Value(this->hash.c_str(), allocator), allocator);
+	#endif // NEW_FIRMWARE
+		auto data = stringify(d);
+
+		// write to a new file with a unique name and move it in place, so that readers never see a partial file,
+		// even when several processes store the same cache at once
+		std::string tmp = path + ".XXXXXX";
+		int fd = ::mkostemp(&tmp[0], O_CLOEXEC);
+		if (fd < 0) {
+			LOG_E("Couldn't create session cache ", tmp, ": ", strerror(errno));
+			return false;
+		}
+		bool ok = ::fchmod(fd, 0600) == 0
+			&& ::write(fd, data.data(), data.size()) == static_cast<ssize_t>(data.size())
+			&& ::fsync(fd) == 0;
+		ok = ::close(fd) == 0 && ok;
+		if (!ok || ::rename(tmp.c_str(), path.c_str()) != 0) {
+			::unlink(tmp.c_str());
+			LOG_E("Couldn't write session cache ", path);
+			return false;
+		}
 		return true;
 	}
+
+
+	bool TPLink_M7350::load_session(const std::string & path) {
+		int fd = ::open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+		if (fd < 0) return false;
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_uid != ::geteuid() || (st.st_mode & 077) != 0) {
+			::close(fd);
+			LOG_E("Ignoring session cache ", path, ": it must be owned and only readable by current user.");
+			return false;
+		}
+		std::string data(st.st_size, '\0');
+		bool ok = ::read(fd, &data[0], data.size()) == static_cast<ssize_t>(data.size());
+		::close(fd);
+		rj::Document d;
+		if (!ok || d.Parse(data.c_str()).HasParseError() || !d.IsObject()) {
+			LOG_E("Ignoring invalid session cache ", path);
+			return false;
+		}
+		auto text = [&d](const char * name) {
+			auto it = d.FindMember(name);
+			return it != d.MemberEnd() && it->value.IsString() ? std::string(it->value.GetString()) : std::string();
+		};
+		auto version = d.FindMember("version");
+		if (version == d.MemberEnd() || version->value != 1 || text("address") != this->modem_address || text("token").empty()) {
+			LOG_I("Session cache ", path, " doesn't match this session.");
+			return false;
+		}
+	#if NEW_FIRMWARE==1
+		auto key = b64_decode(text("key"));
+		auto iv = b64_decode(text("iv"));
+		auto seq = d.FindMember("seq");
+		if (text("hash") != this->hash || key.size() != 16 || iv.size() != 16 || seq == d.MemberEnd() || !seq->value.IsUint()
+				|| text("rsaMod").empty() || text("rsaExp").empty()) {
+			LOG_I("Session cache ", path, " doesn't match this session.");
+			return false;
+		}
+		std::copy(key.begin(), key.end(), this->aes_key);
+		std::copy(iv.begin(), iv.end(), this->aes_iv);
+		// recordings need the keys to decrypt replies, as with keys generated at login
+		if (this->recorder)
+			this->recorder->record_keys(this->aes_key, this->aes_iv);
+		this->seq = seq->value.GetUint();
+		this->rsa_mod = text("rsaMod");
+		this->rsa_exp = text("rsaExp");
+		this->rsa_key.reset(tplink::rsa_public_key(this->rsa_mod, this->rsa_exp));
+	#endif // NEW_FIRMWARE
+		this->token = text("token");
+		this->logged_in = true;
+
+		// a keep-alive request fails if modem dropped the session
+		auto req = this->build_request_object(Modules::WebServer, WebServerOptions::KeepAlive);
+		auto reply = this->parse_response(this->post_request(this->web_url, this->encrypt(stringify(req), false)), true);
+		if (reply.IsObject() && reply.HasMember("result") && reply["result"] == WebReturnCode::Success) {
+			LOG_I("Reusing session from ", path, ".");
+			return true;
+		}
+		LOG_I("Modem rejected cached session.");
+		this->logged_in = false;
+		this->token.clear();
+		return false;
+	}
+
+
+	rj::Document TPLink_M7350::request(const std::string & module, const int action) const {
+		return this->do_request(module, action);
+	}
+
+
+	rj::Document TPLink_M7350::request(const std::string & module, const int action, const rj::Document & data) const {
+		if (!this->authenticated()) {
+			LOG_E("Not logged in! Try logging in first.");
+			return nullptr;
+		}
+		TP_TRACE_SCOPE(trace_span, "request");
+		auto req = this->build_data_request(module, action, data);
+		auto req_json = this->encrypt(stringify(req), false);
+		return this->parse_response(this->post_request(this->web_url, req_json), true);
+	}
+
+
+	/** \brief A POST request run by an event loop; records its metrics and span once it completes. */
+	struct PendingPost {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		/** \brief Request data, kept for the recorder only */
+		std::string request;
+		size_t sent = 0;
+	#if TPLINK_METRICS==1
+		metrics::PendingPhase phase{metrics::Phase::PostRequest};
+	#endif
+	#if TPLINK_TRACING==1
+		trace::Span span{"post_request"};
+	#endif
+
+		PendingPost() {
+			// the loop thread may have started other requests by the time this one completes
+			TP_TRACE(this->span.set_current_request());
+		}
+
+		void finish([[maybe_unused]] const size_t received) {
+		#if TPLINK_METRICS==1
+			this->phase.finish(this->sent, received);
+		#endif
+			TP_TRACE(this->span.add_bytes(this->sent, received));
+			TP_TRACE(this->span.finish());
+		}
+	};
+
+
+	void TPLink_M7350::post_async(LoopDriver & driver, const std::string & url, std::string data, std::function<void(std::string &&)> done) const {
+		if (this->transport) {
+			// transports have no non-blocking form: run request in place
+			done(this->post_request(url, data));
+			return;
+		}
+		auto pending = std::make_shared<PendingPost>();
+		pending->sent = data.size();
+		if (this->recorder) pending->request = data;
+		driver.post(url, std::move(data), [this, url, pending, done = std::move(done)](bool ok, std::string && reply) {
+			if (!ok) {
+				LOG_E("Request to ", url, " failed.");
+				reply.clear();
+			}
+			pending->finish(reply.size());
+			if (this->recorder)
+				this->recorder->record(url, pending->request, reply, pending->start, std::chrono::steady_clock::now() - pending->start);
+			done(std::move(reply));
+		});
+	}
+
+
+	void TPLink_M7350::login_async(LoopDriver & driver, std::function<void(bool)> done) {
+		this->finish_warm_up();
+		this->login_request.clear();
+		this->logged_in_early = false;
+		LOG_I("Attempting login into ", this->auth_url, " ...");
+		this->post_async(driver, this->auth_url, this->build_load_request(), [this, &driver, done = std::move(done)](std::string && reply) mutable {
+			std::string req_json;
+			if (!this->build_login_request(this->parse_response(reply, false), req_json)) {
+				done(false);
+				return;
+			}
+			this->post_async(driver, this->auth_url, std::move(req_json), [this, done = std::move(done)](std::string && reply) {
+				done(this->complete_login(this->parse_response(reply, true)));
+			});
+		});
+	}
+
+
+	void TPLink_M7350::request_async(LoopDriver & driver, const std::string & module, const int action, std::function<void(rj::Document)> done) const {
+		if (!this->authenticated()) {
+			LOG_E("Not logged in! Try logging in first.");
+			done(rj::Document());
+			return;
+		}
+		auto req = this->build_request_object(module, action);
+		this->post_async(driver, this->web_url, this->encrypt(stringify(req), false), [this, done = std::move(done)](std::string && reply) {
+			done(this->parse_response(reply, true));
+		});
+	}
+
+
+	void TPLink_M7350::request_async(LoopDriver & driver, const std::string & module, const int action, const rj::Document & data, std::function<void(rj::Document)> done) const {
+		if (!this->authenticated()) {
+			LOG_E("Not logged in! Try logging in first.");
+			done(rj::Document());
+			return;
+		}
+		auto req = this->build_data_request(module, action, data);
+		this->post_async(driver, this->web_url, this->encrypt(stringify(req), false), [this, done = std::move(done)](std::string && reply) {
+			done(this->parse_response(reply, true));
+		});
+	}
+
+
+	void TPLink_M7350::send_data_async(LoopDriver & driver, const std::string & module, const int action, const rj::Document & data, std::function<void(bool)> done) const {
+		if (!this->authenticated()) {
+			LOG_E("Not logged in! Try logging in first.");
+			done(false);
+			return;
+		}
+		auto req = this->build_data_request(module, action, data);
+		this->post_async(driver, this->web_url, this->encrypt(stringify(req), false), [this, done = std::move(done)](std::string && reply) {
+			auto d = this->parse_response(reply, true);
+			done(d.IsObject() && d.HasMember("result") && d["result"] == WebReturnCode::Success);
+		});
+	}
 	
 	bool TPLink_M7350::logout() {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_I("Not logged in.");
 			return true;
 		}
@@ -510,6 +815,8 @@ namespace tplink {
 		this->logged_in = !(d["result"].GetInt() == AuthReturnCode::Success);
 		if (this->logged_in)
 			LOG_E("Couldn't log out!");
+		else if (!this->session_cache.empty())
+			::unlink(this->session_cache.c_str());
 	
 		return !(this->logged_in);
 	}
@@ -519,7 +826,7 @@ namespace tplink {
 	}
 
 	bool TPLink_M7350::change_password(const std::string & old_password, const std::string & new_password) {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return false;
 		}
@@ -575,7 +882,7 @@ namespace tplink {
 
 	/* Log module */
 	rj::Document TPLink_M7350::get_log() const {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return nullptr;
 		}
@@ -608,7 +915,7 @@ namespace tplink {
   
 	/* Message module */
 	rj::Document TPLink_M7350::read_sms(const MailboxCode box) const {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return nullptr;
 		}
@@ -622,7 +929,13 @@ namespace tplink {
 	}
 
 	bool TPLink_M7350::send_sms(const std::string & phone_number, const std::string & message) const {
-		if (!this->logged_in) {
+		int8_t result;
+		return this->send_sms(phone_number, message, result);
+	}
+
+	bool TPLink_M7350::send_sms(const std::string & phone_number, const std::string & message, int8_t & result) const {
+		result = -1;
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return false;
 		}
@@ -653,6 +966,16 @@ namespace tplink {
 
 			d = this->parse_response(this->post_request(this->web_url, req_json), true);
 		}
+		// a missing or malformed reply means the message may not have been queued
+		auto valid_reply = [](const rj::Document & d) {
+			return d.IsObject() && d.HasMember("result") && d["result"].IsInt();
+		};
+		if (!valid_reply(d)) {
+			LOG_E("Invalid reply to send request.");
+			return false;
+		}
+		// from here on, the message may leave the modem whatever happens
+		result = MessageReturnCode::Sending;
 		
 		/* wait until message has been sent */
 		{
@@ -661,16 +984,28 @@ namespace tplink {
 			// serialize
 			req_json = this->encrypt(stringify(req), false);
 		}
-		// send request repeatedly
-		do {
+		// send request repeatedly, but give up if the modem never leaves the sending state
+		auto deadline = std::chrono::steady_clock::now() + this->send_timeout;
+		for (;;) {
 			d = this->parse_response(this->post_request(this->web_url, req_json), true);
-		} while (d["result"].GetInt() == MessageReturnCode::Sending);
+			if (!valid_reply(d)) {
+				LOG_E("Invalid reply to send status request; message may still be sent.");
+				return false;
+			}
+			if (d["result"].GetInt() != MessageReturnCode::Sending) break;
+			if (std::chrono::steady_clock::now() + this->send_poll_interval > deadline) {
+				LOG_E("Gave up waiting for message to be sent; it may still be sent.");
+				return false;
+			}
+			std::this_thread::sleep_for(this->send_poll_interval);
+		}
 	
-		return d["result"].GetInt() == MessageReturnCode::SendSuccessSaveSuccess;
+		result = d["result"].GetInt();
+		return result == MessageReturnCode::SendSuccessSaveSuccess;
 	}
 	
 	bool TPLink_M7350::delete_sms(const MailboxCode box, const std::vector<int> & indices) const {
-		if (!this->logged_in) {
+		if (!this->authenticated()) {
 			LOG_E("Not logged in! Try logging in first.");
 			return false;
 		}
@@ -800,7 +1135,7 @@ namespace tplink {
 	
 	/* WebServer module */
 	rj::Document TPLink_M7350::get_web_server_info() const {
-		if (this->logged_in) {
+		if (this->authenticated()) {
 			return this->do_request(Modules::WebServer, WebServerOptions::GetFeatureList);
 		} else {
 		#if NEW_FIRMWARE==1
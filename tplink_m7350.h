@@ -9,31 +9,19 @@
 #include <vector>
 #include <iostream>
 #include <memory>
+#include <functional>
+#include <future>
+#include <chrono>
 #include <rapidjson/document.h>
 #include <curl/curl.h>
+#include <openssl/evp.h>
 
 #include "tp_m7350_enums.h"
+#include "tp_m7350_log.h"
+#include "tp_m7350_transport.h"
 
 namespace tplink {
 
-  #ifndef NDEBUG
-  template <typename... Args> void tp_logger(const char * level, const char * file, const int line, const Args... args) {
-    std::cout << level << ":[" << file << "|" << line << "] ";
-    ([&]{std::cout << args;}(), ...);
-    std::cout << std::endl;
-  }
-  #define __FILENAME__ (strrchr(__FILE__, '/') ? strrchr(__FILE__, '/') + 1 : __FILE__)
-  #define LOG_V(...) tp_logger("V", __FILENAME__, __LINE__, __VA_ARGS__)
-  #define LOG_D(...) tp_logger("D", __FILENAME__, __LINE__, __VA_ARGS__)
-  #define LOG_E(...) tp_logger("E", __FILENAME__, __LINE__, __VA_ARGS__)
-  #define LOG_I(...) tp_logger("I", __FILENAME__, __LINE__, __VA_ARGS__)
-  #else
-  #define LOG_V(...)
-  #define LOG_D(...)
-  #define LOG_E(...)
-  #define LOG_I(...)
-  #endif
-	
 	/** \brief Wrap a C deleter function for use with smart pointers.
 	 * 
 	 *  This relies on the behaviour of the call operator that assumes
@@ -54,6 +42,15 @@ namespace tplink {
 	using UniquePointer = std::unique_ptr<WrappedType, CustomDeleter<DeleterFunction> >;
 
 	namespace rj = rapidjson;
+
+	class LoopDriver;
+
+	/** \brief Work a session does in the background once it knows the modem address. */
+	enum class WarmUp : uint8_t {
+		None = 0, ///< Nothing; the first request connects
+		Connect = 1, ///< Connect, fetch login parameters and prepare login request
+		Login = 2, ///< Connect and log in
+	};
 	
 	/** \brief Class handling communication with a TP-Link M7350 v5 web interface. */
 	class TPLink_M7350 {
@@ -82,8 +79,58 @@ namespace tplink {
     /** \brief Authentication token */
     std::string token{};
 
+    /** \brief Transport used instead of #conn, if set */
+    std::shared_ptr<Transport> transport;
+
+    /** \brief Recorder of exchanged data, if set */
+    std::shared_ptr<Recorder> recorder;
+
+    /** \brief Background work started when modem address is set */
+    WarmUp warm_up_mode = WarmUp::None;
+
+    /** \brief Login request prepared by warm-up, if any */
+    std::string login_request{};
+
+    /** \brief True if warm-up logged in and login() wasn't called since */
+    bool logged_in_early = false;
+
+    /** \brief Longest wait for a message accepted by the modem to be sent */
+    std::chrono::milliseconds send_timeout{60000};
+
+    /** \brief Time between two send status requests */
+    std::chrono::milliseconds send_poll_interval{250};
+
+    /** \brief Path of session cache file, if any */
+    std::string session_cache{};
+
+    /** \brief Warm-up in progress */
+    mutable std::future<void> warming;
+
     /** \brief Initialize instance */
     void initialize();
+
+    /** \brief Start warm-up, if enabled, after waiting for the previous one. */
+    void start_warm_up();
+
+    /** \brief Wait for warm-up in progress, if any. */
+    void finish_warm_up() const;
+
+    /** \brief Check if session is logged in, once warm-up is done.
+     *  \returns true if logged in.
+     */
+    bool authenticated() const;
+
+    /** \brief Write session state to a file readable by its owner only.
+     *  \param path: file path.
+     *  \returns true if state was written, false otherwise.
+     */
+    bool store_session(const std::string & path) const;
+
+    /** \brief Read session state from a file and check with modem that it is still valid.
+     *  \param path: file path.
+     *  \returns true if session was restored, false otherwise.
+     */
+    bool load_session(const std::string & path);
     
   #if NEW_FIRMWARE==1
     /** \brief Hashed password, used to generate message signatures */
@@ -99,6 +146,8 @@ namespace tplink {
     std::string rsa_exp{};
     /** \brief Salt for RSA sign */
     unsigned int seq;
+    /** \brief RSA key built from #rsa_mod and #rsa_exp */
+    UniquePointer<EVP_PKEY, EVP_PKEY_free> rsa_key;
 
     /** \brief Initialize instance. */
     void generate_aes_keys();
@@ -168,6 +217,14 @@ namespace tplink {
      */
     rj::Document do_request(const std::string & module, const int action) const;
     
+    /** \brief Build a request object carrying data.
+     *  \param module: name of module to send data to
+     *  \param action: code of action to perform with data
+     *  \param data: JSON object containing data to be sent
+     *  \returns a RapidJSON object with request fields and data.
+     */
+    rj::Document build_data_request(const std::string & module, const int action, const rj::Document & data) const;
+
     /** \brief Send data to the modem web gateway interface.
      *  \param module: name of module to send data to
      *  \param action: code of action to perform with data
@@ -183,6 +240,34 @@ namespace tplink {
      */
     rj::Document get_data_array(rj::Document & request, const std::string & field) const;
 
+    /** \brief Build first login request, which asks for a password salt.
+     *  \returns serialized request.
+     */
+    std::string build_load_request() const;
+
+    /** \brief Check reply to first login request, and build authentication request.
+     *  \param d: reply to first login request.
+     *  \param req_json: where to store serialized authentication request.
+     *  \returns true if reply was valid, false otherwise.
+     */
+    bool build_login_request(const rj::Document & d, std::string & req_json);
+
+    /** \brief Check reply to authentication request, and store authentication token.
+     *  \param d: reply to authentication request.
+     *  \returns true if login succeeded, false otherwise.
+     */
+    bool complete_login(const rj::Document & d);
+
+    /** \brief Send a HTTP POST request through an event loop driver.
+     *  With a transport set, the request is sent through it with #post_request instead,
+     *  and done is called before returning.
+     *  \param driver: event loop driver.
+     *  \param url: URL to send request to.
+     *  \param data: data to join with the POST request.
+     *  \param done: called with server reply, or with an empty string if request failed.
+     */
+    void post_async(LoopDriver & driver, const std::string & url, std::string data, std::function<void(std::string &&)> done) const;
+
 	public:
     /** \brief Default constructor. */
     TPLink_M7350();
@@ -190,14 +275,72 @@ namespace tplink {
     /** \brief Constructor with parameters.
      *  \param modem_address: IP or DNS address of modem
      *  \param password: modem admin password
+     *  \param warm_up: work to start in the background (see set_warm_up)
      */
-    TPLink_M7350(const std::string & modem_address, const std::string & password);
+    TPLink_M7350(const std::string & modem_address, const std::string & password, const WarmUp warm_up = WarmUp::None);
+
+    TPLink_M7350(const TPLink_M7350 &) = delete;
+    TPLink_M7350 & operator=(const TPLink_M7350 &) = delete;
+
+    /** \brief Move constructor; waits for warm-up of moved session.
+     *  The moved session mustn't have asynchronous requests in progress.
+     *  \param other: session to move.
+     */
+    TPLink_M7350(TPLink_M7350 && other);
+
+    /** \brief Move assignment; waits for warm-up of both sessions.
+     *  Neither session may have asynchronous requests in progress.
+     *  \param other: session to move.
+     *  \returns this session.
+     */
+    TPLink_M7350 & operator=(TPLink_M7350 && other);
+
+    /** \brief Destructor; waits for warm-up in progress. */
+    ~TPLink_M7350();
+
+    /** \brief Set work to do in the background whenever modem address is set, and start it.
+     *  Warm-up connects to the modem and fetches login parameters, and may log
+     *  in. Calls made meanwhile wait for it to finish; login() then only sends
+     *  what is still needed. The session must not be used from other threads
+     *  while warm-up runs.
+     *  \param warm_up: work to do.
+     */
+    void set_warm_up(const WarmUp warm_up);
 
     /** \fn void set_address(std::string & modem_address)
      *  \brief Set modem IP address or domain name.
      *  \param modem_address: modem IP address or domain name
      */
     void set_address(const std::string & modem_address);
+
+    /** \brief Get modem IP address or domain name.
+     *  \returns modem address, as given to set_address.
+     */
+    std::string get_address() const;
+    
+    /** \brief Share DNS cache, connections, etc. with other sessions.
+     *  The share handle must outlive the session, and must be set up with lock
+     *  functions if sessions are used from several threads.
+     *  \param share: CURL share handle, or nullptr to stop sharing.
+     */
+    void set_share_handle(CURLSH * share);
+
+    /** \brief Send requests through another transport than the session's CURL handle.
+     *  Non-blocking methods (#login_async, #request_async, #send_data_async) then block.
+     *  \param transport: transport, or nullptr to use CURL.
+     */
+    void set_transport(std::shared_ptr<Transport> transport);
+
+    /** \brief Set how send_sms waits for the modem to send a message.
+     *  \param timeout: longest wait once the modem accepted the message.
+     *  \param poll_interval: time between two send status requests.
+     */
+    void set_send_status_polling(const std::chrono::milliseconds timeout, const std::chrono::milliseconds poll_interval);
+
+    /** \brief Record requests and replies, for later replay with a ReplayTransport.
+     *  \param recorder: recorder, or nullptr to stop recording.
+     */
+    void set_recorder(std::shared_ptr<Recorder> recorder);
     
     /** \fn void set_password(std::string & password)
      *  \brief Set modem admin password.
@@ -205,6 +348,58 @@ namespace tplink {
      */
     void set_password(const std::string & password);
     
+    /** \brief Send a request to the modem and return reply.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \returns a RapidJSON object containing modem reply, or an empty object if request failed.
+     */
+    rj::Document request(const std::string & module, const int action) const;
+
+    /** \brief Send a request carrying data to the modem and return reply.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \param data: JSON object whose members are added to the request.
+     *  \returns a RapidJSON object containing modem reply, or an empty object if request failed.
+     */
+    rj::Document request(const std::string & module, const int action, const rj::Document & data) const;
+
+    /** \brief Log in without blocking; requests are run by an event loop driver.
+     *  The session must outlive the request. Sessions with a transport (see #set_transport)
+     *  block instead, as transports have no non-blocking form; done is then called before returning.
+     *  \param driver: event loop driver.
+     *  \param done: called with true if login succeeded, false otherwise.
+     */
+    void login_async(LoopDriver & driver, std::function<void(bool)> done);
+
+    /** \brief Send a request to the modem without blocking; see LoopDriver.
+     *  The session must outlive the request. Sessions with a transport block instead (see #login_async).
+     *  \param driver: event loop driver.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \param done: called with modem reply, or with an empty object if request failed.
+     */
+    void request_async(LoopDriver & driver, const std::string & module, const int action, std::function<void(rj::Document)> done) const;
+
+    /** \brief Send a request carrying data to the modem without blocking; see LoopDriver.
+     *  The session must outlive the request. Sessions with a transport block instead (see #login_async).
+     *  \param driver: event loop driver.
+     *  \param module: name of module to query (see Modules).
+     *  \param action: code of action to perform.
+     *  \param data: JSON object whose members are added to the request.
+     *  \param done: called with modem reply, or with an empty object if request failed.
+     */
+    void request_async(LoopDriver & driver, const std::string & module, const int action, const rj::Document & data, std::function<void(rj::Document)> done) const;
+
+    /** \brief Send data to the modem without blocking; see LoopDriver.
+     *  The session must outlive the request. Sessions with a transport block instead (see #login_async).
+     *  \param driver: event loop driver.
+     *  \param module: name of module to send data to (see Modules).
+     *  \param action: code of action to perform with data.
+     *  \param data: JSON object containing data to be sent.
+     *  \param done: called with true if operation was successful, false otherwise.
+     */
+    void send_data_async(LoopDriver & driver, const std::string & module, const int action, const rj::Document & data, std::function<void(bool)> done) const;
+
     /** \brief Retrieve settings for alg module.
      *  \returns JSON object with modem reply.
      */
@@ -246,9 +441,31 @@ namespace tplink {
     rj::Document check_ap_connection_status() const;
 
     /** \brief Attempt to log in into modem web interface.
+     *  If a session cache is set, the cached session is reused if modem still accepts it.
      *  \returns true if operation was successful, false otherwise.
      */
     bool login();
+
+    /** \brief Keep session state in a file, so that later sessions (e.g. other processes) skip login.
+     *  The file holds the authentication token and keys, and is only readable
+     *  by its owner; it is written after each login, and removed on logout. It
+     *  must be set before warm-up starts for warm-up to use it.
+     *  \param path: file path, or an empty string to stop caching.
+     */
+    void set_session_cache(const std::string & path);
+
+    /** \brief Save session state to a file readable by its owner only.
+     *  \param path: file path.
+     *  \returns true if state was saved, false otherwise.
+     */
+    bool save_session(const std::string & path) const;
+
+    /** \brief Restore session state saved by save_session, if modem still accepts it.
+     *  The session is checked with a single keep-alive request.
+     *  \param path: file path.
+     *  \returns true if session was restored, false otherwise.
+     */
+    bool restore_session(const std::string & path);
     
     /** \fn bool logout()
      *  \brief Attempt to log out from modem web interface.
@@ -339,6 +556,18 @@ namespace tplink {
      *  \returns true if successful, false otherwise.
      */
     bool send_sms(const std::string & phone_number, const std::string & message) const;
+
+    /** \brief Sends a SMS through the TP-Link M7350 interface and reports the modem's status code.
+     *  \param phone_number: recipient number
+     *  \param message: text message to send
+     *  \param result: receives the final send status (see MessageReturnCode); -1 if the
+     *  modem didn't accept the message (not logged in, request failed or invalid reply);
+     *  MessageReturnCode::Sending if the modem accepted it but its outcome is unknown, as
+     *  a status reply was invalid or the message was still being sent after the timeout
+     *  (see set_send_status_polling). Such a message may still be sent.
+     *  \returns true if successful, false otherwise.
+     */
+    bool send_sms(const std::string & phone_number, const std::string & message, int8_t & result) const;
     
     /** \brief Deletes messages stored in the TP-Link M7350 memory.
      *  \param box: mailbox number (see MAILBOX_ENUM)
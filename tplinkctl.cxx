@@ -0,0 +1,487 @@
+/** \file tplinkctl.cxx
+ *	Command line control of TP-Link M7350 modems. A daemon holds a logged-in
+ *	session per modem and listens on a Unix domain socket; each invocation of
+ *	the client sends one command to it and prints the modem reply as JSON, so
+ *	that commands cost a local round trip and a modem request instead of a
+ *	process start and a full login.
+ *	Author: Vincent Paeder
+ *	License: GPL v3
+ */
+#include "tp_m7350_fleet.h"
+#include "tp_m7350_codec.h"
+#include "tp_m7350_batch.h"
+#include "tp_m7350_config.h"
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <csignal>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+/* Protocol: a request is a list of strings, sent as a 32-bit count followed by
+	each string as a 32-bit length and its bytes; the first string is the modem
+	index, the others are the command words. A reply is a 32-bit status (0 if
+	command succeeded) followed by a JSON text, as a 32-bit length and its bytes.
+	Batch results are streamed first, one line per step as steps complete, each
+	with status 2; the final status then comes with an empty text.
+	Integers are in host byte order, as both ends run on the same host. */
+
+/* reply status of a streamed line, followed by further replies */
+static const uint32_t status_line = 2;
+
+/* limits on requests accepted by the daemon */
+static const uint32_t max_strings = 16;
+static const uint32_t max_string_size = 1 << 20; // fits batch files
+
+static volatile std::sig_atomic_t stopping = 0;
+
+static void stop(int) {
+	stopping = 1;
+}
+
+/* write a whole buffer to a socket - returns false on error */
+static bool write_all(const int fd, const void * data, size_t size) {
+	auto p = static_cast<const char*>(data);
+	while (size > 0) {
+		auto n = ::send(fd, p, size, MSG_NOSIGNAL);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/* read a whole buffer from a socket - returns false on error or end of stream */
+static bool read_all(const int fd, void * data, size_t size) {
+	auto p = static_cast<char*>(data);
+	while (size > 0) {
+		auto n = ::recv(fd, p, size, 0);
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+/* write a length-prefixed string */
+static bool write_string(const int fd, const std::string & s) {
+	uint32_t size = s.size();
+	return write_all(fd, &size, sizeof(size)) && write_all(fd, s.data(), s.size());
+}
+
+/* read a length-prefixed string of at most given size */
+static bool read_string(const int fd, std::string & s, const uint32_t max_size) {
+	uint32_t size;
+	if (!read_all(fd, &size, sizeof(size)) || size > max_size) return false;
+	s.resize(size);
+	return read_all(fd, &s[0], size);
+}
+
+/* send a line of a streamed reply - returns false on error */
+static bool send_line(const int fd, const std::string & json) {
+	return write_all(fd, &status_line, sizeof(status_line)) && write_string(fd, json);
+}
+
+/* send a reply and close connection */
+static void reply_and_close(const int fd, const bool ok, const std::string & json) {
+	uint32_t status = ok ? 0 : 1;
+	if (!write_all(fd, &status, sizeof(status)) || !write_string(fd, json))
+		LOG_E("Couldn't send reply to client.");
+	::close(fd);
+}
+
+/* default socket path: in the user runtime directory if there is one */
+static std::string default_socket_path() {
+	auto dir = std::getenv("XDG_RUNTIME_DIR");
+	if (dir != nullptr && *dir != '\0')
+		return std::string(dir) + "/tplinkctl.sock";
+	return "/tmp/tplinkctl-" + std::to_string(::getuid()) + ".sock";
+}
+
+/* check that the other end of a Unix socket runs as the current user - returns false otherwise */
+static bool peer_is_user(const int fd) {
+	ucred credentials{};
+	socklen_t size = sizeof(credentials);
+	return ::getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &size) == 0 && credentials.uid == ::getuid();
+}
+
+/* fill a Unix socket address - returns false if path is too long */
+static bool socket_address(const std::string & path, sockaddr_un & address) {
+	std::memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (path.size() >= sizeof(address.sun_path)) {
+		std::cerr << "Socket path too long: " << path << std::endl;
+		return false;
+	}
+	std::memcpy(address.sun_path, path.c_str(), path.size());
+	return true;
+}
+
+/* build a reply for commands that only succeed or fail */
+static tplink::rj::Document success(const bool ok) {
+	tplink::rj::Document d;
+	d.SetObject();
+	d.AddMember("success", ok, d.GetAllocator());
+	return d;
+}
+
+/* build a reply for commands that couldn't be run */
+static tplink::rj::Document error(const char * message) {
+	tplink::rj::Document d;
+	d.SetObject();
+	d.AddMember("error", tplink::rj::Value(message, d.GetAllocator()), d.GetAllocator());
+	return d;
+}
+
+/* check if a reply looks like the modem dropped the session */
+static bool session_lost(const tplink::rj::Document & d) {
+	using tplink::WebReturnCode;
+	if (!d.IsObject()) return true;
+	auto result = d.FindMember("result");
+	return result != d.MemberEnd() && (result->value == WebReturnCode::KickedOut || result->value == WebReturnCode::TokenError);
+}
+
+/* run a command with a modem session - returns false if command is invalid or failed */
+static bool run_command(tplink::TPLink_M7350 & modem, const std::vector<std::string> & words, tplink::rj::Document & reply) {
+	using namespace tplink;
+	auto & command = words[0];
+	auto argc = words.size() - 1;
+	if (command == "status" && argc == 0) {
+		reply = modem.get_status();
+	} else if (command == "devices" && argc == 0) {
+		reply = modem.get_connected_devices();
+	} else if (command == "log" && argc == 0) {
+		reply = modem.get_log();
+	} else if (command == "sms" && argc >= 1 && words[1] == "read" && argc <= 2) {
+		auto box = argc == 2 && words[2] == "outbox" ? MailboxCode::Outbox : MailboxCode::Inbox;
+		reply = modem.read_sms(box);
+	} else if (command == "sms" && argc == 3 && words[1] == "send") {
+		reply = success(modem.send_sms(words[2], words[3]));
+		return reply["success"].GetBool();
+	} else if (command == "request" && (argc == 2 || argc == 3)) {
+		char * end;
+		auto action = std::strtol(words[2].c_str(), &end, 10);
+		if (words[2].empty() || *end != '\0') {
+			reply = error("invalid action");
+			return false;
+		}
+		if (argc == 2) {
+			reply = modem.request(words[1], action);
+		} else {
+			rj::Document data;
+			if (data.Parse(words[3].c_str()).HasParseError() || !data.IsObject()) {
+				reply = error("invalid JSON data");
+				return false;
+			}
+			reply = modem.request(words[1], action, data);
+		}
+	} else if (command == "config" && argc == 1 && words[1] == "snapshot") {
+		ConfigBackup backup;
+		reply = backup.snapshot(modem);
+		return backup.failed().empty();
+	} else if (command == "config" && argc == 2 && words[1] == "restore") {
+		rj::Document snapshot;
+		std::string problem;
+		if (snapshot.Parse(words[2].c_str()).HasParseError()) {
+			reply = error("invalid JSON data");
+			return false;
+		} else if (!ConfigBackup::validate(snapshot, problem)) {
+			reply = error(problem.c_str());
+			return false;
+		}
+		ConfigBackup backup;
+		reply = success(backup.restore(modem, snapshot));
+		rj::Value failed(rj::kArrayType);
+		for (auto & name: backup.failed())
+			failed.PushBack(rj::Value(name.c_str(), reply.GetAllocator()), reply.GetAllocator());
+		reply.AddMember("failed", failed, reply.GetAllocator());
+		return reply["success"].GetBool();
+	} else if (command == "config" && argc == 3 && words[1] == "apply") {
+		rj::Document desired;
+		if (desired.Parse(words[3].c_str()).HasParseError() || !desired.IsObject()) {
+			reply = error("invalid JSON data");
+			return false;
+		}
+		// other commands may change settings; always compare with fresh ones
+		ConfigState state(std::chrono::milliseconds(0));
+		auto result = state.apply(modem, words[2], desired);
+		static const char * names[] = {"unchanged", "applied", "failed"};
+		reply.SetObject();
+		reply.AddMember("result", rj::StringRef(names[static_cast<int>(result)]), reply.GetAllocator());
+		return result != ApplyResult::Failed;
+	} else {
+		reply = error("unknown command");
+		return false;
+	}
+	return !session_lost(reply);
+}
+
+/* run daemon - returns process exit code */
+static int run_daemon(const std::string & path, const std::vector<std::string> & addresses, const std::string & password, const size_t threads) {
+	using namespace tplink;
+	Fleet fleet(threads);
+	for (auto & a: addresses)
+		fleet.add(a, password);
+	// sessions that must log in again before their next command; only used under the modem lock
+	std::vector<uint8_t> stale(addresses.size(), 0);
+	auto logged_in = fleet.login_all();
+	for (size_t i=0; i<logged_in.size(); i++) {
+		if (logged_in[i]) continue;
+		LOG_E("Couldn't log in to ", addresses[i], "; will try again on next command.");
+		stale[i] = 1;
+	}
+
+	sockaddr_un address;
+	if (!socket_address(path, address)) return 1;
+	int listener = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	// replace a socket left by a previous daemon, but nothing else
+	struct stat st;
+	if (::lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode))
+		::unlink(path.c_str());
+	// socket gives control over modems: owner only
+	auto mask = ::umask(077);
+	bool bound = ::bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0;
+	::umask(mask);
+	if (!bound || ::listen(listener, 64) != 0) {
+		std::cerr << "Couldn't listen on " << path << ": " << std::strerror(errno) << std::endl;
+		::close(listener);
+		return 1;
+	}
+
+	// no SA_RESTART: signals interrupt accept
+	struct sigaction action{};
+	action.sa_handler = stop;
+	::sigaction(SIGINT, &action, nullptr);
+	::sigaction(SIGTERM, &action, nullptr);
+	LOG_I("Listening on ", path, " for ", addresses.size(), " modem(s).");
+
+	while (!stopping) {
+		int client = ::accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+		if (client < 0) continue;
+		if (!peer_is_user(client)) {
+			LOG_E("Refusing connection from another user.");
+			::close(client);
+			continue;
+		}
+		// a client that stalls must not hold back the others
+		timeval timeout{1, 0};
+		::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		uint32_t count = 0;
+		std::vector<std::string> words;
+		bool ok = read_all(client, &count, sizeof(count)) && count >= 2 && count <= max_strings;
+		for (uint32_t i=0; ok && i<count; i++) {
+			words.emplace_back();
+			ok = read_string(client, words.back(), max_string_size);
+		}
+		size_t index = ok ? std::strtoul(words[0].c_str(), nullptr, 10) : 0;
+		if (ok && words[1] == "modems") {
+			rj::Document d;
+			d.SetObject();
+			rj::Value list(rj::kArrayType);
+			for (size_t i=0; i<fleet.size(); i++)
+				list.PushBack(rj::Value(fleet.address(i).c_str(), d.GetAllocator()), d.GetAllocator());
+			d.AddMember("modems", list, d.GetAllocator());
+			reply_and_close(client, true, stringify(d));
+			continue;
+		}
+		if (!ok || index >= fleet.size()) {
+			reply_and_close(client, false, ok ? "{\"error\":\"no such modem\"}" : "{\"error\":\"invalid request\"}");
+			continue;
+		}
+		words.erase(words.begin());
+
+		// runs under the modem lock; the reply is written from the worker thread
+		fleet.submit(index, [client, words = std::move(words), &stale, index](TPLink_M7350 & modem) {
+			if (stale[index])
+				stale[index] = !modem.login();
+			if (words[0] == "batch" && words.size() == 2) {
+				// one JSON line per step, sent as steps complete
+				Batch batch;
+				std::string problem;
+				if (!batch.parse(words[1], problem)) {
+					reply_and_close(client, false, stringify(error(problem.c_str())));
+					return false;
+				}
+				bool connected = true;
+				auto failed = batch.run(modem, [client, &connected](BatchResult && result) {
+					// steps still run if the client is gone, as they may change the modem state
+					if (connected && !send_line(client, Batch::to_json(result))) {
+						LOG_E("Couldn't send batch result to client.");
+						connected = false;
+					}
+				});
+				if (failed > 0) stale[index] = 1;
+				if (connected)
+					reply_and_close(client, failed == 0, "");
+				else
+					::close(client);
+				return failed == 0;
+			}
+			rj::Document reply;
+			bool ok = run_command(modem, words, reply);
+			// reads are safe to repeat; other commands may have been carried out
+			bool read = words[0] == "status" || words[0] == "devices" || words[0] == "log"
+				|| (words.size() > 1 && ((words[0] == "sms" && words[1] == "read") || (words[0] == "config" && words[1] == "snapshot")));
+			if (!ok && read && session_lost(reply)) {
+				stale[index] = !modem.login();
+				if (!stale[index])
+					ok = run_command(modem, words, reply);
+			} else if (!ok && !(reply.IsObject() && reply.HasMember("error"))) {
+				// failure may come from a lost session, which can't be told from the reply
+				stale[index] = 1;
+			}
+			reply_and_close(client, ok, stringify(reply));
+			return ok;
+		});
+	}
+	LOG_I("Stopping.");
+	::close(listener);
+	::unlink(path.c_str());
+	return 0;
+}
+
+/* send a command to the daemon and print the reply - returns process exit code */
+static int run_client(const std::string & path, const size_t index, const std::vector<std::string> & words) {
+	sockaddr_un address;
+	if (!socket_address(path, address)) return 1;
+	int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+		std::cerr << "Couldn't reach daemon on " << path << ": " << std::strerror(errno) << std::endl;
+		::close(fd);
+		return 1;
+	}
+	// a socket in a shared directory may have been created by someone else
+	if (!peer_is_user(fd)) {
+		std::cerr << "Socket " << path << " isn't served by a daemon of current user." << std::endl;
+		::close(fd);
+		return 1;
+	}
+	uint32_t count = words.size() + 1;
+	bool ok = write_all(fd, &count, sizeof(count)) && write_string(fd, std::to_string(index));
+	for (size_t i=0; ok && i<words.size(); i++)
+		ok = write_string(fd, words[i]);
+	uint32_t status = 1;
+	std::string reply;
+	// streamed lines come before the final reply
+	while ((ok = ok && read_all(fd, &status, sizeof(status)) && read_string(fd, reply, UINT32_MAX)) && status == status_line)
+		std::cout << reply << std::endl;
+	::close(fd);
+	if (!ok) {
+		std::cerr << "Daemon closed connection." << std::endl;
+		return 1;
+	}
+	if (!reply.empty())
+		std::cout << reply << std::endl;
+	return status == 0 ? 0 : 1;
+}
+
+/* read a file, or standard input if name is - - returns false if file couldn't be read */
+static bool read_input(const std::string & name, std::string & text) {
+	std::ostringstream contents;
+	if (name == "-") {
+		contents << std::cin.rdbuf();
+	} else {
+		std::ifstream file(name);
+		if (!file) {
+			std::cerr << "Couldn't read " << name << std::endl;
+			return false;
+		}
+		contents << file.rdbuf();
+	}
+	text = contents.str();
+	return true;
+}
+
+static void usage(const char * name) {
+	std::cout << "Usage:" << std::endl;
+	std::cout << name << " [-s socket] daemon [-t threads] -p password -a modem_address [-a modem_address...]" << std::endl;
+	std::cout << name << " [-s socket] [-m modem_index] command" << std::endl;
+	std::cout << name << " -h" << std::endl;
+	std::cout << "Commands:" << std::endl;
+	std::cout << "  modems                        list modems handled by daemon" << std::endl;
+	std::cout << "  status                        get modem status" << std::endl;
+	std::cout << "  devices                       get connected devices" << std::endl;
+	std::cout << "  log                           get modem log" << std::endl;
+	std::cout << "  sms read [inbox|outbox]       read messages" << std::endl;
+	std::cout << "  sms send phone_number text    send a message" << std::endl;
+	std::cout << "  request module action [json]  send any request" << std::endl;
+	std::cout << "  batch file                    run operations listed in file (- for standard input)" << std::endl;
+	std::cout << "  config snapshot               get configuration of all modules" << std::endl;
+	std::cout << "  config restore file           restore configuration snapshot (- for standard input)" << std::endl;
+	std::cout << "  config apply module json      set module configuration, sending only changed values" << std::endl;
+}
+
+/* main function - returns 0 if command succeeded, 1 otherwise */
+int main( int argc, char** argv ) {
+	std::string path = default_socket_path();
+	size_t index = 0;
+
+	// parse command line for arguments; options stop at the command
+	int opt;
+	while ( ( opt = getopt ( argc, argv, "+hs:m:" ) ) != -1 ) {
+		switch ( opt ) {
+			case 'h':
+				usage(argv[0]);
+				return 1;
+				break;
+
+			case 's':
+				path = optarg;
+				break;
+
+			case 'm':
+				index = std::stoul(optarg);
+				break;
+		}
+	}
+	if (optind >= argc) {
+		std::cout << "No command given." << std::endl;
+		std::cout << "Type " << argv[0] << " -h for help" << std::endl;
+		return 1;
+	}
+
+	if (std::strcmp(argv[optind], "daemon") == 0) {
+		std::vector<std::string> addresses;
+		std::string password;
+		size_t threads = 0;
+		optind++;
+		while ( ( opt = getopt ( argc, argv, "+a:p:t:" ) ) != -1 ) {
+			switch ( opt ) {
+				case 'a':
+					addresses.push_back(optarg);
+					break;
+
+				case 'p':
+					password = optarg;
+					break;
+
+				case 't':
+					threads = std::stoul(optarg);
+					break;
+			}
+		}
+		if (addresses.empty() || password.empty()) {
+			std::cout << "Daemon needs a password and at least one modem address." << std::endl;
+			std::cout << "Type " << argv[0] << " -h for help" << std::endl;
+			return 1;
+		}
+		return run_daemon(path, addresses, password, threads);
+	}
+
+	std::vector<std::string> words(argv + optind, argv + argc);
+	// send file contents in place of file name
+	if (words[0] == "batch" && words.size() == 2 && !read_input(words[1], words[1]))
+		return 1;
+	if (words[0] == "config" && words.size() == 3 && words[1] == "restore" && !read_input(words[2], words[2]))
+		return 1;
+	return run_client(path, index, words);
+}